@@ -47,326 +47,222 @@
  */
 extern int adjtimex (struct timex *timex);
 
-const char *version = "1.5.2";							//!< Program version 1.5.2 updated on 30 Aug 2018
+const char *version = "1.5.6";							//!< Program version 1.5.6 updated on 16 Oct 2026
 														//!< because of change to gps-pps-io.c
 struct G g;												//!< Declares the global variables defined in pps-client.h.
 
 /**
- * Sets G.noiseLevel to be proportional to G.sysDelay.
+ * Gets the monotonic time from the system.
  */
-void setDelayTrackers(void){
-	g.noiseLevel = (int)round((double)g.sysDelay * NOISE_FACTOR) + 1;
-	if (g.noiseLevel < NOISE_LEVEL_MIN){
-		g.noiseLevel = NOISE_LEVEL_MIN;
-	}
+int getSystemMonotonic(struct timespec *ts){
+	return clock_gettime(CLOCK_MONOTONIC, ts);
 }
 
 /**
- * Sets global variables to initial values at
- * startup or restart and sets system clock
- * frequency offset to zero.
- *
- * @param[in] verbose Enables printing of state status params when "true".
+ * Gets the time of day from the system.
  */
-void initialize(bool verbose){
-	memset(&g, 0, sizeof(struct G));
-
-	g.isVerbose = verbose;
-	g.sysDelay = INTERRUPT_LATENCY;
-	g.delayMedian = (double)INTERRUPT_LATENCY;
-	g.integralGain = INTEGRAL_GAIN;
-	g.invProportionalGain = INV_GAIN_0;
-	g.hardLimit = HARD_LIMIT_NONE;
-	g.exitOnLostPPS = true;
-	g.doCalibration = true;
-	g.doNTPsettime = true;
-
-	g.t3.modes = ADJ_FREQUENCY;			// Initialize system clock
-	g.t3.freq = 0;						// frequency offset to zero.
+int getSystemTimeOfDay(struct timeval *tv){
+	return gettimeofday(tv, NULL);
 }
 
 /**
- * Returns true when the control loop can begin to
- * control the system clock frequency. At program
- * start only the time slew is adjusted because the
- * drift can be too large for it to be practical to
- * adjust the system clock frequency to correct for
- * it. SLEW_MAX sets a reasonable limit below which
- * frequency offset can also be adjusted to correct
- * system time.
- *
- * Consequently, once the drift is within SLEW_MAX
- * microseconds of zero and the controller has been
- * running for at least 60 seconds (time selected for
- * convenience), this function returns "true" causing
- * the controller to begin to also adjust the system
- * clock frequency offset.
- *
- * @returns "true" when the control loop can begin to
- * control the system clock frequency. Else "false".
+ * Gets the raw monotonic time of the PPS edge being
+ * processed, recorded by the gps-pps-io driver with
+ * the PPS interrupt time.
+ *
+ * @returns 0 on success or -1 if it is not available.
  */
-bool getAcquireState(void){
+int getSystemEdgeRaw(struct timespec *ts){
+	if (g.ppsRawTime <= 0){
+		return -1;
+	}
+	ts->tv_sec = g.ppsRawTime / NSECS_PER_SEC;
+	ts->tv_nsec = g.ppsRawTime % NSECS_PER_SEC;
+	return 0;
+}
+
+struct clockBackend systemClock = {adjtimex, getSystemTimeOfDay, getSystemMonotonic, getSystemEdgeRaw, false};	//!< Clock backend for the system clock.
+struct clockBackend *clk = &systemClock;						//!< The active clock backend.
 
-	if (! g.slewIsLow && g.slewAccum_cnt == 0
-			&& fabs(g.avgSlew) < SLEW_MAX){					// SLEW_MAX only needs to be low enough
-		g.slewIsLow = true;									// that the controller can begin locking
-	}														// at limitValue == HARD_LIMIT_NONE
+static struct controller ctl;									//!< The controller of the active clock.
 
-	return (g.slewIsLow && g.seq_num >= SECS_PER_MINUTE);		// The g.seq_num requirement sets a limit on the
-}															// length of time to run the Type 1 controller
-															// that initially pushes avgSlew below SLEW_MAX.
+static const struct pps_ring *ppsRing = NULL;					//!< The PPS timestamp ring mapped from the gps-pps-io driver.
+static unsigned int configGen = 0;							//!< The getConfigGen() count of the config copied to G.
+static bool usePPSApi = false;								//!< "true" if the PPS is read from the pps-device of the config file through the PPS API instead of from the gps-pps-io driver.
 
 /**
- * Uses G.avgSlew or avgCorrection and the curent
- * hard limit, G.hardLimit, to determine the global
- * G.hardLimit to set on zero error to convert error
- * values to time corrections.
- *
- * Because it is much more effective and does not
- * introduce additional time delay, hard limiting
- * is used instead of filtering to remove noise
- * (jitter) from the reported time of PPS capture.
- *
- * @param[in] avgCorrection Current average
- * correction value.
+ * Copies the outputs of the controller to G.
  */
-void setHardLimit(double avgCorrection){
-
-	double avgMedianMag = fabs(avgCorrection);
-
-	if (g.activeCount < SECS_PER_MINUTE){
-		g.hardLimit = HARD_LIMIT_NONE;
-		return;
-	}
-
-	if (abs(g.avgSlew) > SLEW_MAX){							// As long as average time slew is
-		int d_4 = abs(g.avgSlew) * 4;						// outside of range SLEW_MAX this keeps
-		while (g.hardLimit < d_4								// g.hardLimit above 4 * g.avgSlew
-				&& g.hardLimit < HARD_LIMIT_NONE){			// which is high enough to allow the
-			g.hardLimit = g.hardLimit << 1;					// controller to pull avgSlew within
-		}													// SLEW_MAX.
-		return;
-	}
-
-	if (g.hardLimit == HARD_LIMIT_1){
-		if (avgMedianMag > HARD_LIMIT_05){
-			g.hardLimit = g.hardLimit << 1;
-		}
-	}
-	else if (avgMedianMag < HARD_LIMIT_05){
-		g.hardLimit = HARD_LIMIT_1;
-	}
-	else if (avgMedianMag < (g.hardLimit >> 2)){				// If avgCorrection is below 1/4 of limitValue
-		g.hardLimit = g.hardLimit >> 1;						// then halve limitValue.
-	}
-	else if (avgMedianMag > (g.hardLimit >> 1)){				// If avgCorrection is above 1/2 of limitValue
-		g.hardLimit = g.hardLimit << 1;						// then double limitValue.
-
-		if (g.hardLimit > HARD_LIMIT_NONE){
-			g.hardLimit = HARD_LIMIT_NONE;
-		}
-	}
+void copyControllerOutputs(void){
+	g.isControlling = ctl.isControlling;
+	g.activeCount = ctl.activeCount;
+	g.noiseLevel = ctl.noiseLevel;
+	g.isDelaySpike = ctl.isDelaySpike;
+	g.avgSlew = ctl.avgSlew;
+	g.zeroError = ctl.zeroError;
+	g.hardLimit = ctl.hardLimit;
+	g.timeCorrection = ctl.timeCorrection;
+	g.slewResidual = ctl.slewResidual;
+	g.avgCorrection = ctl.avgCorrection;
+	g.freqOffset = ctl.freqOffset;
 }
 
 /**
- * Removes jitter delay spikes by returning "true"
- * as long as the jitter value remains beyond a
- * threshold (G.noiseLevel). Is not active unless
- * G.hardLimit is at HARD_LIMIT_4 or below.
- *
- * @param[in] rawError The raw error vlue to be
- * tested for a delay spike.
+ * Passes the current PPS edge and the corrections
+ * that the controller made to the clock to the shadow
+ * controllers.
  *
- * @returns "true" if a delay spike is detected. Else "false".
+ * @param[in] isRestart "true" if the controller is
+ * about to be restarted, which sets the clock frequency
+ * offset to zero.
  */
-bool detectDelaySpike(int rawError){
-	bool isDelaySpike = false;
-
-	if (g.hardLimit <= HARD_LIMIT_4 && rawError >= g.noiseLevel){
-
-		if (g.nDelaySpikes < MAX_SPIKES) {
-			g.nDelaySpikes += 1;						// Record unbroken sequence of delay spikes
-
-			isDelaySpike = true;
-		}
-		else {										// If nDelaySpikes == MAX_SPIKES stop the
-			isDelaySpike = false;					// suspend even if spikes continue.
-		}
-	}
-	else {
-		isDelaySpike = false;
-
-		if (g.nDelaySpikes > 0){
-			g.nDelaySpikes = 0;
-		}
-	}
-	return isDelaySpike;
+void feedShadows(bool isRestart){
+	struct shadowInput in;
+
+	in.t_mono = ctl.t_mono;
+	in.t_raw = ctl.t_raw;
+	in.rawError = ctl.rawError;
+	in.sysDelay = ctl.sysDelay;
+	in.stepOffset = ctl.stepOffset;
+	in.isSlewed = ctl.isNoiseRemoved && ! ctl.isDelaySpike;
+	in.slewOffset = ctl.slewOffset;
+	in.freqOffset = isRestart ? 0.0 : ctl.freqOffset;
+	in.timeCorrection = ctl.timeCorrection;
+	in.isLocked = ctl.hardLimit == HARD_LIMIT_1 && ctl.isControlling;
+	in.isRestart = isRestart;
+
+	postShadowInput(&in);
 }
 
 /**
- * Gets the average time offset from zero over the interval
- * SLEW_LEN and updates avgSlew with this value every SLEW_LEN
- * seconds.
- *
- * @param[in] rawError The raw error to be accumulated to
- * determine average slew.
+ * Sets the controller noise level to be proportional
+ * to G.sysDelay.
  */
-void getTimeSlew(int rawError){
-
-	g.slewAccum += (double)rawError;
-
-	g.slewAccum_cnt += 1;
-	if (g.slewAccum_cnt >= SLEW_LEN){
-		g.slewAccum_cnt = 0;
-
-		g.avgSlew = g.slewAccum / (double)SLEW_LEN;
-
-		g.slewAccum = 0.0;
-	}
+void setDelayTrackers(void){
+	setNoiseLevel(&ctl, g.sysDelay);
+	g.noiseLevel = ctl.noiseLevel;
 }
 
 /**
- * Clamps rawError to an adaptive value determined at the current
- * hardLimit value from the current value of G.avgCorrection.
- *
- * Once the rawError values have been limited to values of +/- 1
- * microsecond and the control loop has settled, this clamping causes
- * the controller to make the average number of positive and negative
- * rawError values equal rather than making the sum of the positive and
- * negative jitter values zero. This removes the bias that would
- * otherwise be introduced by the rawError values which are largely
- * random and consequently would introduce a constantly changing
- * random offset. The result is also to move the average PPS interrupt
- * delay to its median value.
- *
- * @param[in] rawError The raw error value to be converted to a
- * zero error.
+ * Sets the controller state in G to initial values
+ * and sets the system clock frequency offset to zero.
+ * Called by initialize() and when the controller is
+ * restarted.
+ *
+ * Only the state of the controller, its acquisition
+ * and its delay trackers is reset. The message buffers,
+ * distributions and histograms in G are read by the
+ * I/O worker and the other threads while the controller
+ * runs, and the read position in the driver ring and
+ * its counts must be kept across a restart, so none of
+ * those are written here.
  */
-int clampJitter(int rawError){
+void resetControllerState(void){
+	g.seq_num = 0;
 
-	int zeroError = rawError;
-
-	if (rawError > g.hardLimit){
-		zeroError = g.hardLimit;
-	}
-	else if (rawError < -g.hardLimit){
-		zeroError = -g.hardLimit;
-	}
+	g.interruptReceived = false;
+	g.interruptLost = false;
+	g.interruptLossCount = 0;
 
-	return zeroError;
-}
+	memset(&g.t, 0, sizeof(struct timespec));
+	g.interruptTime = 0.0;
+	memset(g.tm, 0, sizeof(g.tm));
+	g.ppsRawTime = 0;
 
-/**
- * Constructs, at each second over the last 10 seconds
- * in each minute, 10 integrals of the average time
- * correction over the last minute.
- *
- * These integrals are then averaged to G.avgIntegral
- * just before the minute rolls over. The use of this
- * average of the last 10 integrals to correct the
- * frequency offset of the system clock provides a modest
- * improvement over using only the single last integral.
- *
- * @param[in] avgCorrection The average correction
- * to be integrated.
- */
-void makeAverageIntegral(double avgCorrection){
+	g.t_now = 0;
+	g.t_count = 0;
+	g.t_mono_now = 0.0;
+	g.t_mono_last = 0.0;
 
-	int indexOffset = SECS_PER_MINUTE - NUM_INTEGRALS;
+	g.intrptDelay = 0.0;
+	g.intrptError = 0.0;
+	g.delayMedian = (double)INTERRUPT_LATENCY;
+	g.delaySamples.window = 0;							// Set up again by processInterruptDelay().
+	g.sysDelay = INTERRUPT_LATENCY;
 
-	if (g.correctionFifo_idx >= indexOffset){					// Over the last NUM_INTEGRALS seconds in each minute
+	g.rawError = 0.0;
+	g.delayShift = 0;
+	g.sysDelayShift = 0;
+	g.delayPeakLen = 0;
+	g.disableDelayShift = false;
+	g.disableDelayCount = 0;
+	g.delayMinIdx = 0;
 
-		int i = g.correctionFifo_idx - indexOffset;
-		if (i == 0){
-			g.avgIntegral = 0.0;
-			g.integralCount = 0;
-		}
+	g.consensusTimeError = 0;
+	g.blockDetectClockChange = 0;
+	g.serialTimeError = 0;
 
-		g.integral[i] = g.integral[i] + avgCorrection;			// avgCorrection sums into g.integral[i] once each
-																// minute forming the ith integral over the last minute.
-		if (g.hardLimit == HARD_LIMIT_1){
-			g.avgIntegral += g.integral[i];						// Accumulate each integral that is being formed
-			g.integralCount += 1;								// into g.avgIntegral for averaging.
-		}
-	}
+	g.pps_t_sec = 0;
+	g.pps_t_nsec = 0;
+	g.jitter = 0.0;
+	g.lastActiveCount = 0;
 
-	if (g.correctionFifo_idx == SECS_PER_MINUTE - 1				// just before the minute rolls over.
-			&& g.integralCount == NUM_INTEGRALS){
+	memset(&g.t3, 0, sizeof(struct timex));
+	g.t3.modes = ADJ_FREQUENCY | ADJ_NANO;	// Initialize system clock frequency offset to
+	g.t3.freq = 0;						// zero and set the kernel to nanosecond resolution.
 
-		g.avgIntegral *= PER_NUM_INTEGRALS;						// Normalize g.avgIntegral.
-	}
+	struct controllerParams params;
+	setControllerDefaults(&params);
+	initController(&ctl, &params, g.sysDelay);
+	copyControllerOutputs();
 }
 
 /**
- * Advances the G.correctionFifo index each second and
- * returns "true" when 60 new time correction values
- * have been accumulated in G.correctionAccum.
- *
- * When a value of "true" is returned, new average
- * time correction integrals have been generated by
- * makeAverageIntegral() and are ready for use.
+ * Sets global variables to initial values at
+ * startup and sets system clock frequency offset
+ * to zero. Must be called before any other thread
+ * is started.
  *
- * @returns "true" when ready, else "false".
+ * @param[in] verbose Enables printing of state status params when "true".
  */
-bool integralIsReady(void){
-	bool isReady = false;
-
-	if (g.correctionFifo_idx == 0){
-		setDelayTrackers();
-		isReady = true;
-	}
+void initialize(bool verbose){
+	memset(&g, 0, sizeof(struct G));
 
-	g.correctionFifo_idx += 1;
-	if (g.correctionFifo_idx >= SECS_PER_MINUTE){
-		g.correctionFifo_idx = 0;
-	}
+	g.isVerbose = verbose;
+	g.delayWindow = DELAY_WINDOW;
+	g.exitOnLostPPS = true;
+	g.doCalibration = true;
+	g.doNTPsettime = true;
+	g.doFastAcquire = true;
 
-	return isReady;
+	resetControllerState();
 }
 
 /**
- * Maintains G.correctionFifo which contains second-by-second
- * values of time corrections over the last minute, accumulates
- * a rolling sum of these and returns the average correction
- * over the last minute.
- *
- * Since timeCorrection converges to a sequence of positive
- * and negative values each of magnitude one, the average
- * timeCorrection which is forced to be zero by the controller
- * also corresponds to the time delay where the number of
- * positive and negative corrections are equal and thus this
- * time delay, although not directly measurable, is the
- * median of the time delays causing the corrections.
- *
- * @param[in] timeCorrection The time correction value
- * to be accumulated.
- *
- * @returns The average correction value.
+ * Applies an offset to the system time by writing it to
+ * the gps-pps-io driver or, when the PPS is read through
+ * the PPS API and the driver is not loaded, by stepping
+ * the system time with ADJ_SETOFFSET in the same way.
+ *
+ * @param[in] msg The message for the driver: msg[0] is
+ * 2 for an offset in nanoseconds or 3 for an offset in
+ * seconds and msg[1] is the offset.
+ *
+ * @param[in] pps_fd The gps-pps-io device driver file
+ * descriptor.
+ *
+ * @returns -1 on error with errno set, else not -1.
  */
-double getAverageCorrection(int timeCorrection){
-
-	double avgCorrection;
-
-	if (g.seq_num > SETTLE_TIME && (g.config_select & ERROR_DISTRIB)){
-		buildErrorDistrib(timeCorrection);
+int writeTimeOffset(const int msg[2], int pps_fd){
+	if (! usePPSApi){
+		return write(pps_fd, msg, 2 * sizeof(int));
 	}
 
-	g.correctionAccum += timeCorrection;				// Add the new timeCorrection into the error accumulator.
+	struct timex t;
+	memset(&t, 0, sizeof(struct timex));
 
-	if (g.correctionFifoCount == SECS_PER_MINUTE){	// Once the FIFO is full, maintain the continuous
-													// rolling sum accumulator by subtracting the
-		int oldError = g.correctionFifo[g.correctionFifo_idx];
-		g.correctionAccum -= oldError;				// old timeCorrection value at the current correctionFifo_idx.
+	t.modes = ADJ_SETOFFSET | ADJ_NANO;
+	if (msg[0] == 3){
+		t.time.tv_sec = msg[1];
 	}
-
-	g.correctionFifo[g.correctionFifo_idx] = timeCorrection;	// and replacing the old value in the FIFO with the new.
-
-	if (g.correctionFifoCount < SECS_PER_MINUTE){	// When correctionFifoCount == SECS_PER_MINUTE
-		g.correctionFifoCount += 1;					// the FIFO is full and ready to use.
+	else if (msg[1] < 0){
+		t.time.tv_sec = -1;								// Nanoseconds with ADJ_NANO. Must not be negative.
+		t.time.tv_usec = NSECS_PER_SEC + msg[1];
 	}
-
-	avgCorrection = g.correctionAccum * PER_MINUTE;
-	return avgCorrection;
+	else {
+		t.time.tv_usec = msg[1];
+	}
+	return clk->adjtimex(&t);
 }
 
 /**
@@ -390,10 +286,15 @@ int setClockToNTPtime(int pps_fd){
 	sprintf(g.logbuf, "seq_num: %d consensusTimeError: %d\n", g.seq_num, g.consensusTimeError);
 	writeToLog(g.logbuf);
 
+	if (clk->isSimulated){
+		g.consensusTimeError = 0;
+		return 0;
+	}
+
 	int msg[2];
 	msg[0] = 3;
 	msg[1] = g.consensusTimeError;
-	int rv = write(pps_fd, msg, 2 * sizeof(int));
+	int rv = writeTimeOffset(msg, pps_fd);
 	if (rv == -1){
 		sprintf(g.logbuf, "setClockToNTPtime() write to driver failed with msg: %s\n", strerror(errno));
 		writeToLog(g.logbuf);
@@ -422,10 +323,15 @@ int setClockToSerialTime(int pps_fd){
 	sprintf(g.logbuf, "setClockToSerialTime() Corrected time by %d seconds\n", g.serialTimeError);
 	writeToLog(g.logbuf);
 
+	if (clk->isSimulated){
+		g.serialTimeError = 0;
+		return 0;
+	}
+
 	int msg[2];
 	msg[0] = 3;
 	msg[1] = g.serialTimeError;
-	int rv = write(pps_fd, msg, 2 * sizeof(int));
+	int rv = writeTimeOffset(msg, pps_fd);
 	if (rv == -1){
 		sprintf(g.logbuf, "setClockToSerialTime() write to driver failed with msg: %s\n", strerror(errno));
 		writeToLog(g.logbuf);
@@ -449,23 +355,27 @@ int setClockToSerialTime(int pps_fd){
  * as a clock correction.
  *
  * @param[in] correction The fractional correction value in
- * microseconds.
+ * microseconds at nanosecond resolution.
  *
  * @param[in] pps_fd The gps-pps-io device driver file
  * descriptor.
  *
  * @returns 0 on success or -1 on write error.
  */
-int setClockFractionalSecond(int correction, int pps_fd){
+int setClockFractionalSecond(double correction, int pps_fd){
 
-	sprintf(g.logbuf, "setClockFractionalSecond() Made correction: %d\n", correction);
+	sprintf(g.logbuf, "setClockFractionalSecond() Made correction: %.3lf\n", correction);
 	writeToLog(g.logbuf);
 
+	if (clk->isSimulated){
+		return 0;
+	}
+
 	int msg[2];
 	msg[0] = 2;
-	msg[1] = correction;						// Make a correction equal and opposite to the fractional
+	msg[1] = (int)lround(correction * NSECS_PER_USEC);	// Make a correction in nanoseconds equal and opposite to the fractional
 											// second that was set externally in order to cancel it.
-	int rv = write(pps_fd, msg, 2 * sizeof(int));
+	int rv = writeTimeOffset(msg, pps_fd);
 	if (rv == -1){
 		sprintf(g.logbuf, "setClockFractionalSecond() write to driver failed with msg: %s\n", strerror(errno));
 		writeToLog(g.logbuf);
@@ -483,10 +393,10 @@ int setClockFractionalSecond(int correction, int pps_fd){
  * @param[out] errorDistrib The distribution being constructed.
  * @param[in,out] count The count of distribution samples.
  */
-void buildRawErrorDistrib(int rawError, double errorDistrib[], unsigned int *count){
+void buildRawErrorDistrib(double rawError, double errorDistrib[], unsigned int *count){
 	int len = ERROR_DISTRIB_LEN - 1;
 
-	int idx = rawError + RAW_ERROR_ZERO;
+	int idx = (int)lround(rawError) + RAW_ERROR_ZERO;
 	if (idx > len){
 		idx = len;
 	}
@@ -509,16 +419,14 @@ void buildRawErrorDistrib(int rawError, double errorDistrib[], unsigned int *cou
 }
 
 /**
- * Removes spikes and jitter from rawError and
- * returns the resulting clamped zeroError.
- *
- * @param[in] rawError The raw error value to be processed.
+ * Records the time error of the current PPS edge in
+ * the jitter distributions. Called for each PPS edge
+ * from which the controller has removed noise, before
+ * the controller outputs are copied to G.
  *
- * @returns The resulting zeroError value.
+ * @param[in] rawError The time error.
  */
-int removeNoise(int rawError){
-
-	int zeroError;
+void recordJitter(double rawError){
 
 	buildRawErrorDistrib(rawError, g.rawErrorDistrib, &(g.ppsCount));
 
@@ -526,75 +434,55 @@ int removeNoise(int rawError){
 
 	g.jitter = rawError;
 
-	if ((g.config_select & JITTER_DISTRIB) && g.seq_num > SETTLE_TIME){
+	if (getConfig()->jitterDistrib && g.seq_num > SETTLE_TIME){
 		buildJitterDistrib(rawError);
 	}
 
-	g.isDelaySpike = detectDelaySpike(rawError);		// g.isDelaySpike == true will prevent time and
-													// frequency updates during a delay spike.
-	if (g.isDelaySpike){
-		return 0;
-	}
-
-	getTimeSlew(rawError);
-
-	setHardLimit(g.avgCorrection);
-	zeroError = clampJitter(rawError);				// Recover the time error by
-													// limiting away the jitter.
-	if (g.isControlling){
-		g.invProportionalGain = INV_GAIN_1;
+	if (g.hardLimit == HARD_LIMIT_1 && g.isControlling){
+		histRecord(&g.jitterHist, rawError);
 	}
-	return zeroError;
 }
 
 /**
- * if G.hardLimit == HARD_LIMIT_1, gets an integral time
- * correction as a 10 second average of integrals of average
- * time corrections over one minute. Otherwise gets the
- * integral time correction as the single last integral
- * of average time corrections over one minute.
+ * Records the time correction of the current PPS edge
+ * in the error distributions.
  *
- * @returns The integral of time correction values.
+ * @param[in] timeCorrection The time correction.
  */
-double getIntegral(void){
-	double integral;
+void recordCorrection(double timeCorrection){
 
-	if (g.hardLimit == HARD_LIMIT_1
-			&& g.integralCount == NUM_INTEGRALS){
-		integral = g.avgIntegral;					// Use average of last 10 integrals
-	}												// in the last minute.
-	else {
-		integral = g.integral[9];					// Use only the last integral from
-													// the last minute
+	if (g.seq_num > SETTLE_TIME && getConfig()->errorDistrib){
+		buildErrorDistrib(timeCorrection);
 	}
 
-	recordFrequencyVars();
-
-	return integral;
+	if (g.hardLimit == HARD_LIMIT_1 && g.isControlling){
+		histRecord(&g.errorHist, timeCorrection);
+	}
 }
 
 /**
  * Gets the time of the PPS rising edge from the
- * timeCorrection value and sets the corresponding
- * timestamp.
+ * timeCorrection value and publishes the corresponding
+ * timestamp to the shared memory segment.
  *
  * @param[in] t The delayed time of the PPS
  * rising edge returned by the system.
  *
- * @param[in] timeCorrection The correction to
- * be applied to get the back dated time of the
- * PPS rising edge.
+ * @param[in] timeCorrection The correction in
+ * microseconds to be applied to get the back
+ * dated time of the PPS rising edge.
  */
-void getPPStime(timeval t, int timeCorrection){
+void getPPStime(struct timespec t, double timeCorrection){
+	long correction = lround(timeCorrection * NSECS_PER_USEC);
+
 	g.pps_t_sec = t.tv_sec;
-	g.pps_t_usec = -timeCorrection;
-	if (timeCorrection > 0){
+	g.pps_t_nsec = -correction;
+	if (correction > 0){
 		g.pps_t_sec -= 1;
-		g.pps_t_usec = 1000000 - timeCorrection;
+		g.pps_t_nsec = NSECS_PER_SEC - correction;
 	}
 
-	double timestamp = t.tv_sec - 1e-6 * (double)timeCorrection;
-	writeTimestamp(timestamp);
+	writeSharedState();
 }
 
 /**
@@ -605,15 +493,16 @@ void getPPStime(timeval t, int timeCorrection){
  * @param[in] pps_t The delayed time of
  * the PPS rising edge returned by the system clock.
  *
- * @returns The fractional seconds part of the time.
+ * @returns The fractional seconds part of the time
+ * in microseconds at nanosecond resolution.
  */
-int getFractionalSeconds(timeval pps_t){
-	int interruptTime = pps_t.tv_usec;
+double getFractionalSeconds(struct timespec pps_t){
+	long nsec = pps_t.tv_nsec;
 
-	if (interruptTime > 500000){
-		interruptTime -= USECS_PER_SEC;
+	if (nsec > NSECS_PER_SEC / 2){
+		nsec -= NSECS_PER_SEC;
 	}
-	return interruptTime;
+	return (double)nsec / NSECS_PER_USEC;
 }
 
 /**
@@ -627,14 +516,14 @@ void increaseMonotonicCount(void){
 	struct timespec t_mono;
 	struct timeval t_now;
 
-	clock_gettime(CLOCK_MONOTONIC, &t_mono);
+	clk->getMonotonic(&t_mono);
 	g.t_mono_now = (double)t_mono.tv_sec + 1e-9 * (double)t_mono.tv_nsec;
 
 	if (g.seq_num < 2){							// Initialize g.t_mono_last
 		g.t_mono_last = g.t_mono_now - 1;
 	}
 
-	gettimeofday(&t_now, NULL);
+	clk->gettimeofday(&t_now);
 	g.t_now = (int)t_now.tv_sec;
 
 	if (g.seq_num == 0){							// Initialize g.t_count
@@ -685,9 +574,13 @@ bool detectExteralSystemClockChange(void){
 }
 
 /**
- * Makes time corrections each second, frequency
- * corrections each minute and removes jitter
- * from the PPS time reported by pps_t.
+ * Passes the PPS time reported by pps_t to the
+ * controller, which removes jitter from it and
+ * makes time corrections each second and frequency
+ * corrections each minute, or each second if the
+ * Kalman controller is selected. Then records the
+ * jitter and corrections and publishes the
+ * controller outputs to G.
  *
  * This function is called by readPPS_SetTime()
  * from within the one-second delay loop in the
@@ -701,7 +594,7 @@ bool detectExteralSystemClockChange(void){
  *
  * @returns 0 on success else -1 on system error.
  */
-int makeTimeCorrection(struct timeval pps_t, int pps_fd){
+int makeTimeCorrection(struct timespec pps_t, int pps_fd){
 	int rv = 0;
 	g.interruptReceived = true;
 
@@ -723,12 +616,12 @@ int makeTimeCorrection(struct timeval pps_t, int pps_fd){
 
 	if (g.blockDetectClockChange == 0 &&
 			detectExteralSystemClockChange()){				// If the time was changed by an external clock setting,
-		int correction = -getFractionalSeconds(pps_t);		// this cancels the change that may have
+		double correction = -getFractionalSeconds(pps_t);	// this cancels the change that may have
 		rv = setClockFractionalSecond(correction, pps_fd);	// been made to the fractional second.
 		if (rv == -1){
 			return rv;
 		}
-		pps_t.tv_usec = g.sysDelay;							// Temporarily zero the time correction.
+		pps_t.tv_nsec = g.sysDelay * 1000;					// Temporarily zero the time correction.
 	}
 
 	g.seq_num += 1;
@@ -736,47 +629,36 @@ int makeTimeCorrection(struct timeval pps_t, int pps_fd){
 	g.interruptTime = getFractionalSeconds(pps_t);
 	g.rawError = g.interruptTime - g.sysDelay;			// References the controller to g.sysDelay which sets the time
 														// of the PPS rising edge to zero at the start of each second.
-	g.zeroError = removeNoise(g.rawError);
+	ctl.params.doFastAcquire = g.doFastAcquire;
+	ctl.params.doKalman = g.doKalman;
 
-	if (g.isDelaySpike){									// Skip a delay spike.
-		getPPStime(pps_t, 0);
-		return 0;
-	}
+	bool isCorrected = makeControllerCorrection(&ctl, g.rawError, g.sysDelay, clk);
 
-	g.timeCorrection = -g.zeroError
-			/ g.invProportionalGain;						// Apply controller proportional gain factor.
+	if (ctl.isClockStepped){
+		g.blockDetectClockChange = BLOCK_FOR_3;
+	}
+	if (ctl.isNoiseRemoved){
+		recordJitter(g.rawError);
+	}
+	copyControllerOutputs();
 
-	g.t3.modes = ADJ_OFFSET_SINGLESHOT;					// Adjust the time slew. adjtimex() limits the maximum
-	g.t3.offset = g.timeCorrection;						// correction to about 500 microseconds each second so
-														// it can take up to 20 minutes to start pps-client.
-	adjtimex(&g.t3);
+	if (! isCorrected){									// Skip PPS edges used by fastAcquire()
+		getPPStime(pps_t, 0);								// and delay spikes.
+		return 0;
+	}
 
-	g.isControlling = getAcquireState();					// Provides enough time to reduce time slew on startup.
 	if (g.isControlling){
-
-		g.avgCorrection = getAverageCorrection(g.timeCorrection);
-
-		makeAverageIntegral(g.avgCorrection);			// Constructs an average of integrals of one
-														// minute rolling averages of time corrections.
-		if (integralIsReady()){							// Get a new frequency offset.
-			g.integralTimeCorrection = getIntegral();
-			g.freqOffset = g.integralTimeCorrection * g.integralGain;
-
-			g.t3.modes = ADJ_FREQUENCY;
-			g.t3.freq = (long)round(ADJTIMEX_SCALE * g.freqOffset);
-			adjtimex(&g.t3);								// Adjust the system clock frequency.
-		}
-
-		recordOffsets(g.timeCorrection);
-
-		g.activeCount += 1;
-		writeSysDelay();
+		recordCorrection(g.timeCorrection);
 	}
 	else {
 		g.t_count = g.t_now;								// Unless g.isControlling let g.t_count copy pps_t.tv_sec.
 	}													// If g.isControlling then g.t_count is an independent counter.
 
 	getPPStime(pps_t, g.timeCorrection);
+
+	if (g.isControlling){
+		recordOffsets(g.timeCorrection, ctl.isFreqSet);
+	}
 	return 0;
 }
 
@@ -802,7 +684,7 @@ int checkPPSInterrupt(int pps_fd){
 				sprintf(g.logbuf, "WARNING: PPS interrupt lost\n");
 				writeToLog(g.logbuf);
 
-				if (g.config_select & ALERT_PPS_LOST){
+				if (getConfig()->alertPPSLost && ! usePPSApi){
 					output = HIGH;
 					rv = write(pps_fd, &output, sizeof(int));
 					if (rv == -1){
@@ -823,7 +705,7 @@ int checkPPSInterrupt(int pps_fd){
 				sprintf(g.logbuf, "PPS interrupt resumed\n");
 				writeToLog(g.logbuf);
 
-				if (g.config_select & ALERT_PPS_LOST){
+				if (getConfig()->alertPPSLost && ! usePPSApi){
 					output = LOW;
 					rv = write(pps_fd, &output, sizeof(int));
 					if (rv == -1){
@@ -842,66 +724,6 @@ int checkPPSInterrupt(int pps_fd){
 	return 0;
 }
 
-/**
- * Removes jitter delay spikes by returning "true"
- * as long as the jitter level remains above a
- * threshold (G.noiseLevel). Is not active unless
- * G.hardLimit is at HARD_LIMIT_4 or below.
- *
- * @param[in] intrptError The raw interrupt error
- * value to be tested for a delay spike.
- *
- * @returns "true if a delay spike is detected, else
- * "false".
- */
-bool detectIntrptDelaySpike(int intrptError){
-	bool isDelaySpike = false;
-
-	if (g.hardLimit <= HARD_LIMIT_4 && intrptError >= g.noiseLevel){
-		if (g.nIntrptDelaySpikes < MAX_SPIKES) {
-			g.nIntrptDelaySpikes += 1;				// Record unbroken sequence of delay spikes
-
-			isDelaySpike = true;
-		}
-		else {										// If nIntrptDelaySpikes == MAX_SPIKES stop the
-			isDelaySpike = false;					// suspend even if spikes continue.
-		}
-	}
-	else {
-		isDelaySpike = false;
-
-		if (g.nIntrptDelaySpikes > 0){
-			g.nIntrptDelaySpikes = 0;
-		}
-	}
-	return isDelaySpike;
-}
-
-/**
- * Removes delay peaks, spikes and jitter from intrptError
- * and returns the resulting clamped zeroError.
- *
- * @param[in] intrptError The raw interrupt error value
- * to be processed.
- *
- * @returns The resulting zeroError value after processing.
- */
-int removeIntrptNoise(int intrptError){
-
-	int zeroError;
-
-	buildRawErrorDistrib(intrptError, g.intrptErrorDistrib, &(g.intrptCount));
-
-	bool isDelaySpike = detectIntrptDelaySpike(intrptError);
-	if (isDelaySpike){
-		return 0;
-	}
-
-	zeroError = clampJitter(intrptError);					// Recover the time error by
-															// limiting away the jitter.
-	return zeroError;
-}
-
 /**
  * Sets a nanosleep() time delay equal to the time remaining
  * in the second from the time recorded as fracSec plus an
@@ -939,6 +761,54 @@ struct timespec setSyncDelay(int timeAt, int fracSec){
 	return ts2;
 }
 
+/**
+ * Updates G.sysDelay from a calibration interrupt
+ * delay measurement. The median of the last
+ * G.delayWindow measurements is the approximate
+ * interrupt delay and is assigned to G.sysDelay.
+ * Since it is a median, delay spikes are ignored
+ * without being removed, and a change in the delay
+ * is followed within half of the window.
+ *
+ * @param[in] intrptDelay The time interval in microseconds
+ * between a write to the calibration output pin and the
+ * recognition of the resulting interrupt.
+ */
+void processInterruptDelay(double intrptDelay){
+
+	g.intrptDelay = intrptDelay;
+
+	g.intrptError = g.intrptDelay - g.sysDelay;
+
+	if (g.seq_num > SETTLE_TIME && getConfig()->interruptDistrib){
+		buildInterruptDistrib(g.intrptDelay);
+	}
+
+	histRecord(&g.intrptHist, g.intrptDelay);
+
+	buildRawErrorDistrib(g.intrptError, g.intrptErrorDistrib, &(g.intrptCount));
+
+	if (g.delaySamples.window != g.delayWindow){				// On startup or a change of delay-window.
+		initSlidingMedian(&g.delaySamples, g.delayWindow);
+	}
+	addSlidingMedian(&g.delaySamples, g.intrptDelay);
+
+	g.delayMedian = getSlidingMedian(&g.delaySamples);
+	g.sysDelay = (int)round(g.delayMedian);
+
+	if (g.activeCount > SETTLE_TIME && g.hardLimit == HARD_LIMIT_1 && getConfig()->sysDelayDistrib){
+		buildSysDelayDistrib(g.sysDelay);
+	}
+
+	if (g.activeCount % SHOW_INTRPT_DATA_INTVL == 0 && g.activeCount != g.lastActiveCount){
+		g.lastActiveCount = g.activeCount;
+
+		sprintf(g.msgbuf, "Interrupt delay: %.3lf usec, Delay median: %lf usec  sysDelay: %d usec\n",
+				g.intrptDelay, g.delayMedian, g.sysDelay);
+		bufferStatusMsg(g.msgbuf);
+	}
+}
+
 /**
  * When CALIBRATE is enabled, calculates the time
  * interval between a write to an I/O pin that
@@ -946,10 +816,12 @@ struct timespec setSyncDelay(int timeAt, int fracSec){
  * of that interrupt by the system.
  *
  * Both the write time and the recognition time are
- * read from the PPS-Client kernel driver approximately
- * each second. The time interval is then calculated
- * along with its median value. The median value,
- * generated with one-minute weighting, is the approximate
+ * read from the calibration record in the ring mapped
+ * from the PPS-Client kernel driver approximately each
+ * second once poll() reports that the calibration
+ * interrupt has been received. The time interval is then calculated
+ * along with its median value. The median value over
+ * the last G.delayWindow seconds is the approximate
  * interrupt delay and is assigned to G.sysDelay.
  *
  * @param[in] pps_fd The PPS-Client device driver file
@@ -968,36 +840,20 @@ int getInterruptDelay(int pps_fd){
 		return -1;
 	}
 
-	rv = read(pps_fd, (void *)g.tm, 6 * sizeof(int));			// Read the interrupt write and response times.
-	if (rv > 0){
-
-		g.intrptDelay = g.tm[5] - g.tm[3];
-
-		g.intrptError = g.intrptDelay - g.sysDelay;
-
-		if (g.seq_num > SETTLE_TIME && (g.config_select & INTERRUPT_DISTRIB)){
-			buildInterruptDistrib(g.intrptDelay);
-		}
-
-		int zeroError = removeIntrptNoise(g.intrptError);
-
-		g.delayMedian += (double)zeroError * INV_DELAY_SAMPLES_PER_MIN;
-		g.sysDelay = (int)round(g.delayMedian);
-
-		if (g.activeCount > SETTLE_TIME && g.hardLimit == HARD_LIMIT_1 && (g.config_select & SYSDELAY_DISTRIB)){
-			buildSysDelayDistrib(g.sysDelay);
-		}
-
-		if (g.activeCount % SHOW_INTRPT_DATA_INTVL == 0 && g.activeCount != g.lastActiveCount){
-			g.lastActiveCount = g.activeCount;
+	struct pollfd pfd;
+	pfd.fd = pps_fd;
+	pfd.events = POLLIN;
 
-			sprintf(g.msgbuf, "Interrupt delay: %d usec, Delay median: %lf usec  sysDelay: %d usec\n",
-					g.intrptDelay, g.delayMedian, g.sysDelay);
-			bufferStatusMsg(g.msgbuf);
-		}
+	struct pps_calib_record calib;
+	rv = poll(&pfd, 1, CALIB_TIMEOUT_MSECS);					// Wait for the calibration interrupt.
+	if (rv == 1 && readPPSCalibRecord(ppsRing, &calib) == 0 && calib.seq != g.calibSeq){
+		g.calibSeq = calib.seq;
+		g.tm[1] = calib.write_time;							// Read the interrupt write and response times.
+		g.tm[2] = calib.intrpt_time;
+		processInterruptDelay((double)(g.tm[2] - g.tm[1]) / NSECS_PER_USEC);
 	}
 	else {
-		sprintf(g.logbuf, "getInterruptDelay() Device driver read returned: %d Error: %s\n", rv, strerror(errno));
+		sprintf(g.logbuf, "getInterruptDelay() Calibration interrupt not received. poll() returned: %d Error: %s\n", (int)rv, strerror(errno));
 		writeToLog(g.logbuf);
 		return -1;
 	}
@@ -1014,26 +870,12 @@ int getInterruptDelay(int pps_fd){
 }
 
 /**
- * Requests a read of the reception time of the PPS hardware
- * interrupt by the gps-pps-io driver and passes the value
- * read to makeTimeCorrection(). The driver is accessed with
- * the pps_fd file descriptor.
- *
- * When read(pps_fd) is called, the driver puts pps-client to
- * sleep until a PPS hardware interrupt has occurred. When it
- * occurs, the driver wakes up pps-client, read(pps_fd) copies
- * the time at which the interrupt was caught by the driver and
- * the value is passed to makeTimeCorrection().
+ * Processes the result of a read of the PPS interrupt
+ * time into G.tm by passing the time to makeTimeCorrection()
+ * and restarting the controller if that is required.
  *
- * The first time pps-client runs, the time slew can be as
- * large as hundreds of milliseconds. When this is the case,
- * limits imposed by adjtimex() prevent changes in offset of
- * more than about 500 microseconds each second. As a result,
- * pps-client will make a partial correction each minute and
- * will restart several times before the slew is small enough
- * that getAcquireState() will set G.isControlling to "true".
- * This looping will eventually converge  but can take as
- * long as 20 minutes.
+ * @param[in] rv The value returned by the read of the
+ * interrupt time.
  *
  * @param[in] verbose If "true" then write pps-client
  * state status messages to the console. Else not.
@@ -1044,11 +886,9 @@ int getInterruptDelay(int pps_fd){
  * @returns 0 if no restart is required, 1 if restart
  * is required or -1 on system error.
  */
-int readPPS_SetTime(bool verbose, int pps_fd){
+int setTimeFromPPSread(ssize_t rv, bool verbose, int pps_fd){
 	int restart = 0;
 
-	ssize_t rv = read(pps_fd, (void *)g.tm, 2 * sizeof(int));
-
 	increaseMonotonicCount();
 
 	g.interruptLost = false;
@@ -1067,22 +907,24 @@ int readPPS_SetTime(bool verbose, int pps_fd){
 		g.interruptLost = true;
 	}
 	else {
-		g.t.tv_sec = g.tm[0];					// Seconds value read by gps-pps-io driver from system clock
-												// at rising edge of PPS signal.
-		g.t.tv_usec = g.tm[1];					// Fractional seconds read from clock at rising edge of PPS signal.
+		g.t.tv_sec = g.tm[0] / NSECS_PER_SEC;	// Time in nanoseconds read by gps-pps-io driver from
+		g.t.tv_nsec = g.tm[0] % NSECS_PER_SEC;	// system clock at rising edge of PPS signal.
 
 		if (makeTimeCorrection(g.t, pps_fd) == -1)
 			return -1;
 
-		if ((! g.isControlling && g.seq_num >= SECS_PER_MINUTE)		// If time slew on startup is too large
-				|| (g.isControlling && g.hardLimit > HARD_LIMIT_1024	// or if g.avgSlew becomes too large
-				&& abs(g.avgSlew) > SLEW_MAX)){						// after acquiring
+		bool needsRestart = controllerNeedsRestart(&ctl);
+		feedShadows(needsRestart);
+
+		if (needsRestart){						// If time slew on startup is too large or if
+													// the average slew becomes too large after acquiring
 
 			sprintf(g.logbuf, "pps-client is restarting...\n");
 			writeToLog(g.logbuf);
 
-			initialize(verbose);					// then restart the controller.
-			adjtimex(&g.t3);
+			resetControllerState();				// then restart the controller.
+			applyConfig(getConfig());
+			clk->adjtimex(&g.t3);
 			setDelayTrackers();
 
 			restart = 1;
@@ -1091,6 +933,162 @@ int readPPS_SetTime(bool verbose, int pps_fd){
 	return restart;
 }
 
+/**
+ * Maps the ring of PPS interrupt times from the
+ * gps-pps-io driver.
+ *
+ * @param[in] pps_fd The gps-pps-io device driver
+ * file descriptor.
+ *
+ * @returns 0 on success else -1 on error.
+ */
+int mapPPSRing(int pps_fd){
+	void *p = mmap(NULL, sizeof(struct pps_ring), PROT_READ, MAP_SHARED, pps_fd, 0);
+	if (p == MAP_FAILED){
+		sprintf(g.logbuf, "mapPPSRing() mmap() failed with error: %s\n", strerror(errno));
+		writeToLog(g.logbuf);
+		return -1;
+	}
+	ppsRing = (const struct pps_ring *)p;
+	return 0;
+}
+
+/**
+ * Unmaps the ring of PPS interrupt times.
+ */
+void unmapPPSRing(void){
+	if (ppsRing != NULL){
+		munmap((void *)ppsRing, sizeof(struct pps_ring));
+		ppsRing = NULL;
+	}
+}
+
+/**
+ * Returns "true" if the driver has recorded a PPS
+ * interrupt time that has not yet been processed.
+ */
+bool isPPSRecordWaiting(void){
+	return getPPSRingHead(ppsRing) != g.ppsSeq;
+}
+
+/**
+ * Logs PPS interrupt times that were overwritten in
+ * the gps-pps-io driver ring before they were read,
+ * which show as a gap in the record sequence numbers.
+ *
+ * @param[in] rec A PPS record read from the driver.
+ */
+void checkPPSRecord(const struct pps_record *rec){
+	if (g.ppsSeq != 0 && rec->seq != g.ppsSeq + 1){
+		g.ppsOverruns += rec->seq - g.ppsSeq - 1;
+
+		sprintf(g.logbuf, "Missed %u PPS interrupt times in the gps-pps-io ring. Total missed: %u\n",
+				rec->seq - g.ppsSeq - 1, g.ppsOverruns);
+		writeToLog(g.logbuf);
+	}
+	g.ppsSeq = rec->seq;
+}
+
+/**
+ * Records the time error of a PPS interrupt time that was
+ * read from the driver after a newer one in the raw error
+ * distribution. The controller is not run on it because its
+ * time correction would be replaced by the correction made
+ * for the newer PPS interrupt before it could be applied.
+ *
+ * @param[in] rec The PPS record.
+ */
+void recordLateEdge(const struct pps_record *rec){
+	struct timespec t;
+
+	t.tv_sec = rec->time / NSECS_PER_SEC;
+	t.tv_nsec = rec->time % NSECS_PER_SEC;
+
+	buildRawErrorDistrib(getFractionalSeconds(t) - g.sysDelay, g.rawErrorDistrib, &(g.ppsCount));
+}
+
+/**
+ * Reads the reception times of the PPS hardware interrupts
+ * from the ring mapped from the gps-pps-io driver and passes
+ * the newest time to makeTimeCorrection().
+ *
+ * This function is called by waitForPPS() when poll() reports
+ * that the driver has caught a PPS hardware interrupt, so the
+ * newest record in the ring holds the time at which the
+ * interrupt was caught.
+ *
+ * If this process was too late to read a PPS interrupt
+ * time before the next PPS interrupt, the times recorded
+ * since the last one processed are read, oldest first.
+ * Each adjtimex() time slew replaces the one before, so
+ * only the newest time is passed to makeTimeCorrection()
+ * and the older ones are only recorded by recordLateEdge().
+ * The controller sees the older PPS edges as lost. If
+ * more than PPS_RING_LEN times were recorded, the older
+ * ones are being overwritten, so they are counted in
+ * G.ppsOverruns and only the newest is read.
+ *
+ * The first time pps-client runs, the time slew can be as
+ * large as hundreds of milliseconds. When this is the case,
+ * limits imposed by adjtimex() prevent changes in offset of
+ * more than about 500 microseconds each second. As a result,
+ * pps-client will make a partial correction each minute and
+ * will restart several times before the slew is small enough
+ * that getAcquireState() will set G.isControlling to "true".
+ * This looping will eventually converge  but can take as
+ * long as 20 minutes.
+ *
+ * @param[in] verbose If "true" then write pps-client
+ * state status messages to the console. Else not.
+ *
+ * @param[in] pps_fd The gps-pps-io device driver file
+ * descriptor.
+ *
+ * @returns 0 if no restart is required, 1 if restart
+ * is required or -1 on system error.
+ */
+int readPPS_SetTime(bool verbose, int pps_fd){
+	struct pps_record newest, rec;
+
+	uint32_t head = getPPSRingHead(ppsRing);
+	if (head == g.ppsSeq){									// Already processed.
+		return 0;
+	}
+	if (readPPSRecord(ppsRing, head, &newest) == -1){
+		return setTimeFromPPSread(0, verbose, pps_fd);
+	}
+
+	if (g.ppsSeq != 0 && head - g.ppsSeq > PPS_RING_LEN){	// The driver has lapped this reader, so the
+		uint32_t nMissed = head - g.ppsSeq - 1;				// older records are partly overwritten.
+		g.ppsOverruns += nMissed;							// Skip to the newest.
+
+		sprintf(g.logbuf, "readPPS_SetTime() Missed %u PPS interrupt times in the gps-pps-io ring. Resynchronized to the newest. Total missed: %u\n",
+				nMissed, g.ppsOverruns);
+		writeToLog(g.logbuf);
+
+		g.ppsSeq = head - 1;
+	}
+
+	uint32_t seq = (g.ppsSeq == 0) ? head : g.ppsSeq + 1;
+
+	for (; seq != head; seq++){
+		if (readPPSRecord(ppsRing, seq, &rec) == -1){		// Overwritten while reading.
+			continue;
+		}
+		checkPPSRecord(&rec);
+		g.ppsLateCount += 1;
+		recordLateEdge(&rec);
+	}
+	checkPPSRecord(&newest);
+
+	g.tm[0] = newest.time;
+	g.ppsRawTime = newest.raw_time;
+	int restart = setTimeFromPPSread(sizeof(int64_t), verbose, pps_fd);
+	g.ppsRawTime = 0;
+
+	return restart;
+}
+
 //void reportLeak(const char *msg){
 //	sprintf(g.logbuf, msg);
 //	writeToLog(g.logbuf);
@@ -1112,11 +1110,68 @@ int readPPS_SetTime(bool verbose, int pps_fd){
 //}
 
 /**
- * Runs the one-second wait loop that waits for
- * the PPS hardware interrupt that returns the
- * timestamp of the interrupt which is passed to
+ * Records the time from the wakeup on a PPS event at
+ * start to the end of the controller cycle and once
+ * each hour logs the worst case over the hour along
+ * with the count of any I/O records that were dropped.
+ *
+ * @param[in] start The time of the wakeup.
+ */
+void recordHotPathLatency(struct timespec *start){
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	long latency = (end.tv_sec - start->tv_sec) * NSECS_PER_SEC + (end.tv_nsec - start->tv_nsec);
+	if (latency > g.hotPathMax){
+		g.hotPathMax = latency;
+	}
+
+	g.hotPathCount += 1;
+	if (g.hotPathCount >= SECS_PER_HOUR){
+		sprintf(g.logbuf, "Controller cycle max latency: %.1f usec over %u cycles. Dropped I/O records: %u\n",
+				(double)g.hotPathMax / NSECS_PER_USEC, g.hotPathCount, getIODropCount());
+		writeToLog(g.logbuf);
+		g.hotPathMax = 0;
+		g.hotPathCount = 0;
+	}
+}
+
+/**
+ * Arms the timerfd timer_fd to expire PPS_TIMEOUT_NSECS
+ * after the next PPS interrupt is expected. If the timer
+ * expires before the interrupt arrives, the interrupt is
+ * treated as lost for that second.
+ *
+ * @param[in] timer_fd The timerfd file descriptor.
+ *
+ * @returns 0 on success else -1 on error.
+ */
+int setPPSTimeout(int timer_fd){
+	struct itimerspec its;
+	memset(&its, 0, sizeof(struct itimerspec));
+
+	its.it_value.tv_sec = 1;
+	its.it_value.tv_nsec = PPS_TIMEOUT_NSECS;
+
+	if (timerfd_settime(timer_fd, 0, &its, NULL) == -1){
+		sprintf(g.logbuf, "setPPSTimeout() timerfd_settime() failed with msg: %s\n", strerror(errno));
+		writeToLog(g.logbuf);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Runs the one-second event loop that waits with
+ * poll() for the PPS hardware interrupt that returns
+ * the timestamp of the interrupt which is passed to
  * makeTimeCorrection().
  *
+ * The loop wakes when the gps-pps-io driver has caught
+ * the interrupt or, if the interrupt is lost, when a
+ * timerfd timer set by setPPSTimeout() expires. Either
+ * event runs one controller cycle.
+ *
  * @param[in] verbose If "true" then write pps-client
  * state status messages to the console. Else not.
  *
@@ -1124,18 +1179,18 @@ int readPPS_SetTime(bool verbose, int pps_fd){
  * file descriptor.
  */
 void waitForPPS(bool verbose, int pps_fd){
-	struct timeval tv1;
-	struct timespec ts2;
-	int timePPS;
+	struct pollfd fds[3];
+	uint64_t expirations;
+	int timer_fd = -1;
+	int config_fd = -1;
 	int rv;
 	timeCheckParams tcp;
 	int restart = 0;
+	struct timespec hotPathStart;
 
-	adjtimex(&g.t3);
+	clk->adjtimex(&g.t3);
 	setDelayTrackers();
 
-	initFileLocalData();
-
 	if (g.doNTPsettime){
 		rv = allocInitializeSNTPThreads(&tcp);
 		if (rv == -1){
@@ -1157,39 +1212,114 @@ void waitForPPS(bool verbose, int pps_fd){
 		allocInitializeSerialThread(&tcp);
 	}
 
+	if (openSharedState() == -1){
+		goto end;
+	}
+
+	openHistory();						// On failure no history is recorded.
+
+	if (startIOWorker() == -1){
+		goto end;
+	}
+
+	startMetricsExporter();				// On failure metrics are not served.
+	startControlServer();				// On failure -v and -s are not available.
+	startShadowWorker();					// On failure shadow controllers are not run.
+
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (timer_fd == -1){
+		sprintf(g.logbuf, "waitForPPS() timerfd_create() failed with msg: %s\n", strerror(errno));
+		writeToLog(g.logbuf);
+		goto end;
+	}
+
+	config_fd = openConfigWatch();		// On failure config file changes are ignored.
 
 	signal(SIGHUP, HUPhandler);			// Handler used to ignore SIGHUP.
 	signal(SIGTERM, TERMhandler);		// Handler for the termination signal.
 
 	sprintf(g.logbuf, "PPS-Client v%s is starting ...\n", version);
 	writeToLog(g.logbuf);
-										// Set up a one-second delay loop that stays in synch by
-	timePPS = -150;		    				// continuously re-timing to before the roll-over of the second.
-										// This allows for a delay of about 50 microseconds coming out
-										// of sleep plus interrupt latencies up to 100 microseconds.
-	gettimeofday(&tv1, NULL);
-	ts2 = setSyncDelay(timePPS, tv1.tv_usec);
+
+	fds[0].fd = pps_fd;					// Readable when the driver has caught a PPS interrupt.
+	fds[0].events = POLLIN;
+	fds[1].fd = timer_fd;				// Readable when the PPS interrupt is overdue.
+	fds[1].events = POLLIN;
+	fds[2].fd = config_fd;				// Readable when a file in the config file directory was written.
+	fds[2].events = POLLIN;
+
+	if (setPPSTimeout(timer_fd) == -1){
+		goto end;
+	}
 
 	writeStatusStrings();
 
-	for (;;){							// Delay loop
+	for (;;){							// Event loop
 		if (g.exit_requested){
+			sprintf(g.logbuf, "Recieved SIGTERM\n");
+			writeToLog(g.logbuf);
 			sprintf(g.logbuf, "PPS-Client stopped.\n");
 			writeToLog(g.logbuf);
 			break;
 		}
 
-		nanosleep(&ts2, NULL);			// Sleep until ready to look for PPS interrupt
+		rv = poll(fds, 3, -1);			// Sleep until the PPS interrupt is caught or is overdue.
+		if (rv == -1){
+			if (errno == EINTR){			// Interrupted by a signal. Check for exit request.
+				continue;
+			}
+			sprintf(g.logbuf, "waitForPPS() poll() failed with msg: %s\n", strerror(errno));
+			writeToLog(g.logbuf);
+			break;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &hotPathStart);
+
+		if (usePPSApi && (fds[0].revents & POLLIN)){
+			rv = read(pps_fd, &expirations, sizeof(uint64_t));	// Clear the eventfd of the PPS API reader.
+		}
+
+		if ((fds[0].revents & POLLIN) && ! isPPSRecordWaiting()){
+			fds[0].revents = 0;			// The PPS interrupt time was read after an earlier wake.
+			if (((fds[1].revents | fds[2].revents) & POLLIN) == 0){
+				continue;
+			}
+		}
+
+		if (fds[2].revents & POLLIN){
+			if (configFileChanged(config_fd)){
+				readConfigFile();		// Parsed by the I/O worker.
+			}
+			if (((fds[0].revents | fds[1].revents) & POLLIN) == 0){
+				continue;
+			}
+		}
+
+		if (getConfigGen() != configGen){	// Apply a config file reread by the I/O worker
+			configGen = applyReloadedConfig();	// at the start of the second.
+		}
 
 		if (g.doNTPsettime){				// Don't move from this location ahead of readPPS_SetTime()
 			makeSNTPTimeQuery(&tcp);		// because SNTP servers are allocated on g.seq_num == 0.
 		}
 
-		restart = readPPS_SetTime(verbose, pps_fd);
+		if (fds[0].revents & POLLIN){
+			restart = readPPS_SetTime(verbose, pps_fd);
+		}
+		else if (fds[1].revents & POLLIN){
+			rv = read(timer_fd, &expirations, sizeof(uint64_t));
+			restart = setTimeFromPPSread(0, verbose, pps_fd);	// PPS interrupt was lost.
+		}
+		else {
+			continue;
+		}
 		if (restart == -1){
 			break;
 		}
 
+		if (setPPSTimeout(timer_fd) == -1){
+			break;
+		}
+
 		if (restart == 1) {
 			readConfigFile();
 		}
@@ -1214,7 +1344,7 @@ void waitForPPS(bool verbose, int pps_fd){
 			writeStatusStrings();
 
 			if (! g.interruptLost && ! g.isDelaySpike){
-				if (g.doCalibration && g.hardLimit == HARD_LIMIT_1){
+				if (g.doCalibration && ! usePPSApi && g.hardLimit == HARD_LIMIT_1){
 					rv = getInterruptDelay(pps_fd);
 					if (rv == -1){
 						break;
@@ -1225,9 +1355,7 @@ void waitForPPS(bool verbose, int pps_fd){
 			}
 		}
 
-		gettimeofday(&tv1, NULL);
-
-		ts2 = setSyncDelay(timePPS, tv1.tv_usec);
+		recordHotPathLatency(&hotPathStart);
 	}
 end:
 	if (g.doNTPsettime){
@@ -1236,6 +1364,18 @@ end:
 	if (g.doSerialsettime){
 		freeSerialThread(&tcp);
 	}
+	if (timer_fd != -1){
+		close(timer_fd);
+	}
+	if (config_fd != -1){
+		close(config_fd);
+	}
+	stopShadowWorker();
+	stopMetricsExporter();
+	stopIOWorker();
+	stopControlServer();
+	closeHistory();
+	closeSharedState();
 	return;
 }
 
@@ -1258,6 +1398,16 @@ end:
  * The -s flag requests that specified files be saved.
  * If the -s flag is not followed by a file specifier,
  * a list of the files that can be saved is printed.
+ *
+ * The -q flag prints the current controller params.
+ *
+ * Independently of the daemon, the -r flag followed by
+ * a trace file runs the controller offline on the
+ * recorded PPS interrupt times in the trace file.
+ *
+ * The -t flag followed by a trace file records the
+ * PPS interrupt times from the driver to the trace
+ * file for replay.
  */
 int main(int argc, char *argv[])
 {
@@ -1269,6 +1419,12 @@ int main(int argc, char *argv[])
 		if (strcmp(argv[1], "-v") == 0){
 			verbose = true;
 		}
+		if (strcmp(argv[1], "-r") == 0){					// Replay a recorded trace offline.
+			return replayTrace(argc, argv);
+		}
+		if (strcmp(argv[1], "-t") == 0){					// Record a trace for replay.
+			return captureTrace(argc, argv);
+		}
 	}
 
 	int prStat = accessDaemon(argc, argv);				// Send commands to the daemon.
@@ -1299,6 +1455,12 @@ int main(int argc, char *argv[])
 	mlockall(MCL_CURRENT | MCL_FUTURE);
 
 	initialize(verbose);
+	initFileLocalData();
+	rv = readConfigFile();
+	if (rv == -1){
+		goto end0;
+	}
+	configGen = applyReloadedConfig();
 	rv = processFiles();
 	if (rv == -1){
 		goto end0;
@@ -1312,19 +1474,23 @@ int main(int argc, char *argv[])
 	param.sched_priority = 99;							// to get real-time priority.
 	sched_setscheduler(0, SCHED_FIFO, &param);			// SCHED_FIFO: Don't yield to scheduler until sleep.
 
-	if(getDriverGPIOvals() == -1){
-		sprintf(g.logbuf, "Could not get GPIO vals for driver. Exiting.\n");
-		fprintf(stderr, "%s", g.logbuf);
-		writeToLog(g.logbuf);
-		goto end0;
-	}
+	usePPSApi = getConfig()->ppsDevice[0] != '\0';		// Read only when PPS-Client starts.
 
-	if (driver_load(g.ppsGPIO, g.outputGPIO, g.intrptGPIO) == -1){
-		sprintf(g.logbuf, "Could not load PPS-Client driver. Exiting.\n");
-		fprintf(stderr, "%s", g.logbuf);
-		writeToLog(g.logbuf);
-		rv = -1;
-		goto end0;
+	if (! usePPSApi){
+		if(getDriverGPIOvals() == -1){
+			sprintf(g.logbuf, "Could not get GPIO vals for driver. Exiting.\n");
+			fprintf(stderr, "%s", g.logbuf);
+			writeToLog(g.logbuf);
+			goto end0;
+		}
+
+		if (driver_load(g.ppsGPIO, g.outputGPIO, g.intrptGPIO) == -1){
+			sprintf(g.logbuf, "Could not load PPS-Client driver. Exiting.\n");
+			fprintf(stderr, "%s", g.logbuf);
+			writeToLog(g.logbuf);
+			rv = -1;
+			goto end0;
+		}
 	}
 
 	ppid = createPIDfile();								// Create the PID file for this process.
@@ -1333,10 +1499,26 @@ int main(int argc, char *argv[])
 		goto end1;
 	}
 
-	pps_fd = open_logerr("/dev/gps-pps-io", O_RDWR);		// Open the gps-pps-io device driver.
-	if (pps_fd == -1){
-		rv = -1;
-		goto end2;
+	if (usePPSApi){
+		pps_fd = startPPSApi(getConfig()->ppsDevice);		// Read the PPS through the PPS API.
+		if (pps_fd == -1){
+			rv = -1;
+			goto end2;
+		}
+		ppsRing = getPPSApiRing();
+	}
+	else {
+		pps_fd = open_logerr("/dev/gps-pps-io", O_RDWR);	// Open the gps-pps-io device driver.
+		if (pps_fd == -1){
+			rv = -1;
+			goto end2;
+		}
+
+		if (mapPPSRing(pps_fd) == -1){					// Map its ring of PPS interrupt times.
+			close(pps_fd);
+			rv = -1;
+			goto end2;
+		}
 	}
 
 	sprintf(g.msgbuf, "Process PID: %d\n", ppid);		// PPS client is starting.
@@ -1344,10 +1526,17 @@ int main(int argc, char *argv[])
 
 	waitForPPS(verbose, pps_fd);							// Synchronize to the PPS.
 
-	close(pps_fd);										// Close the interrupt device driver.
+	if (usePPSApi){
+		stopPPSApi();
+		ppsRing = NULL;
+	}
+	else {
+		unmapPPSRing();
+		close(pps_fd);									// Close the interrupt device driver.
 
-	sprintf(g.logbuf, "PPS-Client closed driver\n");
-	writeToLog(g.logbuf);
+		sprintf(g.logbuf, "PPS-Client closed driver\n");
+		writeToLog(g.logbuf);
+	}
 
 end2:
 	sysCommand("rm /var/run/pps-client.pid");			// Remove PID file with system() which blocks until
@@ -1355,10 +1544,12 @@ end2:
 	end1:
 	sysCommand("timedatectl set-ntp 1");					// Always try to re-enable NTP on shutdown.
 
-	driver_unload();										// Driver will not be unloaded until a timeout occurs to
-														// prevent driver from being unloaded before being closed
-	sprintf(g.logbuf, "PPS-Client unloaded driver.\n");	// by OS.
-	writeToLog(g.logbuf);
+	if (! usePPSApi){
+		driver_unload();									// Driver will not be unloaded until a timeout occurs to
+															// prevent driver from being unloaded before being closed
+		sprintf(g.logbuf, "PPS-Client unloaded driver.\n");	// by OS.
+		writeToLog(g.logbuf);
+	}
 end0:
 	return rv;
 }
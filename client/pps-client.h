@@ -39,9 +39,23 @@
 #include <errno.h>
 #include <poll.h>
 #include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <sys/inotify.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../client/pps-shm.h"
+#include "../driver/gps-pps-io.h"
 
 #define PTHREAD_STACK_REQUIRED 16384		//!< Stack space requirements for threads
 #define USECS_PER_SEC 1000000
+#define NSECS_PER_SEC 1000000000
+#define NSECS_PER_USEC 1000.0
 #define SECS_PER_MINUTE 60
 #define SECS_PER_5_MIN 300
 #define SECS_PER_10_MIN 600
@@ -55,7 +69,7 @@
 #define INV_GAIN_0 4						//!< Controller inverse proportional gain constant at startup
 #define INTEGRAL_GAIN 0.63212			//!< Controller integral gain constant in active controller operation
 #define SHOW_INTRPT_DATA_INTVL 6			//!< The number of seconds between displays of interrupt delay in the PPS-Client status line
-#define INV_DELAY_SAMPLES_PER_MIN (1.0 / (double)SECS_PER_MINUTE) //!< Constant for calculating \b G.sysDelay
+#define DELAY_WINDOW SECS_PER_MINUTE		//!< Default count of calibration interrupt delays in the median that sets \b G.sysDelay.
 #define FREQDIFF_INTRVL 5				//!< The number of minutes between Allan deviation samples of system clock frequency correction
 
 #define OFFSETFIFO_LEN 80				//!< Length of \b G.correctionFifo which contains the data used to generate \b G.avgCorrection.
@@ -72,6 +86,9 @@
 #define RAW_ERROR_DECAY 0.98851			//!< Decay rate for \b G.rawError samples (1 hour half life)
 
 #define INTERRUPT_LOST 15				//!< Number of consecutive lost interrupts at which a warning starts
+#define PPS_TIMEOUT_NSECS 200000000		//!< Time past the expected PPS interrupt after which it is treated as lost (nanoseconds).
+#define CALIB_TIMEOUT_MSECS 200			//!< Time allowed for the calibration interrupt to be received (milliseconds).
+#define PPS_API_TIMEOUT_SECS 2			//!< Longest wait for a PPS edge in the PPS_FETCH ioctl of the PPS API reader (seconds).
 
 #define MAX_SERVERS 4					//!< Maximum number of SNTP time servers to use
 #define CHECK_TIME 1024					//!< Interval between Internet time checks (about 17 minutes)
@@ -83,10 +100,91 @@
 
 #define NOISE_FACTOR 0.354				//!< Adjusts \b G.noiseLevel to track \b G.sysDelay
 #define NOISE_LEVEL_MIN 4				//!< The minimum level at which interrupt delays are delay spikes.
+#define SPIKE_SIGMAS 3.0					//!< Default robust standard deviations of rawError above its median at which a delay is a delay spike.
+#define NOISE_FLOOR_RATE 0.05				//!< Fraction of the MAD by which the rawError median and MAD estimates move each second.
+#define NOISE_FLOOR_MAD_INIT 1.0			//!< Initial MAD estimate of rawError (microseconds).
+#define NOISE_FLOOR_MAD_MIN 0.1			//!< Minimum MAD estimate of rawError (microseconds).
+#define MAD_TO_SIGMA 1.4826				//!< Ratio of the standard deviation to the MAD of Gaussian noise.
 #define SLEW_LEN 10						//!< The slew accumulator (slewAccum) update interval
 #define SLEW_MAX 65						//!< Jitter slew value below which the controller will begin to frequency lock.
+#define HARD_LIMIT_SHIFT 1				//!< Default hard limit policy. See \b setHardLimit().
+
+#define ACQUIRE_LEN 16					//!< Number of PPS edges fitted by \b fastAcquire() to estimate the clock frequency offset.
+#define ACQUIRE_MAX_RESIDUAL 10.0		//!< Maximum RMS residual (microseconds) of the \b fastAcquire() fit. Above this the standard startup is used.
+#define RAW_FIT_LEN 60					//!< Maximum number of PPS edges in the fit of the free-running clock frequency on startup.
+#define RAW_FIT_MIN 16					//!< Minimum number of PPS edges in the fit of the free-running clock frequency.
+
+#define KALMAN_Q_PHASE 0.001				//!< Default Kalman controller phase process noise (square microseconds per second).
+#define KALMAN_Q_FREQ 1e-6				//!< Default Kalman controller frequency process noise (square ppm per second).
+#define KALMAN_R_INIT 1.0				//!< Kalman controller measurement noise (square microseconds) until enough jitter has been recorded.
+#define KALMAN_R_MIN 0.01				//!< Minimum Kalman controller measurement noise (square microseconds).
+#define KALMAN_R_COUNT 60				//!< Count of \b G.jitterHist values required to set the measurement noise from the jitter.
+#define KALMAN_P_FREQ_INIT 1.0			//!< Initial variance of the Kalman controller frequency estimate (square ppm).
+#define KALMAN_GATE 3.0					//!< Innovations are limited to this many standard deviations by the Kalman controller.
+#define KALMAN_MAX_DT 10					//!< Seconds without a PPS edge after which the Kalman controller restarts.
+
+#define IO_QUEUE_LEN 64					//!< Number of records in the I/O worker queue. Must be a power of 2.
+#define COPY_MAX_RETRIES 1000			//!< Maximum tries by readCopy() to copy data while the control thread is writing it.
+
+#define IO_LOG 1							//!< I/O record types: Append a message to the log file with a timestamp.
+#define IO_LOG_NO_TIMESTAMP 2			//!< Append a message to the log file without a timestamp.
+#define IO_STATUS_MSG 3					//!< Buffer a message for the status display.
+#define IO_STATE_PARAMS 4				//!< Format the controller state params for the status display.
+#define IO_WRITE_STATUS 5				//!< Write the buffered status display messages to the status file.
+#define IO_PROCESS_FILES 6				//!< Run processFiles().
+#define IO_READ_CONFIG 7					//!< Run readConfigFile().
+#define IO_EXIT 8						//!< Stop the I/O worker.
+#define IO_HISTORY 9						//!< Append a record to the history file and the stability calculation.
+
+#define SHADOW_MAX 4						//!< Maximum number of shadow controllers.
+#define SHADOW_QUEUE_LEN 64				//!< Number of PPS edges in the shadow worker queue. Must be a power of 2.
+#define SHADOW_REPORT_SECS SECS_PER_HOUR	//!< Interval in seconds at which the shadow controller ranking is logged.
+
+#define LOG_DEFAULT_SIZE 100000			//!< Default size in bytes at which the log file is rotated.
+#define LOG_DEFAULT_COUNT 1				//!< Default number of rotated log files kept.
+#define LOG_MAX_COUNT 9					//!< Maximum number of rotated log files kept.
+#define LOG_BATCH_SZ 8192				//!< Size of each of the two log batch buffers of the I/O worker.
+#define LOG_FLUSH_SECS 1					//!< Maximum time in seconds that a logged message is held in the batch buffer.
+
+#define METRICS_SOCKET "/run/pps-client-metrics.sock"	//!< Unix domain socket on which metrics are served.
+#define METRICS_BUF_SZ 4096				//!< Size of the buffer holding a metrics response.
+
+#define CTL_SOCKET "/run/pps-client-control.sock"	//!< Unix domain socket on which the daemon accepts control requests.
+#define CTL_MAX_SUBSCRIBERS 8			//!< Maximum number of status subscribers.
+#define CTL_LABEL_SZ 32					//!< Size of a save request data label.
+#define CTL_PATH_SZ 225					//!< Size of a save request filename.
+#define CTL_REPLY_SECS 5					//!< Time in seconds that a client waits for a reply.
+
+#define CTL_SAVE 1						//!< Control message types: Request to save the data identified by a label to a file.
+#define CTL_QUERY 2						//!< Request for the current controller params.
+#define CTL_SUBSCRIBE 3					//!< Request to receive a CTL_STATUS message each second.
+#define CTL_REPLY 4						//!< Reply to CTL_SAVE or CTL_QUERY.
+#define CTL_STATUS 5						//!< The status messages for one second.
+
+#define HISTORY_FILE "/var/local/pps-history"	//!< Memory-mapped ring file of per-second controller records.
+#define HISTORY_DAYS 30					//!< Number of days of per-second records held in the history file.
+#define HISTORY_LEN (HISTORY_DAYS * SECS_PER_DAY)	//!< Number of records in the history file.
+#define HISTORY_HDR_SZ 4096				//!< Size of the history file header. The records start on the next page.
+#define HISTORY_WINDOW 8192				//!< Number of records mapped at a time for appending.
+#define HISTORY_MAGIC 0x50505348			//!< Identifies a history file.
+#define HISTORY_VERSION 2				//!< Changes when struct historyRec changes.
+#define HISTORY_LOCKED 0x1				//!< struct historyRec flags: The controller hard limit was 1.
+#define HISTORY_FREQ_SET 0x2				//!< The clock frequency offset was set in this second.
+
+#define STABILITY_NUM_TAUS 18			//!< Number of taus at which stability is calculated: 2^0 to 2^16 seconds and one day.
+#define STABILITY_MAX_TAU SECS_PER_DAY	//!< The largest tau in seconds.
+#define STABILITY_MAX_GAP 10				//!< The most missing seconds of phase that are interpolated.
+
+#define MEDIAN_WINDOW_MAX 1024			//!< Maximum window of a struct slidingMedian.
+#define MEDIAN_LOWER 0					//!< The max-heap of the lower half of the values of a struct slidingMedian.
+#define MEDIAN_UPPER 1					//!< The min-heap of the upper half of the values of a struct slidingMedian.
+
+#define HIST_SUB_BITS 7					//!< Sets the resolution of a struct hdrHist to 1/2^(HIST_SUB_BITS - 1) of the value.
+#define HIST_MAX_BITS 40					//!< Values of 2^HIST_MAX_BITS nanoseconds or more are counted in the last bucket of a struct hdrHist.
+#define HIST_LEN ((HIST_MAX_BITS - HIST_SUB_BITS + 2) << (HIST_SUB_BITS - 1))	//!< Number of buckets in a struct hdrHist.
 
 #define MAX_LINE_LEN 50
+#define FILEBUF_SZ (JITTER_DISTRIB_LEN * MAX_LINE_LEN)	//!< Size of the buffer in which a data file is formatted before it is written.
 #define STRBUF_SZ 500
 #define LOGBUF_SZ 500
 #define MSGBUF_SZ 500
@@ -95,7 +193,8 @@
 
 #define NUM_PARAMS 5
 #define ERROR_DISTRIB_LEN 121
-#define JITTER_DISTRIB_LEN 121
+#define JITTER_DISTRIB_LEN 1201
+#define JITTER_DISTRIB_RES 0.1					//!< Width in microseconds of a \b G.jitterDistrib bin.
 #define INTRPT_DISTRIB_LEN 121
 
 #define HARD_LIMIT_NONE 32768
@@ -107,21 +206,184 @@
 #define HIGH 1
 #define LOW 0
 
-#define MAX_CONFIGS 32
-
-#define ERROR_DISTRIB 1				// Configuration file Keys
-#define ALERT_PPS_LOST 2
-#define JITTER_DISTRIB 4
-#define CALIBRATE 8
-#define INTERRUPT_DISTRIB 16
-#define SYSDELAY_DISTRIB 32
-#define EXIT_LOST_PPS 64
-#define PPS_GPIO 128
-#define OUTPUT_GPIO 256
-#define INTRPT_GPIO 512
-#define SNTP 1024
-#define SERIAL 2048
-#define SERIAL_PORT 4096
+#define CONFIG_BOOL 1						//!< Config value types: "enable" or "disable".
+#define CONFIG_INT 2						//!< An integer.
+#define CONFIG_STRING 3					//!< A string such as a file path.
+#define CONFIG_STR_SZ 80					//!< Size of a config string value.
+
+#define MAX_SLEW_PER_SEC 500				//!< Approximate maximum offset slew in microseconds per second applied by \b adjtimex() with \b ADJ_OFFSET_SINGLESHOT.
+
+/**
+ * Struct of the clock functions through which the controller
+ * reads the time and applies time and frequency corrections.
+ * The default backend uses the system clock. The replay
+ * engine substitutes a simulated clock that records the
+ * corrections instead of applying them to the system clock.
+ */
+struct clockBackend {
+	int (*adjtimex)(struct timex *);					//!< Applies a time or frequency correction to the clock.
+	int (*gettimeofday)(struct timeval *);			//!< Gets the current time of day from the clock.
+	int (*getMonotonic)(struct timespec *);			//!< Gets a monotonic time count that is not affected by clock corrections.
+	int (*getEdgeRaw)(struct timespec *);			//!< Gets the free-running time of the PPS edge being processed, which is not affected by clock frequency corrections. Returns -1 if not available.
+	bool isSimulated;								//!< "true" if the clock is simulated. Suppresses writes to files and to the driver.
+};
+
+/**
+ * A simulated clock on which the controller replays
+ * a trace of free-running PPS interrupt times. Used
+ * through simClockBackend by the replay engine and
+ * pps-sweep. See pps-sim.cpp.
+ */
+struct simClock {
+	double phase;									//!< Accumulated time correction applied to the clock (microseconds).
+	double pendingSlew;								//!< Remaining ADJ_OFFSET_SINGLESHOT slew (microseconds).
+	double freq;									//!< Frequency offset applied to the clock (ppm).
+	double monoSecs;								//!< Simulated monotonic time in seconds.
+	time_t simSec;									//!< Whole seconds of the simulated clock at the current PPS interrupt.
+	struct timespec rawTime;						//!< Free-running interrupt time from the trace of the current PPS interrupt.
+	int64_t lastEdge;								//!< Free-running time of the last PPS interrupt read from the trace (nanoseconds).
+	bool started;									//!< "true" once the first PPS interrupt has been read from the trace.
+
+	unsigned int nOffsetCalls;						//!< Count of time slew adjtimex() calls.
+	unsigned int nFreqCalls;						//!< Count of frequency adjtimex() calls.
+	unsigned int nStepCalls;						//!< Count of time step adjtimex() calls.
+	long lastOffset;								//!< Last time slew.
+	double lastFreq;								//!< Last frequency offset.
+};
+
+/**
+ * Controller state params for the status display
+ * that are copied by bufferStateParams() each second.
+ */
+struct stateParams {
+	time_t pps_t_sec;								//!< Whole seconds of the time of the PPS rising edge.
+	long pps_t_nsec;									//!< Nanoseconds of the time of the PPS rising edge.
+	unsigned int seq_num;							//!< The \b G.seq_num of the PPS rising edge.
+	double jitter;									//!< The \b G.jitter value.
+	double freqOffset;								//!< The \b G.freqOffset value.
+	double avgCorrection;							//!< The \b G.avgCorrection value.
+	int hardLimit;									//!< The \b G.hardLimit value.
+	int sysDelayShift;								//!< The \b G.sysDelayShift value.
+	double jitterP99;								//!< The p99 of \b G.jitterHist.
+};
+
+/**
+ * A per-second record of the controller in the
+ * history file.
+ */
+struct historyRec {
+	int64_t timestamp;								//!< Whole seconds of the time of the PPS rising edge.
+	uint32_t seq_num;								//!< The \b G.seq_num value.
+	uint16_t flags;									//!< HISTORY_ flags.
+	int16_t sysDelay;								//!< The \b G.sysDelay value.
+	float rawError;									//!< The \b G.rawError value.
+	float timeCorrection;							//!< The \b G.timeCorrection value.
+	float freqOffset;								//!< The \b G.freqOffset value.
+	float slewResidual;								//!< The \b G.slewResidual value.
+};
+
+/**
+ * A fixed-size record passed from the controller
+ * thread to the I/O worker thread.
+ */
+struct ioRecord {
+	int type;										//!< One of the IO_ record types.
+	time_t t;										//!< Time the record was posted. Used for log timestamps.
+	union {
+		char msg[LOGBUF_SZ];							//!< Message for IO_LOG, IO_LOG_NO_TIMESTAMP and IO_STATUS_MSG.
+		struct stateParams params;					//!< State params for IO_STATE_PARAMS.
+		struct historyRec hrec;						//!< Record for IO_HISTORY.
+	};
+};
+
+/**
+ * The PPS-Client configuration parsed from
+ * pps-client.conf by readConfigFile(). Settings
+ * that are not in the file keep their default
+ * values. Read only through getConfig().
+ */
+struct ppsConfig {
+	bool errorDistrib;								//!< error-distrib: Save the distribution of time corrections.
+	bool alertPPSLost;								//!< alert-pps-lost: Set the output GPIO HIGH while the PPS is lost.
+	bool jitterDistrib;								//!< jitter-distrib: Save the distribution of jitter.
+	bool calibrate;									//!< calibrate: Calibrate the interrupt delay.
+	bool interruptDistrib;							//!< interrupt-distrib: Save the distribution of interrupt delay.
+	bool sysDelayDistrib;							//!< sysdelay-distrib: Save the distribution of sysDelay.
+	int delayWindow;									//!< delay-window: Count of calibration interrupt delays in the median that sets sysDelay.
+	bool exitLostPPS;								//!< exit-lost-pps: Exit if the PPS is lost.
+	int ppsGPIO;										//!< pps-gpio: The PPS GPIO number or -1 if not given.
+	int outputGPIO;									//!< output-gpio: The calibrate GPIO output number or -1 if not given.
+	int intrptGPIO;									//!< intrpt-gpio: The calibrate GPIO interrupt number or -1 if not given.
+	bool sntp;										//!< sntp: Set the time of day from SNTP servers.
+	bool serial;										//!< serial: Set the time of day from a serial port. Overrides sntp.
+	char serialPort[CONFIG_STR_SZ];					//!< serialPort: The serial port file.
+	char ppsDevice[CONFIG_STR_SZ];					//!< pps-device: The PPS API device to read instead of the gps-pps-io driver or "" if none.
+	bool fastAcquire;								//!< fast-acquire: Use fastAcquire() on startup.
+	int logSize;										//!< log-size: Size in kilobytes at which the log file is rotated.
+	int logCount;									//!< log-count: Number of rotated log files kept.
+	bool metrics;									//!< metrics: Serve metrics on METRICS_SOCKET.
+	int metricsPort;									//!< metrics-port: Also serve metrics on this loopback TCP port if not 0.
+	char controller[CONFIG_STR_SZ];					//!< controller: "pi" for the proportional-integral controller or "kalman".
+	char shadow[SHADOW_MAX][CONFIG_STR_SZ];			//!< shadow-1 ... shadow-4: The settings of each shadow controller or "" if none.
+};
+
+/**
+ * A log-linear histogram of the magnitudes of
+ * values recorded in nanoseconds. See pps-hist.cpp.
+ */
+struct hdrHist {
+	uint32_t counts[HIST_LEN];						//!< Counts in each bucket.
+	uint64_t total;									//!< Total count.
+	uint64_t max;									//!< Largest value recorded.
+};
+
+/**
+ * The median of the most recent values in a window.
+ * See pps-median.cpp.
+ */
+struct slidingMedian {
+	int window;										//!< Count of the most recent values from which the median is taken.
+	int count;										//!< Count of values held.
+	int next;										//!< The ring slot of the next value.
+	double values[MEDIAN_WINDOW_MAX];				//!< Ring of the most recent values.
+	int heap[2][MEDIAN_WINDOW_MAX];					//!< Ring slots in the lower max-heap and the upper min-heap.
+	int heapLen[2];									//!< Count of ring slots in each heap.
+	int heapOf[MEDIAN_WINDOW_MAX];					//!< The heap that holds each ring slot.
+	int heapPos[MEDIAN_WINDOW_MAX];					//!< The position of each ring slot in its heap.
+};
+
+/**
+ * Controller params returned by a CTL_QUERY
+ * control request.
+ */
+struct ctlParams {
+	uint32_t seq_num;								//!< The \b G.seq_num value.
+	int32_t hardLimit;								//!< The \b G.hardLimit value.
+	int32_t sysDelay;								//!< The \b G.sysDelay value including any delay shift.
+	int32_t isControlling;							//!< The \b G.isControlling value.
+	int32_t interruptLossCount;						//!< The \b G.interruptLossCount value.
+	double jitter;									//!< The \b G.jitter value.
+	double freqOffset;								//!< The \b G.freqOffset value.
+	double avgCorrection;							//!< The \b G.avgCorrection value.
+	double jitterP99;								//!< The p99 of \b G.jitterHist.
+};
+
+/**
+ * A message on the control socket. Each message
+ * is sent as one SOCK_SEQPACKET packet.
+ */
+struct ctlMsg {
+	int32_t type;									//!< One of the CTL_ message types.
+	int32_t status;									//!< In a CTL_REPLY: 0 on success, else -1.
+	union {
+		struct {
+			char label[CTL_LABEL_SZ];				//!< The label of the data to save.
+			char filename[CTL_PATH_SZ];				//!< The file to save to. Empty for the default file.
+		} save;										//!< For CTL_SAVE.
+		struct ctlParams params;						//!< For a CTL_REPLY to CTL_QUERY.
+		char text[MSGBUF_SZ];						//!< For CTL_STATUS and a CTL_REPLY to CTL_SAVE.
+	};
+};
 
 /*
  * Struct for passing arguments to and from threads
@@ -142,6 +404,139 @@ struct timeCheckParams {
 	int rv;											//!< Return value of thread
 };													//!< Struct for passing arguments to and from threads querying SNTP time servers or GPS receivers.
 
+/**
+ * The settings of a controller.
+ */
+struct controllerParams {
+	bool doFastAcquire;								//!< Enables \b fastAcquire() on startup.
+	bool doKalman;									//!< Selects the Kalman filter once the controller is controlling.
+	bool doLog;										//!< Enables log messages from the controller.
+	int invGain0;									//!< Inverse proportional gain before the controller is controlling.
+	double integralGain;								//!< Integral gain of the proportional-integral controller.
+	double noiseFactor;								//!< Sets \b noiseLevel in proportion to \b sysDelay.
+	double spikeSigmas;								//!< Sets \b spikeLevel in robust standard deviations above the median of rawError. 0 uses \b noiseLevel.
+	double slewMax;									//!< Average slew below which the controller begins to control the clock frequency.
+	int maxSpikes;									//!< Maximum count of continuous delay spikes that are removed.
+	int hardLimitShift;								//!< The hard limit policy of \b setHardLimit().
+	double kalmanQPhase;								//!< Kalman filter phase process noise (square microseconds per second).
+	double kalmanQFreq;								//!< Kalman filter frequency process noise (square ppm per second).
+};
+
+/**
+ * Streaming estimates of the median and the median
+ * absolute deviation (MAD) of rawError.
+ */
+struct noiseFloor {
+	bool isStarted;									//!< "true" after the first value.
+	double median;									//!< Estimated median in microseconds.
+	double mad;										//!< Estimated MAD in microseconds.
+};
+
+/**
+ * The state of the Kalman filter of a controller.
+ */
+struct kalmanState {
+	bool isStarted;									//!< "true" after the first update.
+	double lastTime;									//!< Monotonic time in seconds of the last update.
+	double phase;									//!< Estimated phase in microseconds less the corrections since made.
+	double freq;										//!< Estimated residual frequency error in ppm less the corrections since made.
+	double P[2][2];									//!< Covariance of the phase and frequency estimates.
+	double R;										//!< Measurement noise in square microseconds.
+	double slew;										//!< Time slew applied since the last update.
+};
+
+/**
+ * A controller of a clock. The controller holds all of
+ * its state and makes its corrections through the clock
+ * backend passed to makeControllerCorrection(), so more
+ * than one controller can run at a time. The daemon
+ * runs one on the system clock and copies its outputs
+ * to G each second.
+ */
+struct controller {
+	struct controllerParams params;					//!< The controller settings.
+
+	unsigned int seq_num;							//!< Count of PPS edges passed to the controller.
+	double t_mono;									//!< Monotonic time in seconds of the current PPS edge.
+	int sysDelay;									//!< The interrupt delay referenced by rawError.
+	double rawError;									//!< The time error of the current PPS edge.
+
+	bool isControlling;								//!< Set "true" by \b getAcquireState() when the control loop can begin to control the clock frequency.
+	unsigned int activeCount;						//!< Advancing count of controller cycles once \b isControlling is "true".
+
+	int acquireCount;								//!< Count of PPS edges collected by \b fastAcquire(). Set to -1 when fast acquisition is finished.
+	double acquireStart;								//!< Monotonic time in seconds of the first PPS edge collected by \b fastAcquire().
+	double acquireTime[ACQUIRE_LEN];					//!< Monotonic times in seconds since \b acquireStart of the PPS edges collected by \b fastAcquire().
+	double acquireError[ACQUIRE_LEN];				//!< The rawError values of the PPS edges collected by \b fastAcquire().
+	struct timespec t_raw;							//!< Free-running time of the current PPS edge. Zero if not available.
+	struct timespec rawStart;						//!< Free-running time of the first PPS edge in the fit of the free-running clock frequency.
+	int rawCount;									//!< Count of PPS edges in \b rawSecs and \b rawOffset.
+	double rawSecs[RAW_FIT_LEN];						//!< Whole PPS seconds from \b rawStart of each PPS edge in the fit.
+	double rawOffset[RAW_FIT_LEN];					//!< Free-running time from \b rawStart less \b rawSecs of each PPS edge in the fit (microseconds).
+	double rawFreqOffset;							//!< Frequency offset that corrects the free-running clock oscillator measured by the fit (ppm).
+	bool isFastAcquired;								//!< Set "true" by \b fastAcquire() when it has started the controller at \b HARD_LIMIT_1.
+	bool isClockStepped;								//!< Set "true" when the clock was stepped at the current PPS edge.
+	double stepOffset;								//!< Sum of the time steps in microseconds made at the current PPS edge.
+	double slewOffset;								//!< The time slew in microseconds passed to \b adjtimex() at the current PPS edge.
+
+	int noiseLevel;									//!< PPS time delay value proportional to \b sysDelay beyond which a delay is defined to be a delay spike.
+	struct noiseFloor noiseFloor;					//!< Recent median and MAD of rawError.
+	double spikeLevel;								//!< The rawError beyond which a delay is a delay spike. Set by \b setSpikeLevel().
+	int nDelaySpikes;								//!< Current count of continuous delay spikes made by \b detectDelaySpike().
+	bool isDelaySpike;								//!< Set "true" by \b detectDelaySpike() when rawError exceeds \b spikeLevel.
+	bool isNoiseRemoved;								//!< Set "true" when \b removeNoise() has processed the current PPS edge.
+
+	double slewAccum;								//!< Accumulates rawError in \b getTimeSlew() and is used to determine \b avgSlew.
+	int slewAccum_cnt;								//!< Count of the number of times rawError has been summed into \b slewAccum.
+	double avgSlew;									//!< Average slew value determined by \b getTimeSlew() from the average of \b slewAccum each time \b slewAccum_cnt reaches \b SLEW_LEN.
+	bool slewIsLow;									//!< Set to "true" in \b getAcquireState() when \b avgSlew is less than \b SLEW_MAX. This is a precondition for \b getAcquireState() to set \b isControlling to "true".
+
+	double zeroError;								//!< The controller error resulting from removing jitter noise from rawError in \b removeNoise().
+	int hardLimit;									//!< An adaptive limit value determined by \b setHardLimit() and applied to rawError by \b clampJitter() as the final noise reduction step to generate \b zeroError.
+	int invProportionalGain;							//!< Controller proportional gain configured inversely to use as an int divisor.
+	double timeCorrection;							//!< Time correction value constructed by dividing \b zeroError by \b invProportionalGain.
+	double slewResidual;								//!< Sub-microsecond part of \b timeCorrection not yet applied by \b adjtimex(). Carried into the next second.
+	struct timex t3;									//!< Passes the corrections to \b adjtimex().
+
+	double avgCorrection;							//!< A one-minute rolling average of \b timeCorrection values generated by \b getAverageCorrection().
+	double correctionFifo[OFFSETFIFO_LEN];				//!< Contains the \b timeCorrection values from over the previous 60 seconds.
+	int correctionFifoCount;							//!< Signals that \b correctionFifo contains a full count of \b timeCorrection values.
+	double correctionAccum;								//!< Accumulates \b timeCorrection values from \b correctionFifo in \b getAverageCorrection() in order to generate \b avgCorrection.
+
+	double integral[NUM_INTEGRALS];					//!< Array of integrals constructed by \b makeAverageIntegral().
+	double avgIntegral;								//!< One-minute average of the integrals in \b integral[].
+	int integralCount;								//!< Counts the integrals formed over the last 10 controller cycles and signals when all integrals in \b integral have been constructed.
+
+	int correctionFifo_idx;							//!< Advances \b correctionFifo on each controller cycle in \b integralIsReady() which returns "true" every 60 controller cycles.
+
+	double integralTimeCorrection;					//!< Integral or average integral of \b timeCorrection returned by \b getIntegral();
+	double freqOffset;								//!< Clock frequency correction in ppm.
+	bool isFreqSet;									//!< Set "true" when the once a minute frequency correction was made at the current PPS edge.
+
+	struct kalmanState kalman;						//!< The Kalman filter used when \b params.doKalman is "true".
+	struct hdrHist jitterHist;						//!< The jitter while locked, from which the Kalman filter measurement noise is set.
+
+	char logbuf[LOGBUF_SZ];							//!< Used in place of G.logbuf.
+};
+
+/**
+ * A PPS edge as seen by the controller of the active
+ * clock, passed to the shadow controllers.
+ */
+struct shadowInput {
+	double t_mono;									//!< Monotonic time in seconds of the PPS edge.
+	struct timespec t_raw;							//!< Free-running time of the PPS edge. Zero if not available.
+	double rawError;									//!< The time error of the PPS edge.
+	int sysDelay;									//!< The interrupt delay referenced by rawError.
+	double stepOffset;								//!< The time steps made to the active clock at the PPS edge.
+	bool isSlewed;									//!< "true" if the active clock was slewed at the PPS edge.
+	double slewOffset;								//!< The time slew made to the active clock at the PPS edge.
+	double freqOffset;								//!< The frequency offset of the active clock after the PPS edge.
+	double timeCorrection;							//!< The time correction of the active controller.
+	bool isLocked;									//!< "true" if the active controller is controlling at \b HARD_LIMIT_1.
+	bool isRestart;									//!< "true" if the active controller restarts after the PPS edge.
+};
+
 /*
  * Struct for program-wide global variables.
  */
@@ -152,35 +547,42 @@ struct G {
 
 	bool isVerbose;									//!< Enables continuous printing of PPS-Client status params when "true".
 
-	bool configWasRead;								//!< True if pps-client.conf was read at least once.
-
 	unsigned int seq_num;							//!< Advancing count of the number of PPS interrupt timings that have been received.
 
-	bool isControlling;								//!< Set "true" by \b getAcquireState() when the control loop can begin to control the system clock frequency.
-	unsigned int activeCount;						//!< Advancing count of controller cycles once \b G.isControlling is "true".
+	bool isControlling;								//!< Copied from the controller. "true" when the controller is controlling the system clock frequency.
+	bool doFastAcquire;								//!< Enables \b fastAcquire() on startup and restart. Set from pps-client.conf.
+	bool doKalman;									//!< Selects the Kalman controller in place of the proportional-integral controller. Set from pps-client.conf.
+	unsigned int activeCount;						//!< Copied from the controller. Advancing count of controller cycles once \b G.isControlling is "true".
 
 	bool interruptReceived;							//!< Set "true" when \b makeTimeCorrection() processes an interrupt time from the PPS-Client device driver.
 	bool interruptLost;								//!< Set "true" when a PPS interrupt time fails to be received.
 	int interruptLossCount;							//!< Records the number of consecutive lost PPS interrupt times.
 
-	struct timeval t;								//!< Time of system response to the PPS interrupt. Received from the PPS-Client device driver.
-	int interruptTime;								//!< Fractional second part of \b G.t received from PPS-Client device driver.
+	struct timespec t;								//!< Time of system response to the PPS interrupt. Received from the PPS-Client device driver.
+	double interruptTime;							//!< Fractional second part of \b G.t in microseconds at nanosecond resolution.
 
-	int tm[6];										//!< Returns the interrupt calibration reception and response times from the PPS-Client device driver.
+	int64_t tm[3];									//!< Returns the PPS and calibration interrupt times in nanoseconds from the PPS-Client device driver.
+	int64_t ppsRawTime;								//!< Raw monotonic time in nanoseconds of the PPS edge being processed. Zero if not available.
+	uint32_t ppsSeq;									//!< Sequence number of the last PPS record read from the driver.
+	uint32_t ppsOverruns;							//!< Count of PPS records overwritten in the driver ring before they were read.
+	uint32_t calibSeq;								//!< Sequence number of the last calibration record read from the driver.
+	unsigned int ppsLateCount;						//!< Count of PPS records read from the driver after a newer record had arrived.
 
 	int t_now;										//!< Whole seconds of current time reported by \b gettimeofday().
 	int t_count;										//!< Whole seconds counted at the time of \b G.t_now.
 	double t_mono_now;								//!< Current monotonic count of passing seconds
 	double t_mono_last;								//!< Last recorded monotonic count used to determine a lost PPS update
 
-	int intrptDelay;									//!< Value of the interrupt delay calibration measurement received from the PPS-Client device driver.
-	int intrptError;									//!< Set equal to "intrptDelay - sysDelay" in \b getInterruptDelay().
+	double intrptDelay;								//!< Value of the interrupt delay calibration measurement received from the PPS-Client device driver.
+	double intrptError;									//!< Set equal to "intrptDelay - sysDelay" in \b getInterruptDelay().
 	unsigned int intrptCount;						//!< Advancing count of intrptErrorDistrib[] entries made by \b detectDelayPeak().
-	double delayMedian;								//!< Median of \b G.intrptDelay values calculated in \b getInterruptDelay().
+	double delayMedian;								//!< Median of the last \b G.delayWindow \b G.intrptDelay values calculated in \b processInterruptDelay().
+	int delayWindow;									//!< Count of \b G.intrptDelay values in \b G.delaySamples. Set from pps-client.conf.
+	struct slidingMedian delaySamples;				//!< The most recent \b G.intrptDelay values.
 	int	sysDelay;									//!< System time delay between reception and response to an external interrupt.
-													//!< Calculated as the one-minute median of \b G.intrptDelay values in \b getInterruptDelay().
+													//!< Set to \b G.delayMedian rounded to whole microseconds in \b processInterruptDelay().
 
-	int rawError;									//!< Set equal to \b G.interruptTime - \b G.sysDelay in \b makeTimeCorrection().
+	double rawError;									//!< Set equal to \b G.interruptTime - \b G.sysDelay in \b makeTimeCorrection().
 
 	int delayShift;									//!< Interval of a delay shift when one is detected by \b detectDelayPeak().
 	int sysDelayShift;								//!< Assigned from \b G.delayShift and subtracted from \b G.rawError in \b correctDelayPeak() when a delay shift occurs.
@@ -194,40 +596,24 @@ struct G {
 	int delayMinIdx;									//!< If a delay shift occurs, the minimum value preceding the delay peak in \b rawErrorDistrib[].
 	unsigned int ppsCount;							//!< Advancing count of \b G.rawErrorDistrib[] entries made by \b detectDelayPeak().
 
-	int nIntrptDelaySpikes;
-
-	int noiseLevel;									//!< PPS time delay value beyond which a delay is defined to be a delay spike.
-	int nDelaySpikes;								//!< Current count of continuous delay spikes made by \b detectDelaySpike().
-	bool isDelaySpike;								//!< Set "true" by \b detectDelaySpike() when \b G.rawError exceeds \b G.noiseLevel.
-
-	double slewAccum;								//!< Accumulates \b G.rawError in \b getTimeSlew() and is used to determine \b G.avgSlew.
-	int slewAccum_cnt;								//!< Count of the number of times \b G.rawError has been summed into \b G.slewAccum.
-	double avgSlew;									//!< Average slew value determined by \b getTimeSlew() from the average of \b G.slewAccum each time \b G.slewAccum_cnt reaches \b SLEW_LEN.
-	bool slewIsLow;									//!< Set to "true" in \b getAcquireState() when \b G.avgSlew is less than \b SLEW_MAX. This is a precondition for \b getAcquireState() to set \b G.isControlling to "true".
-
-	int zeroError;									//!< The controller error resulting from removing jitter noise from \b G.rawError in \b removeNoise().
-	int hardLimit;									//!< An adaptive limit value determined by \b setHardLimit() and applied to \b G.rawError by \b clampJitter() as the final noise reduction step to generate \b G.zeroError.
-	int invProportionalGain;							//!< Controller proportional gain configured inversely to use as an int divisor.
-	int timeCorrection;								//!< Time correction value constructed in \b makeTimeCorrection() by dividing \b G.zeroError by \b G.invProportionalGain.
-	struct timex t3;									//!< Passes \b G.timeCorrection to the system function \b adjtimex() in \b makeTimeCorrection().
-
-	double avgCorrection;							//!< A one-minute rolling average of \b G.timeCorrection values generated by \b getAverageCorrection().
-	int correctionFifo[OFFSETFIFO_LEN];				//!< Contains the \b G.timeCorrection values from over the previous 60 seconds.
-	int correctionFifoCount;							//!< Signals that \b G.correctionFifo contains a full count of \b G.timeCorrection values.
-	int correctionAccum;								//!< Accumulates \b G.timeCorrection values from \b G.correctionFifo in \b getAverageCorrection() in order to generate \b G.avgCorrection.
-
-	double integral[NUM_INTEGRALS];					//!< Array of integrals constructed by \b makeAverageIntegral().
-	double avgIntegral;								//!< One-minute average of the integrals in \b G.integral[].
-	int integralCount;								//!< Counts the integrals formed over the last 10 controller cycles and signals when all integrals in \b G.integral have been constructed.
+	int noiseLevel;									//!< Copied from the controller. PPS time delay value beyond which a delay is defined to be a delay spike.
+	bool isDelaySpike;								//!< Copied from the controller. "true" if the current PPS edge is a delay spike.
+	double avgSlew;									//!< Copied from the controller. Average of \b G.rawError over the last \b SLEW_LEN seconds.
 
-	int correctionFifo_idx;							//!< Advances \b G.correctionFifo on each controller cycle in \b integralIsReady() which returns "true" every 60 controller cycles.
+	double zeroError;								//!< Copied from the controller. \b G.rawError with jitter removed by \b removeNoise().
+	int hardLimit;									//!< Copied from the controller. The adaptive limit applied to \b G.rawError by \b clampJitter().
+	double timeCorrection;							//!< Copied from the controller. The time correction made at the current PPS edge.
+	double slewResidual;								//!< Copied from the controller. Sub-microsecond part of \b G.timeCorrection not yet applied by \b adjtimex().
+	struct timex t3;									//!< Passes the initial frequency offset to the system function \b adjtimex().
 
-	double integralGain;								//!< Current controller integral gain.
-	double integralTimeCorrection;					//!< Integral or average integral of \b G.timeCorrection returned by \b getIntegral();
-	double freqOffset;								//!< System clock frequency correction calculated as \b G.integralTimeCorrection * \b G.integralGain.
+	double avgCorrection;							//!< Copied from the controller. A one-minute rolling average of \b G.timeCorrection values.
+	double freqOffset;								//!< Copied from the controller. The system clock frequency correction in ppm.
 
 	int consensusTimeError;							//!< Consensus value of whole-second time corrections for DST or leap seconds from Internet SNTP servers.
 
+	long hotPathMax;									//!< Worst-case time in nanoseconds from the wakeup on a PPS event to the end of the controller cycle over the current hour.
+	unsigned int hotPathCount;						//!< Count of controller cycles included in \b G.hotPathMax.
+
 	char linuxVersion[20];							//!< Array for recording the Linux version.
 	/**
 	 * @cond FILES
@@ -236,7 +622,6 @@ struct G {
 	char msgbuf[MSGBUF_SZ];
 	char savebuf[MSGBUF_SZ];
 	char strbuf[STRBUF_SZ];
-	char *configVals[MAX_CONFIGS];
 
 	bool exit_requested;
 	bool exitOnLostPPS;
@@ -250,23 +635,10 @@ struct G {
 
 	int serialTimeError;
 
-	int recIndex;
-	int recIndex2;
-
 	time_t pps_t_sec;
-	int pps_t_usec;
+	long pps_t_nsec;
 
-	unsigned int config_select;
-
-	int intervalCount;
-
-	int jitter;
-
-	int seq_numRec[SECS_PER_10_MIN];
-
-	double lastFreqOffset;
-	double freqOffsetSum;
-	double freqOffsetDiff[FREQDIFF_INTRVL];
+	double jitter;
 
 	unsigned int lastActiveCount;
 
@@ -286,15 +658,13 @@ struct G {
 
 	int errorDistrib[ERROR_DISTRIB_LEN];
 	int errorCount;
+
+	struct hdrHist jitterHist;
+	struct hdrHist errorHist;
+	struct hdrHist intrptHist;
 	int queryCount;
 
-	double freqAllanDev[NUM_5_MIN_INTERVALS];
-	double freqOffsetRec[NUM_5_MIN_INTERVALS];
-	double freqOffsetRec2[SECS_PER_10_MIN];
-	__time_t timestampRec[NUM_5_MIN_INTERVALS];
-	int offsetRec[SECS_PER_10_MIN];
-	char serialPort[50];
-	char configBuf[CONFIG_FILE_SZ];
+	char serialPort[CONFIG_STR_SZ];
 	/**
 	 * @endcond
 	 */
@@ -324,7 +694,7 @@ struct saveFileData {
 	void *array;					//!< Array to hold data to be saved
 	const char *filename;		//!< Filename to save data
 	int arrayLen;				//!< Length of the array in array units
-	int arrayType;				//!< Array type: 1 - int, 2 - double
+	int arrayType;				//!< Array type: 1 - int, 2 - double, 3 - frequency vars, 4 - offsets, 5 - struct hdrHist, 6 - stability, 7 - shadow ranking
 	int arrayZero;				//!< Array index of data zero.
 };
 
@@ -340,9 +710,9 @@ void writeToLog(char *);
 pid_t getChildPID(void);
 int createPIDfile(void);
 int readConfigFile(void);
-void writeOffsets(void);
-void writeTimestamp(double);
-void writeSysDelay(void);
+int openSharedState(void);
+void closeSharedState(void);
+void writeSharedState(void);
 int bufferStateParams(void);
 int disableNTP(void);
 int enableNTP(void);
@@ -350,27 +720,108 @@ int open_logerr(const char*, int);
 int read_logerr(int fd, char *, int, const char *);
 void writeInterruptDistribFile(void);
 int processFiles(void);
-bool isEnabled(int);
-bool isDisabled(int);
 void writeSysdelayDistribFile(void);
 void showStatusEachSecond(void);
 struct timespec setSyncDelay(int, int);
 int accessDaemon(int argc, char *argv[]);
 int driver_load(int, int, int);
 void driver_unload(void);
-void buildErrorDistrib(int);
-void buildJitterDistrib(int);
+void buildErrorDistrib(double);
+void buildJitterDistrib(double);
 void TERMhandler(int);
 void HUPhandler(int);
-void buildInterruptDistrib(int);
+void buildInterruptDistrib(double);
 void buildInterruptJitterDistrib(int);
 void buildSysDelayDistrib(int);
-void recordFrequencyVars(void);
-void recordOffsets(int timeCorrection);
-bool configHasValue(int, char *[], void *);
+void recordOffsets(double timeCorrection, bool isFreqSet);
+void saveHistoryRec(const struct historyRec *rec);
+const struct ppsConfig *getConfig(void);
+void applyConfig(const struct ppsConfig *cfg);
+unsigned int applyReloadedConfig(void);
+unsigned int getConfigGen(void);
+int getLogMaxSize(void);
+int getLogCount(void);
+int openConfigWatch(void);
+bool configFileChanged(int);
 int getDriverGPIOvals(void);
 void writeToLogNoTimestamp(char *);
 int getTimeErrorOverSerial(int *);
+void initialize(bool);
+void setDelayTrackers(void);
+int setTimeFromPPSread(ssize_t, bool, int);
+void processInterruptDelay(double);
+int checkPPSInterrupt(int);
+void initSimClock(struct simClock *sc);
+void advanceSimClock(struct simClock *sc);
+long getSimEdgeSecs(struct simClock *sc, long sec, long nsec);
+int64_t setSimEdge(struct simClock *sc, long sec, long nsec);
+int replayTrace(int argc, char *argv[]);
+int captureTrace(int argc, char *argv[]);
+int startIOWorker(void);
+void stopIOWorker(void);
+bool isControlThread(void);
+struct ioRecord *getIORecord(int type);
+void postIORecord(void);
+int postIORequest(int type, const char *msg);
+unsigned int getIODropCount(void);
+void beginCopy(unsigned int *seq);
+void endCopy(unsigned int *seq);
+int readCopy(const unsigned int *seq, const void *src, void *dst, size_t len);
+void lockStatusBuf(void);
+void unlockStatusBuf(void);
+void appendToLog(const char *msg, time_t t, bool timestamp);
+void bufferLogMsg(const char *msg, time_t t, bool timestamp);
+bool logWorkerIsRunning(void);
+void rotateLogFiles(void);
+int writeStateParams(const struct stateParams *sp);
+int writeFileAtomic(const char *filename, const char *buf, int len);
+void histRecord(struct hdrHist *h, double usec);
+void histMerge(struct hdrHist *dst, const struct hdrHist *src);
+double getHistValue(int idx);
+double histPercentile(const struct hdrHist *h, double pct);
+int writeHistFile(const struct hdrHist *h, const char *filename);
+const struct ppsShm *getSharedState(void);
+int startMetricsExporter(void);
+void stopMetricsExporter(void);
+int startControlServer(void);
+void stopControlServer(void);
+bool takeSaveRequest(char *label, char *filename, int *fd);
+void replySaveRequest(int fd, int status, const char *msg);
+void publishStatus(const char *status);
+int sendControlRequest(const struct ctlMsg *msg, int len, int timeout);
+int openHistory(void);
+void closeHistory(void);
+void appendHistory(const struct historyRec *rec);
+int64_t findHistory(int64_t t);
+int readHistory(int64_t idx, struct historyRec *buf, int n);
+void recordStability(const struct historyRec *rec);
+int getStabilityTau(int i);
+uint64_t getStability(int i, double *adev, double *mdev, double *tdev);
+int writeStabilityFile(const char *filename);
+void resetKalman(struct kalmanState *k);
+double getKalmanCorrection(struct kalmanState *k, const struct controllerParams *p, double rawError, double t, double *freqStep);
+void setKalmanSlew(struct kalmanState *k, double slew);
+void initSlidingMedian(struct slidingMedian *m, int window);
+void addSlidingMedian(struct slidingMedian *m, double value);
+double getSlidingMedian(const struct slidingMedian *m);
+int startPPSApi(const char *path);
+void stopPPSApi(void);
+const struct pps_ring *getPPSApiRing(void);
+void setKalmanNoise(struct kalmanState *k, const struct hdrHist *jitterHist);
+void setControllerDefaults(struct controllerParams *p);
+void setNoiseLevel(struct controller *c, int sysDelay);
+void initController(struct controller *c, const struct controllerParams *p, int sysDelay);
+bool makeControllerCorrection(struct controller *c, double rawError, int sysDelay, struct clockBackend *clock);
+bool controllerNeedsRestart(const struct controller *c);
+double clampJitter(struct controller *c, double rawError);
+void controllerLog(struct controller *c);
+int parseShadowParams(const char *spec, struct controllerParams *p);
+int initShadows(const char *specs[], int n);
+void postShadowInput(const struct shadowInput *in);
+int writeShadowFile(const char *filename);
+void printShadowRanking(void);
+int startShadowWorker(void);
+void stopShadowWorker(void);
 /**
  * @endcond
  */
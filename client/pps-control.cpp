@@ -0,0 +1,423 @@
+/**
+ * @file pps-control.cpp
+ * @brief This file contains the control socket through which the command line interface of PPS-Client talks to the daemon.
+ *
+ * The daemon listens on the Unix domain socket CTL_SOCKET. Each
+ * request and reply is one struct ctlMsg sent as one SOCK_SEQPACKET
+ * packet, so no framing is needed. A connection carries one of:
+ *
+ * - CTL_QUERY: The server thread replies with the current controller
+ *   params read from the shared memory snapshot and closes.
+ * - CTL_SAVE: The request is passed to the I/O worker, which saves
+ *   the data with the other files, replies with the result and closes.
+ * - CTL_SUBSCRIBE: The connection is kept. Each second the I/O worker
+ *   sends the status messages for that second to every subscriber as
+ *   one CTL_STATUS message. A subscriber that is not reading loses
+ *   messages rather than delaying the others.
+ *
+ * Save requests are accepted only from root, since they write files.
+ */
+
+/*
+ * Copyright (C) 2016-2018  Raymond S. Connell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "../client/pps-client.h"
+extern struct G g;
+
+/**
+ * Local file-scope shared variables.
+ */
+static struct controlLocalVars {
+	pthread_t serverThread;						//!< The control server thread.
+	bool isRunning;								//!< Set "false" to stop the server thread.
+	int listenFd;								//!< The listening socket fd or -1.
+	pthread_mutex_t subLock;					//!< Protects subFds and nSubs.
+	int subFds[CTL_MAX_SUBSCRIBERS];			//!< Connections subscribed to status messages.
+	int nSubs;									//!< Number of subscribers.
+	pthread_mutex_t saveLock;					//!< Protects the pending save request.
+	int saveFd;									//!< Connection of the pending save request or -1.
+	char saveLabel[CTL_LABEL_SZ];				//!< Data label of the pending save request.
+	char saveFilename[CTL_PATH_SZ];				//!< Filename of the pending save request.
+	char logbuf[LOGBUF_SZ];						//!< Used in place of G.logbuf by the server thread.
+	struct ctlMsg statusMsg;					//!< The status message sent to subscribers.
+} f = {0, false, -1, PTHREAD_MUTEX_INITIALIZER, {0}, 0, PTHREAD_MUTEX_INITIALIZER, -1};	//!< Local file-scope shared variables.
+
+/**
+ * Sends a reply and closes the connection.
+ *
+ * @param[in] fd The connection.
+ * @param[in] msg The reply.
+ * @param[in] len The length of the reply.
+ */
+void sendReply(int fd, const struct ctlMsg *msg, int len){
+	int rv = send(fd, msg, len, MSG_NOSIGNAL);			// A client that has gone must not raise SIGPIPE.
+	if (rv == -1){
+		;
+	}
+	close(fd);
+}
+
+/**
+ * Replies to a CTL_QUERY request with the controller
+ * params from the shared memory snapshot.
+ *
+ * @param[in] fd The connection.
+ */
+void replyQuery(int fd){
+	struct ctlMsg msg;
+	struct ppsShm snap;
+
+	memset(&msg, 0, sizeof(struct ctlMsg));
+	msg.type = CTL_REPLY;
+
+	const struct ppsShm *shm = getSharedState();
+	if (shm == NULL || readPPSshm(shm, &snap) == -1){
+		msg.status = -1;
+	}
+	else {
+		msg.params.seq_num = snap.seq_num;
+		msg.params.hardLimit = snap.hardLimit;
+		msg.params.sysDelay = snap.sysDelay;
+		msg.params.isControlling = snap.isControlling;
+		msg.params.interruptLossCount = snap.interruptLossCount;
+		msg.params.jitter = snap.jitter;
+		msg.params.freqOffset = snap.freqOffset;
+		msg.params.avgCorrection = snap.avgCorrection;
+		msg.params.jitterP99 = snap.jitterHist.p99;
+	}
+	sendReply(fd, &msg, offsetof(struct ctlMsg, params) + sizeof(struct ctlParams));
+}
+
+/**
+ * Replies to a request with a status and a text
+ * message and closes the connection.
+ *
+ * @param[in] fd The connection.
+ * @param[in] status 0 on success, else -1.
+ * @param[in] text The message.
+ */
+void replySaveRequest(int fd, int status, const char *text){
+	struct ctlMsg msg;
+
+	msg.type = CTL_REPLY;
+	msg.status = status;
+	strncpy(msg.text, text, MSGBUF_SZ - 1);
+	msg.text[MSGBUF_SZ - 1] = '\0';
+	sendReply(fd, &msg, offsetof(struct ctlMsg, text) + strlen(msg.text) + 1);
+}
+
+/**
+ * Passes a CTL_SAVE request to the I/O worker, which
+ * replies when the data has been saved.
+ *
+ * @param[in] fd The connection.
+ * @param[in] msg The request.
+ */
+void queueSaveRequest(int fd, struct ctlMsg *msg){
+	struct ucred cred;
+	socklen_t credLen = sizeof(struct ucred);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &credLen) == -1 || cred.uid != 0){
+		replySaveRequest(fd, -1, "Save requests require root.\n");
+		return;
+	}
+
+	msg->save.label[CTL_LABEL_SZ - 1] = '\0';
+	msg->save.filename[CTL_PATH_SZ - 1] = '\0';
+
+	pthread_mutex_lock(&f.saveLock);
+	if (f.saveFd != -1){
+		pthread_mutex_unlock(&f.saveLock);
+		replySaveRequest(fd, -1, "A save request is already pending.\n");
+		return;
+	}
+	strcpy(f.saveLabel, msg->save.label);
+	strcpy(f.saveFilename, msg->save.filename);
+	f.saveFd = fd;
+	pthread_mutex_unlock(&f.saveLock);
+}
+
+/**
+ * Takes the pending save request, if any. The caller
+ * replies with replySaveRequest() when it has been
+ * processed.
+ *
+ * @param[out] label The data label.
+ * @param[out] filename The filename or an empty string.
+ * @param[out] fd The connection to reply on.
+ *
+ * @returns "true" if a save request was pending, else
+ * "false".
+ */
+bool takeSaveRequest(char *label, char *filename, int *fd){
+	bool isPending = false;
+
+	pthread_mutex_lock(&f.saveLock);
+	if (f.saveFd != -1){
+		strcpy(label, f.saveLabel);
+		strcpy(filename, f.saveFilename);
+		*fd = f.saveFd;
+		f.saveFd = -1;
+		isPending = true;
+	}
+	pthread_mutex_unlock(&f.saveLock);
+	return isPending;
+}
+
+/**
+ * Adds a connection to the status subscribers.
+ *
+ * @param[in] fd The connection.
+ */
+void addSubscriber(int fd){
+	struct ctlMsg msg;
+
+	shutdown(fd, SHUT_RD);
+
+	pthread_mutex_lock(&f.subLock);
+	if (f.nSubs < CTL_MAX_SUBSCRIBERS){
+		f.subFds[f.nSubs] = fd;
+		f.nSubs += 1;
+		pthread_mutex_unlock(&f.subLock);
+		return;
+	}
+	pthread_mutex_unlock(&f.subLock);
+
+	msg.type = CTL_REPLY;
+	msg.status = -1;
+	strcpy(msg.text, "Too many status subscribers.\n");
+	sendReply(fd, &msg, offsetof(struct ctlMsg, text) + strlen(msg.text) + 1);
+}
+
+/**
+ * Sends the status messages for one second to all
+ * subscribers. Called by the I/O worker.
+ *
+ * The message is formatted once and sent to each
+ * subscriber without blocking. If a subscriber's
+ * socket buffer is full the message is dropped for
+ * that subscriber. A subscriber that has closed its
+ * connection is removed.
+ *
+ * @param[in] status The status messages.
+ */
+void publishStatus(const char *status){
+
+	pthread_mutex_lock(&f.subLock);
+	if (f.nSubs == 0){
+		pthread_mutex_unlock(&f.subLock);
+		return;
+	}
+
+	f.statusMsg.type = CTL_STATUS;
+	f.statusMsg.status = 0;
+	strncpy(f.statusMsg.text, status, MSGBUF_SZ - 1);
+	f.statusMsg.text[MSGBUF_SZ - 1] = '\0';
+	int len = offsetof(struct ctlMsg, text) + strlen(f.statusMsg.text) + 1;
+
+	int i = 0;
+	while (i < f.nSubs){
+		int rv = send(f.subFds[i], &f.statusMsg, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (rv == -1 && errno != EAGAIN && errno != EWOULDBLOCK){
+			close(f.subFds[i]);
+			f.nSubs -= 1;
+			f.subFds[i] = f.subFds[f.nSubs];
+			continue;
+		}
+		i += 1;
+	}
+	pthread_mutex_unlock(&f.subLock);
+}
+
+/**
+ * Reads a request from a new connection and
+ * dispatches it.
+ *
+ * @param[in] fd The connection.
+ */
+void handleRequest(int fd){
+	struct timeval tv = {0, 200000};
+	struct ctlMsg msg;
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	memset(&msg, 0, sizeof(struct ctlMsg));
+	int rv = recv(fd, &msg, sizeof(struct ctlMsg), 0);
+	if (rv < (int)offsetof(struct ctlMsg, text)){
+		close(fd);
+		return;
+	}
+
+	switch (msg.type){
+	case CTL_QUERY:
+		replyQuery(fd);
+		break;
+	case CTL_SAVE:
+		queueSaveRequest(fd, &msg);
+		break;
+	case CTL_SUBSCRIBE:
+		addSubscriber(fd);
+		break;
+	default:
+		replySaveRequest(fd, -1, "Request not recognized.\n");
+		break;
+	}
+}
+
+/**
+ * The control server thread. Accepts connections
+ * until stopControlServer() is called.
+ */
+void *controlServer(void *){
+	struct sched_param param;
+	struct pollfd fds[1];
+
+	param.sched_priority = 0;
+	pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+
+	fds[0].fd = f.listenFd;
+	fds[0].events = POLLIN;
+
+	while (__atomic_load_n(&f.isRunning, __ATOMIC_ACQUIRE)){
+		int rv = poll(fds, 1, 1000);					// Wakes each second to check for stop.
+		if (rv <= 0 || ! (fds[0].revents & POLLIN)){
+			continue;
+		}
+
+		int fd = accept4(f.listenFd, NULL, NULL, SOCK_CLOEXEC);
+		if (fd != -1){
+			handleRequest(fd);
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Creates the listening socket and starts the
+ * control server thread.
+ *
+ * @returns 0 on success, else -1 on error.
+ */
+int startControlServer(void){
+	struct sockaddr_un addr;
+
+	f.listenFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (f.listenFd == -1){
+		sprintf(f.logbuf, "startControlServer() socket() failed with msg: %s\n", strerror(errno));
+		writeToLog(f.logbuf);
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(struct sockaddr_un));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, CTL_SOCKET, sizeof(addr.sun_path) - 1);
+
+	unlink(CTL_SOCKET);
+	if (bind(f.listenFd, (struct sockaddr *)&addr, sizeof(struct sockaddr_un)) == -1 || listen(f.listenFd, 4) == -1){
+		sprintf(f.logbuf, "startControlServer() Unable to listen on %s. Error: %s\n", CTL_SOCKET, strerror(errno));
+		writeToLog(f.logbuf);
+		close(f.listenFd);
+		f.listenFd = -1;
+		return -1;
+	}
+	chmod(CTL_SOCKET, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+
+	f.isRunning = true;
+	int rv = pthread_create(&f.serverThread, NULL, &controlServer, NULL);
+	if (rv != 0){
+		sprintf(f.logbuf, "startControlServer() pthread_create() failed with msg: %s\n", strerror(rv));
+		writeToLog(f.logbuf);
+		f.isRunning = false;
+		stopControlServer();
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Stops the control server thread, closes all
+ * connections and removes the socket.
+ */
+void stopControlServer(void){
+	if (f.isRunning){
+		__atomic_store_n(&f.isRunning, false, __ATOMIC_RELEASE);
+		pthread_join(f.serverThread, NULL);
+	}
+
+	pthread_mutex_lock(&f.subLock);
+	for (int i = 0; i < f.nSubs; i++){
+		close(f.subFds[i]);
+	}
+	f.nSubs = 0;
+	pthread_mutex_unlock(&f.subLock);
+
+	pthread_mutex_lock(&f.saveLock);
+	if (f.saveFd != -1){
+		close(f.saveFd);
+		f.saveFd = -1;
+	}
+	pthread_mutex_unlock(&f.saveLock);
+
+	if (f.listenFd != -1){
+		close(f.listenFd);
+		unlink(CTL_SOCKET);
+		f.listenFd = -1;
+	}
+}
+
+/**
+ * From the command line, connects to the control
+ * socket of the daemon and sends a request.
+ *
+ * @param[in] msg The request.
+ * @param[in] len The length of the request.
+ * @param[in] timeout Seconds to wait for each message
+ * received on the connection.
+ *
+ * @returns The connection on which to receive the
+ * reply, else -1 on error.
+ */
+int sendControlRequest(const struct ctlMsg *msg, int len, int timeout){
+	struct sockaddr_un addr;
+	struct timeval tv = {timeout, 0};
+
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd == -1){
+		printf("sendControlRequest() socket() failed with msg: %s\n", strerror(errno));
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(struct sockaddr_un));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, CTL_SOCKET, sizeof(addr.sun_path) - 1);
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(struct sockaddr_un)) == -1){
+		printf("Unable to connect to %s. Error: %s\n", CTL_SOCKET, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	if (send(fd, msg, len, MSG_NOSIGNAL) == -1){
+		printf("sendControlRequest() send() failed with msg: %s\n", strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
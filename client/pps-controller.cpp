@@ -0,0 +1,930 @@
+/**
+ * @file pps-controller.cpp
+ * @brief This file contains the controller that disciplines a clock to the PPS signal.
+ *
+ * All of the state of a controller is held in a struct controller
+ * and the clock that it corrects is passed to it as a struct
+ * clockBackend, which is both the time source from which the
+ * controller reads monotonic time and the actuator through which
+ * it makes its adjtimex() corrections. So a controller can run on
+ * the system clock, on the simulated clock of a replay or beside
+ * another controller without sharing any state.
+ *
+ * The daemon runs one controller on the system clock, passing it
+ * the time error of each PPS edge with makeControllerCorrection(),
+ * and copies the controller outputs to G for the status display,
+ * the saved files and the shared memory segment.
+ */
+
+/*
+ * Copyright (C) 2016-2018  Raymond S. Connell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "../client/pps-client.h"
+
+/**
+ * Sets the default controller settings.
+ *
+ * @param[out] p The settings.
+ */
+void setControllerDefaults(struct controllerParams *p){
+	memset(p, 0, sizeof(struct controllerParams));
+
+	p->doFastAcquire = true;
+	p->doLog = true;
+	p->invGain0 = INV_GAIN_0;
+	p->integralGain = INTEGRAL_GAIN;
+	p->noiseFactor = NOISE_FACTOR;
+	p->spikeSigmas = SPIKE_SIGMAS;
+	p->slewMax = SLEW_MAX;
+	p->maxSpikes = MAX_SPIKES;
+	p->hardLimitShift = HARD_LIMIT_SHIFT;
+	p->kalmanQPhase = KALMAN_Q_PHASE;
+	p->kalmanQFreq = KALMAN_Q_FREQ;
+}
+
+/**
+ * Writes the message in the controller log buffer
+ * to the log file unless logging is disabled in
+ * the controller settings, as it is for a shadow
+ * controller.
+ *
+ * @param[in] c The controller.
+ */
+void controllerLog(struct controller *c){
+	if (c->params.doLog){
+		writeToLog(c->logbuf);
+	}
+}
+
+/**
+ * Updates the estimates of the median and the median
+ * absolute deviation (MAD) of recent rawError values
+ * with one value in constant time.
+ *
+ * Each second the median estimate moves toward the
+ * value by NOISE_FLOOR_RATE times the MAD estimate. For
+ * a value below the median, the MAD estimate grows or
+ * shrinks by the factor 1 + NOISE_FLOOR_RATE as the
+ * deviation of the value from the median is above or
+ * below it. The steps up and down balance where half of
+ * the values lie on each side, so the estimates settle
+ * at the median and MAD of the recent values and follow
+ * a change in the noise within about a minute. Since
+ * delay spikes are late, taking the MAD from the values
+ * below the median keeps them from widening it, and a
+ * large delay moves the median no further than a small
+ * one.
+ *
+ * @param[in,out] n The estimates.
+ * @param[in] rawError The value in microseconds.
+ */
+void updateNoiseFloor(struct noiseFloor *n, double rawError){
+	if (! n->isStarted){
+		n->isStarted = true;
+		n->median = rawError;
+		n->mad = NOISE_FLOOR_MAD_INIT;
+		return;
+	}
+
+	double step = NOISE_FLOOR_RATE * n->mad;
+	double diff = rawError - n->median;
+	if (diff > step){
+		diff = step;
+	}
+	else if (diff < -step){
+		diff = -step;
+	}
+	n->median += diff;
+
+	if (rawError < n->median){
+		double dev = n->median - rawError;
+		if (dev > n->mad){
+			n->mad *= 1.0 + NOISE_FLOOR_RATE;
+		}
+		else if (dev < n->mad){
+			n->mad /= 1.0 + NOISE_FLOOR_RATE;
+		}
+	}
+	if (n->mad < NOISE_FLOOR_MAD_MIN){
+		n->mad = NOISE_FLOOR_MAD_MIN;
+	}
+}
+
+/**
+ * Sets the rawError above which a PPS delay is a delay
+ * spike to spikeSigmas robust standard deviations (the
+ * MAD scaled by MAD_TO_SIGMA) above the median of the
+ * recent rawError values, but not below NOISE_LEVEL_MIN.
+ * If spikeSigmas is zero or no values have been seen,
+ * noiseLevel is used.
+ *
+ * @param[in,out] c The controller.
+ */
+void setSpikeLevel(struct controller *c){
+	const struct noiseFloor *n = &c->noiseFloor;
+
+	if (c->params.spikeSigmas <= 0.0 || ! n->isStarted){
+		c->spikeLevel = c->noiseLevel;
+		return;
+	}
+
+	c->spikeLevel = n->median + c->params.spikeSigmas * MAD_TO_SIGMA * n->mad;
+	if (c->spikeLevel < NOISE_LEVEL_MIN){
+		c->spikeLevel = NOISE_LEVEL_MIN;
+	}
+}
+
+/**
+ * Sets the noise level above which a PPS delay is
+ * a delay spike to be proportional to sysDelay by
+ * the noiseFactor setting.
+ *
+ * @param[in,out] c The controller.
+ * @param[in] sysDelay The interrupt delay in microseconds.
+ */
+void setNoiseLevel(struct controller *c, int sysDelay){
+	c->noiseLevel = (int)round((double)sysDelay * c->params.noiseFactor) + 1;
+	if (c->noiseLevel < NOISE_LEVEL_MIN){
+		c->noiseLevel = NOISE_LEVEL_MIN;
+	}
+	setSpikeLevel(c);
+}
+
+/**
+ * Sets a controller to its initial state at startup
+ * or restart.
+ *
+ * @param[out] c The controller.
+ * @param[in] p The controller settings.
+ * @param[in] sysDelay The interrupt delay in microseconds.
+ */
+void initController(struct controller *c, const struct controllerParams *p, int sysDelay){
+	memset(c, 0, sizeof(struct controller));
+
+	c->params = *p;
+	c->sysDelay = sysDelay;
+	c->invProportionalGain = c->params.invGain0;
+	c->hardLimit = HARD_LIMIT_NONE;
+	setNoiseLevel(c, sysDelay);
+}
+
+/**
+ * Returns true when the control loop can begin to
+ * control the system clock frequency. At program
+ * start only the time slew is adjusted because the
+ * drift can be too large for it to be practical to
+ * adjust the system clock frequency to correct for
+ * it. The slewMax setting, which defaults to SLEW_MAX,
+ * sets a reasonable limit below which
+ * frequency offset can also be adjusted to correct
+ * system time.
+ *
+ * Consequently, once the drift is within slewMax
+ * microseconds of zero and the controller has been
+ * running for at least 60 seconds (time selected for
+ * convenience), this function returns "true" causing
+ * the controller to begin to also adjust the system
+ * clock frequency offset.
+ *
+ * If fastAcquire() has already started the controller
+ * this function returns "true" immediately.
+ *
+ * @returns "true" when the control loop can begin to
+ * control the system clock frequency. Else "false".
+ */
+bool getAcquireState(struct controller *c){
+
+	if (c->isFastAcquired){
+		return true;
+	}
+
+	if (! c->slewIsLow && c->slewAccum_cnt == 0
+			&& fabs(c->avgSlew) < c->params.slewMax){			// slewMax only needs to be low enough
+		c->slewIsLow = true;									// that the controller can begin locking
+	}														// at limitValue == HARD_LIMIT_NONE
+
+	return (c->slewIsLow && c->seq_num >= SECS_PER_MINUTE);		// The c->seq_num requirement sets a limit on the
+}															// length of time to run the Type 1 controller
+															// that initially pushes avgSlew below slewMax.
+
+/**
+ * Steps the system time by offset microseconds with
+ * ADJ_SETOFFSET. Unlike the ADJ_OFFSET_SINGLESHOT time
+ * slew, the step is applied immediately and is not
+ * limited to about 500 microseconds each second.
+ *
+ * @param[in,out] c The controller.
+ * @param[in] clock The clock to step.
+ * @param[in] offset The time step in microseconds.
+ *
+ * @returns 0 on success else -1 on error.
+ */
+int stepClockOffset(struct controller *c, struct clockBackend *clock, double offset){
+	struct timex t;
+	memset(&t, 0, sizeof(struct timex));
+
+	long long nsecs = llround(offset * NSECS_PER_USEC);
+
+	t.modes = ADJ_SETOFFSET | ADJ_NANO;
+	t.time.tv_sec = nsecs / NSECS_PER_SEC;
+	t.time.tv_usec = nsecs % NSECS_PER_SEC;				// Nanoseconds with ADJ_NANO. Must not be negative.
+	if (t.time.tv_usec < 0){
+		t.time.tv_sec -= 1;
+		t.time.tv_usec += NSECS_PER_SEC;
+	}
+
+	if (clock->adjtimex(&t) == -1){
+		sprintf(c->logbuf, "stepClockOffset() adjtimex() failed with msg: %s\n", strerror(errno));
+		controllerLog(c);
+		return -1;
+	}
+
+	c->isClockStepped = true;
+	c->stepOffset += offset;
+	return 0;
+}
+
+/**
+ * Sets the controller integrals so that getIntegral()
+ * returns the current freqOffset. *
+ * @param[in,out] c The controller.
+ */
+void seedIntegrals(struct controller *c){
+	for (int i = 0; i < NUM_INTEGRALS; i++){
+		c->integral[i] = c->freqOffset / c->params.integralGain;
+	}
+	c->avgIntegral = c->integral[0];
+}
+
+/**
+ * Fits a straight line to n points by least squares.
+ *
+ * @param[in] x The x values.
+ * @param[in] y The y values.
+ * @param[in] n The count of points.
+ * @param[out] slope The slope of the line.
+ * @param[out] intercept The value of the line at x = 0.
+ *
+ * @returns The RMS residual of the fit.
+ */
+double fitLine(const double *x, const double *y, int n, double *slope, double *intercept){
+	double sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+	for (int i = 0; i < n; i++){
+		sx += x[i];
+		sy += y[i];
+		sxx += x[i] * x[i];
+		sxy += x[i] * y[i];
+	}
+	*slope = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+	*intercept = (sy - *slope * sx) / n;
+
+	double sumSq = 0.0;
+	for (int i = 0; i < n; i++){
+		double r = y[i] - (*intercept + *slope * x[i]);
+		sumSq += r * r;
+	}
+	return sqrt(sumSq / n);
+}
+
+/**
+ * Adds the free-running time of the current PPS edge,
+ * when the clock backend provides it, to the fit of
+ * the free-running clock frequency.
+ *
+ * The free-running clock is not affected by the time
+ * and frequency corrections made by the controller, so
+ * its time at each PPS edge less the whole PPS seconds
+ * since the first edge drifts at the frequency offset
+ * of the clock oscillator itself.
+ *
+ * @param[in,out] c The controller.
+ * @param[in] clock The clock backend.
+ */
+void addRawEdge(struct controller *c, struct clockBackend *clock){
+	if (clock->getEdgeRaw == NULL || clock->getEdgeRaw(&c->t_raw) == -1){
+		memset(&c->t_raw, 0, sizeof(struct timespec));
+		return;
+	}
+
+	if (c->rawCount == 0){
+		c->rawStart = c->t_raw;
+	}
+	else if (c->rawCount >= RAW_FIT_LEN){
+		return;
+	}
+
+	int64_t dt = (int64_t)(c->t_raw.tv_sec - c->rawStart.tv_sec) * NSECS_PER_SEC
+			+ (c->t_raw.tv_nsec - c->rawStart.tv_nsec);
+	int64_t secs = (dt + NSECS_PER_SEC / 2) / NSECS_PER_SEC;		// Nearest whole PPS second.
+
+	c->rawSecs[c->rawCount] = (double)secs;
+	c->rawOffset[c->rawCount] = (double)(dt - secs * NSECS_PER_SEC) / NSECS_PER_USEC;
+	c->rawCount += 1;
+}
+
+/**
+ * Sets the clock frequency offset to the frequency offset
+ * of the clock oscillator measured by the fit of the
+ * free-running clock and seeds the controller integrals
+ * from it, so that the controller does not have to find
+ * the frequency offset from its integrals over several
+ * minutes.
+ *
+ * Called by the standard startup once RAW_FIT_MIN PPS edges
+ * have been fitted, so that the time slew only has to remove
+ * the time offset, and again with up to RAW_FIT_LEN edges
+ * when it begins to control the clock frequency. Does nothing
+ * if the clock backend did not provide at least RAW_FIT_MIN
+ * free-running PPS edge times or if the fit residual exceeds
+ * ACQUIRE_MAX_RESIDUAL.
+ *
+ * @param[in,out] c The controller.
+ * @param[in] clock The clock to correct.
+ */
+void seedRawFrequency(struct controller *c, struct clockBackend *clock){
+	double slope, intercept;
+
+	if (c->rawCount < RAW_FIT_MIN){
+		return;
+	}
+
+	double residual = fitLine(c->rawSecs, c->rawOffset, c->rawCount, &slope, &intercept);	// Drift in ppm.
+	if (residual > ACQUIRE_MAX_RESIDUAL){
+		sprintf(c->logbuf, "seedRawFrequency() Fit residual %lf usec is too large. Frequency not seeded.\n", residual);
+		controllerLog(c);
+		return;
+	}
+	c->rawFreqOffset = -slope;
+
+	c->freqOffset = c->rawFreqOffset;
+	c->t3.modes = ADJ_FREQUENCY | ADJ_NANO;
+	c->t3.freq = (long)round(ADJTIMEX_SCALE * c->freqOffset);
+	clock->adjtimex(&c->t3);
+	c->isFreqSet = true;
+
+	seedIntegrals(c);
+
+	sprintf(c->logbuf, "seedRawFrequency() Seeded at seq_num %d. freqOffset: %lf ppm residual: %lf usec\n",
+			c->seq_num, c->freqOffset, residual);
+	controllerLog(c);
+}
+
+/**
+ * Replaces the slow startup of the controller with an
+ * acquisition phase when "fast-acquire" is enabled.
+ *
+ * On the first PPS edge the time error is removed by
+ * stepping the system time. Then over the next ACQUIRE_LEN
+ * PPS edges the clock frequency offset is estimated from
+ * a least-squares fit of rawError to time. That offset is
+ * applied to the system clock, the remaining time error
+ * predicted by the fit is stepped out and the controller
+ * integrals are seeded so that the controller starts at
+ * HARD_LIMIT_1 with isControlling "true".
+ *
+ * If the clock cannot be stepped or the fit residual
+ * exceeds ACQUIRE_MAX_RESIDUAL, the standard startup
+ * is used instead.
+ *
+ * @param[in,out] c The controller.
+ * @param[in] clock The clock to correct.
+ * @param[in] rawError The raw error of the current PPS edge.
+ *
+ * @returns "true" while fast acquisition is in progress
+ * and has handled the current PPS edge. Else "false".
+ */
+bool fastAcquire(struct controller *c, struct clockBackend *clock, double rawError){
+
+	if (c->acquireCount == 0){
+		if (stepClockOffset(c, clock, -rawError) == -1){
+			c->acquireCount = -1;
+			return false;
+		}
+		c->acquireStart = c->t_mono;
+		c->acquireCount = 1;
+		return true;
+	}
+
+	int n = c->acquireCount - 1;
+	c->acquireTime[n] = c->t_mono - c->acquireStart;
+	c->acquireError[n] = rawError;
+	n += 1;
+
+	if (n < ACQUIRE_LEN){
+		c->acquireCount += 1;
+		return true;
+	}
+
+	c->acquireCount = -1;
+
+	double slope, intercept;										// Drift in microseconds per second (ppm).
+	double residual = fitLine(c->acquireTime, c->acquireError, n, &slope, &intercept);
+
+	if (residual > ACQUIRE_MAX_RESIDUAL){
+		sprintf(c->logbuf, "fastAcquire() Fit residual %lf usec is too large. Using standard startup.\n", residual);
+		controllerLog(c);
+		return false;
+	}
+
+	c->freqOffset = -slope;
+	c->t3.modes = ADJ_FREQUENCY | ADJ_NANO;
+	c->t3.freq = (long)round(ADJTIMEX_SCALE * c->freqOffset);
+	clock->adjtimex(&c->t3);
+
+	double timeError = intercept + slope * c->acquireTime[n-1];	// Time error at the current PPS edge.
+	if (stepClockOffset(c, clock, -timeError) == -1){
+		return false;
+	}
+
+	seedIntegrals(c);
+
+	c->hardLimit = HARD_LIMIT_1;
+	c->invProportionalGain = INV_GAIN_1;
+	c->slewIsLow = true;
+	c->avgSlew = 0.0;
+	c->isFastAcquired = true;
+	c->isControlling = true;
+
+	sprintf(c->logbuf, "fastAcquire() Acquired at seq_num %d. freqOffset: %lf ppm residual: %lf usec\n",
+			c->seq_num, c->freqOffset, residual);
+	controllerLog(c);
+	return true;
+}
+
+/**
+ * Uses avgSlew or avgCorrection and the curent
+ * hard limit, hardLimit, to determine the new
+ * hardLimit to set on zero error to convert error
+ * values to time corrections.
+ *
+ * Because it is much more effective and does not
+ * introduce additional time delay, hard limiting
+ * is used instead of filtering to remove noise
+ * (jitter) from the reported time of PPS capture.
+ *
+ * The hardLimitShift setting is the policy: hardLimit
+ * is halved when avgCorrection is below hardLimit
+ * divided by 2^(hardLimitShift + 1) and doubled when
+ * it is above hardLimit divided by 2^hardLimitShift.
+ * The default of 1 gives 1/4 and 1/2. Larger values
+ * tighten the limit more slowly.
+ *
+ * @param[in,out] c The controller.
+ * @param[in] avgCorrection Current average
+ * correction value.
+ */
+void setHardLimit(struct controller *c, double avgCorrection){
+
+	double avgMedianMag = fabs(avgCorrection);
+	int shift = c->params.hardLimitShift;
+
+	if (c->activeCount < SECS_PER_MINUTE && ! c->isFastAcquired){
+		c->hardLimit = HARD_LIMIT_NONE;
+		return;
+	}
+
+	if (abs(c->avgSlew) > c->params.slewMax){					// As long as average time slew is
+		int d_4 = abs(c->avgSlew) * 4;						// outside of range slewMax this keeps
+		while (c->hardLimit < d_4								// c->hardLimit above 4 * c->avgSlew
+				&& c->hardLimit < HARD_LIMIT_NONE){			// which is high enough to allow the
+			c->hardLimit = c->hardLimit << 1;					// controller to pull avgSlew within
+		}													// slewMax.
+		return;
+	}
+
+	if (c->hardLimit == HARD_LIMIT_1){
+		if (avgMedianMag > HARD_LIMIT_05){
+			c->hardLimit = c->hardLimit << 1;
+		}
+	}
+	else if (avgMedianMag < HARD_LIMIT_05){
+		c->hardLimit = HARD_LIMIT_1;
+	}
+	else if (avgMedianMag < (c->hardLimit >> (shift + 1))){	// If avgCorrection is below 1/4 of limitValue
+		c->hardLimit = c->hardLimit >> 1;						// then halve limitValue.
+	}
+	else if (avgMedianMag > (c->hardLimit >> shift)){			// If avgCorrection is above 1/2 of limitValue
+		c->hardLimit = c->hardLimit << 1;						// then double limitValue.
+
+		if (c->hardLimit > HARD_LIMIT_NONE){
+			c->hardLimit = HARD_LIMIT_NONE;
+		}
+	}
+}
+
+/**
+ * Removes jitter delay spikes by returning "true"
+ * as long as the jitter value remains beyond a
+ * threshold (spikeLevel). Is not active unless
+ * hardLimit is at HARD_LIMIT_4 or below. Each value
+ * then updates the threshold for the next second.
+ *
+ * @param[in,out] c The controller.
+ * @param[in] rawError The raw error vlue to be
+ * tested for a delay spike.
+ *
+ * @returns "true" if a delay spike is detected. Else "false".
+ */
+bool detectDelaySpike(struct controller *c, double rawError){
+	bool isDelaySpike = false;
+
+	if (c->hardLimit <= HARD_LIMIT_4 && rawError >= c->spikeLevel){
+
+		if (c->nDelaySpikes < c->params.maxSpikes) {
+			c->nDelaySpikes += 1;						// Record unbroken sequence of delay spikes
+
+			isDelaySpike = true;
+		}
+		else {										// If nDelaySpikes == maxSpikes stop the
+			isDelaySpike = false;					// suspend even if spikes continue.
+		}
+	}
+	else {
+		isDelaySpike = false;
+
+		if (c->nDelaySpikes > 0){
+			c->nDelaySpikes = 0;
+		}
+	}
+
+	updateNoiseFloor(&c->noiseFloor, rawError);
+	setSpikeLevel(c);
+
+	return isDelaySpike;
+}
+
+/**
+ * Gets the average time offset from zero over the interval
+ * SLEW_LEN and updates avgSlew with this value every SLEW_LEN
+ * seconds.
+ *
+ * @param[in,out] c The controller.
+ * @param[in] rawError The raw error to be accumulated to
+ * determine average slew.
+ */
+void getTimeSlew(struct controller *c, double rawError){
+
+	c->slewAccum += rawError;
+
+	c->slewAccum_cnt += 1;
+	if (c->slewAccum_cnt >= SLEW_LEN){
+		c->slewAccum_cnt = 0;
+
+		c->avgSlew = c->slewAccum / (double)SLEW_LEN;
+
+		c->slewAccum = 0.0;
+	}
+}
+
+/**
+ * Clamps rawError to an adaptive value determined at the current
+ * hardLimit value from the current value of avgCorrection.
+ *
+ * Once the rawError values have been limited to values of +/- 1
+ * microsecond and the control loop has settled, this clamping causes
+ * the controller to make the average number of positive and negative
+ * rawError values equal rather than making the sum of the positive and
+ * negative jitter values zero. This removes the bias that would
+ * otherwise be introduced by the rawError values which are largely
+ * random and consequently would introduce a constantly changing
+ * random offset. The result is also to move the average PPS interrupt
+ * delay to its median value.
+ *
+ * @param[in,out] c The controller.
+ * @param[in] rawError The raw error value to be converted to a
+ * zero error.
+ */
+double clampJitter(struct controller *c, double rawError){
+
+	double zeroError = rawError;
+
+	if (rawError > c->hardLimit){
+		zeroError = c->hardLimit;
+	}
+	else if (rawError < -c->hardLimit){
+		zeroError = -c->hardLimit;
+	}
+
+	return zeroError;
+}
+
+/**
+ * Constructs, at each second over the last 10 seconds
+ * in each minute, 10 integrals of the average time
+ * correction over the last minute.
+ *
+ * These integrals are then averaged to avgIntegral
+ * just before the minute rolls over. The use of this
+ * average of the last 10 integrals to correct the
+ * frequency offset of the system clock provides a modest
+ * improvement over using only the single last integral.
+ *
+ * @param[in,out] c The controller.
+ * @param[in] avgCorrection The average correction
+ * to be integrated.
+ */
+void makeAverageIntegral(struct controller *c, double avgCorrection){
+
+	int indexOffset = SECS_PER_MINUTE - NUM_INTEGRALS;
+
+	if (c->correctionFifo_idx >= indexOffset){					// Over the last NUM_INTEGRALS seconds in each minute
+
+		int i = c->correctionFifo_idx - indexOffset;
+		if (i == 0){
+			c->avgIntegral = 0.0;
+			c->integralCount = 0;
+		}
+
+		c->integral[i] = c->integral[i] + avgCorrection;			// avgCorrection sums into c->integral[i] once each
+																// minute forming the ith integral over the last minute.
+		if (c->hardLimit == HARD_LIMIT_1){
+			c->avgIntegral += c->integral[i];						// Accumulate each integral that is being formed
+			c->integralCount += 1;								// into c->avgIntegral for averaging.
+		}
+	}
+
+	if (c->correctionFifo_idx == SECS_PER_MINUTE - 1				// just before the minute rolls over.
+			&& c->integralCount == NUM_INTEGRALS){
+
+		c->avgIntegral *= PER_NUM_INTEGRALS;						// Normalize c->avgIntegral.
+	}
+}
+
+/**
+ * Advances the correctionFifo index each second and
+ * returns "true" when 60 new time correction values
+ * have been accumulated in correctionAccum.
+ *
+ * When a value of "true" is returned, new average
+ * time correction integrals have been generated by
+ * makeAverageIntegral() and are ready for use.
+ *
+ * @param[in,out] c The controller.
+ *
+ * @returns "true" when ready, else "false".
+ */
+bool integralIsReady(struct controller *c){
+	bool isReady = false;
+
+	if (c->correctionFifo_idx == 0){
+		setNoiseLevel(c, c->sysDelay);
+		isReady = true;
+	}
+
+	c->correctionFifo_idx += 1;
+	if (c->correctionFifo_idx >= SECS_PER_MINUTE){
+		c->correctionFifo_idx = 0;
+	}
+
+	return isReady;
+}
+
+/**
+ * Maintains correctionFifo which contains second-by-second
+ * values of time corrections over the last minute, accumulates
+ * a rolling sum of these and returns the average correction
+ * over the last minute.
+ *
+ * Since timeCorrection converges to a sequence of positive
+ * and negative values each of magnitude one, the average
+ * timeCorrection which is forced to be zero by the controller
+ * also corresponds to the time delay where the number of
+ * positive and negative corrections are equal and thus this
+ * time delay, although not directly measurable, is the
+ * median of the time delays causing the corrections.
+ *
+ * @param[in,out] c The controller.
+ * @param[in] timeCorrection The time correction value
+ * to be accumulated.
+ *
+ * @returns The average correction value.
+ */
+double getAverageCorrection(struct controller *c, double timeCorrection){
+
+	double avgCorrection;
+
+	c->correctionAccum += timeCorrection;				// Add the new timeCorrection into the error accumulator.
+
+	if (c->correctionFifoCount == SECS_PER_MINUTE){	// Once the FIFO is full, maintain the continuous
+													// rolling sum accumulator by subtracting the
+		double oldError = c->correctionFifo[c->correctionFifo_idx];
+		c->correctionAccum -= oldError;				// old timeCorrection value at the current correctionFifo_idx.
+	}
+
+	c->correctionFifo[c->correctionFifo_idx] = timeCorrection;	// and replacing the old value in the FIFO with the new.
+
+	if (c->correctionFifoCount < SECS_PER_MINUTE){	// When correctionFifoCount == SECS_PER_MINUTE
+		c->correctionFifoCount += 1;					// the FIFO is full and ready to use.
+	}
+
+	avgCorrection = c->correctionAccum * PER_MINUTE;
+	return avgCorrection;
+}
+
+/**
+ * if hardLimit == HARD_LIMIT_1, gets an integral time
+ * correction as a 10 second average of integrals of average
+ * time corrections over one minute. Otherwise gets the
+ * integral time correction as the single last integral
+ * of average time corrections over one minute.
+ *
+ * @param[in,out] c The controller.
+ *
+ * @returns The integral of time correction values.
+ */
+double getIntegral(struct controller *c){
+	double integral;
+
+	if (c->hardLimit == HARD_LIMIT_1
+			&& c->integralCount == NUM_INTEGRALS){
+		integral = c->avgIntegral;					// Use average of last 10 integrals
+	}												// in the last minute.
+	else {
+		integral = c->integral[9];					// Use only the last integral from
+													// the last minute
+	}
+
+	return integral;
+}
+
+/**
+ * Removes spikes and jitter from rawError and
+ * returns the resulting clamped zeroError.
+ *
+ * @param[in,out] c The controller.
+ * @param[in] rawError The raw error value to be processed.
+ *
+ * @returns The resulting zeroError value.
+ */
+double removeNoise(struct controller *c, double rawError){
+
+	double zeroError;
+
+	c->isNoiseRemoved = true;
+
+	if (c->hardLimit == HARD_LIMIT_1 && c->isControlling){
+		histRecord(&c->jitterHist, rawError);
+	}
+
+	c->isDelaySpike = detectDelaySpike(c, rawError);	// c->isDelaySpike == true will prevent time and
+													// frequency updates during a delay spike.
+	if (c->isDelaySpike){
+		return 0;
+	}
+
+	getTimeSlew(c, rawError);
+
+	setHardLimit(c, c->avgCorrection);
+	zeroError = clampJitter(c, rawError);				// Recover the time error by
+													// limiting away the jitter.
+	if (c->isControlling){
+		c->invProportionalGain = INV_GAIN_1;
+	}
+	return zeroError;
+}
+
+/**
+ * Makes the time correction and, when it is due, the
+ * frequency correction of the clock for the current
+ * PPS edge.
+ *
+ * The time correction is the time error with jitter
+ * removed, divided by the proportional gain. The frequency
+ * correction is made each minute from the integral of
+ * the time corrections. If the Kalman filter is selected
+ * it replaces both once the controller is controlling
+ * and corrects the frequency every second.
+ *
+ * @param[in,out] c The controller.
+ * @param[in] rawError The time error of the PPS edge in
+ * microseconds referenced to sysDelay.
+ * @param[in] sysDelay The interrupt delay in microseconds.
+ * @param[in] clock The clock to correct.
+ *
+ * @returns "true" if a time correction was made. "false"
+ * if the PPS edge was used by fastAcquire() or was a
+ * delay spike.
+ */
+bool makeControllerCorrection(struct controller *c, double rawError, int sysDelay, struct clockBackend *clock){
+	struct timespec t_mono;
+
+	clock->getMonotonic(&t_mono);
+	c->t_mono = (double)t_mono.tv_sec + 1e-9 * (double)t_mono.tv_nsec;
+
+	c->seq_num += 1;
+	c->sysDelay = sysDelay;
+	c->rawError = rawError;
+	c->isClockStepped = false;
+	c->isNoiseRemoved = false;
+	c->isFreqSet = false;
+	c->stepOffset = 0.0;
+	c->slewOffset = 0.0;
+
+	addRawEdge(c, clock);
+
+	if (c->params.doFastAcquire && c->acquireCount >= 0
+			&& fastAcquire(c, clock, rawError)){				// Handles the PPS edges on startup
+		return false;										// until fast acquisition completes.
+	}
+
+	if (! c->isControlling && c->rawCount == RAW_FIT_MIN){
+		seedRawFrequency(c, clock);
+	}
+
+	c->zeroError = removeNoise(c, rawError);
+
+	if (c->isDelaySpike){									// Skip a delay spike.
+		return false;
+	}
+
+	double freqStep = 0.0;
+	bool useKalman = c->params.doKalman && c->isControlling;
+	if (useKalman){
+		c->timeCorrection = getKalmanCorrection(&c->kalman, &c->params, rawError, c->t_mono, &freqStep);
+	}
+	else {
+		if (c->kalman.isStarted){							// On a change from the Kalman controller
+			resetKalman(&c->kalman);						// start the integrals from the frequency
+			seedIntegrals(c);								// offset that it set.
+		}
+		c->timeCorrection = -c->zeroError
+				/ c->invProportionalGain;					// Apply controller proportional gain factor.
+	}
+
+	double slew = c->timeCorrection + c->slewResidual;		// ADJ_OFFSET_SINGLESHOT only accepts whole microseconds
+	c->t3.modes = ADJ_OFFSET_SINGLESHOT;					// so the sub-microsecond remainder is carried into the
+	c->t3.offset = lround(slew);							// next second. Adjust the time slew. adjtimex() limits
+	c->slewResidual = slew - (double)c->t3.offset;			// the maximum correction to about 500 microseconds each
+														// second so it can take up to 20 minutes to start pps-client.
+	clock->adjtimex(&c->t3);
+	c->slewOffset = (double)c->t3.offset;
+	if (useKalman){
+		setKalmanSlew(&c->kalman, (double)c->t3.offset);
+	}
+
+	bool wasControlling = c->isControlling;
+	c->isControlling = getAcquireState(c);					// Provides enough time to reduce time slew on startup.
+	if (c->isControlling && ! wasControlling){
+		seedRawFrequency(c, clock);
+	}
+	if (c->isControlling){
+
+		c->avgCorrection = getAverageCorrection(c, c->timeCorrection);
+
+		if (useKalman){									// The Kalman controller corrects the frequency
+			if (integralIsReady(c)){						// every second and updates its measurement
+				setKalmanNoise(&c->kalman, &c->jitterHist);	// noise each minute.
+				c->isFreqSet = true;
+			}
+			c->freqOffset += freqStep;
+
+			c->t3.modes = ADJ_FREQUENCY | ADJ_NANO;
+			c->t3.freq = (long)round(ADJTIMEX_SCALE * c->freqOffset);
+			clock->adjtimex(&c->t3);
+		}
+		else {
+			makeAverageIntegral(c, c->avgCorrection);		// Constructs an average of integrals of one
+														// minute rolling averages of time corrections.
+			if (integralIsReady(c)){						// Get a new frequency offset.
+				c->integralTimeCorrection = getIntegral(c);
+				c->freqOffset = c->integralTimeCorrection * c->params.integralGain;
+
+				c->t3.modes = ADJ_FREQUENCY | ADJ_NANO;
+				c->t3.freq = (long)round(ADJTIMEX_SCALE * c->freqOffset);
+				clock->adjtimex(&c->t3);					// Adjust the clock frequency.
+				c->isFreqSet = true;
+			}
+		}
+
+		c->activeCount += 1;
+	}
+	return true;
+}
+
+/**
+ * Returns "true" if the controller must be restarted
+ * because the time slew on startup is too large or
+ * because the average slew became too large after
+ * acquiring.
+ *
+ * @param[in] c The controller.
+ */
+bool controllerNeedsRestart(const struct controller *c){
+	return (! c->isControlling && c->seq_num >= SECS_PER_MINUTE)
+			|| (c->isControlling && c->hardLimit > HARD_LIMIT_1024 && abs(c->avgSlew) > c->params.slewMax);
+}
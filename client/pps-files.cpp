@@ -22,6 +22,7 @@
 
 #include "../client/pps-client.h"
 extern struct G g;
+extern struct clockBackend *clk;
 
 const char *last_distrib_file = "/var/local/pps-error-distrib";					//!< Stores the completed distribution of offset corrections.
 const char *distrib_file = "/var/local/pps-error-distrib-forming";				//!< Stores a forming distribution of offset corrections.
@@ -40,139 +41,198 @@ const char *ntp_config_file = "/etc/ntp.conf";									//!< The NTP configuratio
 const char *ntp_config_bac = "/etc/ntp.conf.bac";									//!< Backup of the NTP configuration file.
 const char *ntp_config_part = "/etc/ntp.conf.part";								//!< Temporary filename for an NTP config file during copy.
 
-const char *sysDelay_file = "/run/shm/pps-sysDelay";								//!< The current sysDelay value updated each second
-const char *assert_file = "/run/shm/pps-assert";									//!< The timestamps of the time corrections each second
 const char *displayParams_file = "/run/shm/pps-display-params";					//!< Temporary file storing params for the status display
-const char *arrayData_file = "/run/shm/pps-save-data";							//!< Stores a request sent to the PPS-Client daemon.
 
-const char *space = " ";
 const char *num = "0123456789.";
 
 extern const char *version;
 
+/**
+ * A copy of a distribution in G made by the control
+ * thread for the I/O worker to write to its file.
+ */
+struct distribCopy {
+	unsigned int seq;									//!< Sequence lock count. Odd while the control thread is writing the copy.
+	int count;											//!< The sample count of the distribution when it was copied.
+	bool isEpochEnd;									//!< "true" if the file is to be rolled over after the copy is written.
+	int label[NUM_PARAMS];								//!< The sysDelay value of each column of a multiple distribution.
+	union {
+		int distrib[JITTER_DISTRIB_LEN];				//!< A copy of a single distribution.
+		int multiDistrib[NUM_PARAMS][INTRPT_DISTRIB_LEN];	//!< A copy of a multiple distribution.
+	};
+};
+
+/**
+ * A copy of the G arrays written on a save data request
+ * made by the control thread for the I/O worker.
+ */
+struct saveCopy {
+	unsigned int seq;									//!< Sequence count of the copy. Odd while it is written.
+	double rawErrorDistrib[ERROR_DISTRIB_LEN];			//!< Copy of G.rawErrorDistrib.
+	double intrptErrorDistrib[ERROR_DISTRIB_LEN];		//!< Copy of G.intrptErrorDistrib.
+	struct hdrHist jitterHist;							//!< Copy of G.jitterHist.
+	struct hdrHist errorHist;							//!< Copy of G.errorHist.
+	struct hdrHist intrptHist;							//!< Copy of G.intrptHist.
+};
+
 /**
  * Local file-scope shared variables.
  */
 static struct ppsFilesVars {
-	struct stat configFileStat;
-	time_t modifyTime;
-	int lastJitterFileno;
-	int lastSysDelayFileno;
-	int lastErrorFileno;
-	int lastIntrptFileno;
+	char configBuf[CONFIG_FILE_SZ];						//!< Holds the config file while it is parsed.
+	struct ppsConfig config[2];							//!< The current config and the next config to be parsed.
+	struct ppsConfig *pConfig;							//!< Points to the current config. Swapped atomically.
+	unsigned int configGen;								//!< Incremented each time the config file is read.
+	unsigned int configAck;								//!< The configGen of the config last applied by the control thread.
+	bool isReloadDeferred;								//!< Set "true" by readConfigFile() while a reread waits for configAck.
+	struct ppsConfig startConfig;						//!< The config applied when PPS-Client started.
+	bool isStarted;										//!< "true" once startConfig has been set.
+	int lastJitterFileno;								//!< The epoch of the last copy of G.jitterDistrib. Written only by the control thread.
+	int lastSysDelayFileno;								//!< The epoch of the last copy of G.sysDelayDistrib. Written only by the control thread.
+	int lastErrorFileno;								//!< The epoch of the last copy of G.errorDistrib. Written only by the control thread.
+	int lastIntrptFileno;								//!< The epoch of the last copy of G.intrptDistrib. Written only by the control thread.
 	int lastIntrptJitterFileno;
+	struct distribCopy errorCopy;						//!< Copy of G.errorDistrib for the I/O worker.
+	struct distribCopy jitterCopy;						//!< Copy of G.jitterDistrib for the I/O worker.
+	struct distribCopy intrptCopy;						//!< Copy of G.intrptDistrib for the I/O worker.
+	struct distribCopy sysDelayCopy;					//!< Copy of G.sysDelayDistrib for the I/O worker.
+	struct distribCopy distribSnap;						//!< The copy being written by the I/O worker.
+	unsigned int errorWritten;							//!< The seq of the last errorCopy written. Written only by the I/O worker.
+	unsigned int jitterWritten;							//!< The seq of the last jitterCopy written. Written only by the I/O worker.
+	unsigned int intrptWritten;							//!< The seq of the last intrptCopy written. Written only by the I/O worker.
+	unsigned int sysDelayWritten;						//!< The seq of the last sysDelayCopy written. Written only by the I/O worker.
+	struct saveCopy saveCopy;							//!< Copy of the save data request arrays for the I/O worker.
+	struct saveCopy saveSnap;							//!< The copy being written by the I/O worker.
+	unsigned int saveCopySeqNum;						//!< The G.seq_num of the last saveCopy. Written only by the control thread.
+	struct ppsShm *shm;
+	char logbuf[LOGBUF_SZ];									//!< Used in place of G.logbuf by the I/O worker functions.
+	char strbuf[STRBUF_SZ];									//!< Used in place of G.strbuf by the I/O worker functions.
+	char filebuf[FILEBUF_SZ];								//!< Holds a data file formatted by the I/O worker functions.
+	struct historyRec histbuf[SECS_PER_10_MIN];			//!< Records read from the history file by the I/O worker functions.
 } f; 														//!< Local file-scope shared variables.
 
 /**
- * Recognized configuration strings for the PPS-Client
- * configuration file.
- */
-const char *valid_config[] = {
-		"error-distrib",
-		"alert-pps-lost",
-		"jitter-distrib",
-		"calibrate",
-		"interrupt-distrib",
-		"sysdelay-distrib",
-		"exit-lost-pps",
-		"pps-gpio",
-		"output-gpio",
-		"intrpt-gpio",
-		"sntp",
-		"serial",
-		"serialPort"
+ * Recognized configuration keys for the PPS-Client
+ * configuration file with the type and location of
+ * each value in struct ppsConfig.
+ */
+struct configKey {
+	const char *key;
+	int type;
+	size_t offset;
+} configKeys[] = {
+	{"error-distrib", CONFIG_BOOL, offsetof(struct ppsConfig, errorDistrib)},
+	{"alert-pps-lost", CONFIG_BOOL, offsetof(struct ppsConfig, alertPPSLost)},
+	{"jitter-distrib", CONFIG_BOOL, offsetof(struct ppsConfig, jitterDistrib)},
+	{"calibrate", CONFIG_BOOL, offsetof(struct ppsConfig, calibrate)},
+	{"interrupt-distrib", CONFIG_BOOL, offsetof(struct ppsConfig, interruptDistrib)},
+	{"sysdelay-distrib", CONFIG_BOOL, offsetof(struct ppsConfig, sysDelayDistrib)},
+	{"delay-window", CONFIG_INT, offsetof(struct ppsConfig, delayWindow)},
+	{"exit-lost-pps", CONFIG_BOOL, offsetof(struct ppsConfig, exitLostPPS)},
+	{"pps-gpio", CONFIG_INT, offsetof(struct ppsConfig, ppsGPIO)},
+	{"output-gpio", CONFIG_INT, offsetof(struct ppsConfig, outputGPIO)},
+	{"intrpt-gpio", CONFIG_INT, offsetof(struct ppsConfig, intrptGPIO)},
+	{"sntp", CONFIG_BOOL, offsetof(struct ppsConfig, sntp)},
+	{"serial", CONFIG_BOOL, offsetof(struct ppsConfig, serial)},
+	{"serialPort", CONFIG_STRING, offsetof(struct ppsConfig, serialPort)},
+	{"pps-device", CONFIG_STRING, offsetof(struct ppsConfig, ppsDevice)},
+	{"fast-acquire", CONFIG_BOOL, offsetof(struct ppsConfig, fastAcquire)},
+	{"log-size", CONFIG_INT, offsetof(struct ppsConfig, logSize)},
+	{"log-count", CONFIG_INT, offsetof(struct ppsConfig, logCount)},
+	{"metrics", CONFIG_BOOL, offsetof(struct ppsConfig, metrics)},
+	{"metrics-port", CONFIG_INT, offsetof(struct ppsConfig, metricsPort)},
+	{"controller", CONFIG_STRING, offsetof(struct ppsConfig, controller)},
+	{"shadow-1", CONFIG_STRING, offsetof(struct ppsConfig, shadow[0])},
+	{"shadow-2", CONFIG_STRING, offsetof(struct ppsConfig, shadow[1])},
+	{"shadow-3", CONFIG_STRING, offsetof(struct ppsConfig, shadow[2])},
+	{"shadow-4", CONFIG_STRING, offsetof(struct ppsConfig, shadow[3])}
 };
 
+/**
+ * Sets the default value of each config setting.
+ *
+ * @param[out] cfg The config.
+ */
+void setConfigDefaults(struct ppsConfig *cfg){
+	memset(cfg, 0, sizeof(struct ppsConfig));
+
+	cfg->calibrate = true;
+	cfg->exitLostPPS = true;
+	cfg->ppsGPIO = -1;
+	cfg->outputGPIO = -1;
+	cfg->intrptGPIO = -1;
+	cfg->sntp = true;
+	strcpy(cfg->serialPort, "/dev/serial0");
+	cfg->fastAcquire = true;
+	cfg->logSize = LOG_DEFAULT_SIZE / 1000;
+	cfg->logCount = LOG_DEFAULT_COUNT;
+	cfg->delayWindow = DELAY_WINDOW;
+	cfg->metrics = true;
+	strcpy(cfg->controller, "pi");
+}
+
 void initFileLocalData(void){
 	memset(&f, 0, sizeof(struct ppsFilesVars));
+	setConfigDefaults(&f.config[0]);
+	f.pConfig = &f.config[0];
 }
 
 int sysCommand(const char *cmd){
 	int rv = system(cmd);
 	if (rv == -1 || WIFEXITED(rv) == false){
-		sprintf(g.logbuf, "System command failed: %s\n", cmd);
-		writeToLog(g.logbuf);
+		sprintf(f.logbuf, "System command failed: %s\n", cmd);
+		writeToLog(f.logbuf);
 		return -1;
 	}
 	return 0;
 }
 
 /**
- * Retrieves the string from the config file assigned
- * to the valid_config string with value key.
- *
- * @param[in] key The config key corresponding to a string in
- * the valid_config[] array above.
- *
- * @returns The string assigned to the key.
- */
-char *getString(int key){
-	int i = round(log2(key));
-
-	if (g.config_select & key){
-		return g.configVals[i];
-	}
-	return NULL;
+ * Returns the current PPS-Client configuration. The
+ * returned config is replaced, not modified, when
+ * the config file is reread. The config that it
+ * replaced is not reused for the next reread until
+ * the control thread has applied the new one with
+ * applyReloadedConfig() and no longer reads the old
+ * one, so it can be read without a lock by the
+ * control thread and by the I/O worker, which
+ * rereads the config file.
+ */
+const struct ppsConfig *getConfig(void){
+	struct ppsConfig *cfg = __atomic_load_n(&f.pConfig, __ATOMIC_ACQUIRE);
+	if (cfg == NULL){
+		setConfigDefaults(&f.config[0]);
+		cfg = &f.config[0];
+	}
+	return cfg;
 }
 
 /**
- * Tests configuration strings from /etc/pps-client.conf
- * for the specified string. To avoid searching the config
- * file more than once, the config key is a bit position in
- * g.config_select that is set or not set if the corresponding
- * config string is found in the config file when it is first
- * read. In that case an array g.configVals[], constructed when
- * the config file was read, will contain the string from the
- * config file that followed the valid_config. That string
- * will be g.configVals[log2(key)].
- *
- * @param[in] key The config key corresponding to a string in
- * the valid_config[] array above.
- *
- * @param[in] string The string that must be matched by the string
- * that follows the config string name from the valid_config[] array.
- *
- * @returns "true" if the string in the config file matches arg
- * "string", else "false".
+ * Returns a count that is incremented each time
+ * readConfigFile() replaces the current config.
  */
-bool hasString(int key, const char *string){
-	int i = round(log2(key));
-
-	if (g.config_select & key){
-		char *val = strstr(g.configVals[i], string);
-		if (val != NULL){
-			return true;
-		}
-	}
-	return false;
+unsigned int getConfigGen(void){
+	return __atomic_load_n(&f.configGen, __ATOMIC_ACQUIRE);
 }
 
 /**
- * Tests configuration strings from /etc/pps-client.conf
- * for the "enable" keyword.
- *
- * @param[in] key The config key corresponding to a string in
- * the valid_config[] array above.
- *
- * @returns "true" if the "enable" keyword is detected,
- * else "false".
+ * Returns the size in bytes at which the log file
+ * is rotated.
  */
-bool isEnabled(int key){
-	return hasString(key, "enable");
+int getLogMaxSize(void){
+	int size = getConfig()->logSize * 1000;
+	return (size > 0) ? size : LOG_DEFAULT_SIZE;
 }
 
 /**
- * Tests configuration strings from /etc/pps-client.conf
- * for the "disable" keyword.
- *
- * @param[in] key The config key corresponding to a string in
- * the valid_config[] array above.
- *
- * @returns "true" if the "disable" keyword is detected,
- * else false.
+ * Returns the number of rotated log files kept.
  */
-bool isDisabled(int key){
-	return hasString(key, "disable");
+int getLogCount(void){
+	int count = getConfig()->logCount;
+	if (count < 1){
+		return LOG_DEFAULT_COUNT;
+	}
+	return (count > LOG_MAX_COUNT) ? LOG_MAX_COUNT : count;
 }
 
 /**
@@ -180,10 +240,15 @@ bool isDisabled(int key){
  * data requests with the -s flag.
  */
 struct saveFileData arrayData[] = {
-	{"rawError", g.rawErrorDistrib, "/var/local/pps-raw-error-distrib", ERROR_DISTRIB_LEN, 2, RAW_ERROR_ZERO},
-	{"intrptError", g.intrptErrorDistrib, "/var/local/pps-intrpt-error-distrib", ERROR_DISTRIB_LEN, 2, RAW_ERROR_ZERO},
+	{"rawError", f.saveSnap.rawErrorDistrib, "/var/local/pps-raw-error-distrib", ERROR_DISTRIB_LEN, 2, RAW_ERROR_ZERO},
+	{"intrptError", f.saveSnap.intrptErrorDistrib, "/var/local/pps-intrpt-error-distrib", ERROR_DISTRIB_LEN, 2, RAW_ERROR_ZERO},
 	{"frequency-vars", NULL, "/var/local/pps-frequency-vars", 0, 3, 0},
-	{"pps-offsets", NULL, "/var/local/pps-offsets", 0, 4, 0}
+	{"pps-offsets", NULL, "/var/local/pps-offsets", 0, 4, 0},
+	{"jitter-hist", &f.saveSnap.jitterHist, "/var/local/pps-jitter-hist", 0, 5, 0},
+	{"error-hist", &f.saveSnap.errorHist, "/var/local/pps-error-hist", 0, 5, 0},
+	{"intrpt-hist", &f.saveSnap.intrptHist, "/var/local/pps-intrpt-hist", 0, 5, 0},
+	{"stability", NULL, "/var/local/pps-stability", 0, 6, 0},
+	{"shadows", NULL, "/var/local/pps-shadows", 0, 7, 0}
 };
 
 /**
@@ -209,74 +274,126 @@ void errorReadingMsgTo(char *logbuf, const char *filename){
 }
 
 /**
- * Appends logbuf to the log file.
- *
- * @param[in,out] logbuf Pointer to the log buffer.
+ * Renames the log file to old_log_file after renaming
+ * each older log file to the next older name. Keeps at
+ * most getLogCount() old log files: old_log_file, then
+ * old_log_file.2, old_log_file.3 ...
  */
-void writeToLogNoTimestamp(char *logbuf){
+void rotateLogFiles(void){
+	char oldName[STRBUF_SZ];
+	char newName[STRBUF_SZ];
+
+	int count = getLogCount();
+
+	for (int i = count; i > 1; i--){
+		if (i - 1 == 1){
+			strcpy(oldName, old_log_file);
+		}
+		else {
+			sprintf(oldName, "%s.%d", old_log_file, i - 1);
+		}
+		sprintf(newName, "%s.%d", old_log_file, i);
+		rename(oldName, newName);
+	}
+
+	rename(log_file, old_log_file);
+}
+
+/**
+ * Appends msg to the log file. While the I/O worker is
+ * running, msg is only copied to the log batch buffer
+ * which is written to the log file by the I/O worker.
+ * Otherwise msg is written directly, first rotating the
+ * log file if it has grown past getLogMaxSize().
+ *
+ * @param[in] msg The message.
+ * @param[in] t The time at which the message was logged.
+ * @param[in] timestamp If "true" the message is preceded
+ * by a timestamp made from t.
+ */
+void appendToLog(const char *msg, time_t t, bool timestamp){
 	struct stat info;
+	char errbuf[LOGBUF_SZ];
 
-	bufferStatusMsg(logbuf);
+	if (logWorkerIsRunning()){
+		bufferLogMsg(msg, t, timestamp);
+		return;
+	}
 
-	stat(log_file, &info);
-	if (info.st_size > 100000){			// Prevent unbounded log file growth
-		remove(old_log_file);
-		rename(log_file, old_log_file);
+	if (stat(log_file, &info) == 0 && info.st_size > getLogMaxSize()){	// Prevent unbounded log file growth
+		rotateLogFiles();
 	}
 
 	mode_t mode = S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH;
 	int fd = open(log_file, O_CREAT | O_WRONLY | O_APPEND, mode);
 	if (fd == -1){
-		couldNotOpenMsgTo(logbuf, log_file);
-		printf("%s", logbuf);
+		couldNotOpenMsgTo(errbuf, log_file);
+		printf("%s", errbuf);
 		return;
 	}
 
-	int rv = write(fd, logbuf, strlen(logbuf));
+	if (timestamp){
+		char timeStr[STRBUF_SZ];
+		struct tm tmv;
+		strftime(timeStr, STRBUF_SZ, "%F %H:%M:%S ", localtime_r(&t, &tmv));
+		int rv = write(fd, timeStr, strlen(timeStr));
+		if (rv == -1){
+			;
+		}
+	}
+
+	int rv = write(fd, msg, strlen(msg));
 	if (rv == -1){
 		;
 	}
 	close(fd);
 }
 
-
 /**
- * Appends logbuf to the log file with a timestamp.
+ * Appends logbuf to the log file. If called from the
+ * controller thread while the I/O worker is running,
+ * logbuf is passed to the I/O worker instead.
  *
- * @param[in,out] logbuf Pointer to the log buffer.
+ * @param[in] logbuf Pointer to the log buffer.
  */
-void writeToLog(char *logbuf){
-	struct stat info;
+void writeToLogNoTimestamp(char *logbuf){
+
+	if (isControlThread()){
+		postIORequest(IO_LOG_NO_TIMESTAMP, logbuf);
+		return;
+	}
 
 	bufferStatusMsg(logbuf);
 
-	stat(log_file, &info);
-	if (info.st_size > 100000){			// Prevent unbounded log file growth
-		remove(old_log_file);
-		rename(log_file, old_log_file);
+	if (clk->isSimulated){
+		return;
 	}
 
-	mode_t mode = S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH;
-	int fd = open(log_file, O_CREAT | O_WRONLY | O_APPEND, mode);
-	if (fd == -1){
-		couldNotOpenMsgTo(logbuf, log_file);
-		printf("%s", logbuf);
+	appendToLog(logbuf, time(NULL), false);
+}
+
+
+/**
+ * Appends logbuf to the log file with a timestamp. If
+ * called from the controller thread while the I/O worker
+ * is running, logbuf is passed to the I/O worker instead.
+ *
+ * @param[in] logbuf Pointer to the log buffer.
+ */
+void writeToLog(char *logbuf){
+
+	if (isControlThread()){
+		postIORequest(IO_LOG, logbuf);
 		return;
 	}
 
-	time_t t = time(NULL);
-	struct tm *tmp = localtime(&t);
-	strftime(g.strbuf, STRBUF_SZ, "%F %H:%M:%S ", tmp);
-	int rv = write(fd, g.strbuf, strlen(g.strbuf));
-	if (rv == -1){
-		;
-	}
+	bufferStatusMsg(logbuf);
 
-	rv = write(fd, logbuf, strlen(logbuf));
-	if (rv == -1){
-		;
+	if (clk->isSimulated){
+		return;
 	}
-	close(fd);
+
+	appendToLog(logbuf, time(NULL), true);
 }
 
 /**
@@ -290,6 +407,13 @@ void writeToLog(char *logbuf){
  */
 void bufferStatusMsg(const char *msg){
 
+	if (isControlThread()){
+		postIORequest(IO_STATUS_MSG, msg);
+		return;
+	}
+
+	lockStatusBuf();
+
 	if (g.isVerbose){
 		fprintf(stdout, "%s", msg);
 	}
@@ -297,41 +421,41 @@ void bufferStatusMsg(const char *msg){
 	int msglen = strlen(g.savebuf);
 	int parmslen = strlen(msg);
 
-	if (msglen + parmslen > MSGBUF_SZ){
-		return;
+	if (msglen + parmslen < MSGBUF_SZ){
+		strcat(g.savebuf, msg);
 	}
 
-	strcat(g.savebuf, msg);
+	unlockStatusBuf();
 }
 
 /**
  * Writes status strings accumulated in a message buffer,
  * g.savebuf, from bufferStateParams() and other sources
- * to a tmpfs memory file, displayParams_file, once each
- * second. This file can be displayed in real time by
- * invoking the PPS-Client program with the -v command
- * line flag while the PPS-Client daemon is running.
+ * to a tmpfs memory file, displayParams_file, and sends
+ * them to the subscribers on the control socket once each
+ * second. They are displayed in real time by invoking the
+ * PPS-Client program with the -v command line flag while
+ * the PPS-Client daemon is running.
  *
  * @returns 0 on success, else -1 on error.
  */
 int writeStatusStrings(void){
+	char statusbuf[MSGBUF_SZ];
 
-	int fSize = strlen(g.savebuf);
-
-	remove(displayParams_file);
-	int fd = open_logerr(displayParams_file, O_CREAT | O_WRONLY);
-	if (fd == -1){
-		return -1;
-	}
-	int rv = write(fd, g.savebuf, fSize);
-	close(fd);
-	if (rv == -1){
-		sprintf(g.logbuf, "writeStatusStrings() Could not write to %s. Error: %s\n", displayParams_file, strerror(errno));
-		writeToLog(g.logbuf);
-		return -1;
+	if (isControlThread()){
+		return postIORequest(IO_WRITE_STATUS, NULL);
 	}
 
+	lockStatusBuf();
+	strcpy(statusbuf, g.savebuf);
 	g.savebuf[0] = '\0';
+	unlockStatusBuf();
+
+	publishStatus(statusbuf);
+
+	if (writeFileAtomic(displayParams_file, statusbuf, strlen(statusbuf)) == -1){
+		return -1;
+	}
 	return 0;
 }
 
@@ -348,8 +472,8 @@ int writeStatusStrings(void){
 int read_logerr(int fd, char *buf, int sz, const char *filename){
 	int rv = read(fd, buf, sz);
 	if (rv == -1){
-		errorReadingMsgTo(g.logbuf, filename);
-		writeToLog(g.logbuf);
+		errorReadingMsgTo(f.logbuf, filename);
+		writeToLog(f.logbuf);
 		return rv;
 	}
 	return rv;
@@ -374,8 +498,8 @@ int open_logerr(const char* filename, int flags){
 		fd = open(filename, flags);
 	}
 	if (fd == -1){
-		couldNotOpenMsgTo(g.logbuf, filename);
-		writeToLog(g.logbuf);
+		couldNotOpenMsgTo(f.logbuf, filename);
+		writeToLog(f.logbuf);
 		return -1;
 	}
 	return fd;
@@ -436,7 +560,7 @@ int writeFileMsgToLogbuf(const char *filename, char *logbuf){
  * @returns 0 on success, else -1 on error;
  */
 int writeFileMsgToLog(const char *filename){
-	return writeFileMsgToLogbuf(filename, g.logbuf);
+	return writeFileMsgToLogbuf(filename, f.logbuf);
 }
 
 /**
@@ -449,17 +573,17 @@ pid_t getChildPID(void){
 	pid_t pid = 0;
 	const char *filename = "/var/run/pps-client.pid";
 
-	memset(g.strbuf, 0, STRBUF_SZ);
+	memset(f.strbuf, 0, STRBUF_SZ);
 
 	int pfd = open_logerr(filename, O_RDONLY);
 	if (pfd == -1){
 		return -1;
 	}
-	if (read_logerr(pfd, g.strbuf, 19, filename) == -1){
+	if (read_logerr(pfd, f.strbuf, 19, filename) == -1){
 		close(pfd);
 		return -1;
 	}
-	sscanf(g.strbuf, "%d\n", &pid);
+	sscanf(f.strbuf, "%d\n", &pid);
 	close(pfd);
 	if (pid > 0){
 		return pid;
@@ -484,15 +608,15 @@ bool ppsIsRunning(void){
 
 	int fd = open(filename, O_RDONLY);
 	if (fd == -1){
-		sprintf(g.logbuf, "ppsIsRunning() Failed. Could not open %s. Error: %s\n", filename, strerror(errno));
-		writeToLog(g.logbuf);
+		sprintf(f.logbuf, "ppsIsRunning() Failed. Could not open %s. Error: %s\n", filename, strerror(errno));
+		writeToLog(f.logbuf);
 		return false;
 	}
 	memset(buf, 0, 50);
 	rv = read(fd, buf, 50);
 	if (rv == -1){
-		sprintf(g.logbuf, "ppsIsRunning() Failed. Could not read %s. Error: %s\n", filename, strerror(errno));
-		writeToLog(g.logbuf);
+		sprintf(f.logbuf, "ppsIsRunning() Failed. Could not read %s. Error: %s\n", filename, strerror(errno));
+		writeToLog(f.logbuf);
 		return false;
 	}
 
@@ -522,12 +646,12 @@ int createPIDfile(void){
 
 	pid_t ppid = getpid();
 
-	sprintf(g.strbuf, "%d\n", ppid);
-	if (write(pfd, g.strbuf, strlen(g.strbuf)) == -1)	// Try to write the PID
+	sprintf(f.strbuf, "%d\n", ppid);
+	if (write(pfd, f.strbuf, strlen(f.strbuf)) == -1)	// Try to write the PID
 	{
 		close(pfd);
-		sprintf(g.logbuf, "createPIDfile() Could not write a PID file. Error: %s\n", strerror(errno));
-		writeToLog(g.logbuf);
+		sprintf(f.logbuf, "createPIDfile() Could not write a PID file. Error: %s\n", strerror(errno));
+		writeToLog(f.logbuf);
 		return -1;									// Write failed.
 	}
 	close(pfd);
@@ -535,34 +659,6 @@ int createPIDfile(void){
 	return ppid;
 }
 
-/**
- * Tests configuration strings from /etc/pps-client.conf
- * for a numeric value and returns it in the value pointer.
- * The numeric value may be either int or double with the
- * value pointer and the presence of a decimal point
- * determining int or double.
- *
- * @param[in] config_val The configuration identifier value.
- * @param[out] value The returned numeric value as int or double.
- *
- * @returns "true" if the selected config_str has a numeric
- * value, else "false".
- */
-bool configHasValue(int config_val, void *value){
-	int i = round(log2(config_val));
-	if (g.config_select & config_val){
-		char *val = strpbrk(g.configVals[i], num);
-		if (strpbrk(val, ".") != NULL){
-			sscanf(val, "%lf", (double *)value);
-		}
-		else {
-			sscanf(val, "%d", (int *)value);
-		}
-		return true;
-	}
-	return false;
-}
-
 /**
  * Reads PPS-Client driver GPIO number assignments from
  * "/etc/pps-client.conf" and stores them as temporary
@@ -574,53 +670,196 @@ bool configHasValue(int config_val, void *value){
  * @returns 0 on success else -1.
  */
 int getDriverGPIOvals(void){
+	const struct ppsConfig *cfg = getConfig();
 
-	int value;
-	int rv = 0;
-
-	rv = readConfigFile();
-	if (rv == -1){
-		goto err_end;
+	if (cfg->ppsGPIO < 0 || cfg->outputGPIO < 0 || cfg->intrptGPIO < 0){
+		return -1;
 	}
 
-	if (configHasValue(PPS_GPIO, &value)){
-		g.ppsGPIO = value;
+	g.ppsGPIO = cfg->ppsGPIO;
+	g.outputGPIO = cfg->outputGPIO;
+	g.intrptGPIO = cfg->intrptGPIO;
+	return 0;
+}
+
+/**
+ * Removes leading and trailing spaces and tabs
+ * from str in place.
+ *
+ * @param[in,out] str The string.
+ *
+ * @returns A pointer to the first non-space character.
+ */
+char *trimSpaces(char *str){
+	while (*str == ' ' || *str == '\t'){
+		str += 1;
 	}
-	else {
-		goto err_end;
+	char *end = str + strlen(str);
+	while (end > str && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')){
+		end -= 1;
 	}
+	*end = '\0';
+	return str;
+}
 
-	if (configHasValue(OUTPUT_GPIO, &value)){
-		g.outputGPIO = value;
+/**
+ * Parses a "key=value" line from the config file into
+ * cfg. The key must exactly match one of configKeys[].
+ * Unrecognized keys and values are logged and ignored.
+ *
+ * @param[in,out] line The line. Modified by parsing.
+ * @param[out] cfg The config.
+ */
+void parseConfigLine(char *line, struct ppsConfig *cfg){
+	char *key = trimSpaces(line);
+	if (key[0] == '\0' || key[0] == '#'){				// Blank or comment line.
+		return;
 	}
-	else {
-		goto err_end;
+
+	char *value = strchr(key, '=');
+	if (value == NULL){
+		sprintf(f.logbuf, "readConfigFile(): Ignored config line with no value: %s\n", key);
+		writeToLog(f.logbuf);
+		return;
 	}
+	*value = '\0';
+	value = trimSpaces(value + 1);
+	key = trimSpaces(key);
+
+	int nKeys = sizeof(configKeys) / sizeof(struct configKey);
+	for (int i = 0; i < nKeys; i++){
+		if (strcmp(key, configKeys[i].key) != 0){
+			continue;
+		}
+
+		char *pVal = (char *)cfg + configKeys[i].offset;
+		char *end;
+		long num;
 
-	if (configHasValue(INTRPT_GPIO, &value)){
-		g.intrptGPIO = value;
+		switch (configKeys[i].type){
+		case CONFIG_BOOL:
+			if (strcmp(value, "enable") == 0){
+				*(bool *)pVal = true;
+				return;
+			}
+			if (strcmp(value, "disable") == 0){
+				*(bool *)pVal = false;
+				return;
+			}
+			break;
+		case CONFIG_INT:
+			num = strtol(value, &end, 10);
+			if (end != value && *end == '\0'){
+				*(int *)pVal = (int)num;
+				return;
+			}
+			break;
+		case CONFIG_STRING:
+			if (strlen(value) > 0 && strlen(value) < CONFIG_STR_SZ){
+				strcpy(pVal, value);
+				return;
+			}
+			break;
+		}
+
+		sprintf(f.logbuf, "readConfigFile(): Ignored invalid value for %s: %s\n", key, value);
+		writeToLog(f.logbuf);
+		return;
 	}
-	else {
-		goto err_end;
+
+	sprintf(f.logbuf, "readConfigFile(): Ignored unrecognized config key: %s\n", key);
+	writeToLog(f.logbuf);
+}
+
+/**
+ * Copies the settings from cfg that are held in G.
+ * Called only by the control thread, when PPS-Client
+ * starts, at a restart and by applyReloadedConfig().
+ *
+ * The sntp, serial and serialPort settings start the
+ * SNTP and serial port query threads, so they are
+ * taken from the config applied when PPS-Client
+ * started and a reload does not change them.
+ *
+ * @param[in] cfg The config.
+ */
+void applyConfig(const struct ppsConfig *cfg){
+	if (! f.isStarted){
+		memcpy(&f.startConfig, cfg, sizeof(struct ppsConfig));
+		f.isStarted = true;
 	}
 
-	return rv;
+	g.doCalibration = cfg->calibrate;
+	g.exitOnLostPPS = cfg->exitLostPPS;
+	g.doNTPsettime = f.startConfig.sntp && ! f.startConfig.serial;
+	g.doSerialsettime = f.startConfig.serial;
+	g.doFastAcquire = cfg->fastAcquire;
+	strcpy(g.serialPort, f.startConfig.serialPort);
 
-err_end:
-	return -1;
+	g.doKalman = strcmp(cfg->controller, "kalman") == 0;
+	if (! g.doKalman && strcmp(cfg->controller, "pi") != 0){
+		sprintf(g.logbuf, "applyConfig(): Unrecognized controller %s. Using pi.\n", cfg->controller);
+		writeToLog(g.logbuf);
+	}
+
+	if (cfg->delayWindow > 0){
+		g.delayWindow = cfg->delayWindow > MEDIAN_WINDOW_MAX ? MEDIAN_WINDOW_MAX : cfg->delayWindow;
+	}
 }
 
 /**
- * Reads the PPS-Client config file and sets bits
- * in g.config_select to 1 or 0 corresponding to
- * whether a particular g.configVals appears in the
- * config file. The g.configVals from the file is then
- * copied to fbuf and a pointer to that string is
- * placed in the g.configVals array.
+ * Applies the config last read by readConfigFile() on
+ * the I/O worker. Called by the control thread when
+ * PPS-Client starts and at the start of the second
+ * after getConfigGen() changes so that the G settings
+ * are only written by the control thread.
+ *
+ * Logs any change to the settings that are read only
+ * when PPS-Client starts.
  *
- * If the g.configVals did not occur in the config file
- * then g.configVals has a NULL char* in the corresponding
- * location.
+ * Then acknowledges the config so that readConfigFile()
+ * can reuse the config that it replaced, and rereads the
+ * config file if a reread was deferred until then.
+ *
+ * @returns The getConfigGen() count of the config.
+ */
+unsigned int applyReloadedConfig(void){
+	unsigned int gen = getConfigGen();
+	const struct ppsConfig *cfg = getConfig();
+
+	if (f.isStarted && (cfg->sntp != f.startConfig.sntp || cfg->serial != f.startConfig.serial
+			|| strcmp(cfg->serialPort, f.startConfig.serialPort) != 0
+			|| strcmp(cfg->ppsDevice, f.startConfig.ppsDevice) != 0)){
+		sprintf(g.logbuf, "applyReloadedConfig(): sntp, serial, serialPort and pps-device are read only when PPS-Client starts. Restart to apply them.\n");
+		writeToLog(g.logbuf);
+	}
+
+	applyConfig(cfg);
+
+	__atomic_store_n(&f.configAck, gen, __ATOMIC_SEQ_CST);
+	if (__atomic_exchange_n(&f.isReloadDeferred, false, __ATOMIC_SEQ_CST)){
+		readConfigFile();								// Passed to the I/O worker.
+	}
+	return gen;
+}
+
+/**
+ * Reads the PPS-Client config file and parses it into
+ * a new struct ppsConfig that then replaces the current
+ * config returned by getConfig(). Called on startup and
+ * by the I/O worker when configFileChanged() reports
+ * that the config file was written.
+ *
+ * Only publishes the new config and increments the count
+ * returned by getConfigGen(). The settings held in G are
+ * copied from it by the control thread with applyConfig().
+ *
+ * The new config is parsed into the config that was
+ * replaced by the last reread. Until the control thread
+ * has applied the current config it may still be reading
+ * that one, for example when an editor saves the file
+ * twice in quick succession, so the reread is deferred
+ * until applyReloadedConfig().
  *
  * @returns 0 on success, else -1 on error.
  */
@@ -628,161 +867,301 @@ int readConfigFile(void){
 
 	struct stat stat_buf;
 
-	int rvs = stat(config_file, &f.configFileStat);
-	if (rvs == -1){
-		sprintf(g.logbuf, "readConfigFile(): Config file not found.\n");
-		writeToLog(g.logbuf);
-		return -1;									// No config file
+	if (isControlThread()){
+		postIORequest(IO_READ_CONFIG, NULL);
+		return 0;
 	}
 
-	timespec t = f.configFileStat.st_mtim;
-
-	if (g.configWasRead && g.seq_num > 0 && f.modifyTime == t.tv_sec){
-		return 0;									// Config file unchanged from last read
+	if (getConfigGen() != __atomic_load_n(&f.configAck, __ATOMIC_SEQ_CST)){
+		__atomic_store_n(&f.isReloadDeferred, true, __ATOMIC_SEQ_CST);
+		if (getConfigGen() != __atomic_load_n(&f.configAck, __ATOMIC_SEQ_CST)){
+			return 0;									// Reread by applyReloadedConfig().
+		}
 	}
 
-	f.modifyTime = t.tv_sec;
-
 	int fd = open_logerr(config_file, O_RDONLY);
 	if (fd == -1){
-		return -1;
+		return -1;									// No config file
 	}
 
 	fstat(fd, &stat_buf);
 	int sz = stat_buf.st_size;
 
 	if (sz >= CONFIG_FILE_SZ){
-		sprintf(g.logbuf, "readConfigFile(): not enough space allocated for config file.\n");
-		writeToLog(g.logbuf);
+		sprintf(f.logbuf, "readConfigFile(): not enough space allocated for config file.\n");
+		writeToLog(f.logbuf);
+		close(fd);
 		return -1;
 	}
 
-	int rv = read_logerr(fd, g.configBuf, sz, config_file);
+	int rv = read_logerr(fd, f.configBuf, sz, config_file);
+	close(fd);
 	if (rv == -1 || sz != rv){
 		return -1;
 	}
-	close(fd);
 
-	g.configBuf[sz] = '\0';
+	f.configBuf[sz] = '\0';
 
-	int nCfgStrs = 0;
-	int i;
+	struct ppsConfig *cfg = (getConfig() == &f.config[0]) ? &f.config[1] : &f.config[0];
+	setConfigDefaults(cfg);
 
-	char *pToken = strtok(g.configBuf, "\n");			// Separate tokens at "\n".
+	char *savePtr;
+	char *line = strtok_r(f.configBuf, "\n", &savePtr);
+	while (line != NULL){
+		parseConfigLine(line, cfg);
+		line = strtok_r(NULL, "\n", &savePtr);
+	}
 
-	while (pToken != NULL){
-		if (strlen(pToken) != 0){						// If not a blank line.
-			for (int j = 0; j < 10; j++){				// Skip leading spaces.
-				if (pToken[0] == ' '){
-					pToken += 1;
-				}
-				else {
-					break;								// Break on first non-space character.
-				}
-			}
+	__atomic_store_n(&f.pConfig, cfg, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&f.configGen, 1, __ATOMIC_RELEASE);
+	return 0;
+}
 
-			if (pToken[0] != '#'){						// Ignore comment lines.
-				g.configVals[nCfgStrs] = pToken;
-				nCfgStrs += 1;
-			}
-		}
-		pToken = strtok(NULL, "\n");						// Get the next token.
+/**
+ * Creates an inotify watch on the directory of the config
+ * file so that configFileChanged() can detect when the
+ * config file is written or replaced.
+ *
+ * @returns The inotify file descriptor, else -1 on error.
+ */
+int openConfigWatch(void){
+	char dir[STRBUF_SZ];
+
+	strcpy(dir, config_file);
+	char *pName = strrchr(dir, '/');
+	if (pName != NULL){
+		*pName = '\0';
 	}
 
-	if (nCfgStrs == 0){
-		return 0;
+	int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd == -1){
+		sprintf(g.logbuf, "openConfigWatch() inotify_init1() failed with msg: %s\n", strerror(errno));
+		writeToLog(g.logbuf);
+		return -1;
+	}
+
+	if (inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) == -1){
+		sprintf(g.logbuf, "openConfigWatch() inotify_add_watch() failed with msg: %s\n", strerror(errno));
+		writeToLog(g.logbuf);
+		close(fd);
+		return -1;
 	}
+	return fd;
+}
+
+/**
+ * Reads the pending events from the inotify watch
+ * created by openConfigWatch().
+ *
+ * @param[in] fd The inotify file descriptor.
+ *
+ * @returns "true" if the config file was written or
+ * replaced, else "false".
+ */
+bool configFileChanged(int fd){
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	bool changed = false;
 
-	for (i = 0; i < nCfgStrs; i++){						// Compact g.configBuf to remove string terminators inserted by
-		if (i == 0){										// strtok() so that g.configBuf can be searched as a single string.
-			strcpy(g.configBuf, g.configVals[i]);
+	const char *name = strrchr(config_file, '/');
+	name = (name == NULL) ? config_file : name + 1;
+
+	for (;;){
+		ssize_t len = read(fd, buf, sizeof(buf));
+		if (len <= 0){
+			break;
 		}
-		else {
-			strcat(g.configBuf, g.configVals[i]);
+
+		for (char *p = buf; p < buf + len; ){
+			struct inotify_event *event = (struct inotify_event *)p;
+			if (event->len > 0 && strcmp(event->name, name) == 0){
+				changed = true;
+			}
+			p += sizeof(struct inotify_event) + event->len;
 		}
-		strcat(g.configBuf, "\n");
 	}
+	return changed;
+}
 
-	int nValidCnfgs = sizeof(valid_config) / sizeof(char *);
+/**
+ * Writes buf to filename so that readers never see a
+ * partly written file: buf is written with one write()
+ * to a temporary file that is then renamed to filename.
+ *
+ * @param[in] filename The file to write.
+ * @param[in] buf The file contents.
+ * @param[in] len The length of the file contents.
+ *
+ * @returns 0 on success, else -1 on error.
+ */
+int writeFileAtomic(const char *filename, const char *buf, int len){
+	char tmpName[STRBUF_SZ];
 
-	char **configVal = g.configVals;						// Use g.configVals to return pointers to value strings
-	char *value;
+	sprintf(tmpName, "%s.tmp", filename);
 
-	for (i = 0; i < nValidCnfgs; i++){
+	int fd = open_logerr(tmpName, O_CREAT | O_WRONLY | O_TRUNC);
+	if (fd == -1){
+		return -1;
+	}
 
-		char *found = strstr(g.configBuf, valid_config[i]);
-		if (found != NULL){
-			g.config_select |= 1 << i;					// Set a bit in config_select
+	int rv = write(fd, buf, len);
+	close(fd);
+	if (rv != len){
+		sprintf(f.logbuf, "writeFileAtomic() Unable to write to %s. Error: %s\n", filename, strerror(errno));
+		writeToLog(f.logbuf);
+		remove(tmpName);
+		return -1;
+	}
 
-			value = strpbrk(found, "=");					// Get the value string following '='.
-			value += 1;
+	if (rename(tmpName, filename) == -1){
+		sprintf(f.logbuf, "writeFileAtomic() Unable to rename to %s. Error: %s\n", filename, strerror(errno));
+		writeToLog(f.logbuf);
+		remove(tmpName);
+		return -1;
+	}
+	return 0;
+}
 
-			configVal[i] = value;						// Point to g.configVals[i] value string in g.configBuf
-		}
-		else {
-			g.config_select &= ~(1 << i);				// Clear a bit in config_select
-			configVal[i] = NULL;
-		}
+/**
+ * Copies a distribution for the I/O worker to write to
+ * its file. At the end of each epoch of SECS_PER_DAY
+ * samples the copy is marked for the file to be rolled
+ * over and the distribution is cleared to begin the
+ * next one. Called only by the control thread, which
+ * adds the samples, so no sample is lost to the reset.
+ *
+ * @param[out] c The copy.
+ * @param[in,out] distrib The distribution.
+ * @param[in] size The size of the distribution in bytes.
+ * @param[in] label The sysDelay value of each column of a
+ * multiple distribution or NULL.
+ * @param[in] count The current number of samples in the distribution.
+ * @param[in,out] last_epoch The epoch of the last copy.
+ */
+void copyDistrib(struct distribCopy *c, void *distrib, size_t size, const int label[], int count, int *last_epoch){
+	if (count == c->count){								// No samples added since the last copy.
+		return;
 	}
 
-	for (i = 0; i < nValidCnfgs; i++){					// Replace the "\n" at the end of each value
-		if (configVal[i] != NULL){						// string with a string terminator.
-			value = strpbrk(configVal[i], "\n");
-			if (value != NULL){
-				*value = 0;
-			}
-		}
+	int epoch = count / SECS_PER_DAY;
+
+	beginCopy(&c->seq);
+	c->count = count;
+	c->isEpochEnd = (epoch != *last_epoch);
+	if (label != NULL){
+		memcpy(c->label, label, NUM_PARAMS * sizeof(int));
+	}
+	memcpy(c->distrib, distrib, size);
+	endCopy(&c->seq);
+
+	if (epoch != *last_epoch){
+		*last_epoch = epoch;
+		memset(distrib, 0, size);
 	}
+}
+
+/**
+ * Copies each distribution that is due to be written
+ * to its file, approximately once a minute when 60
+ * more samples have been added to it. Called by the
+ * control thread from processFiles().
+ */
+void copyDistribs(void){
+	const struct ppsConfig *cfg = getConfig();
 
-	if (g.seq_num > 0){
-		g.configWasRead = true;							// Insures that config file read at least once.
+	if (g.seq_num <= SETTLE_TIME){
+		return;
 	}
 
-	return 0;
+	if (cfg->errorDistrib && g.errorCount % SECS_PER_MINUTE == 0){
+		copyDistrib(&f.errorCopy, g.errorDistrib, sizeof(g.errorDistrib), NULL, g.errorCount, &f.lastErrorFileno);
+	}
+
+	if (cfg->jitterDistrib && g.jitterCount % SECS_PER_MINUTE == 0){
+		copyDistrib(&f.jitterCopy, g.jitterDistrib, sizeof(g.jitterDistrib), NULL, g.jitterCount, &f.lastJitterFileno);
+	}
+
+	if (g.doCalibration && cfg->interruptDistrib && g.interruptCount % SECS_PER_MINUTE == 0){
+		copyDistrib(&f.intrptCopy, g.intrptDistrib, sizeof(g.intrptDistrib), g.delayLabel, g.interruptCount, &f.lastIntrptFileno);
+	}
+
+	if (g.doCalibration && cfg->sysDelayDistrib && g.sysDelayCount % SECS_PER_MINUTE == 0 && g.hardLimit == HARD_LIMIT_1){
+		copyDistrib(&f.sysDelayCopy, g.sysDelayDistrib, sizeof(g.sysDelayDistrib), NULL, g.sysDelayCount, &f.lastSysDelayFileno);
+	}
+}
+
+/**
+ * Copies the arrays written on a save data request once
+ * a minute so that the I/O worker writes them from the
+ * copy and not from G while the control thread adds to
+ * them. Called by the control thread from processFiles().
+ */
+void copySaveArrays(void){
+	if (f.saveCopy.seq != 0 && g.seq_num >= f.saveCopySeqNum
+			&& g.seq_num - f.saveCopySeqNum < SECS_PER_MINUTE){
+		return;
+	}
+	f.saveCopySeqNum = g.seq_num;
+
+	beginCopy(&f.saveCopy.seq);
+	memcpy(f.saveCopy.rawErrorDistrib, g.rawErrorDistrib, sizeof(g.rawErrorDistrib));
+	memcpy(f.saveCopy.intrptErrorDistrib, g.intrptErrorDistrib, sizeof(g.intrptErrorDistrib));
+	memcpy(&f.saveCopy.jitterHist, &g.jitterHist, sizeof(struct hdrHist));
+	memcpy(&f.saveCopy.errorHist, &g.errorHist, sizeof(struct hdrHist));
+	memcpy(&f.saveCopy.intrptHist, &g.intrptHist, sizeof(struct hdrHist));
+	endCopy(&f.saveCopy.seq);
 }
 
 /**
- * Writes an accumulating statistical distribution to disk and
- * rolls over the accumulating data to a new file every epoch
- * counts and begins a new distribution file. An epoch is
- * 86,400 counts.
+ * Gets a copy of a distribution made by copyDistrib()
+ * if it has been copied again since it was last taken.
+ * Called by the I/O worker.
+ *
+ * @param[in] c The copy.
+ * @param[in,out] lastSeq The seq of the copy last taken.
+ *
+ * @returns A pointer to a snapshot of the copy or NULL
+ * if there is no new copy.
+ */
+const struct distribCopy *takeDistribCopy(const struct distribCopy *c, unsigned int *lastSeq){
+	if (__atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) == *lastSeq){
+		return NULL;
+	}
+	if (readCopy(&c->seq, c, &f.distribSnap, sizeof(struct distribCopy)) == -1){
+		return NULL;
+	}
+	*lastSeq = f.distribSnap.seq;
+	return &f.distribSnap;
+}
+
+/**
+ * Writes an accumulating statistical distribution to disk
+ * and, at the end of an epoch of 86,400 counts, rolls the
+ * file over so that a new distribution file is begun.
  *
  * @param[in] distrib The array containing the distribution.
  * @param[in] len The length of the array.
  * @param[in] scaleZero The array index corresponding to distribution zero.
- * @param[in] count The current number of samples in the distribution.
- * @param[out] last_epoch The saved count of the previous epoch.
- * @param[in] distrib_file The filename of the last completed
- * distribution file.
- * @param[in] last_distrib_file The filename of the currently
+ * @param[in] binWidth The width of a distribution bin in microseconds.
+ * @param[in] isEpochEnd "true" if the file is to be rolled over.
+ * @param[in] distrib_file The filename of the currently
  * forming distribution file.
+ * @param[in] last_distrib_file The filename of the last
+ * completed distribution file.
  */
-void writeDistribution(int distrib[], int len, int scaleZero, int count,
-		int *last_epoch, const char *distrib_file, const char *last_distrib_file){
-	int rv = 0;
-	remove(distrib_file);
-	int fd = open_logerr(distrib_file, O_CREAT | O_WRONLY | O_APPEND);
-	if (fd == -1){
-		return;
-	}
+void writeDistribution(const int distrib[], int len, int scaleZero, double binWidth, bool isEpochEnd,
+		const char *distrib_file, const char *last_distrib_file){
+	int fileLen = 0;
+
 	for (int i = 0; i < len; i++){
-		sprintf(g.strbuf, "%d %d\n", i-scaleZero, distrib[i]);
-		rv = write(fd, g.strbuf, strlen(g.strbuf));
-		if (rv == -1){
-			sprintf(g.logbuf, "writeDistribution() Unable to write to %s. Error: %s\n", distrib_file, strerror(errno));
-			writeToLog(g.logbuf);
-			close(fd);
-			return;
-		}
+		fileLen += sprintf(f.filebuf + fileLen, "%g %d\n", (double)(i - scaleZero) * binWidth, distrib[i]);
 	}
-	close(fd);
 
-	int epoch = count / SECS_PER_DAY;
-	if (epoch != *last_epoch ){
-		*last_epoch = epoch;
-		remove(last_distrib_file);
+	if (writeFileAtomic(distrib_file, f.filebuf, fileLen) == -1){
+		return;
+	}
+
+	if (isEpochEnd){
 		rename(distrib_file, last_distrib_file);
-		memset(distrib, 0, len * sizeof(int));
 	}
 }
 
@@ -795,28 +1174,21 @@ void writeDistribution(int distrib[], int len, int scaleZero, int count,
  * values as column headings. The second line of
  * the file lists the column total samples.
  *
- * Rolls over the accumulating data to a new file
- * every epoch counts and begins a new distribution
- * file. An epoch is 86,400 counts.
+ * At the end of an epoch of 86,400 counts, rolls
+ * the file over so that a new distribution file
+ * is begun.
  *
  * @param[in] label The sysDelay values for each column.
  * @param[in] distrib The arrays containing the distributions.
  * @param[in] len The length of the distrib[] arrays.
  * @param[in] scaleZero The array index corresponding to distribution zero.
- * @param[in] count The current total number of samples in the distributions.
- * @param[out] last_epoch The saved count of the previous epoch.
- * @param[in] distrib_file The filename of the last completed distribution file.
- * @param[in] last_distrib_file The filename of the currently forming file.
+ * @param[in] isEpochEnd "true" if the file is to be rolled over.
+ * @param[in] distrib_file The filename of the currently forming file.
+ * @param[in] last_distrib_file The filename of the last completed distribution file.
  */
-void writeMultipleDistrib(int label[], int distrib[][INTRPT_DISTRIB_LEN], int len, int scaleZero, int count,
-		int *last_epoch, const char *distrib_file, const char *last_distrib_file){
-	int rv;
-
-	remove(distrib_file);
-	int fd = open_logerr(distrib_file, O_CREAT | O_WRONLY | O_APPEND);
-	if (fd == -1){
-		return;
-	}
+void writeMultipleDistrib(const int label[], const int distrib[][INTRPT_DISTRIB_LEN], int len, int scaleZero, bool isEpochEnd,
+		const char *distrib_file, const char *last_distrib_file){
+	int fileLen = 0;
 
 	int totals[NUM_PARAMS] = {0};
 	for (int i = 0; i < INTRPT_DISTRIB_LEN; i++){
@@ -825,45 +1197,19 @@ void writeMultipleDistrib(int label[], int distrib[][INTRPT_DISTRIB_LEN], int le
 		}
 	}
 
-	sprintf(g.strbuf, "%s %d %d %d %d %d\n", "sysDelay:", label[0], label[1], label[2], label[3], label[4]);
-	rv = write(fd, g.strbuf, strlen(g.strbuf));
-	if (rv == -1){
-		sprintf(g.logbuf, "writeMultipleDistrib() Unable to write to %s. Error: %s\n", distrib_file, strerror(errno));
-		writeToLog(g.logbuf);
-		close(fd);
-		return;
-	}
+	fileLen += sprintf(f.filebuf + fileLen, "%s %d %d %d %d %d\n", "sysDelay:", label[0], label[1], label[2], label[3], label[4]);
+	fileLen += sprintf(f.filebuf + fileLen, "%s %d %d %d %d %d\n", "totals:", totals[0], totals[1], totals[2], totals[3], totals[4]);
 
-	sprintf(g.strbuf, "%s %d %d %d %d %d\n", "totals:", totals[0], totals[1], totals[2], totals[3], totals[4]);
-	rv = write(fd, g.strbuf, strlen(g.strbuf));
-	if (rv == -1){
-		sprintf(g.logbuf, "writeMultipleDistrib() Unable to write to %s. Error: %s\n", distrib_file, strerror(errno));
-		writeToLog(g.logbuf);
-		close(fd);
-		return;
+	for (int i = 0; i < len; i++){
+		fileLen += sprintf(f.filebuf + fileLen, "%d %d %d %d %d %d\n", i-scaleZero, distrib[0][i], distrib[1][i], distrib[2][i], distrib[3][i], distrib[4][i]);
 	}
 
-	for (int i = 0; i < len; i++){
-		sprintf(g.strbuf, "%d %d %d %d %d %d\n", i-scaleZero, distrib[0][i], distrib[1][i], distrib[2][i], distrib[3][i], distrib[4][i]);
-		rv = write(fd, g.strbuf, strlen(g.strbuf));
-		if (rv == -1){
-			sprintf(g.logbuf, "writeMultipleDistrib() Unable to write to %s. Error: %s\n", distrib_file, strerror(errno));
-			writeToLog(g.logbuf);
-			close(fd);
-			return;
-		}
+	if (writeFileAtomic(distrib_file, f.filebuf, fileLen) == -1){
+		return;
 	}
-	close(fd);
 
-	int epoch = count / SECS_PER_DAY;
-	if (epoch != *last_epoch ){
-		*last_epoch = epoch;
-		remove(last_distrib_file);
+	if (isEpochEnd){
 		rename(distrib_file, last_distrib_file);
-		for (int i = 0; i < NUM_PARAMS; i++){
-			memset(distrib[i], 0, len * sizeof(int));
-		}
-
 	}
 }
 
@@ -877,9 +1223,10 @@ void writeMultipleDistrib(int label[], int distrib[][INTRPT_DISTRIB_LEN], int le
  * a new file.
  */
 void writeIntrptDistribFile(void){
-	if (g.interruptCount % SECS_PER_MINUTE == 0 && g.seq_num > SETTLE_TIME){
-		writeMultipleDistrib(g.delayLabel, g.intrptDistrib, INTRPT_DISTRIB_LEN, 0, g.interruptCount,
-				&f.lastIntrptFileno, intrpt_distrib_file, last_intrpt_distrib_file);
+	const struct distribCopy *c = takeDistribCopy(&f.intrptCopy, &f.intrptWritten);
+	if (c != NULL){
+		writeMultipleDistrib(c->label, c->multiDistrib, INTRPT_DISTRIB_LEN, 0, c->isEpochEnd,
+				intrpt_distrib_file, last_intrpt_distrib_file);
 	}
 }
 
@@ -889,9 +1236,10 @@ void writeIntrptDistribFile(void){
  * day of sysDelay samples before rolling over a new file.
  */
 void writeSysdelayDistribFile(void){
-	if (g.sysDelayCount % SECS_PER_MINUTE == 0 && g.seq_num > SETTLE_TIME && g.hardLimit == HARD_LIMIT_1){
-		writeDistribution(g.sysDelayDistrib, INTRPT_DISTRIB_LEN, 0, g.sysDelayCount,
-				&f.lastSysDelayFileno, sysDelay_distrib_file, last_sysDelay_distrib_file);
+	const struct distribCopy *c = takeDistribCopy(&f.sysDelayCopy, &f.sysDelayWritten);
+	if (c != NULL){
+		writeDistribution(c->distrib, INTRPT_DISTRIB_LEN, 0, 1.0, c->isEpochEnd,
+				sysDelay_distrib_file, last_sysDelay_distrib_file);
 	}
 }
 
@@ -902,10 +1250,11 @@ void writeSysdelayDistribFile(void){
  * rolled over to a new file every 24 hours.
  */
 void writeJitterDistribFile(void){
-	if (g.jitterCount % SECS_PER_MINUTE == 0 && g.seq_num > SETTLE_TIME){
+	const struct distribCopy *c = takeDistribCopy(&f.jitterCopy, &f.jitterWritten);
+	if (c != NULL){
 		int scaleZero = JITTER_DISTRIB_LEN / 6;
-		writeDistribution(g.jitterDistrib, JITTER_DISTRIB_LEN, scaleZero, g.jitterCount,
-				&f.lastJitterFileno, jitter_distrib_file, last_jitter_distrib_file);
+		writeDistribution(c->distrib, JITTER_DISTRIB_LEN, scaleZero, JITTER_DISTRIB_RES, c->isEpochEnd,
+				jitter_distrib_file, last_jitter_distrib_file);
 	}
 }
 
@@ -916,69 +1265,100 @@ void writeJitterDistribFile(void){
  * to a new file every 24 hours.
  */
 void writeErrorDistribFile(void){
-	if (g.errorCount % SECS_PER_MINUTE == 0 && g.seq_num > SETTLE_TIME){
+	const struct distribCopy *c = takeDistribCopy(&f.errorCopy, &f.errorWritten);
+	if (c != NULL){
 		int scaleZero = ERROR_DISTRIB_LEN / 6;
-		writeDistribution(g.errorDistrib, ERROR_DISTRIB_LEN, scaleZero,
-				g.errorCount, &f.lastErrorFileno, distrib_file, last_distrib_file);
+		writeDistribution(c->distrib, ERROR_DISTRIB_LEN, scaleZero, 1.0, c->isEpochEnd,
+				distrib_file, last_distrib_file);
 	}
 }
 
 /**
- * Writes the previously completed list of 10 minutes of recorded
- * time offsets and applied frequency offsets indexed by seq_num.
+ * Writes the last 10 minutes of recorded time offsets and
+ * applied frequency offsets indexed by seq_num from the
+ * history file.
  *
  * @param[in] filename The file to write to.
+ *
+ * @returns 0 on success, else -1 on error.
  */
-void writeOffsets(const char *filename){
-	int fd = open_logerr(filename, O_CREAT | O_WRONLY | O_TRUNC);
-	if (fd == -1){
-		return;
+int writeOffsets(const char *filename){
+	int fileLen = 0;
+
+	int64_t idx = findHistory(time(NULL) - SECS_PER_10_MIN);
+	if (idx == -1){
+		return -1;
 	}
-	for (int i = 0; i < SECS_PER_10_MIN; i++){
-		int j = g.recIndex2 + i;
-		if (j >= SECS_PER_10_MIN){
-			j -= SECS_PER_10_MIN;
-		}
-		sprintf(g.strbuf, "%d %d %lf\n", g.seq_numRec[j], g.offsetRec[j], g.freqOffsetRec2[j]);
-		int rv = write(fd, g.strbuf, strlen(g.strbuf));
-		if (rv == -1){
-			sprintf(g.logbuf, "writeOffsets() Unable to write to %s. Error: %s\n", filename, strerror(errno));
-			writeToLog(g.logbuf);
-		}
+
+	int n = readHistory(idx, f.histbuf, SECS_PER_10_MIN);
+	if (n == -1){
+		return -1;
+	}
+
+	for (int i = 0; i < n; i++){
+		fileLen += sprintf(f.filebuf + fileLen, "%u %.3lf %lf\n", f.histbuf[i].seq_num,
+				f.histbuf[i].timeCorrection, f.histbuf[i].freqOffset);
 	}
-	close(fd);
+	return writeFileAtomic(filename, f.filebuf, fileLen);
 }
 
 /**
  * Writes the last 24 hours of clock frequency offset and Allan
  * deviation in each 5 minute interval indexed by the timestamp
- * at each interval.
+ * at each interval. These are calculated from the frequency
+ * offsets that were set each minute, as recorded in the history
+ * file.
  *
  * @param[in] filename The file to write to.
+ *
+ * @returns 0 on success, else -1 on error.
  */
-void writeFrequencyVars(const char *filename){
-	int fd = open_logerr(filename, O_CREAT | O_WRONLY | O_TRUNC);
-	if (fd == -1){
-		return;
+int writeFrequencyVars(const char *filename){
+	int fileLen = 0;
+	int intervalCount = 0;
+	double freqOffsetSum = 0.0;
+	double diffSum = 0.0;
+	double norm = 1.0 / (double)FREQDIFF_INTRVL;
+
+	int64_t idx = findHistory(time(NULL) - SECS_PER_DAY);
+	if (idx == -1){
+		return -1;
 	}
-	for (int i = 0; i < NUM_5_MIN_INTERVALS; i++){
-		int j = g.recIndex + i;							// Read the circular buffers relative to g.recIndx.
-		if (j >= NUM_5_MIN_INTERVALS){
-			j -= NUM_5_MIN_INTERVALS;
+	double lastFreqOffset = readHistory(idx, f.histbuf, 1) == 1 ? f.histbuf[0].freqOffset : 0.0;
+
+	for (;;){
+		int n = readHistory(idx, f.histbuf, SECS_PER_10_MIN);
+		if (n == -1){
+			return -1;
 		}
-		sprintf(g.strbuf, "%ld %lf %lf\n", g.timestampRec[j], g.freqOffsetRec[j], g.freqAllanDev[j]);
-		int rv = write(fd, g.strbuf, strlen(g.strbuf));
-		if (rv == -1){
-			sprintf(g.logbuf, "writeFrequencyVars() Write to %s failed with error: %s\n", filename, strerror(errno));
-			writeToLog(g.logbuf);
-			close(fd);
-			return;
+		if (n == 0){
+			break;
+		}
+		idx += n;
+
+		for (int i = 0; i < n; i++){
+			const struct historyRec *rec = f.histbuf + i;
+
+			if (rec->flags & HISTORY_FREQ_SET){
+				double diff = rec->freqOffset - lastFreqOffset;
+				freqOffsetSum += rec->freqOffset;
+				diffSum += diff * diff;
+				intervalCount += 1;
+
+				if (intervalCount >= FIVE_MINUTES && fileLen < FILEBUF_SZ - MAX_LINE_LEN){
+					fileLen += sprintf(f.filebuf + fileLen, "%lld %lf %lf\n", (long long)rec->timestamp,
+							freqOffsetSum * norm, sqrt(diffSum * norm * 0.5));
+					intervalCount = 0;
+					freqOffsetSum = 0.0;
+					diffSum = 0.0;
+				}
+			}
+			lastFreqOffset = rec->freqOffset;
 		}
 	}
-	close(fd);
+	return writeFileAtomic(filename, f.filebuf, fileLen);
 }
 
-
 /**
  * Saves a distribution consisting of an array of doubles.
  *
@@ -990,209 +1370,275 @@ void writeFrequencyVars(const char *filename){
  * @returns 0 on success, else -1 on error.
  */
 int saveDoubleArray(double distrib[], const char *filename, int len, int arrayZero){
+	int fileLen = 0;
 
-	int fd = open_logerr(filename, O_CREAT | O_WRONLY | O_TRUNC);
-	if (fd == -1){
-		return -1;
+	for (int i = 0; i < len; i++){
+		fileLen += sprintf(f.filebuf + fileLen, "%d %7.2lf\n", i - arrayZero, distrib[i]);
 	}
 
-	int fileMaxLen = len * MAX_LINE_LEN * sizeof(char);
-	char *filebuf = new char[fileMaxLen];
+	return writeFileAtomic(filename, f.filebuf, fileLen);
+}
+
+/**
+ * Writes the p50, p99, p99.9 and max values of a
+ * histogram followed by the midpoint value in
+ * microseconds and count of each non-empty bucket.
+ *
+ * @param[in] h The histogram.
+ * @param[in] filename The file to write.
+ *
+ * @returns 0 on success, else -1 on error.
+ */
+int writeHistFile(const struct hdrHist *h, const char *filename){
+	char *filebuf = new char[HIST_LEN * MAX_LINE_LEN];
 	int fileLen = 0;
 
-	filebuf[0] = '\0';
-	for (int i = 0; i < len; i++){
-		sprintf(g.strbuf, "%d %7.2lf\n", i - arrayZero, distrib[i]);
-		fileLen += strlen(g.strbuf);
-		strcat(filebuf, g.strbuf);
-	}
+	fileLen += sprintf(filebuf + fileLen, "# count: %llu p50: %.3lf p99: %.3lf p99.9: %.3lf max: %.3lf usec\n",
+			(unsigned long long)h->total, histPercentile(h, 50.0), histPercentile(h, 99.0),
+			histPercentile(h, 99.9), histPercentile(h, 100.0));
 
-	int rv = write(fd, filebuf, fileLen + 1);
-	if (rv == -1){
-		sprintf(g.logbuf, "saveDoubleArray() Write to %s failed with error: %s\n", filename, strerror(errno));
-		writeToLog(g.logbuf);
-		return -1;
+	for (int i = 0; i < HIST_LEN; i++){
+		if (h->counts[i] != 0){
+			fileLen += sprintf(filebuf + fileLen, "%.3lf %u\n", getHistValue(i) / NSECS_PER_USEC, h->counts[i]);
+		}
 	}
 
-	fsync(fd);
-
+	int rv = writeFileAtomic(filename, filebuf, fileLen);
 	delete[] filebuf;
-	close(fd);
-	return 0;
+	return rv;
 }
 
 /**
- * From within the daemon, reads the data label and filename
- * of an array to write to disk from a request made from the
- * command line with "pps-client -s [label] <filename>".
- * Then matches the requestStr to the corresponding arrayData
- * which is then passed to a routine that saves the array
- * identified by the data label.
+ * From within the daemon, takes a pending request made from
+ * the command line with "pps-client -s [label] <filename>"
+ * from the control socket. Then matches the data label to
+ * the corresponding arrayData which is then passed to a
+ * routine that saves the array identified by the data label.
+ * The result is sent back to the command line.
+ *
+ * The arrays are saved from the last copy made by
+ * copySaveArrays().
  *
  * @returns 0 on success else -1 on fail.
  */
 int processWriteRequest(void){
-	struct stat buf;
+	char requestStr[CTL_LABEL_SZ];
+	char filename[CTL_PATH_SZ];
+	int fd;
 
-	int rv = stat(arrayData_file, &buf);			// stat() used only to check that there is an arrayData_file
-	if (rv == -1){
+	if (! takeSaveRequest(requestStr, filename, &fd)){
 		return 0;
 	}
 
-	int fd = open(arrayData_file, O_RDONLY);
-	if (fd == -1){
-		sprintf(g.logbuf, "processWriteRequest() Unable to open %s. Error: %s\n", arrayData_file, strerror(errno));
-		writeToLog(g.logbuf);
-		return -1;
-	}
-
-	char requestStr[25];
-	char filename[225];
-
-	filename[0] = '\0';
-	rv = read(fd, g.strbuf, STRBUF_SZ);
-	sscanf(g.strbuf, "%s %s", requestStr, filename);
-
-	close(fd);
-	remove(arrayData_file);
-
+	int rv = -1;
 	int arrayLen = sizeof(arrayData) / sizeof(struct saveFileData);
+	if (readCopy(&f.saveCopy.seq, &f.saveCopy, &f.saveSnap, sizeof(struct saveCopy)) == -1){
+		arrayLen = 0;
+		sprintf(f.logbuf, "processWriteRequest(): Could not copy the arrays from the control thread.\n");
+		writeToLog(f.logbuf);
+	}
 	for (int i = 0; i < arrayLen; i++){
 		if (strcmp(requestStr, arrayData[i].label) == 0){
 			if (strlen(filename) == 0){
 				strcpy(filename, arrayData[i].filename);
 			}
 			if (arrayData[i].arrayType == 2){
-				saveDoubleArray((double *)arrayData[i].array, filename, arrayData[i].arrayLen, arrayData[i].arrayZero);
+				rv = saveDoubleArray((double *)arrayData[i].array, filename, arrayData[i].arrayLen, arrayData[i].arrayZero);
 				break;
 			}
 			if (arrayData[i].arrayType == 3){
-				writeFrequencyVars(filename);
+				rv = writeFrequencyVars(filename);
 				break;
 			}
 			if (arrayData[i].arrayType == 4){
-				writeOffsets(filename);
+				rv = writeOffsets(filename);
+				break;
+			}
+			if (arrayData[i].arrayType == 5){
+				rv = writeHistFile((struct hdrHist *)arrayData[i].array, filename);
+				break;
+			}
+			if (arrayData[i].arrayType == 6){
+				rv = writeStabilityFile(filename);
+				break;
+			}
+			if (arrayData[i].arrayType == 7){
+				rv = writeShadowFile(filename);
 				break;
 			}
 
 		}
 	}
+
+	if (rv == 0){
+		snprintf(f.strbuf, STRBUF_SZ, "Wrote %s\n", filename);
+	}
+	else {
+		snprintf(f.strbuf, STRBUF_SZ, "Failed to write \"%s\" to %s. See the log file.\n", requestStr, filename);
+	}
+	replySaveRequest(fd, rv, f.strbuf);
 	return 0;
 }
 
 /**
- * Processes the files and configuration settings specified
- * by the PPS-Client config file.
+ * Writes the files specified by the PPS-Client config
+ * file and processes any pending save data request.
+ *
+ * Called from the control thread, first copies the
+ * distributions that are due to be written and the
+ * save data request arrays, so that the I/O worker
+ * writes them from the copies and not from G while
+ * the control thread adds to them.
  */
 int processFiles(void){
 
-	int rv = readConfigFile();
-	if (rv == -1){
-		return rv;
-	}
-
-	if (isEnabled(ERROR_DISTRIB)){
-		writeErrorDistribFile();
-	}
-
-	if (isEnabled(JITTER_DISTRIB)){
-		writeJitterDistribFile();
+	if (isControlThread()){
+		copyDistribs();
+		copySaveArrays();
+		postIORequest(IO_PROCESS_FILES, NULL);
+		return 0;
 	}
 
-	if (isEnabled(CALIBRATE)){
-		g.doCalibration = true;
-	}
-	else if (isDisabled(CALIBRATE)){
-		g.doCalibration = false;
-	}
+	writeErrorDistribFile();
+	writeJitterDistribFile();
+	writeIntrptDistribFile();
+	writeSysdelayDistribFile();
 
-	if (isEnabled(EXIT_LOST_PPS)){
-		g.exitOnLostPPS = true;
-	}
-	else if (isDisabled(EXIT_LOST_PPS)){
-		g.exitOnLostPPS = false;
+	int rv = processWriteRequest();
+	if (rv == -1){
+		return rv;
 	}
 
-	if (g.doCalibration && isEnabled(INTERRUPT_DISTRIB)){
-		writeIntrptDistribFile();
-	}
+	return 0;
+}
 
-	if (g.doCalibration && isEnabled(SYSDELAY_DISTRIB)){
-		writeSysdelayDistribFile();
-	}
+/**
+ * Creates and maps the shared memory segment to which
+ * the PPS timestamp, sysDelay and controller state are
+ * published each second by writeSharedState(). The
+ * layout of the segment is defined in pps-shm.h.
+ *
+ * @returns 0 on success, else -1 on error.
+ */
+int openSharedState(void){
+	mode_t mode = S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH;
 
-	if (isEnabled(SNTP)){
-		g.doNTPsettime = true;
-	}
-	else if (isDisabled(SNTP)){
-		g.doNTPsettime = false;
+	int fd = shm_open(PPS_SHM_NAME, O_CREAT | O_RDWR, mode);
+	if (fd == -1){
+		sprintf(f.logbuf, "openSharedState() shm_open() failed with error: %s\n", strerror(errno));
+		writeToLog(f.logbuf);
+		return -1;
 	}
 
-	if (isEnabled(SERIAL)){
-		g.doNTPsettime = false;
-		g.doSerialsettime = true;
-	}
-	else if (isDisabled(SERIAL)){
-		g.doSerialsettime = false;
+	if (ftruncate(fd, sizeof(struct ppsShm)) == -1){
+		sprintf(f.logbuf, "openSharedState() ftruncate() failed with error: %s\n", strerror(errno));
+		writeToLog(f.logbuf);
+		close(fd);
+		return -1;
 	}
 
-	char *sp = getString(SERIAL_PORT);
-	if (sp != NULL){
-		strcpy(g.serialPort, sp);
+	void *p = mmap(NULL, sizeof(struct ppsShm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED){
+		sprintf(f.logbuf, "openSharedState() mmap() failed with error: %s\n", strerror(errno));
+		writeToLog(f.logbuf);
+		return -1;
 	}
 
-	rv = processWriteRequest();
-	if (rv == -1){
-		return rv;
-	}
+	f.shm = (struct ppsShm *)p;
+	memset(f.shm, 0, sizeof(struct ppsShm));
+	f.shm->magic = PPS_SHM_MAGIC;
+	f.shm->version = PPS_SHM_VERSION;
+	f.shm->head = PPS_SHM_NUM_TIMESTAMPS - 1;
 
 	return 0;
 }
 
 /**
- * Write g.sysDelay to a temporary file each second.
- *
- * The sysDelay value can be read by other programs
- * that are timing external interrupts.
+ * Returns the shared memory segment written by
+ * writeSharedState() or NULL if it is not open.
+ * Read it with readPPSshm().
  */
-void writeSysDelay(void){
-	memset(g.strbuf, 0, STRBUF_SZ);
-	sprintf(g.strbuf, "%d#%d\n", g.sysDelay + g.sysDelayShift, g.seq_num);
-	remove(sysDelay_file);
-	int pfd = open_logerr(sysDelay_file, O_CREAT | O_WRONLY);
-	if (pfd == -1){
-		return;
-	}
-	int rv = write(pfd, g.strbuf, strlen(g.strbuf) + 1);		// Write PPS sysDelay to sysDelay_file
-	if (rv == -1){
-		sprintf(g.logbuf, "writeSysDelay() Write to memory file failed with error: %s\n", strerror(errno));
-		writeToLog(g.logbuf);
+const struct ppsShm *getSharedState(void){
+	return f.shm;
+}
+
+/**
+ * Invalidates, unmaps and removes the shared memory
+ * segment. Readers that still have it mapped then get
+ * an error from readPPSshm() and map it again.
+ */
+void closeSharedState(void){
+	struct ppsShm *shm = f.shm;
+
+	if (shm != NULL){
+		__atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		shm->magic = 0;
+		__atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELEASE);
+
+		munmap(f.shm, sizeof(struct ppsShm));
+		f.shm = NULL;
+		shm_unlink(PPS_SHM_NAME);
 	}
-	close(pfd);
 }
 
 /**
- * Write a timestamp provided as a double to a temporary
- * file each second.
+ * Copies the summary of a histogram to the shared memory
+ * segment.
+ *
+ * @param[in] h The histogram.
+ * @param[out] s The summary in the segment.
+ */
+void writeSharedHist(const struct hdrHist *h, struct ppsShmHist *s){
+	s->p50 = histPercentile(h, 50.0);
+	s->p99 = histPercentile(h, 99.0);
+	s->p999 = histPercentile(h, 99.9);
+	s->max = histPercentile(h, 100.0);
+	s->count = h->total;
+}
+
+/**
+ * Publishes the timestamp of the PPS rising edge, the
+ * current sysDelay, the controller state and the
+ * histogram summaries each second to the shared memory
+ * segment.
  *
- * @param[in] timestamp The timestamp value.
+ * The segment is written inside a sequence lock so that
+ * readers can copy a consistent snapshot without system
+ * calls (see readPPSshm() in pps-shm.h).
  */
-void writeTimestamp(double timestamp){
-	memset(g.strbuf, 0, STRBUF_SZ);
-
-	sprintf(g.strbuf, "%lf#%d\n", timestamp, g.seq_num);
-	remove(assert_file);
+void writeSharedState(void){
+	struct ppsShm *shm = f.shm;
 
-	int pfd = open_logerr(assert_file, O_CREAT | O_WRONLY);
-	if (pfd == -1){
+	if (shm == NULL || clk->isSimulated){
 		return;
 	}
-	int rv = write(pfd, g.strbuf, strlen(g.strbuf) + 1);		// Write PPS timestamp to assert_file
-	if (rv == -1){
-		sprintf(g.logbuf, "writeTimestamp() write to assert_file failed with error: %s\n", strerror(errno));
-		writeToLog(g.logbuf);
-	}
-	close(pfd);
+
+	__atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELAXED);		// Odd: update in progress.
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	uint32_t head = (shm->head + 1) % PPS_SHM_NUM_TIMESTAMPS;
+	shm->ts[head].tv_sec = g.pps_t_sec;
+	shm->ts[head].tv_nsec = g.pps_t_nsec;
+	shm->ts[head].seq_num = g.seq_num;
+	shm->head = head;
+
+	shm->seq_num = g.seq_num;
+	shm->sysDelay = g.sysDelay + g.sysDelayShift;
+	shm->isControlling = g.isControlling;
+	shm->hardLimit = g.hardLimit;
+	shm->freqOffset = g.freqOffset;
+	shm->jitter = g.jitter;
+	shm->avgCorrection = g.avgCorrection;
+	shm->interruptLossCount = g.interruptLossCount;
+	shm->ppsLateCount = g.ppsLateCount;
+	shm->ppsOverruns = g.ppsOverruns;
+	writeSharedHist(&g.jitterHist, &shm->jitterHist);
+	writeSharedHist(&g.errorHist, &shm->errorHist);
+	writeSharedHist(&g.intrptHist, &shm->intrptHist);
+
+	__atomic_store_n(&shm->seq, shm->seq + 1, __ATOMIC_RELEASE);		// Even: update complete.
 }
 
 /**
@@ -1214,8 +1660,8 @@ int alignNumbersAfter(const char *token, char *buf, int len){
 
 	char *str = strstr(buf, token);
 	if (str == NULL){
-		sprintf(g.logbuf, "alignNumbersAfter(): token not found. Exiting.\n");
-		writeToLog(g.logbuf);
+		sprintf(f.logbuf, "alignNumbersAfter(): token not found. Exiting.\n");
+		writeToLog(f.logbuf);
 		return -1;
 	}
 	str += strlen(token);
@@ -1256,8 +1702,8 @@ int alignTokens(const char *refToken, int offset, const char *token, char *buf,
 
 	char *str = strstr(buf, refToken);
 	if (str == NULL){
-		sprintf(g.logbuf, "alignTokens(): refToken not found. Exiting.\n");
-		writeToLog(g.logbuf);
+		sprintf(f.logbuf, "alignTokens(): refToken not found. Exiting.\n");
+		writeToLog(f.logbuf);
 		return -1;
 	}
 	str += strlen(refToken);
@@ -1265,8 +1711,8 @@ int alignTokens(const char *refToken, int offset, const char *token, char *buf,
 
 	str = strstr(buf, token);
 	if (str == NULL){
-		sprintf(g.logbuf, "alignTokens(): token not found. Exiting.\n");
-		writeToLog(g.logbuf);
+		sprintf(f.logbuf, "alignTokens(): token not found. Exiting.\n");
+		writeToLog(f.logbuf);
 		return -1;
 	}
 	pos2 = str - buf;
@@ -1290,56 +1736,92 @@ int alignTokens(const char *refToken, int offset, const char *token, char *buf,
  * @returns 0 on success, else -1 on error.
  */
 int bufferStateParams(void){
+	struct stateParams sp;
+
+	if (g.interruptLossCount != 0){
+		return 0;
+	}
+
+	sp.pps_t_sec = g.pps_t_sec;
+	sp.pps_t_nsec = g.pps_t_nsec;
+	sp.seq_num = g.seq_num;
+	sp.jitter = g.jitter;
+	sp.freqOffset = g.freqOffset;
+	sp.avgCorrection = g.avgCorrection;
+	sp.hardLimit = g.hardLimit;
+	sp.sysDelayShift = g.sysDelayShift;
+	sp.jitterP99 = histPercentile(&g.jitterHist, 99.0);
+
+	if (isControlThread()){
+		struct ioRecord *rec = getIORecord(IO_STATE_PARAMS);
+		if (rec == NULL){
+			return 0;										// Dropped and counted by getIORecord().
+		}
+		rec->params = sp;
+		postIORecord();
+		return 0;
+	}
 
-	if (g.interruptLossCount == 0) {
-		const char *timefmt = "%F %H:%M:%S";
-		char timeStr[30];
-		char printStr[150];
+	return writeStateParams(&sp);
+}
 
-		strftime(timeStr, 30, timefmt, localtime(&g.pps_t_sec));
+/**
+ * Formats the controller state recorded by bufferStateParams()
+ * and passes it to bufferStatusMsg().
+ *
+ * @param[in] sp The controller state.
+ *
+ * @returns 0 on success, else -1 on error.
+ */
+int writeStateParams(const struct stateParams *sp){
+	const char *timefmt = "%F %H:%M:%S";
+	char timeStr[30];
+	char printStr[170];
+	struct tm tmv;
 
-		char *printfmt = g.strbuf;
+	strftime(timeStr, 30, timefmt, localtime_r(&sp->pps_t_sec, &tmv));
 
-		if (g.sysDelayShift == 0){
-			strcpy(printfmt, "%s.%06d  %d  jitter: ");
-		}
-		else {
-			strcpy(printfmt, "%s.%06d  %d *jitter: ");
-		}
+	char *printfmt = f.strbuf;
 
-		strcat(printfmt, "%d freqOffset: %f avgCorrection: %f  clamp: %d\n");
+	if (sp->sysDelayShift == 0){
+		strcpy(printfmt, "%s.%09ld  %d  jitter: ");
+	}
+	else {
+		strcpy(printfmt, "%s.%09ld  %d *jitter: ");
+	}
 
-		sprintf(printStr, printfmt, timeStr, g.pps_t_usec, g.seq_num,
-				g.jitter, g.freqOffset, g.avgCorrection, g.hardLimit);
+	strcat(printfmt, "%.3f freqOffset: %f avgCorrection: %f  clamp: %d  p99: %.3f\n");
 
-		int len = strlen(printStr) + 1;							// strlen + '\0'
-		len = alignNumbersAfter("jitter: ", printStr, len);
-		if (len == -1){
-			return -1;
-		}
-		len = alignTokens("jitter:", 6, "freqOffset:", printStr, len);
-		if (len == -1){
-			return -1;
-		}
-		len = alignNumbersAfter("freqOffset:", printStr, len);
-		if (len == -1){
-			return -1;
-		}
-		len = alignTokens("freqOffset:", 12, "avgCorrection:", printStr, len);
-		if (len == -1){
-			return -1;
-		}
-		len = alignNumbersAfter("avgCorrection: ", printStr, len);
-		if (len == -1){
-			return -1;
-		}
-		len = alignTokens("avgCorrection:", 12, "clamp:", printStr, len);
-		if (len == -1){
-			return -1;
-		}
+	sprintf(printStr, printfmt, timeStr, sp->pps_t_nsec, sp->seq_num,
+			sp->jitter, sp->freqOffset, sp->avgCorrection, sp->hardLimit, sp->jitterP99);
 
-		bufferStatusMsg(printStr);
+	int len = strlen(printStr) + 1;							// strlen + '\0'
+	len = alignNumbersAfter("jitter: ", printStr, len);
+	if (len == -1){
+		return -1;
+	}
+	len = alignTokens("jitter:", 6, "freqOffset:", printStr, len);
+	if (len == -1){
+		return -1;
+	}
+	len = alignNumbersAfter("freqOffset:", printStr, len);
+	if (len == -1){
+		return -1;
+	}
+	len = alignTokens("freqOffset:", 12, "avgCorrection:", printStr, len);
+	if (len == -1){
+		return -1;
+	}
+	len = alignNumbersAfter("avgCorrection: ", printStr, len);
+	if (len == -1){
+		return -1;
+	}
+	len = alignTokens("avgCorrection:", 12, "clamp:", printStr, len);
+	if (len == -1){
+		return -1;
 	}
+
+	bufferStatusMsg(printStr);
 	return 0;
 }
 
@@ -1349,8 +1831,8 @@ int bufferStateParams(void){
  * @returns 0 on success, else the system errno on failure.
  */
 int restartNTP(void){
-	sprintf(g.logbuf, "Restarting NTP\n");
-	writeToLog(g.logbuf);
+	sprintf(f.logbuf, "Restarting NTP\n");
+	writeToLog(f.logbuf);
 
 	int rv = sysCommand("service ntp restart > /run/shm/ntp-restart-msg");
 	writeFileMsgToLog("/run/shm/ntp-restart-msg");
@@ -1378,8 +1860,8 @@ int replaceNTPConfig(const char *fbuf){
 	if (wr != fSize){
 		close(fd);
 		remove(ntp_config_part);
-		sprintf(g.logbuf, "ERROR: Write of new \"/etc/ntp.conf\" failed. Original unchanged.\n");
-		writeToLog(g.logbuf);
+		sprintf(f.logbuf, "ERROR: Write of new \"/etc/ntp.conf\" failed. Original unchanged.\n");
+		writeToLog(f.logbuf);
 		return -1;
 	}
 	fsync(fd);
@@ -1391,8 +1873,8 @@ int replaceNTPConfig(const char *fbuf){
 			rename(ntp_config_file, ntp_config_bac);
 		}
 		else {
-			couldNotOpenMsgTo(g.logbuf, ntp_config_bac);
-			printf("%s", g.logbuf);
+			couldNotOpenMsgTo(f.logbuf, ntp_config_bac);
+			printf("%s", f.logbuf);
 		}
 	}
 	else {
@@ -1501,8 +1983,8 @@ char *copyMajorTo(char *majorPos){
 
 	char *pos = strstr(fbuf, "gps-pps-io");
 	if (pos == NULL){
-		sprintf(g.logbuf, "Can't find gps-pps-io in \"/run/shm/proc_devices\"\n");
-		writeToLog(g.logbuf);
+		sprintf(f.logbuf, "Can't find gps-pps-io in \"/run/shm/proc_devices\"\n");
+		writeToLog(f.logbuf);
 		delete[] fbuf;
 		return NULL;
 	}
@@ -1532,8 +2014,8 @@ char *getLinuxVersion(void){
 	int fd = open("/run/shm/linuxVersion", O_RDONLY);
 	rv = read(fd, fbuf, 20);
 	if (rv == -1){
-		sprintf(g.logbuf, "getLinuxVersion() Unable to read Linux version from /run/shm/linuxVersion\n");
-		writeToLog(g.logbuf);
+		sprintf(f.logbuf, "getLinuxVersion() Unable to read Linux version from /run/shm/linuxVersion\n");
+		writeToLog(f.logbuf);
 		return NULL;
 	}
 	sscanf(fbuf, "%s\n", g.linuxVersion);
@@ -1561,18 +2043,18 @@ int driver_load(int ppsGPIO, int outputGPIO, int intrptGPIO){
 	int fd = open(driverFile, O_RDONLY);
 	if (fd < 0){
 		if (errno == ENOENT){
-			sprintf(g.logbuf, "Linux version changed. Requires\n");
-			printf("%s", g.logbuf);
-			writeToLog(g.logbuf);
-			sprintf(g.logbuf, "reinstall of version-matching pps-client.\n");
-			printf("%s", g.logbuf);
-			writeToLog(g.logbuf);
+			sprintf(f.logbuf, "Linux version changed. Requires\n");
+			printf("%s", f.logbuf);
+			writeToLog(f.logbuf);
+			sprintf(f.logbuf, "reinstall of version-matching pps-client.\n");
+			printf("%s", f.logbuf);
+			writeToLog(f.logbuf);
 		}
 		return -1;
 	}
 	close(fd);
 
-	char *insmod = g.strbuf;
+	char *insmod = f.strbuf;
 	strcpy(insmod, "/sbin/insmod ");
 	strcat(insmod, driverFile);
 	sprintf(insmod + strlen(insmod), " PPS_GPIO=%d OUTPUT_GPIO=%d INTRPT_GPIO=%d", ppsGPIO, outputGPIO, intrptGPIO);
@@ -1584,12 +2066,12 @@ int driver_load(int ppsGPIO, int outputGPIO, int intrptGPIO){
 		return -1;
 	}
 
-	char *mknod = g.strbuf;
+	char *mknod = f.strbuf;
 	strcpy(mknod, "mknod /dev/gps-pps-io c ");
 	char *major = copyMajorTo(mknod + strlen(mknod));
 	if (major == NULL){								// No major found! insmod failed.
-		sprintf(g.logbuf, "driver_load() error: No major found!\n");
-		writeToLog(g.logbuf);
+		sprintf(f.logbuf, "driver_load() error: No major found!\n");
+		writeToLog(f.logbuf);
 		sysCommand("/sbin/rmmod gps-pps-io");
 		return -1;
 	}
@@ -1623,98 +2105,43 @@ void driver_unload(){
 }
 
 /**
- * Extracts the sequence number g.seq_num from a char string
- * and returns the value.
- *
- * @param[in] pbuf The string to search.
- *
- * @returns The sequence number.
- */
-int getSeqNum(const char *pbuf){
-
-	char *pSpc, *pNum;
-	int seqNum = 0;
-
-	pSpc = strpbrk((char *)pbuf, space);
-
-	pNum = strpbrk(pSpc, num);
-	pSpc = strpbrk(pNum, space);
-	pNum = strpbrk(pSpc, num);
-
-	sscanf(pNum, "%d ", &seqNum);
-	return seqNum;
-}
-
-/**
- * Reads the state params saved to shared memory by the
- * PPS-Client daemon and prints the param string to the
- * console each second.
+ * Subscribes to the state params sent by the PPS-Client
+ * daemon each second on the control socket and prints
+ * them to the console as they arrive.
  */
 void showStatusEachSecond(void){
-	struct timeval tv1;
-	struct timespec ts2;
-	char paramsBuf[MSGBUF_SZ];
-	struct stat stat_buf;
-	int seqNum, lastSeqNum = -1;
-
-	int dispTime = 500000;									// Display at half second
+	struct ctlMsg msg;
 
-	gettimeofday(&tv1, NULL);
-	ts2 = setSyncDelay(dispTime, tv1.tv_usec);
+	msg.type = CTL_SUBSCRIBE;
+	msg.status = 0;
+	int fd = sendControlRequest(&msg, offsetof(struct ctlMsg, text), 1);
+	if (fd == -1){
+		return;
+	}
 
 	for (;;){
 
 		if (g.exit_loop){
 			break;
 		}
-		nanosleep(&ts2, NULL);
 
-		int fd = open(displayParams_file, O_RDONLY);
-		if (fd == -1){
-			printf("showStatusEachSecond(): Could not open ");
-			printf("%s", displayParams_file);
-			printf("\n");
+		int rv = recv(fd, &msg, sizeof(struct ctlMsg), 0);
+		if (rv == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)){
+			continue;										// Checks g.exit_loop at least once a second.
 		}
-		else {
-			fstat(fd, &stat_buf);
-			int sz = stat_buf.st_size;
-
-			if (sz >= MSGBUF_SZ){
-				printf("showStatusEachSecond() buffer too small. sz: %d\n", sz);
-				close(fd);
-				break;
-			}
-
-			int rv = read(fd, paramsBuf, sz);
-			close(fd);
-			if (rv == -1){
-				printf("showStatusEachSecond() Read paramsBuf failed with error: %s\n", strerror(errno));
-				break;
-			}
-
-			if (sz > 0){
-
-				paramsBuf[sz]= '\0';
-
-				int clen = strcspn(paramsBuf, "0123456789");
-				if (clen > 0){									// Is an info message line.
-					printf("%s", paramsBuf);
-				}
-				else {											// Is a standard status line.
-					seqNum = getSeqNum(paramsBuf);
-
-					if (seqNum != lastSeqNum){
-						printf("%s", paramsBuf);
-					}
-					lastSeqNum = seqNum;
-				}
-			}
+		if (rv <= (int)offsetof(struct ctlMsg, text)){		// The daemon has stopped.
+			break;
 		}
 
-		gettimeofday(&tv1, NULL);
-
-		ts2 = setSyncDelay(dispTime, tv1.tv_usec);
+		msg.text[MSGBUF_SZ - 1] = '\0';
+		if (msg.type == CTL_REPLY){							// The subscription was refused.
+			printf("%s", msg.text);
+			break;
+		}
+		printf("%s", msg.text);
+		fflush(stdout);
 	}
+	close(fd);
 	printf("Exiting PPS-Client status display\n");
 }
 
@@ -1749,37 +2176,79 @@ bool missingArg(int argc, char *argv[], int i){
 }
 
 /**
- * Transmits a data save request to the PPS-Client daemon via
- * data written to a tmpfs shared memory file.
+ * Transmits a data save request to the PPS-Client daemon on
+ * the control socket and waits for the reply.
  *
  * @param[in] requestStr The request string.
- * @param[in] filename The shared memory file to write to.
+ * @param[in] filename The file to save to or NULL for the
+ * default file.
  *
  * @returns 0 on success, else -1 on error.
  */
 int daemonSaveArray(const char *requestStr, const char *filename){
-	char buf[200];
+	struct ctlMsg msg;
+
+	memset(&msg, 0, sizeof(struct ctlMsg));
+	msg.type = CTL_SAVE;
+	strncpy(msg.save.label, requestStr, CTL_LABEL_SZ - 1);
+	if (filename != NULL){
+		if (strlen(filename) >= CTL_PATH_SZ){
+			printf("Filename is too long.\n");
+			return -1;
+		}
+		strcpy(msg.save.filename, filename);
+	}
 
-	int fd = open_logerr(arrayData_file, O_CREAT | O_WRONLY | O_TRUNC);
+	int fd = sendControlRequest(&msg, offsetof(struct ctlMsg, save) + sizeof(msg.save), CTL_REPLY_SECS);
 	if (fd == -1){
-		printf("daemonSaveArray() Open arrayData_file failed\n");
 		return -1;
 	}
 
-	strcpy(buf, requestStr);
+	int rv = recv(fd, &msg, sizeof(struct ctlMsg), 0);
+	close(fd);
+	if (rv <= (int)offsetof(struct ctlMsg, text)){
+		printf("No reply from the PPS-Client daemon.\n");
+		return -1;
+	}
+
+	msg.text[MSGBUF_SZ - 1] = '\0';
+	printf("%s", msg.text);
+	return msg.status;
+}
 
-	if (filename != NULL){
-		strcat(buf, " ");
-		strcat(buf, filename);
+/**
+ * Requests the current controller params from the
+ * PPS-Client daemon and prints them to the console.
+ *
+ * @returns 0 on success, else -1 on error.
+ */
+int printDaemonParams(void){
+	struct ctlMsg msg;
+
+	msg.type = CTL_QUERY;
+	msg.status = 0;
+	int fd = sendControlRequest(&msg, offsetof(struct ctlMsg, text), CTL_REPLY_SECS);
+	if (fd == -1){
+		return -1;
 	}
 
-	int rv = write(fd, buf, strlen(buf) + 1);
+	int rv = recv(fd, &msg, sizeof(struct ctlMsg), 0);
 	close(fd);
-	if (rv == -1){
-		sprintf(g.logbuf, "daemonSaveArray() Write to tmpfs memory file failed\n");
-		writeToLog(g.logbuf);
+	if (rv < (int)(offsetof(struct ctlMsg, params) + sizeof(struct ctlParams)) || msg.status == -1){
+		printf("No params from the PPS-Client daemon.\n");
 		return -1;
 	}
+
+	const struct ctlParams *p = &msg.params;
+	printf("seq_num: %u\n", p->seq_num);
+	printf("jitter: %.3lf\n", p->jitter);
+	printf("jitter p99: %.3lf\n", p->jitterP99);
+	printf("freqOffset: %lf\n", p->freqOffset);
+	printf("avgCorrection: %lf\n", p->avgCorrection);
+	printf("hardLimit: %d\n", p->hardLimit);
+	printf("isControlling: %d\n", p->isControlling);
+	printf("sysDelay: %d\n", p->sysDelay);
+	printf("interruptLossCount: %d\n", p->interruptLossCount);
 	return 0;
 }
 
@@ -1829,9 +2298,9 @@ int parseSaveDataRequest(int argc, char *argv[], const char *requestStr){
 				printf("Requires a filename.\n");
 				return -1;
 			}
-			strncpy(g.strbuf, argv[j+1], STRBUF_SZ);
-			g.strbuf[strlen(argv[j+1])] = '\0';
-			filename = g.strbuf;
+			strncpy(f.strbuf, argv[j+1], STRBUF_SZ);
+			f.strbuf[strlen(argv[j+1])] = '\0';
+			filename = f.strbuf;
 			break;
 		}
 	}
@@ -1864,6 +2333,9 @@ int parseSaveDataRequest(int argc, char *argv[], const char *requestStr){
  * Recognizes data save requests (-s) and forwards these
  * to the daemon interface.
  *
+ * If the query flag (-q) is read then prints the current
+ * controller params of the running program.
+ *
  * If verbose flag (-v) is read then also displays status
  * params of the running program to the terminal.
  *
@@ -1874,6 +2346,7 @@ int parseSaveDataRequest(int argc, char *argv[], const char *requestStr){
  */
 int accessDaemon(int argc, char *argv[]){
 	bool verbose = false;
+	bool query = false;
 
 	if (! ppsIsRunning()){						// If not running,
 		remove(pidFilename);					// remove a zombie PID filename if found.
@@ -1890,6 +2363,9 @@ int accessDaemon(int argc, char *argv[]){
 			if (strcmp(argv[i], "-v") == 0){
 				verbose = true;
 			}
+			if (strcmp(argv[i], "-q") == 0){
+				query = true;
+			}
 		}
 		for (int i = 1; i < argc; i++){
 			if (strcmp(argv[i], "-s") == 0){	// This is a save data request.
@@ -1906,6 +2382,10 @@ int accessDaemon(int argc, char *argv[]){
 		}
 	}
 
+	if (query && printDaemonParams() == -1){
+		return -2;
+	}
+
 	if (verbose){
 		printf("Displaying second-by-second state params (ctrl-c to quit):\n");
 		showStatusEachSecond();
@@ -1926,9 +2406,9 @@ int accessDaemon(int argc, char *argv[]){
  * @param[in] timeCorrection The time correction value to be
  * accumulated to a distribution.
  */
-void buildErrorDistrib(int timeCorrection){
+void buildErrorDistrib(double timeCorrection){
 	int len = ERROR_DISTRIB_LEN - 1;
-	int idx = timeCorrection + len / 6;
+	int idx = (int)lround(timeCorrection) + len / 6;
 
 	if (idx < 0){
 		idx = 0;
@@ -1946,13 +2426,15 @@ void buildErrorDistrib(int timeCorrection){
  * saved to disk for analysis.
  *
  * All jitter is collected including delay spikes.
+ * Bins are JITTER_DISTRIB_RES microseconds wide so that
+ * sub-microsecond jitter is resolved.
  *
  * @param[in] rawError The raw error jitter value
  * to save to the distribution.
  */
-void buildJitterDistrib(int rawError){
+void buildJitterDistrib(double rawError){
 	int len = JITTER_DISTRIB_LEN - 1;
-	int idx = rawError + len / 6;
+	int idx = (int)lround(rawError / JITTER_DISTRIB_RES) + len / 6;
 
 	if (idx < 0){
 		idx = 0;
@@ -1973,8 +2455,6 @@ void buildJitterDistrib(int rawError){
  */
 void TERMhandler(int sig){
 	signal(SIGTERM, SIG_IGN);
-	sprintf(g.logbuf,"Recieved SIGTERM\n");
-	writeToLog(g.logbuf);
 	g.exit_requested = true;
 	signal(SIGTERM, TERMhandler);
 }
@@ -2020,9 +2500,9 @@ int getDelayIndex(int sysDelay){
  * value returned from the PPS-Client device
  * driver.
  */
-void buildInterruptDistrib(int intrptDelay){
+void buildInterruptDistrib(double intrptDelay){
 	int len = INTRPT_DISTRIB_LEN - 1;
-	int idx = intrptDelay;
+	int idx = (int)lround(intrptDelay);
 
 	if (idx > len){
 		idx = len;
@@ -2056,73 +2536,63 @@ void buildSysDelayDistrib(int sysDelay){
 	g.sysDelayCount += 1;
 }
 
-/**
- * Accumulates the clock frequency offset over the last 5 minutes
- * and records offset difference each minute over the previous 5
- * minute interval. This function is called once each minute.
- *
- * The values of offset difference, g.freqOffsetDiff[], are used
- * to calculate the Allan deviation of the clock frequency offset
- * which is determined so that it can be saved to disk.
- * g.freqOffsetSum is used to calculate the average clock frequency
- * offset in each 5 minute interval so that value can also be saved
- * to disk.
- */
-void recordFrequencyVars(void){
-	timeval t;
-	g.freqOffsetSum += g.freqOffset;
-
-	g.freqOffsetDiff[g.intervalCount] = g.freqOffset - g.lastFreqOffset;
-
-	g.lastFreqOffset = g.freqOffset;
-	g.intervalCount += 1;
-
-	if (g.intervalCount >= FIVE_MINUTES){
-		gettimeofday(&t, NULL);
-
-		double norm = 1.0 / (double)FREQDIFF_INTRVL;
-
-		double diffSum = 0.0;
-		for (int i = 0; i < FREQDIFF_INTRVL; i++){
-			diffSum += g.freqOffsetDiff[i] * g.freqOffsetDiff[i];
-		}
-		g.freqAllanDev[g.recIndex] = sqrt(diffSum * norm * 0.5);
-
-		g.timestampRec[g.recIndex] = t.tv_sec;
-
-		g.freqOffsetRec[g.recIndex] = g.freqOffsetSum * norm;
-
-		g.recIndex += 1;
-		if (g.recIndex == NUM_5_MIN_INTERVALS){
-			g.recIndex = 0;
-		}
-
-		g.intervalCount = 0;
-		g.freqOffsetSum = 0.0;
-	}
-}
-
 /**
  * Each second, records the time correction that was applied to
  * the system clock and also records the last clock frequency
  * offset (in parts per million) that was applied to the system
  * clock.
  *
- * These values are recorded so that they may be saved to disk
- * for analysis.
+ * These values are appended to the history file so that they
+ * may be saved to disk for analysis, and are used to calculate
+ * the stability of the clock oscillator.
  *
  * @param[in] timeCorrection The time correction value to be
  * recorded.
- */
-void recordOffsets(int timeCorrection){
+ * @param[in] isFreqSet "true" if the clock frequency offset was
+ * set in this second.
+ */
+void recordOffsets(double timeCorrection, bool isFreqSet){
+	struct historyRec rec;
+
+	rec.timestamp = g.pps_t_sec;
+	if (g.pps_t_nsec > NSECS_PER_SEC / 2){						// The PPS edge was just before the second.
+		rec.timestamp += 1;
+	}
+	rec.seq_num = g.seq_num;
+	rec.flags = 0;
+	if (g.hardLimit == HARD_LIMIT_1){
+		rec.flags |= HISTORY_LOCKED;
+	}
+	if (isFreqSet){
+		rec.flags |= HISTORY_FREQ_SET;
+	}
+	rec.rawError = g.rawError;
+	rec.timeCorrection = timeCorrection;
+	rec.freqOffset = g.freqOffset;
+	rec.slewResidual = g.slewResidual;
+	rec.sysDelay = g.sysDelay;
+
+	if (isControlThread()){
+		struct ioRecord *io = getIORecord(IO_HISTORY);
+		if (io == NULL){
+			return;											// Dropped and counted by getIORecord().
+		}
+		io->hrec = rec;
+		postIORecord();
+		return;
+	}
 
-	g.seq_numRec[g.recIndex2] = g.seq_num;
-	g.offsetRec[g.recIndex2] = timeCorrection;
-	g.freqOffsetRec2[g.recIndex2] = g.freqOffset;
+	saveHistoryRec(&rec);
+}
 
-	g.recIndex2 += 1;
-	if (g.recIndex2 >= SECS_PER_10_MIN){
-		g.recIndex2 = 0;
-	}
+/**
+ * Appends a record from recordOffsets() to the history
+ * file and adds it to the clock stability calculation.
+ *
+ * @param[in] rec The record.
+ */
+void saveHistoryRec(const struct historyRec *rec){
+	appendHistory(rec);
+	recordStability(rec);
 }
 
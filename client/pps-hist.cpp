@@ -0,0 +1,144 @@
+/**
+ * @file pps-hist.cpp
+ * @brief This file contains the log-linear histograms that record the full range of jitter, time correction and interrupt delay values.
+ *
+ * The fixed-range distributions written to the -distrib files
+ * clamp values outside of their range into the end bins. These
+ * histograms do not. Each octave of values, in nanoseconds, is
+ * divided into 2^(HIST_SUB_BITS - 1) equal sub-buckets so that
+ * the width of a bucket is never more than 1/64 of the value it
+ * holds. Values less than 2^HIST_SUB_BITS nanoseconds get their
+ * own buckets. A value is recorded with a few integer operations
+ * and the memory used is fixed by HIST_LEN.
+ */
+
+/*
+ * Copyright (C) 2016-2018  Raymond S. Connell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "../client/pps-client.h"
+extern struct G g;
+
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)				//!< Values below this many nanoseconds have their own buckets.
+#define HIST_HALF_COUNT (1 << (HIST_SUB_BITS - 1))		//!< Number of sub-buckets in each octave above HIST_SUB_COUNT.
+
+/**
+ * Returns the index of the bucket that holds value.
+ *
+ * @param[in] value The value in nanoseconds.
+ */
+int getHistIndex(uint64_t value){
+	if (value < HIST_SUB_COUNT){
+		return (int)value;
+	}
+
+	int msb = 63 - __builtin_clzll(value);
+	if (msb >= HIST_MAX_BITS){
+		return HIST_LEN - 1;
+	}
+
+	int shift = msb - HIST_SUB_BITS + 1;
+	return shift * HIST_HALF_COUNT + (int)(value >> shift);
+}
+
+/**
+ * Returns the midpoint value in nanoseconds of the
+ * bucket with index idx.
+ *
+ * @param[in] idx The bucket index.
+ */
+double getHistValue(int idx){
+	if (idx < HIST_SUB_COUNT){
+		return (double)idx;
+	}
+
+	int shift = idx / HIST_HALF_COUNT - 1;
+	uint64_t lower = (uint64_t)(idx - shift * HIST_HALF_COUNT) << shift;
+	return (double)lower + (double)((uint64_t)1 << shift) / 2.0;
+}
+
+/**
+ * Records the magnitude of a value in a histogram.
+ *
+ * @param[in,out] h The histogram.
+ * @param[in] usec The value in microseconds.
+ */
+void histRecord(struct hdrHist *h, double usec){
+	uint64_t value = (uint64_t)llround(fabs(usec) * NSECS_PER_USEC);
+
+	h->counts[getHistIndex(value)] += 1;
+	h->total += 1;
+	if (value > h->max){
+		h->max = value;
+	}
+}
+
+/**
+ * Adds the counts of histogram src to histogram dst.
+ * Histograms recorded over different intervals or by
+ * different threads can be merged this way.
+ *
+ * @param[in,out] dst The histogram that receives the counts.
+ * @param[in] src The histogram to be added.
+ */
+void histMerge(struct hdrHist *dst, const struct hdrHist *src){
+	for (int i = 0; i < HIST_LEN; i++){
+		dst->counts[i] += src->counts[i];
+	}
+	dst->total += src->total;
+	if (src->max > dst->max){
+		dst->max = src->max;
+	}
+}
+
+/**
+ * Returns a percentile of the values recorded in
+ * a histogram.
+ *
+ * @param[in] h The histogram.
+ * @param[in] pct The percentile, for example 99.9.
+ *
+ * @returns The percentile value in microseconds or 0
+ * if the histogram is empty. The 100th percentile is
+ * the exact maximum.
+ */
+double histPercentile(const struct hdrHist *h, double pct){
+	if (h->total == 0){
+		return 0.0;
+	}
+	if (pct >= 100.0){
+		return (double)h->max / NSECS_PER_USEC;
+	}
+
+	uint64_t target = (uint64_t)ceil(pct / 100.0 * (double)h->total);
+	if (target == 0){
+		target = 1;
+	}
+
+	uint64_t count = 0;
+	for (int i = 0; i < HIST_LEN; i++){
+		count += h->counts[i];
+		if (count >= target){
+			double value = getHistValue(i);
+			if (value > (double)h->max){
+				value = (double)h->max;
+			}
+			return value / NSECS_PER_USEC;
+		}
+	}
+	return (double)h->max / NSECS_PER_USEC;
+}
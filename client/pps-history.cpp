@@ -0,0 +1,350 @@
+/**
+ * @file pps-history.cpp
+ * @brief This file contains the memory-mapped ring file that keeps a per-second record of the controller for HISTORY_DAYS days.
+ *
+ * The history file, HISTORY_FILE, is a header page followed by
+ * HISTORY_LEN fixed-size records of struct historyRec. The header
+ * holds the count of records ever appended. The slot of the next
+ * record is that count modulo HISTORY_LEN, so appending is a copy
+ * of one record followed by a store of the count, and the records
+ * are in time order starting from the oldest.
+ *
+ * Only a window of HISTORY_WINDOW records around the append slot
+ * is mapped, so that the daemon, which locks all of its memory,
+ * locks only that window and not the whole file. The window is
+ * moved by the I/O worker, never by the controller.
+ *
+ * A record is always complete before the count that includes it
+ * is stored, so if the daemon is killed the file is consistent.
+ * On a power failure the kernel may have written the header but
+ * not the last records. Those read as zero or, once the ring has
+ * wrapped, as the records they were to replace. Because records
+ * are only appended with increasing timestamps, the records from
+ * the first one that is not newer than the record before it are
+ * dropped when the file is reopened.
+ *
+ * Records are read with pread() rather than through the mapping,
+ * so a time range can be found by binary search on the timestamps
+ * without mapping the file.
+ */
+
+/*
+ * Copyright (C) 2016-2018  Raymond S. Connell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "../client/pps-client.h"
+extern struct G g;
+
+/**
+ * The header at the start of the history file.
+ */
+struct historyHeader {
+	uint32_t magic;									//!< HISTORY_MAGIC.
+	uint32_t version;								//!< HISTORY_VERSION.
+	uint32_t recSize;								//!< sizeof(struct historyRec).
+	uint32_t capacity;								//!< HISTORY_LEN.
+	uint64_t count;									//!< Count of records ever appended.
+};
+
+/**
+ * Local file-scope shared variables.
+ */
+static struct historyLocalVars {
+	int fd;										//!< The history file descriptor or -1.
+	struct historyHeader *hdr;					//!< The mapped header or NULL if the history is not open.
+	struct historyRec *window;					//!< The mapped append window or NULL.
+	int64_t winStart;							//!< The slot of the first record in the window.
+	int64_t winLen;								//!< The number of records in the window.
+	int64_t lastTimestamp;						//!< The timestamp of the newest record.
+	char logbuf[LOGBUF_SZ];						//!< Used in place of G.logbuf.
+} f = {-1, NULL, NULL, 0, 0, 0};					//!< Local file-scope shared variables.
+
+/**
+ * Returns the file offset of the record with
+ * logical index idx.
+ *
+ * @param[in] idx The logical index.
+ */
+off_t historyOffset(int64_t idx){
+	return HISTORY_HDR_SZ + (off_t)(idx % HISTORY_LEN) * sizeof(struct historyRec);
+}
+
+/**
+ * Returns the logical index of the oldest record
+ * in the history.
+ *
+ * @param[in] count The count of records appended.
+ */
+int64_t historyFirst(uint64_t count){
+	return count > HISTORY_LEN ? (int64_t)(count - HISTORY_LEN) : 0;
+}
+
+/**
+ * Reads the timestamp of the record with logical
+ * index idx.
+ *
+ * @param[in] idx The logical index.
+ *
+ * @returns The timestamp or 0 on error.
+ */
+int64_t readTimestamp(int64_t idx){
+	int64_t timestamp;
+
+	if (pread(f.fd, &timestamp, sizeof(int64_t), historyOffset(idx)) != sizeof(int64_t)){
+		return 0;
+	}
+	return timestamp;
+}
+
+/**
+ * Maps the window of records that contains slot.
+ *
+ * @param[in] slot The slot of the next record.
+ *
+ * @returns 0 on success, else -1 on error.
+ */
+int mapHistoryWindow(int64_t slot){
+	if (f.window != NULL){
+		munmap(f.window, f.winLen * sizeof(struct historyRec));
+		f.window = NULL;
+	}
+
+	f.winStart = slot - slot % HISTORY_WINDOW;
+	f.winLen = HISTORY_LEN - f.winStart;
+	if (f.winLen > HISTORY_WINDOW){
+		f.winLen = HISTORY_WINDOW;
+	}
+
+	void *p = mmap(NULL, f.winLen * sizeof(struct historyRec), PROT_READ | PROT_WRITE, MAP_SHARED,
+			f.fd, HISTORY_HDR_SZ + f.winStart * sizeof(struct historyRec));
+	if (p == MAP_FAILED){
+		sprintf(f.logbuf, "mapHistoryWindow() mmap() failed with error: %s\n", strerror(errno));
+		writeToLog(f.logbuf);
+		return -1;
+	}
+	f.window = (struct historyRec *)p;
+	return 0;
+}
+
+/**
+ * Opens the history file, creating it if it does
+ * not exist or has a different layout, and maps
+ * the header.
+ *
+ * @returns 0 on success, else -1 on error.
+ */
+int openHistory(void){
+	struct historyHeader hdr;
+	struct stat stat_buf;
+	off_t fileSize = HISTORY_HDR_SZ + (off_t)HISTORY_LEN * sizeof(struct historyRec);
+
+	f.fd = open(HISTORY_FILE, O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (f.fd == -1){
+		sprintf(f.logbuf, "openHistory() Unable to open %s. Error: %s\n", HISTORY_FILE, strerror(errno));
+		writeToLog(f.logbuf);
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof(struct historyHeader));
+	fstat(f.fd, &stat_buf);
+	if (stat_buf.st_size == fileSize){
+		if (pread(f.fd, &hdr, sizeof(struct historyHeader), 0) != sizeof(struct historyHeader)){
+			memset(&hdr, 0, sizeof(struct historyHeader));
+		}
+	}
+
+	if (hdr.magic != HISTORY_MAGIC || hdr.version != HISTORY_VERSION
+			|| hdr.recSize != sizeof(struct historyRec) || hdr.capacity != HISTORY_LEN){
+		if (ftruncate(f.fd, 0) == -1 || ftruncate(f.fd, fileSize) == -1){		// A sparse file of zero records.
+			sprintf(f.logbuf, "openHistory() ftruncate() failed with error: %s\n", strerror(errno));
+			writeToLog(f.logbuf);
+			closeHistory();
+			return -1;
+		}
+		hdr.magic = HISTORY_MAGIC;
+		hdr.version = HISTORY_VERSION;
+		hdr.recSize = sizeof(struct historyRec);
+		hdr.capacity = HISTORY_LEN;
+		hdr.count = 0;
+	}
+
+	int64_t idx = (int64_t)hdr.count - HISTORY_WINDOW;	// Only the records appended through the last
+	if (idx < historyFirst(hdr.count)){					// window can have been lost on a power failure.
+		idx = historyFirst(hdr.count);
+	}
+	f.lastTimestamp = 0;
+	for ( ; idx < (int64_t)hdr.count; idx++){
+		int64_t timestamp = readTimestamp(idx);
+		if (timestamp <= f.lastTimestamp){				// Zero or a record older than the one before it.
+			sprintf(f.logbuf, "openHistory() Dropped %lld records lost from %s.\n",
+					(long long)(hdr.count - idx), HISTORY_FILE);
+			writeToLog(f.logbuf);
+			hdr.count = idx;
+			break;
+		}
+		f.lastTimestamp = timestamp;
+	}
+
+	if (pwrite(f.fd, &hdr, sizeof(struct historyHeader), 0) != sizeof(struct historyHeader)){
+		sprintf(f.logbuf, "openHistory() Unable to write %s. Error: %s\n", HISTORY_FILE, strerror(errno));
+		writeToLog(f.logbuf);
+		closeHistory();
+		return -1;
+	}
+
+	void *p = mmap(NULL, HISTORY_HDR_SZ, PROT_READ | PROT_WRITE, MAP_SHARED, f.fd, 0);
+	if (p == MAP_FAILED){
+		sprintf(f.logbuf, "openHistory() mmap() failed with error: %s\n", strerror(errno));
+		writeToLog(f.logbuf);
+		closeHistory();
+		return -1;
+	}
+
+	if (mapHistoryWindow(hdr.count % HISTORY_LEN) == -1){
+		munmap(p, HISTORY_HDR_SZ);
+		closeHistory();
+		return -1;
+	}
+	f.hdr = (struct historyHeader *)p;
+	return 0;
+}
+
+/**
+ * Unmaps and closes the history file.
+ */
+void closeHistory(void){
+	if (f.window != NULL){
+		munmap(f.window, f.winLen * sizeof(struct historyRec));
+		f.window = NULL;
+	}
+	if (f.hdr != NULL){
+		munmap(f.hdr, HISTORY_HDR_SZ);
+		f.hdr = NULL;
+	}
+	if (f.fd != -1){
+		close(f.fd);
+		f.fd = -1;
+	}
+}
+
+/**
+ * Appends a record to the history. A record that is
+ * not newer than the last one, as after the clock is
+ * stepped back, is not appended so that the records
+ * stay sorted by timestamp for findHistory().
+ *
+ * @param[in] rec The record.
+ */
+void appendHistory(const struct historyRec *rec){
+	if (f.hdr == NULL || rec->timestamp <= f.lastTimestamp){
+		return;
+	}
+
+	uint64_t count = f.hdr->count;
+	int64_t slot = count % HISTORY_LEN;
+
+	if (f.window == NULL || slot < f.winStart || slot >= f.winStart + f.winLen){
+		if (mapHistoryWindow(slot) == -1){
+			return;
+		}
+	}
+
+	f.window[slot - f.winStart] = *rec;
+	__atomic_store_n(&f.hdr->count, count + 1, __ATOMIC_RELEASE);	// Publishes the record.
+	f.lastTimestamp = rec->timestamp;
+}
+
+/**
+ * Finds the first record in the history with a
+ * timestamp of t or later by binary search.
+ *
+ * @param[in] t The time in seconds.
+ *
+ * @returns The logical index of the record, which is
+ * the count of records appended if there is none, or
+ * -1 if the history is not open.
+ */
+int64_t findHistory(int64_t t){
+	if (f.hdr == NULL){
+		return -1;
+	}
+
+	int64_t hi = __atomic_load_n(&f.hdr->count, __ATOMIC_ACQUIRE);
+	int64_t lo = historyFirst(hi);
+
+	while (lo < hi){
+		int64_t mid = lo + (hi - lo) / 2;
+		if (readTimestamp(mid) < t){
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/**
+ * Reads up to n records from the history starting
+ * at logical index idx.
+ *
+ * @param[in] idx The logical index of the first record
+ * as returned by findHistory().
+ * @param[out] buf The records.
+ * @param[in] n The size of buf in records.
+ *
+ * @returns The number of records read, which is 0 at
+ * the end of the history, or -1 on error.
+ */
+int readHistory(int64_t idx, struct historyRec *buf, int n){
+	if (f.hdr == NULL){
+		return -1;
+	}
+
+	int64_t count = __atomic_load_n(&f.hdr->count, __ATOMIC_ACQUIRE);
+	if (idx < historyFirst(count)){
+		idx = historyFirst(count);
+	}
+	if (idx + n > count){
+		n = count - idx;
+	}
+	if (n <= 0){
+		return 0;
+	}
+
+	int n1 = n;
+	int64_t slot = idx % HISTORY_LEN;
+	if (slot + n1 > HISTORY_LEN){						// The range wraps to the start of the file.
+		n1 = HISTORY_LEN - slot;
+	}
+
+	size_t sz = n1 * sizeof(struct historyRec);
+	if (pread(f.fd, buf, sz, historyOffset(idx)) != (ssize_t)sz){
+		sprintf(f.logbuf, "readHistory() pread() failed with error: %s\n", strerror(errno));
+		writeToLog(f.logbuf);
+		return -1;
+	}
+	if (n1 < n){
+		sz = (n - n1) * sizeof(struct historyRec);
+		if (pread(f.fd, buf + n1, sz, HISTORY_HDR_SZ) != (ssize_t)sz){
+			sprintf(f.logbuf, "readHistory() pread() failed with error: %s\n", strerror(errno));
+			writeToLog(f.logbuf);
+			return -1;
+		}
+	}
+	return n;
+}
@@ -0,0 +1,188 @@
+/**
+ * @file pps-kalman.cpp
+ * @brief This file contains the two-state Kalman filter controller that can be selected in place of the proportional-integral controller.
+ *
+ * The filter estimates the phase of the system clock at the PPS
+ * edge, which is measured by G.rawError, and the rate at which
+ * that phase is drifting, which is the residual frequency error
+ * of the clock in ppm. Both are removed each second: the phase by
+ * the time slew and the rate by a change to G.freqOffset. So unlike
+ * the proportional-integral controller, which corrects frequency
+ * once each minute, this controller corrects frequency every second
+ * by an amount weighted by how well the rate is known.
+ *
+ * The measurement noise is the variance of the PPS jitter. It is
+ * set each minute from the controller jitter histogram as the square of the magnitude
+ * below which 68.3 percent of the jitter lies, which is the standard
+ * deviation for Gaussian jitter but is not inflated by the long tail
+ * of interrupt delays. Innovations are also limited to KALMAN_GATE
+ * standard deviations so that delays that are not removed as delay
+ * spikes do not pull the clock. The process noise is fixed by
+ * the controller settings, which default to KALMAN_Q_PHASE and
+ * KALMAN_Q_FREQ.
+ *
+ * The filter state is a struct kalmanState held by the controller.
+ */
+
+/*
+ * Copyright (C) 2016-2018  Raymond S. Connell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "../client/pps-client.h"
+
+/**
+ * Restarts the Kalman filter on the next call to
+ * getKalmanCorrection().
+ *
+ * @param[out] k The filter state.
+ */
+void resetKalman(struct kalmanState *k){
+	k->isStarted = false;
+}
+
+/**
+ * Starts the Kalman filter at a measured phase.
+ *
+ * @param[in,out] k The filter state.
+ * @param[in] rawError The measured phase in microseconds.
+ * @param[in] t The monotonic time in seconds.
+ */
+void startKalman(struct kalmanState *k, double rawError, double t){
+	k->isStarted = true;
+	k->phase = rawError;
+	k->freq = 0.0;
+	k->P[0][0] = (k->R > 0.0) ? k->R : KALMAN_R_INIT;
+	k->P[0][1] = 0.0;
+	k->P[1][0] = 0.0;
+	k->P[1][1] = KALMAN_P_FREQ_INIT;
+	k->slew = 0.0;
+	k->lastTime = t;
+}
+
+/**
+ * Advances the phase and frequency estimates and their
+ * covariance over dt seconds.
+ *
+ * @param[in,out] k The filter state.
+ * @param[in] p The controller settings.
+ * @param[in] dt The seconds since the last update.
+ */
+void predictKalman(struct kalmanState *k, const struct controllerParams *p, double dt){
+	k->phase += k->slew + k->freq * dt;				// One second at freq ppm is freq microseconds.
+	k->slew = 0.0;
+
+	double p00 = k->P[0][0] + dt * (k->P[0][1] + k->P[1][0]) + dt * dt * k->P[1][1];
+	double p01 = k->P[0][1] + dt * k->P[1][1];
+	double p10 = k->P[1][0] + dt * k->P[1][1];
+
+	k->P[0][0] = p00 + p->kalmanQPhase * dt;
+	k->P[0][1] = p01;
+	k->P[1][0] = p10;
+	k->P[1][1] += p->kalmanQFreq * dt;
+}
+
+/**
+ * Updates the Kalman filter with the measured phase of
+ * the current PPS edge and gets the corrections that
+ * remove the estimated phase and frequency errors.
+ *
+ * The time correction is to be applied as a time slew
+ * and passed back with setKalmanSlew(). The frequency
+ * step is to be added to G.freqOffset. The estimates
+ * are reduced by the corrections, so a frequency step
+ * not applied by the caller is not made again.
+ *
+ * @param[in,out] k The filter state.
+ * @param[in] p The controller settings.
+ * @param[in] rawError The measured phase in microseconds.
+ * @param[in] t The monotonic time in seconds of the PPS edge.
+ * @param[out] freqStep The frequency correction in ppm.
+ *
+ * @returns The time correction in microseconds.
+ */
+double getKalmanCorrection(struct kalmanState *k, const struct controllerParams *p, double rawError, double t, double *freqStep){
+	if (k->R == 0.0){
+		k->R = KALMAN_R_INIT;
+	}
+
+	double dt = round(t - k->lastTime);
+	if (! k->isStarted || dt < 1.0 || dt > KALMAN_MAX_DT){
+		startKalman(k, rawError, t);
+	}
+	else {
+		predictKalman(k, p, dt);
+		k->lastTime = t;
+
+		double S = k->P[0][0] + k->R;
+		double K0 = k->P[0][0] / S;
+		double K1 = k->P[1][0] / S;
+
+		double limit = KALMAN_GATE * sqrt(S);
+		double innovation = rawError - k->phase;
+		if (innovation > limit){
+			innovation = limit;
+		}
+		else if (innovation < -limit){
+			innovation = -limit;
+		}
+
+		k->phase += K0 * innovation;
+		k->freq += K1 * innovation;
+
+		double p00 = k->P[0][0], p01 = k->P[0][1];
+		k->P[0][0] -= K0 * p00;
+		k->P[0][1] -= K0 * p01;
+		k->P[1][0] -= K1 * p00;
+		k->P[1][1] -= K1 * p01;
+	}
+
+	*freqStep = -k->freq;
+	k->freq = 0.0;
+	return -k->phase;
+}
+
+/**
+ * Records the time slew that was applied after
+ * getKalmanCorrection(). Since adjtimex() applies
+ * only whole microseconds this can differ from the
+ * time correction.
+ *
+ * @param[in,out] k The filter state.
+ * @param[in] slew The applied time slew in microseconds.
+ */
+void setKalmanSlew(struct kalmanState *k, double slew){
+	k->slew += slew;
+}
+
+/**
+ * Sets the measurement noise of the Kalman filter from
+ * the recorded jitter. Called once each minute.
+ *
+ * @param[in,out] k The filter state.
+ * @param[in] jitterHist The jitter while locked.
+ */
+void setKalmanNoise(struct kalmanState *k, const struct hdrHist *jitterHist){
+	if (jitterHist->total < KALMAN_R_COUNT){
+		return;
+	}
+
+	double sigma = histPercentile(jitterHist, 68.27);
+	k->R = sigma * sigma;
+	if (k->R < KALMAN_R_MIN){
+		k->R = KALMAN_R_MIN;
+	}
+}
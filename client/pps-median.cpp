@@ -0,0 +1,206 @@
+/**
+ * @file pps-median.cpp
+ * @brief This file contains the sliding-window median of the calibration interrupt delays that sets G.sysDelay.
+ *
+ * The last window values are held in a ring. Each value is also in
+ * one of two heaps: a max-heap of the lower half of the values and
+ * a min-heap of the upper half, with the lower half never smaller
+ * than the upper half and never more than one larger. The median
+ * is then the top of the lower heap, or the average of the two tops
+ * when the count is even. Each heap entry is the index of a ring
+ * slot, and each ring slot records which heap holds it and where,
+ * so the oldest value can be removed from the middle of its heap
+ * when a new value takes its slot. Adding a value takes O(log n)
+ * time, reading the median O(1) and the memory is fixed by
+ * MEDIAN_WINDOW_MAX.
+ */
+
+/*
+ * Copyright (C) 2016-2018  Raymond S. Connell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "../client/pps-client.h"
+
+/**
+ * Returns "true" if the value in ring slot a belongs
+ * above the value in ring slot b in heap h.
+ *
+ * @param[in] m The sliding median.
+ * @param[in] h The heap: MEDIAN_LOWER or MEDIAN_UPPER.
+ * @param[in] a A ring slot.
+ * @param[in] b A ring slot.
+ */
+bool isMedianAbove(const struct slidingMedian *m, int h, int a, int b){
+	return (h == MEDIAN_LOWER) ? m->values[a] > m->values[b] : m->values[a] < m->values[b];
+}
+
+/**
+ * Places ring slot s at position i of heap h.
+ */
+void placeMedianSlot(struct slidingMedian *m, int h, int i, int s){
+	m->heap[h][i] = s;
+	m->heapOf[s] = h;
+	m->heapPos[s] = i;
+}
+
+/**
+ * Moves the entry at position i of heap h up or down
+ * until the heap order is restored.
+ *
+ * @param[in,out] m The sliding median.
+ * @param[in] h The heap.
+ * @param[in] i The position.
+ */
+void siftMedianSlot(struct slidingMedian *m, int h, int i){
+	int s = m->heap[h][i];
+
+	while (i > 0){											// Up
+		int parent = (i - 1) / 2;
+		if (! isMedianAbove(m, h, s, m->heap[h][parent])){
+			break;
+		}
+		placeMedianSlot(m, h, i, m->heap[h][parent]);
+		i = parent;
+	}
+
+	for (;;){												// Down
+		int child = 2 * i + 1;
+		if (child >= m->heapLen[h]){
+			break;
+		}
+		if (child + 1 < m->heapLen[h] && isMedianAbove(m, h, m->heap[h][child + 1], m->heap[h][child])){
+			child += 1;
+		}
+		if (! isMedianAbove(m, h, m->heap[h][child], s)){
+			break;
+		}
+		placeMedianSlot(m, h, i, m->heap[h][child]);
+		i = child;
+	}
+	placeMedianSlot(m, h, i, s);
+}
+
+/**
+ * Adds ring slot s to the end of heap h and restores
+ * the heap order.
+ */
+void pushMedianSlot(struct slidingMedian *m, int h, int s){
+	int i = m->heapLen[h];
+	m->heapLen[h] += 1;
+	placeMedianSlot(m, h, i, s);
+	siftMedianSlot(m, h, i);
+}
+
+/**
+ * Removes ring slot s from the heap that holds it by
+ * replacing it with the last entry of the heap.
+ */
+void removeMedianSlot(struct slidingMedian *m, int s){
+	int h = m->heapOf[s];
+	int i = m->heapPos[s];
+
+	m->heapLen[h] -= 1;
+	int last = m->heap[h][m->heapLen[h]];
+	if (last != s){
+		placeMedianSlot(m, h, i, last);
+		siftMedianSlot(m, h, i);
+	}
+}
+
+/**
+ * Moves the top of one heap to the other until the
+ * lower heap holds the same count as the upper heap
+ * or one more.
+ */
+void balanceMedianHeaps(struct slidingMedian *m){
+	while (m->heapLen[MEDIAN_LOWER] > m->heapLen[MEDIAN_UPPER] + 1){
+		int s = m->heap[MEDIAN_LOWER][0];
+		removeMedianSlot(m, s);
+		pushMedianSlot(m, MEDIAN_UPPER, s);
+	}
+	while (m->heapLen[MEDIAN_UPPER] > m->heapLen[MEDIAN_LOWER]){
+		int s = m->heap[MEDIAN_UPPER][0];
+		removeMedianSlot(m, s);
+		pushMedianSlot(m, MEDIAN_LOWER, s);
+	}
+}
+
+/**
+ * Empties a sliding median and sets its window.
+ *
+ * @param[out] m The sliding median.
+ * @param[in] window The count of the most recent values
+ * from which the median is taken. Limited to 1 ...
+ * MEDIAN_WINDOW_MAX.
+ */
+void initSlidingMedian(struct slidingMedian *m, int window){
+	memset(m, 0, sizeof(struct slidingMedian));
+
+	if (window < 1){
+		window = 1;
+	}
+	else if (window > MEDIAN_WINDOW_MAX){
+		window = MEDIAN_WINDOW_MAX;
+	}
+	m->window = window;
+}
+
+/**
+ * Adds a value to a sliding median, removing the oldest
+ * value once the window is full.
+ *
+ * @param[in,out] m The sliding median.
+ * @param[in] value The value.
+ */
+void addSlidingMedian(struct slidingMedian *m, double value){
+	int s = m->next;
+
+	if (m->count == m->window){
+		removeMedianSlot(m, s);
+	}
+	else {
+		m->count += 1;
+	}
+
+	m->values[s] = value;
+	if (m->heapLen[MEDIAN_LOWER] > 0 && value > m->values[m->heap[MEDIAN_LOWER][0]]){
+		pushMedianSlot(m, MEDIAN_UPPER, s);
+	}
+	else {
+		pushMedianSlot(m, MEDIAN_LOWER, s);
+	}
+	balanceMedianHeaps(m);
+
+	m->next = (s + 1) % m->window;
+}
+
+/**
+ * Returns the median of the values in the window of
+ * a sliding median or 0 if it is empty.
+ *
+ * @param[in] m The sliding median.
+ */
+double getSlidingMedian(const struct slidingMedian *m){
+	if (m->count == 0){
+		return 0.0;
+	}
+	double lower = m->values[m->heap[MEDIAN_LOWER][0]];
+	if (m->count % 2 == 1){
+		return lower;
+	}
+	return 0.5 * (lower + m->values[m->heap[MEDIAN_UPPER][0]]);
+}
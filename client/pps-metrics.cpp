@@ -0,0 +1,322 @@
+/**
+ * @file pps-metrics.cpp
+ * @brief This file contains the exporter thread that serves PPS-Client controller metrics in the OpenMetrics text format.
+ *
+ * The exporter listens on the Unix domain socket METRICS_SOCKET and,
+ * if metrics-port is set in the config file, on that TCP port of the
+ * loopback interface. Each connection receives one HTTP response with
+ * the current metrics, so the socket can be scraped by Prometheus or
+ * read with "curl --unix-socket".
+ *
+ * The exporter never reads the controller state directly. It reads
+ * only a snapshot of the shared memory segment, which the controller
+ * writes under a sequence lock each second with the driver counters
+ * and the histogram percentiles. So the exporter never blocks the
+ * controller and runs at normal priority.
+ */
+
+/*
+ * Copyright (C) 2016-2018  Raymond S. Connell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "../client/pps-client.h"
+extern struct G g;
+
+/**
+ * Local file-scope shared variables.
+ */
+static struct metricsLocalVars {
+	pthread_t exporterThread;					//!< The exporter thread.
+	bool isRunning;								//!< Set "false" to stop the exporter thread.
+	int unixFd;									//!< The Unix domain socket listening fd or -1.
+	int tcpFd;									//!< The loopback TCP listening fd or -1.
+	char logbuf[LOGBUF_SZ];						//!< Used in place of G.logbuf by the exporter thread.
+	char body[METRICS_BUF_SZ];					//!< The metrics text.
+	char response[METRICS_BUF_SZ + 200];			//!< The HTTP response.
+} f = {0, false, -1, -1};						//!< Local file-scope shared variables.
+
+/**
+ * Appends a gauge metric to buf.
+ *
+ * @param[out] buf The metrics text.
+ * @param[in] len The current length of the metrics text.
+ * @param[in] name The metric name.
+ * @param[in] help The metric description.
+ * @param[in] value The metric value.
+ *
+ * @returns The new length of the metrics text.
+ */
+int appendGauge(char *buf, int len, const char *name, const char *help, double value){
+	return len + sprintf(buf + len, "# TYPE %s gauge\n# HELP %s %s\n%s %.9g\n", name, name, help, name, value);
+}
+
+/**
+ * Appends the p50, p99, p99.9 and max values of a
+ * histogram to buf as an OpenMetrics summary.
+ *
+ * @param[out] buf The metrics text.
+ * @param[in] len The current length of the metrics text.
+ * @param[in] name The metric name.
+ * @param[in] help The metric description.
+ * @param[in] hist The histogram summary from the shared memory snapshot.
+ *
+ * @returns The new length of the metrics text.
+ */
+int appendSummary(char *buf, int len, const char *name, const char *help, const struct ppsShmHist *hist){
+	const double quantiles[] = {0.5, 0.99, 0.999, 1.0};
+	const double values[] = {hist->p50, hist->p99, hist->p999, hist->max};
+
+	len += sprintf(buf + len, "# TYPE %s summary\n# HELP %s %s\n", name, name, help);
+	for (int i = 0; i < 4; i++){
+		len += sprintf(buf + len, "%s{quantile=\"%g\"} %.9g\n", name, quantiles[i], values[i]);
+	}
+	len += sprintf(buf + len, "%s_count %llu\n", name, (unsigned long long)hist->count);
+	return len;
+}
+
+/**
+ * Formats the current metrics in the OpenMetrics
+ * text format.
+ *
+ * @param[out] buf The metrics text.
+ *
+ * @returns The length of the metrics text.
+ */
+int formatMetrics(char *buf){
+	struct ppsShm snap;
+	int len = 0;
+
+	const struct ppsShm *shm = getSharedState();
+	if (shm == NULL || readPPSshm(shm, &snap) == -1){
+		memset(&snap, 0, sizeof(struct ppsShm));
+	}
+
+	len = appendGauge(buf, len, "pps_seq_num", "Count of PPS interrupt times received.", snap.seq_num);
+	len = appendGauge(buf, len, "pps_jitter_microseconds", "Jitter of the most recent PPS interrupt.", snap.jitter);
+	len = appendGauge(buf, len, "pps_freq_offset_ppm", "Clock frequency offset.", snap.freqOffset);
+	len = appendGauge(buf, len, "pps_avg_correction_microseconds", "Average time correction over the last minute.", snap.avgCorrection);
+	len = appendGauge(buf, len, "pps_hard_limit", "Controller hard limit. Locked when 1.", snap.hardLimit);
+	len = appendGauge(buf, len, "pps_is_controlling", "1 while the controller is adjusting the clock frequency.", snap.isControlling);
+	len = appendGauge(buf, len, "pps_sys_delay_microseconds", "Interrupt delay removed from the PPS time.", snap.sysDelay);
+	len = appendGauge(buf, len, "pps_interrupt_loss_count", "Count of consecutive lost PPS interrupts.", snap.interruptLossCount);
+	len = appendGauge(buf, len, "pps_driver_late_records", "Count of PPS interrupt times read from the driver after a newer one.", snap.ppsLateCount);
+	len = appendGauge(buf, len, "pps_driver_overruns", "Count of PPS interrupt times overwritten in the driver ring before they were read.", snap.ppsOverruns);
+
+	len = appendSummary(buf, len, "pps_jitter_magnitude_microseconds", "Magnitude of jitter while locked.", &snap.jitterHist);
+	len = appendSummary(buf, len, "pps_time_correction_magnitude_microseconds", "Magnitude of time corrections while locked.", &snap.errorHist);
+	len = appendSummary(buf, len, "pps_interrupt_delay_microseconds", "Calibration interrupt delay.", &snap.intrptHist);
+
+	len += sprintf(buf + len, "# EOF\n");
+	return len;
+}
+
+/**
+ * Reads and discards the request from a client,
+ * then sends the metrics and closes the connection.
+ *
+ * @param[in] fd The connection.
+ */
+void serveMetrics(int fd){
+	struct timeval tv = {0, 200000};
+	char request[1024];
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	int nRead = 0;
+	while (nRead < (int)sizeof(request) - 1){		// A client that sends no request gets the metrics after the timeout.
+		int rv = read(fd, request + nRead, sizeof(request) - 1 - nRead);
+		if (rv <= 0){
+			break;
+		}
+		nRead += rv;
+		request[nRead] = '\0';
+		if (strstr(request, "\r\n\r\n") != NULL){
+			break;
+		}
+	}
+
+	int bodyLen = formatMetrics(f.body);
+	int len = sprintf(f.response, "HTTP/1.0 200 OK\r\n"
+			"Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+			"Content-Length: %d\r\n\r\n", bodyLen);
+	memcpy(f.response + len, f.body, bodyLen);
+	len += bodyLen;
+
+	int rv = send(fd, f.response, len, MSG_NOSIGNAL);		// A client that has gone must not raise SIGPIPE.
+	if (rv == -1){
+		;
+	}
+	close(fd);
+}
+
+/**
+ * The exporter thread. Accepts connections on the
+ * listening sockets until stopMetricsExporter() is
+ * called.
+ */
+void *metricsExporter(void *){
+	struct sched_param param;
+	struct pollfd fds[2];
+
+	param.sched_priority = 0;
+	pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+
+	fds[0].fd = f.unixFd;
+	fds[0].events = POLLIN;
+	fds[1].fd = f.tcpFd;
+	fds[1].events = POLLIN;
+
+	while (__atomic_load_n(&f.isRunning, __ATOMIC_ACQUIRE)){
+		int rv = poll(fds, 2, 1000);					// Wakes each second to check for stop.
+		if (rv <= 0){
+			continue;
+		}
+
+		for (int i = 0; i < 2; i++){
+			if (fds[i].revents & POLLIN){
+				int fd = accept(fds[i].fd, NULL, NULL);
+				if (fd != -1){
+					serveMetrics(fd);
+				}
+			}
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Creates the listening Unix domain socket.
+ *
+ * @returns The socket fd, else -1 on error.
+ */
+int openMetricsSocket(void){
+	struct sockaddr_un addr;
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1){
+		sprintf(f.logbuf, "openMetricsSocket() socket() failed with msg: %s\n", strerror(errno));
+		writeToLog(f.logbuf);
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(struct sockaddr_un));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, METRICS_SOCKET, sizeof(addr.sun_path) - 1);
+
+	unlink(METRICS_SOCKET);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(struct sockaddr_un)) == -1 || listen(fd, 4) == -1){
+		sprintf(f.logbuf, "openMetricsSocket() Unable to listen on %s. Error: %s\n", METRICS_SOCKET, strerror(errno));
+		writeToLog(f.logbuf);
+		close(fd);
+		return -1;
+	}
+	chmod(METRICS_SOCKET, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+	return fd;
+}
+
+/**
+ * Creates the listening TCP socket on the loopback
+ * interface.
+ *
+ * @param[in] port The TCP port.
+ *
+ * @returns The socket fd, else -1 on error.
+ */
+int openMetricsPort(int port){
+	struct sockaddr_in addr;
+	int on = 1;
+
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1){
+		sprintf(f.logbuf, "openMetricsPort() socket() failed with msg: %s\n", strerror(errno));
+		writeToLog(f.logbuf);
+		return -1;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	memset(&addr, 0, sizeof(struct sockaddr_in));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(struct sockaddr_in)) == -1 || listen(fd, 4) == -1){
+		sprintf(f.logbuf, "openMetricsPort() Unable to listen on port %d. Error: %s\n", port, strerror(errno));
+		writeToLog(f.logbuf);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/**
+ * Starts the exporter thread if metrics are enabled
+ * in the config file.
+ *
+ * @returns 0 on success or if metrics are disabled,
+ * else -1 on error.
+ */
+int startMetricsExporter(void){
+	const struct ppsConfig *cfg = getConfig();
+
+	f.unixFd = -1;
+	f.tcpFd = -1;
+
+	if (! cfg->metrics){
+		return 0;
+	}
+
+	f.unixFd = openMetricsSocket();
+	if (cfg->metricsPort > 0){
+		f.tcpFd = openMetricsPort(cfg->metricsPort);
+	}
+	if (f.unixFd == -1 && f.tcpFd == -1){
+		return -1;
+	}
+
+	f.isRunning = true;
+	int rv = pthread_create(&f.exporterThread, NULL, &metricsExporter, NULL);
+	if (rv != 0){
+		sprintf(f.logbuf, "startMetricsExporter() pthread_create() failed with msg: %s\n", strerror(rv));
+		writeToLog(f.logbuf);
+		f.isRunning = false;
+		stopMetricsExporter();
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Stops the exporter thread and removes the
+ * Unix domain socket.
+ */
+void stopMetricsExporter(void){
+	if (f.isRunning){
+		__atomic_store_n(&f.isRunning, false, __ATOMIC_RELEASE);
+		pthread_join(f.exporterThread, NULL);
+	}
+
+	if (f.unixFd != -1){
+		close(f.unixFd);
+		unlink(METRICS_SOCKET);
+		f.unixFd = -1;
+	}
+	if (f.tcpFd != -1){
+		close(f.tcpFd);
+		f.tcpFd = -1;
+	}
+}
@@ -0,0 +1,226 @@
+/**
+ * @file pps-ppsapi.cpp
+ * @brief This file contains the reader of a PPS source of the Linux PPS subsystem through the RFC 2783 PPS API.
+ *
+ * When "pps-device" is set in the config file, PPS-Client reads the
+ * PPS edges from that /dev/ppsN device instead of loading and opening
+ * the gps-pps-io driver. The device can be the source registered by
+ * gps-pps-io itself or one registered by any other PPS driver, such as
+ * pps-gpio, and can be shared with chrony, gpsd or other PPS API
+ * clients.
+ *
+ * The PPS API has no poll(), so a reader thread blocks in the
+ * PPS_FETCH ioctl, which is what time_pps_fetch() calls, for each
+ * assert edge. It writes the time of each edge to a struct pps_ring
+ * in the same way as the gps-pps-io driver writes the ring that it
+ * exports, with the assert sequence number of the edge as the record
+ * sequence number, and then signals an eventfd. The event loop polls
+ * the eventfd in place of the driver file and reads the ring with the
+ * same code that reads the driver ring.
+ *
+ * The PPS API reports only the realtime clock time of each edge, so
+ * the raw monotonic time and the cycle count of the records are zero.
+ * It also has no calibration interrupt, so the interrupt delay is not
+ * calibrated and G.sysDelay keeps its default value.
+ */
+
+/*
+ * Copyright (C) 2016-2018  Raymond S. Connell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "../client/pps-client.h"
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
+#include <linux/pps.h>
+
+extern struct G g;
+
+/**
+ * Local file-scope shared variables.
+ */
+static struct ppsApiLocalVars {
+	int pps_fd;									//!< The /dev/ppsN file descriptor.
+	int event_fd;								//!< Signaled by the reader thread for each PPS edge.
+	pthread_t readerThread;						//!< The thread that fetches the PPS edges.
+	bool isRunning;								//!< "true" while the reader thread is running.
+	bool doExit;									//!< Set "true" to stop the reader thread.
+	struct pps_ring ring;						//!< The PPS edge times. Written only by the reader thread.
+	char logbuf[LOGBUF_SZ];						//!< Used in place of G.logbuf by the reader thread.
+} f;											//!< Local file-scope shared variables.
+
+/**
+ * Writes the time of PPS edge seq to the ring in the
+ * same way as the gps-pps-io driver so that the ring
+ * can be read with readPPSRecord().
+ *
+ * @param[in] seq The assert sequence number of the edge.
+ * @param[in] t The time of the edge.
+ */
+void writePPSApiRecord(__u32 seq, const struct pps_ktime *t){
+	struct pps_record *rec = &f.ring.rec[seq % PPS_RING_LEN];
+
+	__atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);				// Invalid while written.
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	storePPSRing64(&rec->time, t->sec * NSECS_PER_SEC + t->nsec);
+	storePPSRing64(&rec->raw_time, 0);
+	storePPSRing64(&rec->cycles, 0);
+	__atomic_store_n(&rec->seq, seq, __ATOMIC_RELEASE);
+	__atomic_store_n(&f.ring.head, seq, __ATOMIC_RELEASE);
+}
+
+/**
+ * Fetches each assert edge from the PPS device, writes
+ * its time to the ring and signals the event loop.
+ * Waits at most PPS_API_TIMEOUT_SECS for each edge so
+ * that stopPPSApi() is never blocked for longer.
+ */
+void *ppsApiReader(void *){
+	struct pps_fdata fdata;
+	__u32 lastSeq = __atomic_load_n(&f.ring.head, __ATOMIC_RELAXED);
+	uint64_t one = 1;
+
+	while (! __atomic_load_n(&f.doExit, __ATOMIC_ACQUIRE)){
+		memset(&fdata, 0, sizeof(struct pps_fdata));
+		fdata.timeout.sec = PPS_API_TIMEOUT_SECS;
+
+		if (ioctl(f.pps_fd, PPS_FETCH, &fdata) == -1){
+			if (errno == ETIMEDOUT || errno == EINTR){		// No PPS edge. The event loop times it out.
+				continue;
+			}
+			sprintf(f.logbuf, "ppsApiReader() PPS_FETCH failed with msg: %s\n", strerror(errno));
+			writeToLog(f.logbuf);
+			sleep(1);
+			continue;
+		}
+
+		__u32 seq = fdata.info.assert_sequence;
+		if (seq == 0 || seq == lastSeq){
+			continue;
+		}
+		lastSeq = seq;
+
+		writePPSApiRecord(seq, &fdata.info.assert_tu);
+		if (write(f.event_fd, &one, sizeof(uint64_t)) == -1){
+			sprintf(f.logbuf, "ppsApiReader() write to eventfd failed with msg: %s\n", strerror(errno));
+			writeToLog(f.logbuf);
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Returns the ring of PPS edge times written by
+ * the reader thread.
+ */
+const struct pps_ring *getPPSApiRing(void){
+	return &f.ring;
+}
+
+/**
+ * Opens a PPS device of the Linux PPS subsystem, sets
+ * it to capture the assert edge and starts the thread
+ * that reads the PPS edges from it.
+ *
+ * @param[in] path The PPS device, e.g. "/dev/pps0".
+ *
+ * @returns An eventfd that is readable when the time
+ * of a PPS edge has been written to the ring returned
+ * by getPPSApiRing(), else -1 on error.
+ */
+int startPPSApi(const char *path){
+	int mode, rv;
+	struct pps_kparams params;
+
+	memset(&f, 0, sizeof(struct ppsApiLocalVars));
+	f.event_fd = -1;
+
+	f.pps_fd = open(path, O_RDWR);
+	if (f.pps_fd == -1){
+		sprintf(g.logbuf, "startPPSApi() Could not open %s: %s\n", path, strerror(errno));
+		writeToLog(g.logbuf);
+		return -1;
+	}
+
+	if (ioctl(f.pps_fd, PPS_GETCAP, &mode) == -1){
+		sprintf(g.logbuf, "startPPSApi() %s is not a PPS device: %s\n", path, strerror(errno));
+		writeToLog(g.logbuf);
+		goto err;
+	}
+	if ((mode & PPS_CAPTUREASSERT) == 0 || (mode & PPS_CANWAIT) == 0){
+		sprintf(g.logbuf, "startPPSApi() %s cannot capture and wait for the assert edge\n", path);
+		writeToLog(g.logbuf);
+		goto err;
+	}
+
+	if (ioctl(f.pps_fd, PPS_GETPARAMS, &params) == -1){
+		sprintf(g.logbuf, "startPPSApi() PPS_GETPARAMS failed with msg: %s\n", strerror(errno));
+		writeToLog(g.logbuf);
+		goto err;
+	}
+	params.mode |= PPS_CAPTUREASSERT;
+	if (ioctl(f.pps_fd, PPS_SETPARAMS, &params) == -1){
+		sprintf(g.logbuf, "startPPSApi() PPS_SETPARAMS failed with msg: %s\n", strerror(errno));
+		writeToLog(g.logbuf);
+		goto err;
+	}
+
+	f.event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (f.event_fd == -1){
+		sprintf(g.logbuf, "startPPSApi() eventfd() failed with msg: %s\n", strerror(errno));
+		writeToLog(g.logbuf);
+		goto err;
+	}
+
+	rv = pthread_create(&f.readerThread, NULL, &ppsApiReader, NULL);	// Inherits the real-time priority.
+	if (rv != 0){
+		sprintf(g.logbuf, "startPPSApi() pthread_create() failed with msg: %s\n", strerror(rv));
+		writeToLog(g.logbuf);
+		goto err;
+	}
+	f.isRunning = true;
+
+	sprintf(g.logbuf, "Reading the PPS from %s through the PPS API\n", path);
+	writeToLog(g.logbuf);
+	return f.event_fd;
+err:
+	if (f.event_fd != -1){
+		close(f.event_fd);
+		f.event_fd = -1;
+	}
+	close(f.pps_fd);
+	f.pps_fd = -1;
+	return -1;
+}
+
+/**
+ * Stops the reader thread and closes the PPS device
+ * and the eventfd.
+ */
+void stopPPSApi(void){
+	if (! f.isRunning){
+		return;
+	}
+
+	__atomic_store_n(&f.doExit, true, __ATOMIC_RELEASE);
+	pthread_join(f.readerThread, NULL);
+	f.isRunning = false;
+
+	close(f.event_fd);
+	close(f.pps_fd);
+	f.event_fd = -1;
+	f.pps_fd = -1;
+}
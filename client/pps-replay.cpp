@@ -0,0 +1,485 @@
+/**
+ * @file pps-replay.cpp
+ * @brief This file contains functions and structures for replaying recorded PPS interrupt times through the PPS-Client controller.
+ *
+ * The replay engine reads a trace file of PPS interrupt times in the
+ * form of the G.tm[0] nanosecond times that readPPS_SetTime() reads
+ * from the gps-pps-io driver and passes them through the same controller
+ * routines that the daemon uses. The controller is connected to the
+ * simulated clock backend of pps-sim.cpp, which records the adjtimex()
+ * calls instead of making them and applies the recorded corrections to
+ * the times read from the trace file. Because no waiting is involved, a
+ * trace is processed as fast as the CPU allows.
+ *
+ * Each line of the trace file contains the whole seconds and the
+ * nanoseconds of a PPS interrupt time read from a free-running
+ * (undisciplined) clock, optionally followed by a calibration
+ * interrupt delay in microseconds:
+ *
+ *     1460044256 000123456 7.250
+ *
+ * Because the clock is free-running, the interrupt times drift
+ * across its whole seconds, so the PPS seconds are counted from
+ * the time between interrupts by getSimEdgeSecs() and not from
+ * the whole seconds. Missing PPS seconds are replayed as lost PPS
+ * interrupts. Lines
+ * beginning with '#' are ignored.
+ *
+ * Interrupt times read from the system clock while it is being
+ * disciplined are not a free-running trace. A free-running trace
+ * is recorded from the gps-pps-io driver by captureTrace().
+ */
+
+/*
+ * Copyright (C) 2016-2018  Raymond S. Connell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "../client/pps-client.h"
+extern struct G g;
+extern struct clockBackend *clk;
+extern struct clockBackend simClockBackend;
+
+/**
+ * Local file-scope shared variables.
+ */
+static struct replayLocalVars {
+	struct simClock sim;			//!< The simulated clock.
+	bool doKalman;					//!< Runs the Kalman controller in place of the proportional-integral controller.
+
+	unsigned int nSecs;				//!< Count of replayed seconds including lost PPS interrupts.
+	unsigned int nLost;				//!< Count of seconds missing from the trace.
+	unsigned int nRestarts;			//!< Count of controller restarts.
+	int lockSecs;					//!< Seconds from the start of the trace to the first lock at HARD_LIMIT_1.
+
+	unsigned int nLocked;			//!< Count of controller cycles while locked.
+	unsigned int nDelaySpikes;		//!< Count of PPS interrupts skipped as delay spikes.
+	double jitterSumSq;				//!< Sum of squares of G.jitter while locked.
+	double jitterMax;				//!< Maximum magnitude of G.jitter while locked.
+	double correctionSumSq;			//!< Sum of squares of G.timeCorrection while locked.
+	double correctionMax;			//!< Maximum magnitude of G.timeCorrection while locked.
+} f;								//!< Local file-scope shared variables.
+
+/**
+ * Sets the controller to its initial state for
+ * running on the simulated clock.
+ *
+ * @param[in] verbose Enables printing of state status params when "true".
+ */
+void initializeReplay(bool verbose){
+	initialize(verbose);
+
+	g.doNTPsettime = false;
+	g.doCalibration = false;
+	g.doKalman = f.doKalman;
+
+	clk->adjtimex(&g.t3);
+	setDelayTrackers();
+}
+
+/**
+ * Accumulates the controller performance statistics
+ * after each second of replay.
+ */
+void recordReplayStats(void){
+
+	if (g.isDelaySpike && ! g.interruptLost){
+		f.nDelaySpikes += 1;
+	}
+
+	if (g.hardLimit == HARD_LIMIT_1 && g.isControlling){
+		if (f.lockSecs == -1){
+			f.lockSecs = f.nSecs;
+		}
+
+		f.nLocked += 1;
+
+		f.jitterSumSq += g.jitter * g.jitter;
+		if (fabs(g.jitter) > f.jitterMax){
+			f.jitterMax = fabs(g.jitter);
+		}
+
+		f.correctionSumSq += g.timeCorrection * g.timeCorrection;
+		if (fabs(g.timeCorrection) > f.correctionMax){
+			f.correctionMax = fabs(g.timeCorrection);
+		}
+	}
+}
+
+/**
+ * Prints the Allan deviation and time deviation of
+ * the clock oscillator at every fourth octave tau
+ * reached by the replay.
+ */
+void printStabilitySummary(void){
+	double adev, mdev, tdev;
+
+	for (int i = 0; i < STABILITY_NUM_TAUS; i += 4){
+		if (getStability(i, &adev, &mdev, &tdev) == 0){
+			break;
+		}
+		printf("Tau %d sec  ADEV: %.3e  MDEV: %.3e  TDEV: %.3lf usec\n", getStabilityTau(i), adev, mdev, tdev * USECS_PER_SEC);
+	}
+}
+
+/**
+ * Prints a summary of controller performance over
+ * the replayed trace.
+ *
+ * @param[in] cpuSecs The CPU time used by the replay.
+ */
+void printReplaySummary(double cpuSecs){
+	double norm = (f.nLocked > 0) ? 1.0 / (double)f.nLocked : 0.0;
+
+	printf("Controller: %s\n", f.doKalman ? "kalman" : "pi");
+	printf("Replayed seconds: %u\n", f.nSecs);
+	printf("Lost interrupts: %u\n", f.nLost);
+	printf("Restarts: %u\n", f.nRestarts);
+	if (f.lockSecs >= 0){
+		printf("Time to lock: %d sec\n", f.lockSecs);
+	}
+	else {
+		printf("Time to lock: not locked\n");
+	}
+	printf("Locked seconds: %u\n", f.nLocked);
+	printf("Delay spikes: %u\n", f.nDelaySpikes);
+	printf("Jitter RMS: %lf usec  max: %.3lf usec\n", sqrt(f.jitterSumSq * norm), f.jitterMax);
+	printf("Jitter p50: %.3lf  p99: %.3lf  p99.9: %.3lf  max: %.3lf usec\n", histPercentile(&g.jitterHist, 50.0),
+			histPercentile(&g.jitterHist, 99.0), histPercentile(&g.jitterHist, 99.9), histPercentile(&g.jitterHist, 100.0));
+	printf("Time correction RMS: %lf usec  max: %.3lf usec\n", sqrt(f.correctionSumSq * norm), f.correctionMax);
+	printf("Final freqOffset: %lf ppm\n", g.freqOffset);
+	printStabilitySummary();
+	printf("adjtimex() calls: %u offset, %u frequency, %u step\n", f.sim.nOffsetCalls, f.sim.nFreqCalls, f.sim.nStepCalls);
+	if (cpuSecs > 0.0){
+		printf("CPU time: %lf sec (%.0lf replayed sec/sec)\n", cpuSecs, (double)f.nSecs / cpuSecs);
+	}
+	printShadowRanking();
+}
+
+/**
+ * Gets the CPU time used by this process in seconds.
+ */
+double getCPUtime(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+
+/**
+ * Runs the controller for one second of the trace.
+ *
+ * @param[in] haveInterrupt "true" if the trace contains a
+ * PPS interrupt time for this second. The interrupt time
+ * must have been set in G.tm[0].
+ *
+ * @param[in] intrptDelay A calibration interrupt delay
+ * or -1 if none was recorded.
+ *
+ * @param[in] verbose If "true" print the status line each second.
+ *
+ * @param[in] out File for per-second records or NULL.
+ *
+ * @returns 0 on success, else -1 if the controller exits.
+ */
+int replaySecond(bool haveInterrupt, double intrptDelay, bool verbose, FILE *out){
+
+	ssize_t rv = haveInterrupt ? sizeof(int64_t) : 0;
+
+	int restart = setTimeFromPPSread(rv, verbose, -1);
+	if (restart == -1){
+		return -1;
+	}
+
+	f.nSecs += 1;
+
+	if (restart == 1){
+		f.nRestarts += 1;
+		initializeReplay(verbose);
+		return 0;
+	}
+
+	if (checkPPSInterrupt(-1) != 0){
+		printf("Lost PPS for one hour at replay second %u.\n", f.nSecs);
+		return -1;
+	}
+
+	if (! g.interruptLost && ! g.isDelaySpike){
+		if (intrptDelay >= 0 && g.hardLimit == HARD_LIMIT_1){
+			processInterruptDelay(intrptDelay);
+		}
+	}
+
+	recordReplayStats();
+
+	if (verbose){
+		bufferStateParams();
+		g.savebuf[0] = '\0';
+	}
+
+	if (out != NULL && haveInterrupt){
+		fprintf(out, "%u %ld %.3lf %.3lf %.3lf %lf %d %d\n", g.seq_num, (long)g.t.tv_sec, g.interruptTime, g.rawError,
+				g.timeCorrection, g.freqOffset, g.hardLimit, g.sysDelay);
+	}
+	return 0;
+}
+
+/**
+ * Replays a trace file of PPS interrupt times through
+ * the controller as requested from the command line
+ * with "pps-client -r <trace-file> [-f <output-file>] [-c <controller>] [-s <settings>] [-v]".
+ *
+ * If an output file is given, a record is written to it
+ * for each PPS interrupt containing seq_num, interrupt
+ * seconds, interruptTime, rawError, timeCorrection,
+ * freqOffset, hardLimit and sysDelay.
+ *
+ * The controller is "pi" unless "kalman" is given with -c,
+ * so the two can be compared on the same trace. Each -s,
+ * up to SHADOW_MAX, adds a shadow controller with the
+ * given settings, as for shadow-N in the config file.
+ * The shadow controllers are ranked with the replayed
+ * controller at the end of the summary.
+ *
+ * @param[in] argc System command line arg
+ * @param[in] argv System command line arg
+ *
+ * @returns 0 on success, else -1 on error.
+ */
+int replayTrace(int argc, char *argv[]){
+	char line[MAX_LINE_LEN + 50];
+	const char *outname = NULL;
+	const char *controller = "pi";
+	const char *shadowSpecs[SHADOW_MAX];
+	int nShadowSpecs = 0;
+	bool verbose = false;
+	FILE *out = NULL;
+	int rv = 0;
+
+	if (argc < 3 || argv[2][0] == '-'){
+		printf("Usage: pps-client -r <trace-file> [-f <output-file>] [-c <controller>] [-s <settings>] [-v]\n");
+		return -1;
+	}
+
+	for (int i = 3; i < argc; i++){
+		if (strcmp(argv[i], "-f") == 0 && i + 1 < argc){
+			outname = argv[i+1];
+		}
+		if (strcmp(argv[i], "-c") == 0 && i + 1 < argc){
+			controller = argv[i+1];
+		}
+		if (strcmp(argv[i], "-s") == 0 && i + 1 < argc && nShadowSpecs < SHADOW_MAX){
+			shadowSpecs[nShadowSpecs] = argv[i+1];
+			nShadowSpecs += 1;
+		}
+		if (strcmp(argv[i], "-v") == 0){
+			verbose = true;
+		}
+	}
+
+	if (strcmp(controller, "pi") != 0 && strcmp(controller, "kalman") != 0){
+		printf("Unrecognized controller %s. Use pi or kalman.\n", controller);
+		return -1;
+	}
+
+	FILE *trace = fopen(argv[2], "r");
+	if (trace == NULL){
+		printf("Could not open trace file %s: %s\n", argv[2], strerror(errno));
+		return -1;
+	}
+
+	if (outname != NULL){
+		out = fopen(outname, "w");
+		if (out == NULL){
+			printf("Could not open output file %s: %s\n", outname, strerror(errno));
+			fclose(trace);
+			return -1;
+		}
+	}
+
+	memset(&f, 0, sizeof(struct replayLocalVars));
+	f.lockSecs = -1;
+	f.doKalman = strcmp(controller, "kalman") == 0;
+
+	initSimClock(&f.sim);
+	clk = &simClockBackend;
+	initializeReplay(verbose);
+
+	for (int i = 0; i < nShadowSpecs; i++){
+		struct controllerParams params;
+		if (parseShadowParams(shadowSpecs[i], &params) == -1){
+			printf("Invalid shadow controller settings: %s\n", shadowSpecs[i]);
+			fclose(trace);
+			if (out != NULL){
+				fclose(out);
+			}
+			return -1;
+		}
+	}
+	initShadows(shadowSpecs, nShadowSpecs);
+
+	double cpuStart = getCPUtime();
+
+	while (fgets(line, sizeof(line), trace) != NULL){
+		long sec, nsec;
+		double intrptDelay = -1.0;
+
+		if (line[0] == '#' || sscanf(line, "%ld %ld %lf", &sec, &nsec, &intrptDelay) < 2){
+			continue;
+		}
+
+		long nSecs = getSimEdgeSecs(&f.sim, sec, nsec);		// PPS seconds since the last interrupt.
+		if (nSecs == 0){									// Skip out-of-order or repeated interrupts.
+			continue;
+		}
+
+		for (long i = 1; i < nSecs; i++){					// Replay missing seconds as lost interrupts.
+			advanceSimClock(&f.sim);
+			f.nLost += 1;
+			rv = replaySecond(false, -1, verbose, out);
+			if (rv == -1){
+				goto end;
+			}
+		}
+
+		advanceSimClock(&f.sim);
+		g.tm[0] = setSimEdge(&f.sim, sec, nsec);
+
+		rv = replaySecond(true, intrptDelay, verbose, out);
+		if (rv == -1){
+			goto end;
+		}
+	}
+
+end:
+	printReplaySummary(getCPUtime() - cpuStart);
+
+	fclose(trace);
+	if (out != NULL){
+		fclose(out);
+	}
+	return 0;
+}
+
+/**
+ * Records a trace file of PPS interrupt times that can be
+ * replayed with "pps-client -r" as requested from the command
+ * line with "pps-client -t <trace-file> [-n <secs>]".
+ *
+ * The replay applies the corrections of the replayed controller
+ * to the interrupt times, so they must be read from a free-running
+ * clock and not from the system clock that the daemon disciplines.
+ * Each interrupt time is therefore recorded as the raw monotonic
+ * time recorded by the gps-pps-io driver offset to the system time
+ * of the first interrupt. If the daemon has made a calibration
+ * since the last interrupt, its interrupt delay is appended.
+ *
+ * The driver is opened read-only, so the daemon can be running.
+ * Recording continues for <secs> seconds or until ended by ctrl-c.
+ *
+ * @param[in] argc System command line arg
+ * @param[in] argv System command line arg
+ *
+ * @returns 0 on success, else -1 on error.
+ */
+int captureTrace(int argc, char *argv[]){
+	long maxSecs = 0;
+	long nSecs = 0;
+	int64_t rawStart = 0, timeStart = 0;
+	struct pps_record rec;
+	struct pps_calib_record calib;
+	int rv = 0;
+
+	if (argc < 3 || argv[2][0] == '-'){
+		printf("Usage: pps-client -t <trace-file> [-n <secs>]\n");
+		return -1;
+	}
+	for (int i = 3; i < argc; i++){
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc){
+			maxSecs = atol(argv[i+1]);
+		}
+	}
+
+	int pps_fd = open("/dev/gps-pps-io", O_RDONLY);
+	if (pps_fd == -1){
+		printf("Could not open /dev/gps-pps-io: %s\n", strerror(errno));
+		return -1;
+	}
+
+	void *p = mmap(NULL, sizeof(struct pps_ring), PROT_READ, MAP_SHARED, pps_fd, 0);
+	if (p == MAP_FAILED){
+		printf("Could not map /dev/gps-pps-io: %s\n", strerror(errno));
+		close(pps_fd);
+		return -1;
+	}
+	const struct pps_ring *ring = (const struct pps_ring *)p;
+
+	FILE *trace = fopen(argv[2], "w");
+	if (trace == NULL){
+		printf("Could not open trace file %s: %s\n", argv[2], strerror(errno));
+		munmap(p, sizeof(struct pps_ring));
+		close(pps_fd);
+		return -1;
+	}
+	fprintf(trace, "# Free-running PPS interrupt times recorded by pps-client -t\n");
+
+	__u32 seq = getPPSRingHead(ring);
+	__u32 calibSeq = (readPPSCalibRecord(ring, &calib) == 0) ? calib.seq : 0;
+
+	struct pollfd pfd;
+	pfd.fd = pps_fd;
+	pfd.events = POLLIN;
+
+	while (maxSecs == 0 || nSecs < maxSecs){
+		rv = poll(&pfd, 1, -1);							// Sleep until the next PPS interrupt.
+		if (rv == -1){
+			if (errno == EINTR){
+				continue;
+			}
+			printf("poll() failed with msg: %s\n", strerror(errno));
+			break;
+		}
+		rv = 0;
+
+		__u32 head = getPPSRingHead(ring);
+		for (; seq != head; ){
+			seq += 1;
+			if (readPPSRecord(ring, seq, &rec) == -1){		// Overwritten. Replayed as a lost interrupt.
+				continue;
+			}
+			if (rawStart == 0){
+				rawStart = rec.raw_time;
+				timeStart = rec.time;
+			}
+			int64_t t = timeStart + (rec.raw_time - rawStart);
+
+			fprintf(trace, "%lld %09lld", (long long)(t / NSECS_PER_SEC), (long long)(t % NSECS_PER_SEC));
+			if (readPPSCalibRecord(ring, &calib) == 0 && calib.seq != calibSeq){
+				calibSeq = calib.seq;
+				fprintf(trace, " %.3lf", (double)(calib.intrpt_time - calib.write_time) / NSECS_PER_USEC);
+			}
+			fprintf(trace, "\n");
+			fflush(trace);
+			nSecs += 1;
+		}
+	}
+
+	printf("Recorded %ld PPS interrupt times to %s\n", nSecs, argv[2]);
+
+	fclose(trace);
+	munmap(p, sizeof(struct pps_ring));
+	close(pps_fd);
+	return rv;
+}
@@ -0,0 +1,741 @@
+/**
+ * @file pps-shadow.cpp
+ * @brief This file contains the shadow controllers that evaluate other controller settings on the live PPS stream.
+ *
+ * Up to SHADOW_MAX shadow controllers, each with its own settings
+ * from a shadow-N line of the config file, run beside the controller
+ * of the system clock. None of them touches the system clock. Each
+ * one corrects a simulated clock of its own, so each sees the time
+ * errors that the system clock would have had if that controller had
+ * been disciplining it.
+ *
+ * The simulated clocks are driven from the phase of the free-running
+ * clock oscillator. That is reconstructed at each PPS edge from the
+ * rawError seen by the active controller and the time steps, time
+ * slews and frequency offsets that it made to the system clock, which
+ * are applied to a simulated copy of the system clock in the same way
+ * as the replay engine applies them. So the shadow controllers see the
+ * same oscillator and the same interrupt jitter as the active one.
+ *
+ * The controller thread only copies each PPS edge to a single-producer,
+ * single-consumer queue. The shadow controllers are run from that queue
+ * by a worker thread at normal priority, so they can never delay the
+ * controller of the system clock. While locked, the RMS and p99 of the
+ * time error of each controller are recorded, and the controllers are
+ * ranked by RMS time error. The ranking is logged every SHADOW_REPORT_SECS
+ * and can be saved with "pps-client -s shadows".
+ */
+
+/*
+ * Copyright (C) 2016-2018  Raymond S. Connell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "../client/pps-client.h"
+extern struct G g;
+
+/**
+ * A simulated clock corrected by a controller.
+ */
+struct shadowClock {
+	double phase;									//!< Accumulated time correction applied to the clock (microseconds).
+	double pendingSlew;								//!< Remaining ADJ_OFFSET_SINGLESHOT slew (microseconds).
+	double freq;										//!< Frequency offset applied to the clock (ppm).
+};
+
+/**
+ * The performance of a controller while locked.
+ */
+struct shadowStats {
+	int lockSecs;									//!< Seconds from the first PPS edge to the first lock or -1.
+	unsigned int nRestarts;							//!< Count of controller restarts.
+	unsigned int nLocked;							//!< Count of PPS edges while locked.
+	double errorSumSq;								//!< Sum of squares of the time error while locked.
+	double correctionSumSq;							//!< Sum of squares of the time correction while locked.
+	double freqOffset;								//!< The last frequency offset.
+	struct hdrHist errorHist;						//!< Magnitudes of the time error while locked.
+};
+
+/**
+ * A shadow controller and the simulated clock that it corrects.
+ */
+struct shadowController {
+	char name[CTL_LABEL_SZ];							//!< "shadow-" followed by the config key number.
+	char spec[CONFIG_STR_SZ];						//!< The settings as given in the config file.
+	struct controllerParams params;					//!< The controller settings.
+	struct controller ctl;							//!< The controller.
+	struct shadowClock clock;						//!< The simulated clock.
+	struct shadowStats stats;						//!< The performance of the controller.
+};
+
+/**
+ * Local file-scope shared variables.
+ */
+static struct shadowLocalVars {
+	pthread_t workerThread;						//!< The shadow worker thread. The only consumer.
+	bool isRunning;								//!< "true" while the shadow worker is running.
+	bool doExit;									//!< Set "true" to stop the shadow worker.
+	sem_t inputsReady;							//!< Posted once for each PPS edge added to the queue.
+	unsigned int head;							//!< Count of PPS edges added. Written only by the producer.
+	unsigned int tail;							//!< Count of PPS edges removed. Written only by the consumer.
+	unsigned int nDropped;						//!< Count of PPS edges dropped because the queue was full.
+	struct shadowInput queue[SHADOW_QUEUE_LEN];	//!< The PPS edge queue.
+
+	pthread_mutex_t statsLock;					//!< Protects the controllers and their stats while they are run or reported.
+	int nShadows;								//!< Count of shadow controllers.
+	struct shadowController shadow[SHADOW_MAX];	//!< The shadow controllers.
+	struct shadowClock activeClock;				//!< Simulated copy of the clock corrected by the active controller.
+	struct shadowStats active;					//!< The performance of the active controller.
+	bool isStarted;								//!< "true" after the first PPS edge.
+	double startTime;							//!< Monotonic time of the first PPS edge.
+	double lastTime;								//!< Monotonic time of the last PPS edge.
+	double lastReport;							//!< Monotonic time at which the ranking was last logged.
+
+	struct shadowClock *current;					//!< The clock being corrected by shadowAdjtimex().
+	double t_mono;								//!< Monotonic time of the PPS edge being processed.
+	struct timespec t_raw;						//!< Free-running time of the PPS edge being processed. Zero if not available.
+	char logbuf[LOGBUF_SZ];						//!< Used in place of G.logbuf by the shadow worker.
+} f;											//!< Local file-scope shared variables.
+
+/**
+ * Applies an adjtimex() call by a shadow controller
+ * to its simulated clock.
+ *
+ * @param[in] t The timex struct passed by the controller.
+ *
+ * @returns 0 corresponding to TIME_OK.
+ */
+int shadowAdjtimex(struct timex *t){
+	struct shadowClock *sc = f.current;
+
+	if (t->modes & ADJ_SETOFFSET){
+		double step = (t->modes & ADJ_NANO) ? (double)t->time.tv_usec / NSECS_PER_USEC : (double)t->time.tv_usec;
+		sc->phase += (double)t->time.tv_sec * USECS_PER_SEC + step;	// Applied immediately.
+	}
+	else if ((t->modes & ADJ_OFFSET_SINGLESHOT) == ADJ_OFFSET_SINGLESHOT){
+		sc->pendingSlew = (double)t->offset;					// Like adjtimex(), replaces any remaining slew.
+	}
+	else if (t->modes & ADJ_FREQUENCY){
+		sc->freq = (double)t->freq / ADJTIMEX_SCALE;
+	}
+	return 0;
+}
+
+/**
+ * Gets the time of day for a shadow controller.
+ */
+int shadowGetTimeOfDay(struct timeval *tv){
+	tv->tv_sec = (time_t)f.t_mono;
+	tv->tv_usec = 0;
+	return 0;
+}
+
+/**
+ * Gets the monotonic time of the PPS edge being
+ * processed by a shadow controller.
+ */
+int shadowGetMonotonic(struct timespec *ts){
+	ts->tv_sec = (time_t)f.t_mono;
+	ts->tv_nsec = (long)round((f.t_mono - (double)ts->tv_sec) * NSECS_PER_SEC);
+	return 0;
+}
+
+/**
+ * Gets the free-running time of the PPS edge being
+ * processed by a shadow controller.
+ *
+ * @returns 0 on success or -1 if it is not available.
+ */
+int shadowGetEdgeRaw(struct timespec *ts){
+	if (f.t_raw.tv_sec == 0 && f.t_raw.tv_nsec == 0){
+		return -1;
+	}
+	*ts = f.t_raw;
+	return 0;
+}
+
+struct clockBackend shadowClockBackend = {shadowAdjtimex, shadowGetTimeOfDay, shadowGetMonotonic, shadowGetEdgeRaw, true};	//!< Clock backend for the shadow controllers.
+
+/**
+ * Advances a simulated clock by secs seconds, applying
+ * the time slew remaining from adjtimex() at the rate
+ * limit of MAX_SLEW_PER_SEC and the current frequency
+ * offset.
+ *
+ * @param[in,out] sc The clock.
+ * @param[in] secs The number of seconds.
+ */
+void advanceShadowClock(struct shadowClock *sc, int secs){
+	for (int i = 0; i < secs; i++){
+		double slew = sc->pendingSlew;
+
+		if (slew > MAX_SLEW_PER_SEC){
+			slew = MAX_SLEW_PER_SEC;
+		}
+		else if (slew < -MAX_SLEW_PER_SEC){
+			slew = -MAX_SLEW_PER_SEC;
+		}
+		sc->pendingSlew -= slew;
+
+		sc->phase += slew + sc->freq;					// One second at freq ppm is freq microseconds.
+	}
+}
+
+/**
+ * Parses the settings of a shadow controller. The settings
+ * are separated by spaces. "pi" or "kalman" selects the
+ * controller and each of "inv-gain:", "gain:", "noise:",
+ * "sigmas:", "slew:", "spikes:" and "limit:" followed by
+ * a value sets the startup inverse proportional gain,
+ * integral gain, noise factor, delay spike threshold in
+ * robust standard deviations, slew limit, maximum delay
+ * spike count and hard limit policy. Settings
+ * that are not given keep their default values. For
+ * example:
+ *
+ *     pi gain:0.5 slew:40 limit:2
+ *
+ * @param[in] spec The settings.
+ * @param[out] p The controller settings.
+ *
+ * @returns 0 on success, else -1 if a setting is not
+ * recognized or is out of range.
+ */
+int parseShadowParams(const char *spec, struct controllerParams *p){
+	char buf[CONFIG_STR_SZ];
+	char *savePtr;
+
+	setControllerDefaults(p);
+	p->doFastAcquire = g.doFastAcquire;
+	p->doLog = false;
+
+	strncpy(buf, spec, CONFIG_STR_SZ - 1);
+	buf[CONFIG_STR_SZ - 1] = '\0';
+
+	char *tok = strtok_r(buf, " \t", &savePtr);
+	while (tok != NULL){
+		char *value = strchr(tok, ':');
+		double num = 0.0;
+
+		if (value != NULL){
+			*value = '\0';
+			char *end;
+			num = strtod(value + 1, &end);
+			if (end == value + 1 || *end != '\0'){
+				return -1;
+			}
+		}
+
+		if (value == NULL && strcmp(tok, "pi") == 0){
+			p->doKalman = false;
+		}
+		else if (value == NULL && strcmp(tok, "kalman") == 0){
+			p->doKalman = true;
+		}
+		else if (value != NULL && strcmp(tok, "inv-gain") == 0 && num >= 1.0){
+			p->invGain0 = (int)num;
+		}
+		else if (value != NULL && strcmp(tok, "gain") == 0 && num > 0.0){
+			p->integralGain = num;
+		}
+		else if (value != NULL && strcmp(tok, "noise") == 0 && num > 0.0){
+			p->noiseFactor = num;
+		}
+		else if (value != NULL && strcmp(tok, "sigmas") == 0 && num >= 0.0){
+			p->spikeSigmas = num;
+		}
+		else if (value != NULL && strcmp(tok, "slew") == 0 && num > 0.0){
+			p->slewMax = num;
+		}
+		else if (value != NULL && strcmp(tok, "spikes") == 0 && num >= 0.0){
+			p->maxSpikes = (int)num;
+		}
+		else if (value != NULL && strcmp(tok, "limit") == 0 && num >= 0.0 && num <= 4.0){
+			p->hardLimitShift = (int)num;
+		}
+		else {
+			return -1;
+		}
+		tok = strtok_r(NULL, " \t", &savePtr);
+	}
+	return 0;
+}
+
+/**
+ * Sets the performance stats to their initial state.
+ *
+ * @param[out] st The stats.
+ */
+void resetShadowStats(struct shadowStats *st){
+	memset(st, 0, sizeof(struct shadowStats));
+	st->lockSecs = -1;
+}
+
+/**
+ * Sets up a shadow controller for each of the non-empty
+ * settings in specs. Called once on startup. A shadow controller is named by the
+ * position of its settings in specs, so the settings of
+ * "shadow-2" in the config file are specs[1].
+ *
+ * @param[in] specs The settings of each shadow controller.
+ * @param[in] n The length of specs.
+ *
+ * @returns The count of shadow controllers.
+ */
+int initShadows(const char *specs[], int n){
+	pthread_mutex_init(&f.statsLock, NULL);
+
+	f.nShadows = 0;
+	f.isStarted = false;
+	memset(&f.activeClock, 0, sizeof(struct shadowClock));
+	resetShadowStats(&f.active);
+
+	for (int i = 0; i < n && f.nShadows < SHADOW_MAX; i++){
+		if (specs[i] == NULL || specs[i][0] == '\0'){
+			continue;
+		}
+
+		struct shadowController *sh = &f.shadow[f.nShadows];
+		memset(sh, 0, sizeof(struct shadowController));
+
+		if (parseShadowParams(specs[i], &sh->params) == -1){
+			sprintf(f.logbuf, "initShadows() Ignored shadow-%d with invalid settings: %s\n", i + 1, specs[i]);
+			writeToLog(f.logbuf);
+			continue;
+		}
+
+		sprintf(sh->name, "shadow-%d", i + 1);
+		snprintf(sh->spec, CONFIG_STR_SZ, "%s", specs[i]);
+		initController(&sh->ctl, &sh->params, g.sysDelay);
+		resetShadowStats(&sh->stats);
+
+		f.nShadows += 1;
+	}
+	return f.nShadows;
+}
+
+/**
+ * Adds the time error and the time correction of a PPS
+ * edge to the performance stats if the controller is
+ * locked.
+ *
+ * @param[in,out] st The stats.
+ * @param[in] rawError The time error.
+ * @param[in] timeCorrection The time correction.
+ * @param[in] freqOffset The frequency offset.
+ * @param[in] isLocked "true" if the controller is locked.
+ * @param[in] t The monotonic time of the PPS edge.
+ */
+void recordShadowStats(struct shadowStats *st, double rawError, double timeCorrection, double freqOffset,
+		bool isLocked, double t){
+
+	st->freqOffset = freqOffset;
+
+	if (! isLocked){
+		return;
+	}
+
+	if (st->lockSecs == -1){
+		st->lockSecs = (int)round(t - f.startTime);
+	}
+	st->nLocked += 1;
+	st->errorSumSq += rawError * rawError;
+	st->correctionSumSq += timeCorrection * timeCorrection;
+	histRecord(&st->errorHist, rawError);
+}
+
+/**
+ * Runs a shadow controller for one PPS edge.
+ *
+ * @param[in,out] sh The shadow controller.
+ * @param[in] phase The phase of the free-running clock oscillator.
+ * @param[in] in The PPS edge.
+ */
+void runShadow(struct shadowController *sh, double phase, const struct shadowInput *in){
+	double rawError = phase + sh->clock.phase;
+
+	f.current = &sh->clock;
+	makeControllerCorrection(&sh->ctl, rawError, in->sysDelay, &shadowClockBackend);
+
+	recordShadowStats(&sh->stats, rawError, sh->ctl.timeCorrection, sh->ctl.freqOffset,
+			sh->ctl.hardLimit == HARD_LIMIT_1 && sh->ctl.isControlling, in->t_mono);
+
+	if (controllerNeedsRestart(&sh->ctl)){				// Restarts like the active controller, which also
+		sh->stats.nRestarts += 1;						// sets the clock frequency offset to zero.
+		initController(&sh->ctl, &sh->params, in->sysDelay);
+		sh->clock.freq = 0.0;
+	}
+}
+
+/**
+ * Returns the RMS time error of a controller while
+ * locked.
+ *
+ * @param[in] st The stats.
+ */
+double getShadowRMS(const struct shadowStats *st){
+	if (st->nLocked == 0){
+		return 0.0;
+	}
+	return sqrt(st->errorSumSq / (double)st->nLocked);
+}
+
+/**
+ * Gets the name, settings and stats of the controller
+ * in row i, where row 0 is the active controller.
+ *
+ * @param[in] i The row.
+ * @param[out] name The controller name.
+ * @param[out] spec The controller settings.
+ *
+ * @returns The stats.
+ */
+const struct shadowStats *getShadowRow(int i, const char **name, const char **spec){
+	if (i == 0){
+		*name = "active";
+		*spec = g.doKalman ? "kalman" : "pi";
+		return &f.active;
+	}
+	*name = f.shadow[i-1].name;
+	*spec = f.shadow[i-1].spec;
+	return &f.shadow[i-1].stats;
+}
+
+/**
+ * Ranks the active controller and the shadow
+ * controllers. Controllers that have locked are
+ * ranked by RMS time error while locked, ahead of
+ * controllers that have not locked.
+ *
+ * @param[out] rank The rows of the controllers in
+ * order of rank.
+ *
+ * @returns The count of ranked controllers.
+ */
+int rankShadows(int rank[]){
+	int n = f.nShadows + 1;
+
+	for (int i = 0; i < n; i++){
+		rank[i] = i;
+	}
+
+	for (int i = 1; i < n; i++){						// Insertion sort. There are at most SHADOW_MAX + 1.
+		const char *name, *spec;
+		int r = rank[i];
+		const struct shadowStats *st = getShadowRow(r, &name, &spec);
+
+		int j = i - 1;
+		while (j >= 0){
+			const struct shadowStats *prev = getShadowRow(rank[j], &name, &spec);
+			bool isBetter = (st->nLocked > 0 && prev->nLocked == 0)
+					|| (st->nLocked > 0 && prev->nLocked > 0 && getShadowRMS(st) < getShadowRMS(prev));
+			if (! isBetter){
+				break;
+			}
+			rank[j+1] = rank[j];
+			j -= 1;
+		}
+		rank[j+1] = r;
+	}
+	return n;
+}
+
+/**
+ * Formats the ranking of the controllers with one line
+ * for each controller.
+ *
+ * @param[out] buf The formatted ranking.
+ *
+ * @returns The length of the formatted ranking.
+ */
+int formatShadowRanking(char *buf){
+	int rank[SHADOW_MAX + 1];
+	const char *name, *spec;
+
+	int len = sprintf(buf, "# rank name lock(s) locked(s) restarts rms-error(us) p99-error(us) rms-correction(us) freq(ppm) settings\n");
+
+	int n = rankShadows(rank);
+	for (int i = 0; i < n; i++){
+		const struct shadowStats *st = getShadowRow(rank[i], &name, &spec);
+		double norm = (st->nLocked > 0) ? 1.0 / (double)st->nLocked : 0.0;
+
+		len += sprintf(buf + len, "%d %s %d %u %u %.3lf %.3lf %.3lf %.3lf %s\n", i + 1, name, st->lockSecs,
+				st->nLocked, st->nRestarts, getShadowRMS(st), histPercentile(&st->errorHist, 99.0),
+				sqrt(st->correctionSumSq * norm), st->freqOffset, spec);
+	}
+	return len;
+}
+
+/**
+ * Logs the ranking of the controllers by RMS
+ * time error.
+ */
+void logShadowRanking(void){
+	int rank[SHADOW_MAX + 1];
+	const char *name, *spec;
+
+	int len = sprintf(f.logbuf, "Shadow ranking by RMS time error:");
+
+	int n = rankShadows(rank);
+	for (int i = 0; i < n; i++){
+		const struct shadowStats *st = getShadowRow(rank[i], &name, &spec);
+		if (st->nLocked > 0){
+			len += sprintf(f.logbuf + len, " %d %s %.3lf usec", i + 1, name, getShadowRMS(st));
+		}
+		else {
+			len += sprintf(f.logbuf + len, " %d %s not locked", i + 1, name);
+		}
+	}
+	sprintf(f.logbuf + len, "\n");
+	writeToLog(f.logbuf);
+}
+
+/**
+ * Reconstructs the phase of the free-running clock
+ * oscillator at a PPS edge seen by the active controller
+ * and runs each shadow controller on it.
+ *
+ * @param[in] in The PPS edge.
+ */
+void processShadowInput(const struct shadowInput *in){
+	pthread_mutex_lock(&f.statsLock);
+
+	if (! f.isStarted){
+		f.isStarted = true;
+		f.startTime = in->t_mono;
+		f.lastReport = in->t_mono;
+	}
+	else {
+		int dt = (int)round(in->t_mono - f.lastTime);
+		if (dt < 1){										// Not a new PPS edge.
+			pthread_mutex_unlock(&f.statsLock);
+			return;
+		}
+
+		advanceShadowClock(&f.activeClock, dt);
+		for (int i = 0; i < f.nShadows; i++){
+			advanceShadowClock(&f.shadow[i].clock, dt);
+		}
+	}
+	f.lastTime = in->t_mono;
+	f.t_mono = in->t_mono;
+	f.t_raw = in->t_raw;
+
+	double phase = in->rawError - f.activeClock.phase;		// The phase without the corrections to the system clock.
+
+	recordShadowStats(&f.active, in->rawError, in->timeCorrection, in->freqOffset, in->isLocked, in->t_mono);
+	if (in->isRestart){
+		f.active.nRestarts += 1;
+	}
+
+	f.activeClock.phase += in->stepOffset;
+	if (in->isSlewed){
+		f.activeClock.pendingSlew = in->slewOffset;
+	}
+	f.activeClock.freq = in->freqOffset;
+
+	for (int i = 0; i < f.nShadows; i++){
+		runShadow(&f.shadow[i], phase, in);
+	}
+
+	bool isReportDue = in->t_mono - f.lastReport >= SHADOW_REPORT_SECS;
+	if (isReportDue){
+		f.lastReport = in->t_mono;
+	}
+
+	pthread_mutex_unlock(&f.statsLock);
+
+	if (isReportDue){
+		logShadowRanking();
+	}
+}
+
+/**
+ * Passes a PPS edge seen by the active controller to
+ * the shadow controllers. While the shadow worker is
+ * running the edge is only copied to the queue. If the
+ * queue is full the edge is dropped and counted, which
+ * the shadow controllers see as a lost PPS interrupt.
+ *
+ * @param[in] in The PPS edge.
+ */
+void postShadowInput(const struct shadowInput *in){
+	if (f.nShadows == 0){
+		return;
+	}
+
+	if (! f.isRunning){
+		processShadowInput(in);
+		return;
+	}
+
+	unsigned int head = f.head;
+	unsigned int tail = __atomic_load_n(&f.tail, __ATOMIC_ACQUIRE);
+
+	if (head - tail >= SHADOW_QUEUE_LEN){
+		__atomic_store_n(&f.nDropped, f.nDropped + 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	f.queue[head & (SHADOW_QUEUE_LEN - 1)] = *in;
+	__atomic_store_n(&f.head, head + 1, __ATOMIC_RELEASE);
+	sem_post(&f.inputsReady);
+}
+
+/**
+ * Writes the ranking of the controllers.
+ *
+ * @param[in] filename The file to write.
+ *
+ * @returns 0 on success, else -1 on error.
+ */
+int writeShadowFile(const char *filename){
+	char filebuf[(SHADOW_MAX + 2) * (CONFIG_STR_SZ + 200)];
+
+	if (f.nShadows == 0){
+		sprintf(f.logbuf, "writeShadowFile() No shadow controllers are configured.\n");
+		writeToLog(f.logbuf);
+		return -1;
+	}
+
+	pthread_mutex_lock(&f.statsLock);
+	int fileLen = formatShadowRanking(filebuf);
+	pthread_mutex_unlock(&f.statsLock);
+
+	return writeFileAtomic(filename, filebuf, fileLen);
+}
+
+/**
+ * Prints the ranking of the controllers.
+ */
+void printShadowRanking(void){
+	char buf[(SHADOW_MAX + 2) * (CONFIG_STR_SZ + 200)];
+
+	if (f.nShadows == 0){
+		return;
+	}
+
+	formatShadowRanking(buf);
+	printf("%s", buf);
+}
+
+/**
+ * The shadow worker thread. Lowers its scheduling
+ * policy from the SCHED_FIFO policy inherited from
+ * the controller thread, then runs the shadow
+ * controllers on each PPS edge from the queue until
+ * stopShadowWorker() is called.
+ */
+void *shadowWorker(void *){
+	struct sched_param param;
+	unsigned int lastDropped = 0;
+
+	param.sched_priority = 0;
+	pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+
+	for (;;){
+		if (sem_wait(&f.inputsReady) == -1){
+			continue;										// Interrupted by a signal.
+		}
+
+		if (__atomic_load_n(&f.doExit, __ATOMIC_ACQUIRE)){
+			break;
+		}
+
+		unsigned int tail = f.tail;
+		unsigned int head = __atomic_load_n(&f.head, __ATOMIC_ACQUIRE);
+		if (tail == head){
+			continue;
+		}
+
+		processShadowInput(&f.queue[tail & (SHADOW_QUEUE_LEN - 1)]);
+
+		__atomic_store_n(&f.tail, tail + 1, __ATOMIC_RELEASE);
+
+		unsigned int nDropped = __atomic_load_n(&f.nDropped, __ATOMIC_RELAXED);
+		if (nDropped != lastDropped){
+			sprintf(f.logbuf, "Shadow worker queue was full. Dropped %u PPS edges.\n", nDropped - lastDropped);
+			writeToLog(f.logbuf);
+			lastDropped = nDropped;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Sets up the shadow controllers from the config file
+ * and starts the shadow worker thread if there are any.
+ *
+ * @returns 0 on success or if there are no shadow
+ * controllers, else -1 on error, in which case the
+ * shadow controllers are not run.
+ */
+int startShadowWorker(void){
+	const char *specs[SHADOW_MAX];
+	const struct ppsConfig *cfg = getConfig();
+
+	for (int i = 0; i < SHADOW_MAX; i++){
+		specs[i] = cfg->shadow[i];
+	}
+	if (initShadows(specs, SHADOW_MAX) == 0){
+		return 0;
+	}
+
+	f.head = 0;
+	f.tail = 0;
+	f.nDropped = 0;
+	f.doExit = false;
+
+	if (sem_init(&f.inputsReady, 0, 0) == -1){
+		sprintf(f.logbuf, "startShadowWorker() sem_init() failed with msg: %s\n", strerror(errno));
+		writeToLog(f.logbuf);
+		f.nShadows = 0;
+		return -1;
+	}
+
+	int rv = pthread_create(&f.workerThread, NULL, &shadowWorker, NULL);
+	if (rv != 0){
+		sprintf(f.logbuf, "startShadowWorker() pthread_create() failed with msg: %s\n", strerror(rv));
+		writeToLog(f.logbuf);
+		sem_destroy(&f.inputsReady);
+		f.nShadows = 0;
+		return -1;
+	}
+
+	f.isRunning = true;
+
+	sprintf(f.logbuf, "Running %d shadow controllers.\n", f.nShadows);
+	writeToLog(f.logbuf);
+	return 0;
+}
+
+/**
+ * Stops the shadow worker thread. PPS edges that
+ * remain in the queue are discarded.
+ */
+void stopShadowWorker(void){
+	if (! f.isRunning){
+		return;
+	}
+
+	f.nShadows = 0;										// No more PPS edges are queued.
+	__atomic_store_n(&f.doExit, true, __ATOMIC_RELEASE);
+	sem_post(&f.inputsReady);
+	pthread_join(f.workerThread, NULL);
+
+	f.isRunning = false;
+	sem_destroy(&f.inputsReady);
+}
@@ -0,0 +1,166 @@
+/**
+ * @file pps-shm.h
+ * @brief This file contains the layout of the PPS-Client shared memory segment and its seqlock reader.
+ *
+ * The PPS-Client daemon publishes the PPS timestamps, sysDelay,
+ * controller state and histogram summaries each second to a fixed-layout shared memory segment,
+ * "/dev/shm/pps-client", instead of writing in-memory files. Readers map
+ * the segment once with mapPPSshm() and then get a consistent snapshot
+ * with readPPSshm() without making any system calls.
+ *
+ * The segment is published with a sequence lock. The daemon increments
+ * \b seq to an odd value before it changes the segment and to the next
+ * even value after, with a memory barrier between each store and the
+ * data. A reader that sees an odd \b seq or a \b seq that changed while
+ * it was copying the segment simply copies it again, up to
+ * PPS_SHM_MAX_RETRIES times so that a daemon that died while writing
+ * cannot hang its readers.
+ *
+ * The daemon invalidates and unlinks the segment when it exits and
+ * creates a new one when it starts again, so a mapping held across a
+ * daemon restart is left on the old segment. A reader that keeps the
+ * segment mapped and finds that it is no longer valid or that \b seq
+ * has stopped changing unmaps it with unmapPPSshm() and maps it again.
+ */
+
+/*
+ * Copyright (C) 2016-2018  Raymond S. Connell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef PPS_CLIENT_PPS_SHM_H_
+#define PPS_CLIENT_PPS_SHM_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define PPS_SHM_NAME "/pps-client"			//!< Name of the shared memory segment passed to \b shm_open().
+#define PPS_SHM_MAGIC 0x50505343			//!< Identifies a valid segment ("PPSC").
+#define PPS_SHM_VERSION 4					//!< Incremented on any change to the segment layout.
+#define PPS_SHM_NUM_TIMESTAMPS 16			//!< The number of most recent PPS timestamps held in the segment.
+#define PPS_SHM_MAX_RETRIES 1000			//!< Maximum copies of the segment by readPPSshm() while it is being written.
+
+/**
+ * A PPS timestamp in the shared memory segment.
+ */
+struct ppsShmTimestamp {
+	int64_t tv_sec;							//!< Whole seconds of the time of the PPS rising edge.
+	int32_t tv_nsec;						//!< Nanoseconds of the time of the PPS rising edge.
+	uint32_t seq_num;						//!< The G.seq_num of the timestamp.
+};
+
+/**
+ * The summary of a PPS-Client histogram in the shared
+ * memory segment.
+ */
+struct ppsShmHist {
+	double p50;								//!< The median (microseconds).
+	double p99;								//!< The 99th percentile (microseconds).
+	double p999;							//!< The 99.9th percentile (microseconds).
+	double max;								//!< The maximum value (microseconds).
+	uint64_t count;							//!< The count of values recorded.
+};
+
+/**
+ * Layout of the PPS-Client shared memory segment.
+ */
+struct ppsShm {
+	uint32_t magic;							//!< Set to PPS_SHM_MAGIC.
+	uint32_t version;						//!< Set to PPS_SHM_VERSION.
+	uint32_t seq;							//!< Sequence lock count. Odd while the daemon is writing.
+	uint32_t seq_num;						//!< G.seq_num at the last update.
+	int32_t sysDelay;						//!< The current sysDelay value including any delay shift (microseconds).
+	int32_t isControlling;					//!< Non-zero when the controller is adjusting the clock frequency.
+	int32_t hardLimit;						//!< The current controller hard limit. Locked when equal to 1.
+	uint32_t head;							//!< Index in \b ts[] of the most recent timestamp.
+	double freqOffset;						//!< The current clock frequency offset (ppm).
+	double jitter;							//!< The jitter of the most recent PPS interrupt (microseconds).
+	double avgCorrection;					//!< The average time correction over the last minute (microseconds).
+	int32_t interruptLossCount;				//!< Count of consecutive lost PPS interrupts.
+	int32_t reserved;						//!< Keeps \b ts[] 8-byte aligned.
+	struct ppsShmTimestamp ts[PPS_SHM_NUM_TIMESTAMPS];	//!< Circular buffer of the most recent PPS timestamps.
+	uint32_t ppsLateCount;					//!< Count of PPS records read from the driver after a newer record had arrived.
+	uint32_t ppsOverruns;					//!< Count of PPS records overwritten in the driver ring before they were read.
+	struct ppsShmHist jitterHist;			//!< Summary of the magnitude of the jitter while locked.
+	struct ppsShmHist errorHist;			//!< Summary of the magnitude of the time corrections while locked.
+	struct ppsShmHist intrptHist;			//!< Summary of the calibration interrupt delay.
+};
+
+/**
+ * Maps the PPS-Client shared memory segment for reading.
+ *
+ * @returns A pointer to the segment or NULL if PPS-Client
+ * is not running.
+ */
+static inline const struct ppsShm *mapPPSshm(void){
+	int fd = shm_open(PPS_SHM_NAME, O_RDONLY, 0);
+	if (fd == -1){
+		return NULL;
+	}
+	void *p = mmap(NULL, sizeof(struct ppsShm), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED){
+		return NULL;
+	}
+	return (const struct ppsShm *)p;
+}
+
+/**
+ * Unmaps a segment mapped with mapPPSshm().
+ *
+ * @param[in] shm The mapped segment.
+ */
+static inline void unmapPPSshm(const struct ppsShm *shm){
+	munmap((void *)shm, sizeof(struct ppsShm));
+}
+
+/**
+ * Copies a consistent snapshot of the shared memory
+ * segment to snap.
+ *
+ * @param[in] shm The mapped segment.
+ * @param[out] snap The snapshot.
+ *
+ * @returns 0 on success or -1 if the segment is not valid
+ * or a consistent snapshot could not be copied in
+ * PPS_SHM_MAX_RETRIES tries.
+ */
+static inline int readPPSshm(const struct ppsShm *shm, struct ppsShm *snap){
+	uint32_t seq1, seq2;
+	int tries = 0;
+
+	do {
+		if (tries == PPS_SHM_MAX_RETRIES){
+			return -1;
+		}
+		tries += 1;
+
+		seq1 = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+		memcpy(snap, shm, sizeof(struct ppsShm));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		seq2 = __atomic_load_n(&shm->seq, __ATOMIC_RELAXED);
+	} while ((seq1 & 1) != 0 || seq1 != seq2);
+
+	if (snap->magic != PPS_SHM_MAGIC || snap->version != PPS_SHM_VERSION){
+		return -1;
+	}
+	return 0;
+}
+
+#endif /* PPS_CLIENT_PPS_SHM_H_ */
@@ -0,0 +1,192 @@
+/**
+ * @file pps-sim.cpp
+ * @brief This file contains the simulated clock on which the controller replays recorded PPS interrupt times.
+ *
+ * The replay engine in pps-replay.cpp and the pps-sweep utility both
+ * run the controller on a simulated clock through simClockBackend.
+ * The backend records the adjtimex() calls of the controller in a
+ * struct simClock instead of making them. advanceSimClock() applies
+ * the recorded time slews and frequency offset to the clock once each
+ * second. setSimEdge() then converts a free-running interrupt time
+ * from the trace to the time at which the simulated clock would have
+ * read the interrupt.
+ *
+ * The interrupt times in a trace are read from a free-running clock,
+ * so they drift across its whole seconds by the frequency offset of
+ * its oscillator. getSimEdgeSecs() therefore counts the PPS seconds
+ * between interrupts from the time between them rather than from
+ * their whole seconds.
+ *
+ * Each thread runs its own simulated clock, which is selected for
+ * the thread by initSimClock(), so that pps-sweep can run many
+ * replays at once.
+ */
+
+/*
+ * Copyright (C) 2016-2018  Raymond S. Connell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "../client/pps-client.h"
+
+static __thread struct simClock *simClk;				//!< The simulated clock of this thread.
+
+/**
+ * Records a call to adjtimex() by the controller
+ * and sets the simulated clock of this thread to
+ * apply it.
+ *
+ * @param[in] t The timex struct passed by the controller.
+ *
+ * @returns 0 corresponding to TIME_OK.
+ */
+int simAdjtimex(struct timex *t){
+	struct simClock *sc = simClk;
+
+	if (t->modes & ADJ_SETOFFSET){
+		double step = (t->modes & ADJ_NANO) ? (double)t->time.tv_usec / NSECS_PER_USEC : (double)t->time.tv_usec;
+		sc->phase += (double)t->time.tv_sec * USECS_PER_SEC + step;	// Applied immediately.
+		sc->nStepCalls += 1;
+	}
+	else if ((t->modes & ADJ_OFFSET_SINGLESHOT) == ADJ_OFFSET_SINGLESHOT){
+		sc->pendingSlew = (double)t->offset;					// Like adjtimex(), replaces any remaining slew.
+		sc->lastOffset = t->offset;
+		sc->nOffsetCalls += 1;
+	}
+	else if (t->modes & ADJ_FREQUENCY){
+		sc->freq = (double)t->freq / ADJTIMEX_SCALE;
+		sc->lastFreq = sc->freq;
+		sc->nFreqCalls += 1;
+	}
+	return 0;
+}
+
+/**
+ * Gets the time of day from the simulated clock.
+ */
+int simGetTimeOfDay(struct timeval *tv){
+	tv->tv_sec = simClk->simSec;
+	tv->tv_usec = 0;
+	return 0;
+}
+
+/**
+ * Gets the monotonic time of the simulated clock.
+ */
+int simGetMonotonic(struct timespec *ts){
+	ts->tv_sec = (time_t)simClk->monoSecs;
+	ts->tv_nsec = 0;
+	return 0;
+}
+
+/**
+ * Gets the free-running time of the current PPS interrupt,
+ * which is the interrupt time recorded in the trace.
+ */
+int simGetEdgeRaw(struct timespec *ts){
+	*ts = simClk->rawTime;
+	return 0;
+}
+
+struct clockBackend simClockBackend = {simAdjtimex, simGetTimeOfDay, simGetMonotonic, simGetEdgeRaw, true};	//!< Clock backend for the simulated clock of each thread.
+
+/**
+ * Sets a simulated clock to its initial state and
+ * selects it as the clock of simClockBackend on
+ * the calling thread.
+ *
+ * @param[out] sc The clock.
+ */
+void initSimClock(struct simClock *sc){
+	memset(sc, 0, sizeof(struct simClock));
+	simClk = sc;
+}
+
+/**
+ * Advances a simulated clock by one second, applying
+ * the time slew remaining from adjtimex() at the rate
+ * limit of MAX_SLEW_PER_SEC and the current frequency
+ * offset.
+ *
+ * @param[in,out] sc The clock.
+ */
+void advanceSimClock(struct simClock *sc){
+	double slew = sc->pendingSlew;
+
+	if (slew > MAX_SLEW_PER_SEC){
+		slew = MAX_SLEW_PER_SEC;
+	}
+	else if (slew < -MAX_SLEW_PER_SEC){
+		slew = -MAX_SLEW_PER_SEC;
+	}
+	sc->pendingSlew -= slew;
+
+	sc->phase += slew + sc->freq;							// One second at freq ppm is freq microseconds.
+	sc->monoSecs += 1.0;
+}
+
+/**
+ * Gets the count of PPS seconds from the last interrupt
+ * time read from the trace to the next one. This is the
+ * time between them rounded to whole seconds, so that an
+ * interrupt time that drifts across a whole second of the
+ * free-running clock is not counted as a lost or repeated
+ * second.
+ *
+ * @param[in,out] sc The clock.
+ * @param[in] sec Whole seconds of the interrupt time.
+ * @param[in] nsec Nanoseconds of the interrupt time.
+ *
+ * @returns The count of PPS seconds, which is 1 for the
+ * first interrupt and greater than 1 after lost PPS
+ * interrupts, or 0 if the interrupt time is out of
+ * order or repeated and must be skipped.
+ */
+long getSimEdgeSecs(struct simClock *sc, long sec, long nsec){
+	int64_t edge = (int64_t)sec * NSECS_PER_SEC + nsec;
+	long nSecs = 1;
+
+	if (sc->started){
+		nSecs = llround((double)(edge - sc->lastEdge) / NSECS_PER_SEC);
+		if (nSecs < 1){
+			return 0;
+		}
+	}
+	sc->lastEdge = edge;
+	sc->started = true;
+	return nSecs;
+}
+
+/**
+ * Converts a free-running interrupt time from the trace
+ * to the time that would have been read from the
+ * simulated clock and makes it the current interrupt.
+ *
+ * @param[in,out] sc The clock.
+ * @param[in] sec Whole seconds of the interrupt time.
+ * @param[in] nsec Nanoseconds of the interrupt time.
+ *
+ * @returns The interrupt time read from the simulated
+ * clock in nanoseconds.
+ */
+int64_t setSimEdge(struct simClock *sc, long sec, long nsec){
+	int64_t t = (int64_t)sec * NSECS_PER_SEC + nsec + llround(sc->phase * NSECS_PER_USEC);
+
+	sc->rawTime.tv_sec = sec;
+	sc->rawTime.tv_nsec = nsec;
+	sc->simSec = (time_t)(t / NSECS_PER_SEC);
+	return t;
+}
@@ -0,0 +1,218 @@
+/**
+ * @file pps-stability.cpp
+ * @brief This file contains the incremental calculation of the overlapping Allan, modified Allan and time deviations of the clock oscillator.
+ *
+ * The deviations are calculated at the octave taus 1, 2, 4 ... 65536
+ * seconds and at one day from the phase of the clock oscillator each
+ * second. The phase is the PPS rawError with the time and frequency
+ * corrections made by the controller removed, so it is the phase that
+ * the clock would have had if it had not been disciplined. A fixed
+ * frequency offset, the one applied when recording started, is also
+ * removed to keep the phase small. That does not change the results
+ * since the deviations are calculated from second differences.
+ *
+ * The phase is kept as a ring of its prefix sums that is long enough
+ * for three times the largest tau. From the prefix sums, each new phase
+ * value adds one term to the sums of squares for the overlapping ADEV
+ * and MDEV at each tau, so the work each second is proportional to the
+ * number of taus. TDEV is calculated from MDEV.
+ *
+ * Up to STABILITY_MAX_GAP missing seconds are filled by interpolating
+ * the phase. After a longer gap the phase record starts over and the
+ * sums of squares are kept.
+ */
+
+/*
+ * Copyright (C) 2016-2018  Raymond S. Connell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "../client/pps-client.h"
+extern struct G g;
+
+#define STABILITY_RING_LEN (3 * STABILITY_MAX_TAU + 2)	//!< Length of the ring of phase prefix sums.
+
+/**
+ * Local file-scope shared variables.
+ */
+static struct stabilityLocalVars {
+	bool isStarted;								//!< "true" after the first record.
+	int64_t lastTimestamp;						//!< Timestamp of the last record.
+	double lastPhase;							//!< The last phase value in microseconds.
+	double lastTimeCorrection;					//!< The time correction of the last record.
+	double lastFreqOffset;						//!< The frequency offset of the last record.
+	double lastSlewResidual;					//!< The part of the last time correction not yet applied.
+	double freqRef;								//!< The fixed frequency offset removed from the phase.
+	double correction;							//!< Sum of the time corrections and relative frequency offsets in microseconds.
+	int64_t n;									//!< Count of phase values since the phase record started.
+	double adevSum[STABILITY_NUM_TAUS];			//!< Sums of squared second differences of the phase at each tau.
+	double mdevSum[STABILITY_NUM_TAUS];			//!< Sums of squared second differences of the phase averages at each tau.
+	uint64_t adevCount[STABILITY_NUM_TAUS];		//!< Number of terms in each of adevSum.
+	uint64_t mdevCount[STABILITY_NUM_TAUS];		//!< Number of terms in each of mdevSum.
+	double prefix[STABILITY_RING_LEN];			//!< Ring of the sums of the phase values before each index.
+} f;											//!< Local file-scope shared variables.
+
+/**
+ * Returns the tau in seconds at index i.
+ *
+ * @param[in] i The tau index.
+ */
+int getStabilityTau(int i){
+	if (i == STABILITY_NUM_TAUS - 1){
+		return STABILITY_MAX_TAU;
+	}
+	return 1 << i;
+}
+
+/**
+ * Returns the sum of the phase values before
+ * index k.
+ *
+ * @param[in] k The index.
+ */
+double prefixSum(int64_t k){
+	return f.prefix[k % STABILITY_RING_LEN];
+}
+
+/**
+ * Returns the phase value at index k.
+ *
+ * @param[in] k The index.
+ */
+double phaseAt(int64_t k){
+	return prefixSum(k + 1) - prefixSum(k);
+}
+
+/**
+ * Adds a phase value and the new terms of the
+ * ADEV and MDEV sums that it completes.
+ *
+ * @param[in] x The phase in microseconds.
+ */
+void addPhase(double x){
+	if (f.n == 0){
+		f.prefix[0] = 0.0;
+	}
+	f.prefix[(f.n + 1) % STABILITY_RING_LEN] = prefixSum(f.n) + x;
+	f.n += 1;
+
+	int64_t last = f.n - 1;
+
+	for (int i = 0; i < STABILITY_NUM_TAUS; i++){
+		int64_t m = getStabilityTau(i);
+		if (f.n < 2 * m + 1){
+			break;
+		}
+
+		double d = phaseAt(last) - 2.0 * phaseAt(last - m) + phaseAt(last - 2 * m);
+		f.adevSum[i] += d * d;
+		f.adevCount[i] += 1;
+
+		if (f.n >= 3 * m){										// The sums of m phase values ending m apart.
+			double s = prefixSum(f.n) - 3.0 * prefixSum(f.n - m) + 3.0 * prefixSum(f.n - 2 * m) - prefixSum(f.n - 3 * m);
+			f.mdevSum[i] += s * s;
+			f.mdevCount[i] += 1;
+		}
+	}
+}
+
+/**
+ * Adds the clock oscillator phase recorded in a
+ * history record.
+ *
+ * @param[in] rec The record.
+ */
+void recordStability(const struct historyRec *rec){
+	int64_t dt = rec->timestamp - f.lastTimestamp;
+
+	if (! f.isStarted || dt <= 0 || dt > STABILITY_MAX_GAP){	// Starts the phase record over.
+		f.isStarted = true;
+		f.n = 0;
+		f.freqRef = rec->freqOffset;
+		f.correction = 0.0;
+		f.lastPhase = rec->rawError;
+		addPhase(f.lastPhase);
+	}
+	else {
+		f.correction += f.lastTimeCorrection + (f.lastFreqOffset - f.freqRef) * (double)dt;	// One second at freqOffset ppm is freqOffset microseconds.
+		double x = rec->rawError - (f.correction - f.lastSlewResidual);		// Only whole microseconds of correction are applied.
+
+		for (int64_t k = 1; k < dt; k++){						// Interpolates missing seconds.
+			addPhase(f.lastPhase + (x - f.lastPhase) * (double)k / (double)dt);
+		}
+		addPhase(x);
+		f.lastPhase = x;
+	}
+
+	f.lastTimestamp = rec->timestamp;
+	f.lastTimeCorrection = rec->timeCorrection;
+	f.lastFreqOffset = rec->freqOffset;
+	f.lastSlewResidual = rec->slewResidual;
+}
+
+/**
+ * Gets the deviations at the tau with index i.
+ *
+ * @param[in] i The tau index.
+ * @param[out] adev The Allan deviation.
+ * @param[out] mdev The modified Allan deviation.
+ * @param[out] tdev The time deviation in seconds.
+ *
+ * @returns The number of terms in the ADEV sum, which
+ * is 0 if there are not yet enough phase values for
+ * this tau.
+ */
+uint64_t getStability(int i, double *adev, double *mdev, double *tdev){
+	double m = (double)getStabilityTau(i);
+
+	*adev = 0.0;
+	*mdev = 0.0;
+	*tdev = 0.0;
+
+	if (f.adevCount[i] > 0){
+		*adev = sqrt(f.adevSum[i] / (2.0 * m * m * (double)f.adevCount[i])) / USECS_PER_SEC;
+	}
+	if (f.mdevCount[i] > 0){
+		*mdev = sqrt(f.mdevSum[i] / (2.0 * m * m * m * m * (double)f.mdevCount[i])) / USECS_PER_SEC;
+		*tdev = m * *mdev / sqrt(3.0);
+	}
+	return f.adevCount[i];
+}
+
+/**
+ * Writes the ADEV, MDEV and TDEV at each tau that has
+ * enough phase values.
+ *
+ * @param[in] filename The file to write.
+ *
+ * @returns 0 on success, else -1 on error.
+ */
+int writeStabilityFile(const char *filename){
+	char filebuf[(STABILITY_NUM_TAUS + 1) * (MAX_LINE_LEN + 30)];
+	double adev, mdev, tdev;
+
+	int fileLen = sprintf(filebuf, "# tau(s) adev mdev tdev(s) count\n");
+
+	for (int i = 0; i < STABILITY_NUM_TAUS; i++){
+		uint64_t count = getStability(i, &adev, &mdev, &tdev);
+		if (count == 0){
+			break;
+		}
+		fileLen += sprintf(filebuf + fileLen, "%d %.4e %.4e %.4e %llu\n", getStabilityTau(i), adev, mdev, tdev,
+				(unsigned long long)count);
+	}
+	return writeFileAtomic(filename, filebuf, fileLen);
+}
@@ -0,0 +1,524 @@
+/**
+ * @file pps-worker.cpp
+ * @brief This file contains the I/O worker thread that does the file and log I/O of the PPS-Client controller.
+ *
+ * The controller runs at real-time priority and must not be delayed
+ * by file writes that can stall for tens of milliseconds on an SD
+ * card. So while the I/O worker is running, the file and log functions
+ * called from the controller thread only copy their data to a fixed-size
+ * record in a lock-free single-producer, single-consumer queue. The I/O
+ * worker runs at normal priority, takes the records from the queue and
+ * does the I/O.
+ *
+ * The producer advances \b head and the consumer advances \b tail. Each
+ * is written by only one thread so no locks are needed. If the queue is
+ * full a record is dropped and counted instead of blocking the controller.
+ *
+ * Data that is too large to pass in a record, such as the distributions,
+ * is copied by the controller thread inside a sequence lock with
+ * beginCopy() and endCopy() and copied again by the I/O worker with
+ * readCopy(), which retries if the controller was writing at the time.
+ *
+ * Log messages are not written one at a time. The I/O worker formats the
+ * timestamp of each message from the time recorded in its record and
+ * appends it to a batch buffer that is written to the log file, which is
+ * kept open, with a single write() at most LOG_FLUSH_SECS after the first
+ * message in the batch. The size of the log file is tracked in memory so
+ * that rotation does not need a stat() for each message.
+ */
+
+/*
+ * Copyright (C) 2016-2018  Raymond S. Connell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "../client/pps-client.h"
+extern struct G g;
+extern const char *log_file;
+
+/**
+ * Local file-scope shared variables.
+ */
+static struct workerLocalVars {
+	pthread_t controlThread;						//!< The controller thread. The only producer.
+	pthread_t workerThread;						//!< The I/O worker thread. The only consumer.
+	bool isRunning;								//!< "true" while the I/O worker is running.
+	sem_t recordsReady;							//!< Posted once for each record added to the queue.
+	pthread_mutex_t statusLock;					//!< Protects G.savebuf while the I/O worker is running.
+	unsigned int head;							//!< Count of records added. Written only by the producer.
+	unsigned int tail;							//!< Count of records removed. Written only by the consumer.
+	unsigned int nDropped;						//!< Count of records dropped because the queue was full.
+	struct ioRecord queue[IO_QUEUE_LEN];			//!< The record queue.
+	pthread_mutex_t logLock;						//!< Protects the log batch buffer being filled.
+	char logBatch[2][LOG_BATCH_SZ];				//!< Log batch buffers. One is filled while the other is written.
+	int batchLen;									//!< Length of the log batch buffer being filled.
+	int active;									//!< Index of the log batch buffer being filled.
+	time_t batchStart;							//!< Time that the first message was added to the batch buffer being filled.
+	unsigned int nLogDropped;						//!< Count of log messages dropped because the batch buffer was full.
+	time_t stampTime;								//!< Time of the last formatted timestamp.
+	char stampStr[STRBUF_SZ];						//!< The last formatted timestamp.
+	int logFd;									//!< The log file descriptor or -1 if not open.
+	off_t logSize;								//!< Size of the open log file.
+} f;											//!< Local file-scope shared variables.
+
+/**
+ * Returns "true" if the caller is the controller thread
+ * and the I/O worker is running. In that case file and
+ * log I/O must be passed to the I/O worker.
+ */
+bool isControlThread(void){
+	return f.isRunning && pthread_equal(pthread_self(), f.controlThread);
+}
+
+/**
+ * Gets the next free record in the queue for the
+ * controller thread to fill. The record is passed
+ * to the I/O worker by postIORecord().
+ *
+ * @param[in] type The record type.
+ *
+ * @returns A pointer to the record or NULL if the
+ * queue is full, in which case the record is dropped.
+ */
+struct ioRecord *getIORecord(int type){
+	unsigned int head = f.head;
+	unsigned int tail = __atomic_load_n(&f.tail, __ATOMIC_ACQUIRE);
+
+	if (head - tail >= IO_QUEUE_LEN){
+		__atomic_store_n(&f.nDropped, f.nDropped + 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+
+	struct ioRecord *rec = &f.queue[head & (IO_QUEUE_LEN - 1)];
+	rec->type = type;
+	rec->t = time(NULL);
+	return rec;
+}
+
+/**
+ * Passes the record from the last call to getIORecord()
+ * to the I/O worker.
+ */
+void postIORecord(void){
+	__atomic_store_n(&f.head, f.head + 1, __ATOMIC_RELEASE);
+	sem_post(&f.recordsReady);
+}
+
+/**
+ * Posts a record of type with an optional message
+ * to the I/O worker.
+ *
+ * @param[in] type The record type.
+ * @param[in] msg The message or NULL.
+ *
+ * @returns 0 on success or -1 if the record was dropped.
+ */
+int postIORequest(int type, const char *msg){
+	struct ioRecord *rec = getIORecord(type);
+	if (rec == NULL){
+		return -1;
+	}
+
+	if (msg != NULL){
+		strncpy(rec->msg, msg, LOGBUF_SZ - 1);
+		rec->msg[LOGBUF_SZ - 1] = '\0';
+	}
+	else {
+		rec->msg[0] = '\0';
+	}
+
+	postIORecord();
+	return 0;
+}
+
+/**
+ * Returns the count of records dropped because the
+ * queue was full.
+ */
+unsigned int getIODropCount(void){
+	return __atomic_load_n(&f.nDropped, __ATOMIC_RELAXED);
+}
+
+/**
+ * Starts a write by the controller thread of data
+ * read by other threads with readCopy(). The count
+ * seq is odd until endCopy().
+ *
+ * @param[in,out] seq The sequence lock count.
+ */
+void beginCopy(unsigned int *seq){
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * Ends a write started with beginCopy().
+ *
+ * @param[in,out] seq The sequence lock count.
+ */
+void endCopy(unsigned int *seq){
+	__atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Copies len bytes from src, which is written by the
+ * controller thread between beginCopy() and endCopy()
+ * on seq, so that the copy is never partly written.
+ *
+ * @param[in] seq The sequence lock count.
+ * @param[in] src The data.
+ * @param[out] dst The copy.
+ * @param[in] len The length of the data.
+ *
+ * @returns 0 on success or -1 if a consistent copy
+ * was not made in COPY_MAX_RETRIES tries.
+ */
+int readCopy(const unsigned int *seq, const void *src, void *dst, size_t len){
+	unsigned int seq1, seq2;
+	int tries = 0;
+
+	do {
+		if (tries == COPY_MAX_RETRIES){
+			return -1;
+		}
+		tries += 1;
+
+		seq1 = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+		memcpy(dst, src, len);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		seq2 = __atomic_load_n(seq, __ATOMIC_RELAXED);
+	} while ((seq1 & 1) != 0 || seq1 != seq2);
+
+	return 0;
+}
+
+/**
+ * Locks G.savebuf if the I/O worker is running.
+ */
+void lockStatusBuf(void){
+	if (f.isRunning){
+		pthread_mutex_lock(&f.statusLock);
+	}
+}
+
+/**
+ * Unlocks G.savebuf if the I/O worker is running.
+ */
+void unlockStatusBuf(void){
+	if (f.isRunning){
+		pthread_mutex_unlock(&f.statusLock);
+	}
+}
+
+/**
+ * Returns "true" if the I/O worker is running and
+ * log messages are written by the I/O worker.
+ */
+bool logWorkerIsRunning(void){
+	return f.isRunning;
+}
+
+/**
+ * Appends msg to the log batch buffer. Called by the I/O
+ * worker and by other non-controller threads while the
+ * I/O worker is running. Never waits for a file write.
+ * If the batch buffer is full the message is dropped and
+ * counted.
+ *
+ * @param[in] msg The message.
+ * @param[in] t The time at which the message was logged.
+ * @param[in] timestamp If "true" the message is preceded
+ * by a timestamp made from t.
+ */
+void bufferLogMsg(const char *msg, time_t t, bool timestamp){
+	struct tm tmv;
+
+	pthread_mutex_lock(&f.logLock);
+
+	if (timestamp && t != f.stampTime){					// Format the timestamp only when the second changes
+		strftime(f.stampStr, STRBUF_SZ, "%F %H:%M:%S ", localtime_r(&t, &tmv));
+		f.stampTime = t;
+	}
+
+	int stampLen = timestamp ? strlen(f.stampStr) : 0;
+	int msgLen = strlen(msg);
+
+	if (f.batchLen + stampLen + msgLen > LOG_BATCH_SZ){
+		f.nLogDropped += 1;
+		pthread_mutex_unlock(&f.logLock);
+		return;
+	}
+
+	char *batch = f.logBatch[f.active];
+	if (f.batchLen == 0){
+		f.batchStart = time(NULL);
+	}
+	if (stampLen > 0){
+		memcpy(batch + f.batchLen, f.stampStr, stampLen);
+		f.batchLen += stampLen;
+	}
+	memcpy(batch + f.batchLen, msg, msgLen);
+	f.batchLen += msgLen;
+
+	pthread_mutex_unlock(&f.logLock);
+}
+
+/**
+ * Returns "true" if the oldest message in the log
+ * batch buffer has waited LOG_FLUSH_SECS or the
+ * buffer is more than half full.
+ */
+bool logFlushIsDue(void){
+	pthread_mutex_lock(&f.logLock);
+	bool isDue = f.batchLen > 0
+			&& (time(NULL) - f.batchStart >= LOG_FLUSH_SECS || f.batchLen > LOG_BATCH_SZ / 2);
+	pthread_mutex_unlock(&f.logLock);
+	return isDue;
+}
+
+/**
+ * Opens the log file for appending and gets
+ * its size.
+ *
+ * @returns 0 on success, else -1 on error.
+ */
+int openLogFile(void){
+	struct stat info;
+
+	mode_t mode = S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH;
+	f.logFd = open(log_file, O_CREAT | O_WRONLY | O_APPEND, mode);
+	if (f.logFd == -1){
+		printf("ERROR: could not open \"%s\": %s\n", log_file, strerror(errno));
+		return -1;
+	}
+
+	f.logSize = 0;
+	if (fstat(f.logFd, &info) == 0){
+		f.logSize = info.st_size;
+	}
+	return 0;
+}
+
+/**
+ * Writes the log batch buffer to the log file with one
+ * write(), first rotating the log file if the write would
+ * take it past getLogMaxSize(). Called only by the I/O worker
+ * or, after it has stopped, by stopIOWorker().
+ */
+void flushLog(void){
+	char dropMsg[LOGBUF_SZ];
+
+	pthread_mutex_lock(&f.logLock);
+	char *batch = f.logBatch[f.active];
+	int len = f.batchLen;
+	unsigned int nDropped = f.nLogDropped;
+	f.active ^= 1;
+	f.batchLen = 0;
+	f.nLogDropped = 0;
+	pthread_mutex_unlock(&f.logLock);
+
+	if (nDropped > 0){
+		sprintf(dropMsg, "Log batch buffer was full. Dropped %u log messages.\n", nDropped);
+		bufferLogMsg(dropMsg, time(NULL), true);
+	}
+
+	if (len == 0){
+		return;
+	}
+
+	if (f.logFd != -1 && f.logSize + len > getLogMaxSize()){
+		close(f.logFd);
+		f.logFd = -1;
+		rotateLogFiles();
+	}
+
+	if (f.logFd == -1 && openLogFile() == -1){
+		return;
+	}
+
+	int rv = write(f.logFd, batch, len);
+	if (rv > 0){
+		f.logSize += rv;
+	}
+}
+
+/**
+ * Does the I/O requested by a record.
+ *
+ * @param[in] rec The record.
+ */
+void processIORecord(struct ioRecord *rec){
+
+	switch (rec->type){
+	case IO_LOG:
+		bufferStatusMsg(rec->msg);
+		appendToLog(rec->msg, rec->t, true);
+		break;
+	case IO_LOG_NO_TIMESTAMP:
+		bufferStatusMsg(rec->msg);
+		appendToLog(rec->msg, rec->t, false);
+		break;
+	case IO_STATUS_MSG:
+		bufferStatusMsg(rec->msg);
+		break;
+	case IO_STATE_PARAMS:
+		writeStateParams(&rec->params);
+		break;
+	case IO_WRITE_STATUS:
+		writeStatusStrings();
+		break;
+	case IO_PROCESS_FILES:
+		processFiles();
+		break;
+	case IO_READ_CONFIG:
+		readConfigFile();
+		break;
+	case IO_HISTORY:
+		saveHistoryRec(&rec->hrec);
+		break;
+	}
+}
+
+/**
+ * The I/O worker thread. Lowers its scheduling
+ * policy from the SCHED_FIFO policy inherited
+ * from the controller thread, then processes
+ * records from the queue until an IO_EXIT
+ * record is received. The log batch buffer is
+ * written when the queue is empty and the oldest
+ * buffered message has waited LOG_FLUSH_SECS or
+ * the buffer is half full.
+ */
+void *ioWorker(void *){
+	struct sched_param param;
+	struct timespec deadline;
+	unsigned int lastDropped = 0;
+	char logbuf[LOGBUF_SZ];
+	int nWaiting;
+
+	param.sched_priority = 0;
+	pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+
+	for (;;){
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += LOG_FLUSH_SECS;
+
+		if (sem_timedwait(&f.recordsReady, &deadline) == -1){
+			if (errno == ETIMEDOUT){
+				flushLog();
+			}
+			continue;										// Timed out or interrupted by a signal.
+		}
+
+		unsigned int tail = f.tail;
+		unsigned int head = __atomic_load_n(&f.head, __ATOMIC_ACQUIRE);
+		if (tail == head){
+			continue;
+		}
+
+		struct ioRecord *rec = &f.queue[tail & (IO_QUEUE_LEN - 1)];
+		bool exit = (rec->type == IO_EXIT);
+		if (! exit){
+			processIORecord(rec);
+		}
+
+		__atomic_store_n(&f.tail, tail + 1, __ATOMIC_RELEASE);
+
+		if (exit){
+			break;
+		}
+
+		unsigned int nDropped = getIODropCount();
+		if (nDropped != lastDropped){
+			sprintf(logbuf, "I/O worker queue was full. Dropped %u records.\n", nDropped - lastDropped);
+			lastDropped = nDropped;
+			bufferStatusMsg(logbuf);
+			bufferLogMsg(logbuf, time(NULL), true);
+		}
+
+		sem_getvalue(&f.recordsReady, &nWaiting);
+		if (nWaiting == 0 && logFlushIsDue()){
+			flushLog();
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Starts the I/O worker thread. After this, file
+ * and log I/O requested from the calling thread is
+ * done by the I/O worker.
+ *
+ * @returns 0 on success, else -1 on error.
+ */
+int startIOWorker(void){
+	memset(&f, 0, sizeof(struct workerLocalVars));
+
+	if (sem_init(&f.recordsReady, 0, 0) == -1){
+		sprintf(g.logbuf, "startIOWorker() sem_init() failed with msg: %s\n", strerror(errno));
+		writeToLog(g.logbuf);
+		return -1;
+	}
+	pthread_mutex_init(&f.statusLock, NULL);
+	pthread_mutex_init(&f.logLock, NULL);
+	f.logFd = -1;
+
+	f.controlThread = pthread_self();
+
+	int rv = pthread_create(&f.workerThread, NULL, &ioWorker, NULL);
+	if (rv != 0){
+		sprintf(g.logbuf, "startIOWorker() pthread_create() failed with msg: %s\n", strerror(rv));
+		writeToLog(g.logbuf);
+		pthread_mutex_destroy(&f.logLock);
+		pthread_mutex_destroy(&f.statusLock);
+		sem_destroy(&f.recordsReady);
+		return -1;
+	}
+
+	f.isRunning = true;
+	return 0;
+}
+
+/**
+ * Stops the I/O worker thread after it has done
+ * the I/O for all of the records in the queue and
+ * writes what remains in the log batch buffer.
+ */
+void stopIOWorker(void){
+	if (! f.isRunning){
+		return;
+	}
+
+	struct ioRecord *rec;
+	while ((rec = getIORecord(IO_EXIT)) == NULL){		// Wait for space in the queue.
+		usleep(10000);
+	}
+	postIORecord();
+
+	pthread_join(f.workerThread, NULL);
+
+	f.isRunning = false;
+
+	flushLog();
+	flushLog();												// Writes any dropped message count.
+	if (f.logFd != -1){
+		close(f.logFd);
+		f.logFd = -1;
+	}
+	pthread_mutex_destroy(&f.logLock);
+	pthread_mutex_destroy(&f.statusLock);
+	sem_destroy(&f.recordsReady);
+}
@@ -4,13 +4,39 @@ OBJS += \
 ./pps-client.o \
 ./pps-files.o \
 ./pps-sntp.o \
-./pps-serial.o
+./pps-serial.o \
+./pps-replay.o \
+./pps-worker.o \
+./pps-hist.o \
+./pps-metrics.o \
+./pps-control.o \
+./pps-history.o \
+./pps-stability.o \
+./pps-kalman.o \
+./pps-controller.o \
+./pps-shadow.o \
+./pps-median.o \
+./pps-ppsapi.o \
+./pps-sim.o
 
 CPP_DEPS += \
 ./pps-client.d \
 ./pps-files.d \
 ./pps-sntp.d \
-./pps-serial.d
+./pps-serial.d \
+./pps-replay.d \
+./pps-worker.d \
+./pps-hist.d \
+./pps-metrics.d \
+./pps-control.d \
+./pps-history.d \
+./pps-stability.d \
+./pps-kalman.d \
+./pps-controller.d \
+./pps-shadow.d \
+./pps-median.d \
+./pps-ppsapi.d \
+./pps-sim.d
 
 # Each subdirectory must supply rules for building sources it contributes
 %.o: ./%.cpp
@@ -6,36 +6,62 @@
  are set on driver load by the PPS-Client daemon):
 
  1. When an interrupt is received on PPS_GPIO this driver records
- the reception time. That time can then be read from the driver
- in the PPS-Client daemon with a read() on the device driver file
- (\b pps_i_read()).
-
- 2. Records the reception time of a second
+ the reception time in nanoseconds on the realtime clock and on the
+ raw monotonic clock and the clocksource cycle count, all from one
+ timekeeping snapshot, with a sequence number in a ring
+ of PPS_RING_LEN records (see gps-pps-io.h). The ring is in a page
+ that can be mapped read-only with mmap() on the device driver file
+ (\b pps_i_mmap()), so the PPS-Client daemon and any number of
+ monitoring tools can read the times without a system call. The
+ records that a caller has not yet read can also be read with a
+ read() on the device driver file (\b pps_i_read()). Only the first
+ caller to open the driver for writing is permitted. Any number of
+ callers can open it read-only.
+
+ 2. Supports poll() and select() on the device driver file. The file
+ is readable when the time of an interrupt has been recorded since
+ poll() last reported the file readable to that caller
+ (\b pps_i_poll()).
+
+ 3. Records the reception time of a second
  interrupt on INTRPT_GPIO that is initiated from within the driver.
  That requires an external wired connection between OUTPUT_GPIO
  and INTRPT_GPIO.
 
    a. With that connection in place, writing "1" to the driver file
- will disable the interrupt on PPS_GPIO, will cause OUTPUT_GPIO to
- request an interrupt on INTRPT_GPIO and will record the time that
- the write arrived at OUTPUT_GPIO (\b pps_i_write()).
+ will disable the interrupt on PPS_GPIO and will schedule OUTPUT_GPIO
+ to request an interrupt on INTRPT_GPIO at CALIB_PULSE_NS into the
+ second, recording the time that the write arrived at OUTPUT_GPIO
+ (\b pps_i_write()). The caller sleeps on an hrtimer until shortly
+ before the pulse and then spins to it, so the caller's priority is
+ kept without spinning for most of the wait (\b pps_calib_output()).
 
    b. The write time to OUTPUT_GPIO and the reception time of the
- interrupt on INTRPT_GPIO can then be read from the driver with
- a read() on the device driver file (\b pps_i_read()).
+ interrupt on INTRPT_GPIO can then be read from the calibration record
+ in the mapped ring once poll() reports the file readable, or read
+ from the driver with a read() on the device driver file
+ (\b pps_i_read()).
 
   c. Writing "0" to the driver file will then re-enable the interrupt
  on PPS_GPIO (\b pps_i_write()).
 
- 3. Sets an offset in microseconds
+ 4. Sets an offset in nanoseconds
  to the system time by writing a pair of integers to the driver file
  with the first being an identifier value of 2 and the second being
- the offset time in microseconds (\b pps_i_write()).
+ the offset time in nanoseconds (\b pps_i_write()).
 
- 4. Sets an offset in whole seconds to the
+ 5. Sets an offset in whole seconds to the
  system time by writing a pair of integers to the driver file with
  the first being an identifier value of 3 and the second being the
  offset time in integer seconds (\b pps_i_write()).
+
+ 6. On kernels built with the PPS core (CONFIG_PPS), also registers
+ PPS_GPIO as a source of the Linux PPS subsystem and reports each PPS
+ interrupt to it with the same timestamp that is written to the ring
+ (\b pps_interrupt1()). The source then appears as /dev/ppsN, so the
+ RFC 2783 PPS API (time_pps_fetch()) and the kernel hardpps() discipline
+ can use it, and chrony, gpsd or any other PPS API client can share the
+ PPS with the PPS-Client daemon.
  */
 
  /* Copyright (C) 2016-2018  Raymond S. Connell
@@ -63,6 +89,22 @@
  * Compile on Raspberry Pi 2 or 3 to create gps-pps-io.ko. On
  * installation gps-pps-io.ko must be copied to
  *  /lib/modules/`uname -r`/kernel/drivers/misc/gps-pps-io.ko
+ *
+ * The driver can also be loaded on a Linux PC without GPIO hardware
+ * by using the lines of the gpio-mockup module, which raise interrupts
+ * when they are pulled from debugfs. For example, with the first
+ * mockup chip at GPIO base 500:
+ *
+ *   make ARCH=x86 KERNELDIR=/lib/modules/`uname -r`/build
+ *   modprobe gpio-mockup gpio_mockup_ranges=500,504
+ *   insmod gps-pps-io.ko PPS_GPIO=500 OUTPUT_GPIO=501 INTRPT_GPIO=502
+ *   echo 1 > /sys/kernel/debug/gpio-mockup/gpiochip0/0
+ *   echo 0 > /sys/kernel/debug/gpio-mockup/gpiochip0/0
+ *
+ * Each rising edge on line 0 records one PPS timestamp. On kernels
+ * that provide gpio-sim instead of gpio-mockup, create a simulated
+ * chip through configfs and pull line 0 up and down through
+ * /sys/devices/platform/gpio-sim.0/gpiochipN/sim_gpio0/pull.
  */
 
 #include <linux/module.h>
@@ -74,8 +116,10 @@
 #include <linux/fs.h>		/* everything... */
 #include <linux/errno.h>		/* error codes */
 #include <linux/delay.h>		/* udelay */
+#include <linux/ktime.h>
 #include <linux/kdev_t.h>
 #include <linux/slab.h>
+#include <linux/timekeeping.h>
 #include <linux/mm.h>
 #include <linux/ioport.h>
 #include <linux/interrupt.h>
@@ -92,11 +136,17 @@
 #include <asm/uaccess.h>
 #include <linux/buffer_head.h>
 #include <linux/version.h>
+#include <linux/hrtimer.h>
+#if IS_ENABLED(CONFIG_PPS)
+#include <linux/pps_kernel.h>
+#endif
+
+#include "gps-pps-io.h"
 
 /* The text below will appear in output from 'cat /proc/interrupt' */
 #define INTERRUPT_NAME "gps-pps-io"
 
-const char *version = "gps-pps-io v1.1.1";
+const char *version = "gps-pps-io v1.7.0";
 
 static int major = 0;							/* dynamic by default */
 /**
@@ -135,6 +185,18 @@ static int INTRPT_GPIO = 0;
  */
 module_param(INTRPT_GPIO, int, 0);				/* Specify INTRPT_GPIO at load time */
 
+static int calib_spin_ns = 20000;
+/**
+ * On driver load, optionally specifies the time in nanoseconds
+ * before the calibration pulse at which the caller of
+ * pps_i_write() wakes from its hrtimer sleep. The remaining
+ * time is spun so that the pulse is written close to
+ * CALIB_PULSE_NS into the second.
+ *
+ * @param[in] calib_spin_ns The spin time in nanoseconds.
+ */
+module_param(calib_spin_ns, int, 0);				/* Optionally specify calib_spin_ns at load time */
+
 /**
  * The IRQ for the PPS interrupt generated by the PPS_GPIO
  * device pin.
@@ -156,14 +218,29 @@ volatile int gpio_out = 0;
 
 MODULE_AUTHOR ("Raymond Connell");
 MODULE_LICENSE("Dual BSD/GPL");
-MODULE_VERSION("1.1.0");
+MODULE_VERSION("1.7.0");
+
+/**
+ * The page of kernel memory that holds the ring of PPS
+ * interrupt times and the last calibration interrupt
+ * times. Written only by the interrupt handlers and
+ * pps_i_write() and mapped read-only by callers.
+ */
+struct pps_ring *pps_ring = NULL;
+
+/**
+ * The number of s64 times returned by a read() of the
+ * calibration interrupt.
+ */
+#define PPS_CALIB_LEN 3
 
 /**
- * Array of ints in kernel memory that is used to
- * pass data to and from the device driver caller
- * with the driver read() and write() functions.
+ * The position in pps_ring of each open file.
  */
-int *pps_buffer = NULL;
+struct pps_reader {
+	u32 tail;						/* Sequence number of the last record returned by read(). */
+	u32 polled;						/* Ring head when poll() last reported the file readable. */
+};
 
 /**
  * Internal driver macro.
@@ -171,10 +248,40 @@ int *pps_buffer = NULL;
 DECLARE_WAIT_QUEUE_HEAD(pps_queue);
 
 /**
- * Flag that is set to 1 when the driver has received a
- * PPS interrupt.
+ * Count of calibration interrupts since the driver was loaded.
+ */
+u32 calib_seq = 0;
+
+/**
+ * The time into the second in nanoseconds at which the
+ * calibration pulse is written to OUTPUT_GPIO.
+ */
+#define CALIB_PULSE_NS 600000
+
+/**
+ * The realtime clock time in nanoseconds at which the
+ * next calibration pulse is written to OUTPUT_GPIO.
  */
-int read1_OK = 0;
+s64 calib_target = 0;
+
+#if IS_ENABLED(CONFIG_PPS)
+/**
+ * Describes PPS_GPIO to the Linux PPS subsystem. The
+ * source captures the assert edge only.
+ */
+struct pps_source_info pps_info = {
+	.name	= "gps-pps-io",
+	.path	= "",
+	.mode	= PPS_CAPTUREASSERT | PPS_OFFSETASSERT | PPS_CANWAIT | PPS_TSFMT_TSPEC,
+	.owner	= THIS_MODULE,
+};
+
+/**
+ * The Linux PPS subsystem source registered for PPS_GPIO
+ * or NULL if it could not be registered.
+ */
+struct pps_device *pps_source = NULL;
+#endif
 
 /**
  * Flag that is set to 1 when the driver has received a
@@ -197,19 +304,24 @@ unsigned long j_delay;
 static atomic_t driver_available = ATOMIC_INIT(1);
 
 /**
- * Opens the driver but permits it to be opened only by the
- * first caller until that caller closes the driver.
+ * Opens the driver but permits it to be opened for writing
+ * only by the first caller until that caller closes the
+ * driver. Any number of callers can open it read-only.
+ * Each caller starts reading from the newest record.
  */
 int pps_open (struct inode *inode, struct file *filp)
 {
+	struct pps_reader *reader;
+
 	/*
-	 * The following statement fails if driver_available
-	 * is 1 and driver_available then gets set to zero.
+	 * For a caller opening for writing, the following statement
+	 * fails if driver_available is 1 and driver_available then
+	 * gets set to zero.
 	 *
 	 * The statement succeeds if driver_available is 0
 	 * and driver_available then gets set to -1.
 	 */
-    if (! atomic_dec_and_test(&driver_available)) {
+    if ((filp->f_mode & FMODE_WRITE) && ! atomic_dec_and_test(&driver_available)) {
 
     	/*
     	 * If driver_available was initially 0 then got
@@ -227,6 +339,17 @@ int pps_open (struct inode *inode, struct file *filp)
      * here and driver_available was set to 0
      * by atomic_dec_and_test().
      */
+
+    reader = kmalloc(sizeof(struct pps_reader), GFP_KERNEL);
+    if (reader == NULL){
+    	if (filp->f_mode & FMODE_WRITE){
+    		atomic_inc(&driver_available);
+    	}
+    	return -ENOMEM;
+    }
+    reader->tail = smp_load_acquire(&pps_ring->head);		/* Start from the newest record. */
+    reader->polled = reader->tail;
+    filp->private_data = reader;
     return 0;
 }
 
@@ -236,30 +359,64 @@ int pps_open (struct inode *inode, struct file *filp)
  */
 int pps_release (struct inode *inode, struct file *filp)
 {
+	kfree(filp->private_data);
+
 	/*
 	 * Sets driver_available to 1 so the next caller
-	 * can open the driver again after this close.
+	 * can open the driver for writing again after
+	 * this close.
 	 */
-	atomic_inc(&driver_available);
+	if (filp->f_mode & FMODE_WRITE){
+		atomic_inc(&driver_available);
+	}
 	return 0;
 }
 
+/**
+ * Copies PPS record seq from pps_ring.
+ *
+ * @param[in] seq The sequence number of the record.
+ *
+ * @param[out] rec The copy.
+ *
+ * @returns true if the copy is consistent, else false
+ * if the record was overwritten.
+ */
+bool pps_get_record(u32 seq, struct pps_record *rec)
+{
+	const struct pps_record *r = &pps_ring->rec[seq % PPS_RING_LEN];
+
+	rec->seq = smp_load_acquire(&r->seq);
+	rec->reserved = 0;
+	rec->time = READ_ONCE(r->time);
+	rec->raw_time = READ_ONCE(r->raw_time);
+	rec->cycles = READ_ONCE(r->cycles);
+	smp_rmb();
+
+	return seq != 0 && rec->seq == seq && READ_ONCE(r->seq) == seq;
+}
+
 /**
  * Reads the reception times of interrupts on PPS_GPIO and INTRPT_GPIO
  * and the time an output write arrived at OUTPUT_GPIO from
  * __user *buf.
  *
- * When reading the time of an interrupt on PPS_GPIO __user *buf is
- * interpreted to be a two-element int array mapping a struct timeval
- * tv. The int with index 0 contains tv.tv_sec and the int with index
- * 1 contains tv.tv_usec. In this case count is 2 * sizeof(int).
+ * All times are 64-bit signed counts of nanoseconds since the
+ * epoch read from the realtime clock.
+ *
+ * When reading the times of interrupts on PPS_GPIO __user *buf is
+ * interpreted to be an array of struct pps_record. As many of the
+ * records recorded since the caller's last read() as fit in count
+ * bytes are copied, oldest first. Records overwritten in pps_ring
+ * before they were read are skipped and show as a gap in the
+ * sequence numbers. count must be at least sizeof(struct pps_record).
  *
- * When reading the time of an interrupt on INTRPT_GPIO __user *buf is
- * interpreted to be a six-element int array mapping three struct
- * timeval objects as int pairs. The first int pair is not used.
- * The second int pair contains the time a write arrived at OUTPUT_GPIO,
- * as above, and the third int pair contains the time the INTRPT_GPIO
- * interrupt was recognized. In this case count is 6 * sizeof(int).
+ * When the caller that opened the driver for writing reads the
+ * time of an interrupt on INTRPT_GPIO __user *buf is
+ * interpreted to be a three-element s64 array. The first element is
+ * not used. The second element contains the time a write arrived at
+ * OUTPUT_GPIO and the third element contains the time the INTRPT_GPIO
+ * interrupt was recognized. In this case count is 3 * sizeof(s64).
  *
  * If this function is called before an interrupt is triggered then the
  * reading process is put to sleep and if the interrupt is triggered
@@ -290,77 +447,130 @@ int pps_release (struct inode *inode, struct file *filp)
  */
 ssize_t pps_i_read(struct file *filp, char __user *buf, size_t count, loff_t *f_pos)
 {
+	struct pps_reader *reader = filp->private_data;
+	struct pps_calib_record calib;
+	struct pps_record rec;
+	s64 times[PPS_CALIB_LEN];
 	ssize_t rv = 0;
 	int wr = 0;
+	u32 head, seq;
 
-	if (readIntr2 == false){
-		while (read1_OK == 0){
-			wr = wait_event_interruptible_timeout(pps_queue, read1_OK == 1, j_delay);
-			if (wr == 0){							// read1_OK == 0 after j_delay
-				break;
-			}
-			if (wr != 1){							// read1_OK == 1 before j_delay
-				break;
-			}
+	if (readIntr2 == false || (filp->f_mode & FMODE_WRITE) == 0){
+
+		if (count < sizeof(struct pps_record)){
+			return -EINVAL;
 		}
 
-		if (read1_OK == 1){
-			if (copy_to_user(buf, pps_buffer, count)){
-				rv = -EFAULT;
+		while ((head = smp_load_acquire(&pps_ring->head)) == reader->tail){
+			wr = wait_event_interruptible_timeout(pps_queue, smp_load_acquire(&pps_ring->head) != reader->tail, j_delay);
+			if (wr == 0){							// No new record after j_delay
+				return 0;
 			}
-			else {
-				rv = count;
+			if (wr < 0){							// Interrupted by a signal
+				return wr;
 			}
 		}
-		else {
-			rv = -wr;
+
+		seq = reader->tail + 1;
+		if (head - seq >= PPS_RING_LEN){			// Skip the overwritten records.
+			seq = head - PPS_RING_LEN + 1;
 		}
-	}
-	else {
-		readIntr2 = false;
 
-		while (read2_OK == 0){
-			wr = wait_event_interruptible_timeout(pps_queue, read2_OK == 1, j_delay);
-			if (wr == 0){
-				break;
+		for (; seq - 1 != head && rv + sizeof(struct pps_record) <= count; seq++){
+			if (! pps_get_record(seq, &rec)){		// Overwritten while reading.
+				continue;
 			}
-			if (wr != 1){
-				break;
+			if (copy_to_user(buf + rv, &rec, sizeof(struct pps_record))){
+				return -EFAULT;
 			}
+			rv += sizeof(struct pps_record);
 		}
+		reader->tail = seq - 1;
+		return rv;
+	}
 
-		if (read2_OK == 1){
-			if (copy_to_user(buf, pps_buffer, count)){
-				rv = -EFAULT;
-			}
-			else {
-				rv = count;
-			}
+	if (count > PPS_CALIB_LEN * sizeof(s64)){
+		count = PPS_CALIB_LEN * sizeof(s64);
+	}
+
+	readIntr2 = false;
+
+	while (read2_OK == 0){
+		wr = wait_event_interruptible_timeout(pps_queue, read2_OK == 1, j_delay);
+		if (wr == 0){
+			break;
 		}
-		else {
-			rv = -wr;
+		if (wr != 1){
+			break;
 		}
 	}
 
-	pps_buffer[0] = 0;
-	pps_buffer[1] = 0;
-	pps_buffer[2] = 0;
-	pps_buffer[3] = 0;
-	pps_buffer[4] = 0;
-	pps_buffer[5] = 0;
+	if (read2_OK == 1){
+		calib = pps_ring->calib;
+
+		times[0] = 0;
+		times[1] = calib.write_time;
+		times[2] = calib.intrpt_time;
+
+		if (copy_to_user(buf, times, count)){
+			rv = -EFAULT;
+		}
+		else {
+			rv = count;
+		}
+	}
+	else {
+		rv = -wr;
+	}
 
-	read1_OK = 0;
 	read2_OK = 0;
 	return rv;
 }
 
+/**
+ * Sleeps until calib_spin_ns before calib_target, spins
+ * until calib_target, then records the time of the write
+ * to the calibration record and sets OUTPUT_GPIO (high).
+ *
+ * Runs in the context of the caller of pps_i_write(),
+ * which is the real-time priority thread of the daemon.
+ * Interrupts are disabled only while the write time is
+ * read and OUTPUT_GPIO is set, so that neither preemption
+ * nor an interrupt can come between them and skew the
+ * measured interrupt delay. The calibration interrupt is
+ * received as soon as they are enabled again.
+ */
+void pps_calib_output(void)
+{
+	unsigned long flags;
+	s64 sleep_ns = calib_target - calib_spin_ns - ktime_get_real_ns();
+
+	if (sleep_ns > 0){
+		ktime_t t = ns_to_ktime(sleep_ns);
+		set_current_state(TASK_UNINTERRUPTIBLE);
+		schedule_hrtimeout_range(&t, 0, HRTIMER_MODE_REL);
+	}
+
+	while (ktime_get_real_ns() < calib_target){
+		cpu_relax();
+	}
+
+	local_irq_save(flags);
+	pps_ring->calib.write_time = ktime_get_real_ns();
+	smp_wmb();
+	gpio_set_value(gpio_out, 1);
+	local_irq_restore(flags);
+}
+
 /**
  * Provides four functions:
  *   1. Writing an integer with a value of 1 to __user *buf
- *   records the time of the write to pps_buffer[2]-[3],
- *   disables pps_irq1 then sets OUTPUT_GPIO (high). This allows
- *   pps_irq2 to be used alternately with pps_irq1. count
- *   is provided with a value of sizeof(int).
+ *   disables pps_irq1 then sets OUTPUT_GPIO (high) at
+ *   CALIB_PULSE_NS into the current second, or immediately
+ *   if that has passed, recording the time of the write to
+ *   the calibration record. This allows pps_irq2 to be used
+ *   alternately with pps_irq1. Returns after the pulse is
+ *   written. count is provided with a value of sizeof(int).
  *
  *   2. Writing an integer with a value of 0 to __user *buf
  *   enables pps_irq1 and resets OUTPUT_GPIO (low). count is
@@ -368,7 +578,7 @@ ssize_t pps_i_read(struct file *filp, char __user *buf, size_t count, loff_t *f_
  *
  *   3. Writing a pair of integers where the first is 2 to
  *   __user *buf causes the second integer to be used as
- *   an offset in microseconds to the system time and this offset
+ *   an offset in nanoseconds to the system time and this offset
  *   is applied immediately. Param count is provided with a value
  *   of 2 * sizeof(int).
  *
@@ -401,30 +611,32 @@ ssize_t pps_i_write(struct file *filp, const char __user *buf, size_t count, lof
 	*  values from appropriate gpio pins.
 	*/
 
-	struct timeval tv;
+	struct timespec64 ts;
 	struct timespec tv2;
 
 	int *val = (int *)buf;
 
+	if ((filp->f_mode & FMODE_WRITE) == 0){
+		return -EBADF;
+	}
+
 	if (val[0] == 1){
 
 		disable_irq_nosync(pps_irq1);
 
-		tv.tv_sec = 0;
-		tv.tv_usec = 0;
-
-		while (tv.tv_usec < 600){		// Spin to 600 microseconds before
-			do_gettimeofday(&tv);		// writing to the output pin.
-		}
-
 		readIntr2 = true;
+		read2_OK = 0;
 
-		do_gettimeofday(&tv);
+		WRITE_ONCE(pps_ring->calib.seq, 0);		// Invalid until pps_interrupt2().
+		smp_wmb();
 
-		pps_buffer[2] = tv.tv_sec;
-		pps_buffer[3] = tv.tv_usec;
+		ktime_get_real_ts64(&ts);
+		calib_target = timespec64_to_ns(&ts);
+		if (ts.tv_nsec < CALIB_PULSE_NS){		// Write to the output pin at 600
+			calib_target += CALIB_PULSE_NS - ts.tv_nsec;	// microseconds into the second.
+		}
 
-		gpio_set_value(gpio_out, 1);
+		pps_calib_output();
 	}
 	else if (val[0] == 0){
 		gpio_set_value(gpio_out, 0);
@@ -433,7 +645,7 @@ ssize_t pps_i_write(struct file *filp, const char __user *buf, size_t count, lof
 		enable_irq(pps_irq1);
 	}
 	else if (val[0] == 2){
-		int frac = val[1] * 1000;
+		int frac = val[1];
 		if (frac < 0){
 			tv2.tv_sec = -1;
 			tv2.tv_nsec = 1000000000 + frac;
@@ -455,6 +667,73 @@ ssize_t pps_i_write(struct file *filp, const char __user *buf, size_t count, lof
 	return 0;
 }
 
+/**
+ * Reports to poll() and select() whether a PPS interrupt
+ * time has been recorded in pps_ring since poll() last
+ * reported the file readable to this caller or, during a
+ * calibration by the caller that opened the driver for
+ * writing, whether the calibration interrupt time has
+ * been recorded.
+ *
+ * The reading process is registered on pps_queue so that
+ * it is woken by pps_interrupt1() or pps_interrupt2() when
+ * the interrupt time is recorded.
+ *
+ * @param[in] filp The file pointer generated when the driver file was opened.
+ *
+ * @param[in] wait The poll table of the caller.
+ *
+ * @returns POLLIN | POLLRDNORM if an interrupt time is
+ * ready to be read, else zero.
+ */
+unsigned int pps_i_poll(struct file *filp, poll_table *wait)
+{
+	struct pps_reader *reader = filp->private_data;
+	unsigned int mask = 0;
+	u32 head;
+
+	poll_wait(filp, &pps_queue, wait);
+
+	if (readIntr2 == true && (filp->f_mode & FMODE_WRITE)){
+		if (read2_OK == 1){
+			mask |= POLLIN | POLLRDNORM;
+		}
+		return mask;
+	}
+
+	head = smp_load_acquire(&pps_ring->head);
+	if (head != reader->polled){
+		reader->polled = head;
+		mask |= POLLIN | POLLRDNORM;
+	}
+
+	return mask;
+}
+
+/**
+ * Maps pps_ring read-only into the caller's address space.
+ * The mapping must be a single page at offset zero.
+ *
+ * @param[in] filp The file pointer generated when the driver file was opened.
+ *
+ * @param[in] vma The caller's memory area.
+ *
+ * @returns Zero on success or a negative value on error.
+ */
+int pps_i_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start > PAGE_SIZE){
+		return -EINVAL;
+	}
+	if (vma->vm_flags & VM_WRITE){
+		return -EPERM;
+	}
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	return remap_pfn_range(vma, vma->vm_start, virt_to_phys(pps_ring) >> PAGE_SHIFT,
+			vma->vm_end - vma->vm_start, vma->vm_page_prot);
+}
+
 /**
  * Identifies the functions to be used for file operations by the driver.
  */
@@ -462,47 +741,87 @@ struct file_operations pps_i_fops = {
 	.owner	 = THIS_MODULE,
 	.read	 = pps_i_read,
 	.write   = pps_i_write,
+	.poll    = pps_i_poll,
+	.mmap    = pps_i_mmap,
 	.open	 = pps_open,
 	.release = pps_release,
 };
 
 /**
  * On recognition of the PPS interrupt on PPS_GPIO
- * copies the time of day to pps_buffer[0]-[1], sets the
- * read1_OK flag and wakes up the reading process.
+ * writes a record of the time of day, the raw monotonic
+ * time and the clocksource cycle count over the oldest
+ * record in pps_ring, advances the ring head and wakes
+ * up the reading processes.
+ *
+ * The three values are taken from one timekeeping
+ * snapshot so that they refer to the same instant.
+ * The same realtime and raw times are reported as an
+ * assert event to pps_source when it is registered.
  *
  * @returns Zero on success else a negative value on failure.
  */
 irqreturn_t pps_interrupt1(int irq, void *dev_id)
 {
-	struct timeval tv;
+	struct system_time_snapshot snap;
+	struct pps_record *rec;
+	u32 seq;
+#if IS_ENABLED(CONFIG_PPS)
+	struct pps_event_time ts;
+#endif
 
-	do_gettimeofday(&tv);
+	ktime_get_snapshot(&snap);
 
-	pps_buffer[0] = tv.tv_sec;
-	pps_buffer[1] = tv.tv_usec;
+	seq = pps_ring->head + 1;
+	rec = &pps_ring->rec[seq % PPS_RING_LEN];
 
-	read1_OK = 1;
-	wake_up_interruptible(&pps_queue); 				/* Wake up the reading process now */
+	WRITE_ONCE(rec->seq, 0);						/* Invalid while written */
+	smp_wmb();
+	rec->time = ktime_to_ns(snap.real);
+	rec->raw_time = ktime_to_ns(snap.raw);
+	rec->cycles = snap.cycles;
+	smp_store_release(&rec->seq, seq);
+	smp_store_release(&pps_ring->head, seq);
+
+	wake_up_interruptible(&pps_queue); 				/* Wake up the reading processes now */
+
+#if IS_ENABLED(CONFIG_PPS)
+	if (pps_source != NULL){
+		ts.ts_real = ktime_to_timespec64(snap.real);
+#ifdef CONFIG_NTP_PPS
+		ts.ts_raw = ktime_to_timespec64(snap.raw);
+#endif
+		pps_event(pps_source, &ts, PPS_CAPTUREASSERT, NULL);
+	}
+#endif
 
 	return IRQ_HANDLED;
 }
 
 /**
  * On recognition of the calibration interrupt on INTRPT_GPIO
- * copies the time of day to pps_buffer[4]-[5], sets the
- * read2_OK flag and wakes up the reading process.
+ * completes the calibration record in pps_ring with the time
+ * of day, the raw monotonic time and the clocksource cycle
+ * count from one timekeeping snapshot, sets the read2_OK flag
+ * and wakes up the reading process.
  *
  * @returns Zero on success else a negative value on failure.
  */
 irqreturn_t pps_interrupt2(int irq, void *dev_id)
 {
-	struct timeval tv;
+	struct system_time_snapshot snap;
+
+	ktime_get_snapshot(&snap);
 
-	do_gettimeofday(&tv);
+	pps_ring->calib.intrpt_time = ktime_to_ns(snap.real);
+	pps_ring->calib.intrpt_raw_time = ktime_to_ns(snap.raw);
+	pps_ring->calib.intrpt_cycles = snap.cycles;
 
-	pps_buffer[4] = tv.tv_sec;
-	pps_buffer[5] = tv.tv_usec;
+	calib_seq += 1;
+	if (calib_seq == 0){							/* Zero marks the record invalid */
+		calib_seq = 1;
+	}
+	smp_store_release(&pps_ring->calib.seq, calib_seq);
 
 	read2_OK = 1;
 	wake_up_interruptible(&pps_queue); 				/* Wake up the reading process now */
@@ -603,12 +922,17 @@ void pps_cleanup(void)
 		free_irq(pps_irq2, NULL);
 	}
 
-	flush_scheduled_work();
+#if IS_ENABLED(CONFIG_PPS)
+	if (pps_source != NULL){
+		pps_unregister_source(pps_source);
+		pps_source = NULL;
+	}
+#endif
 
 	unregister_chrdev(major, "gps-pps-io");
 
-	if (pps_buffer)
-		free_page((unsigned long)pps_buffer);
+	if (pps_ring)
+		free_page((unsigned long)pps_ring);
 
 	gpio_free(PPS_GPIO);
 	gpio_free(INTRPT_GPIO);
@@ -685,16 +1009,34 @@ int pps_init(void)
 
 	j_delay = timespec_to_jiffies(&value);
 
+	BUILD_BUG_ON(sizeof(struct pps_ring) > PAGE_SIZE);
+
+	pps_ring = (struct pps_ring *)get_zeroed_page(GFP_KERNEL);
+	if (pps_ring == NULL){
+		printk(KERN_INFO "gps-pps-io: failed to allocate the timestamp ring\n");
+		return -ENOMEM;
+	}
+
 	result = register_chrdev(major, "gps-pps-io", &pps_i_fops);
 	if (result < 0) {
 		printk(KERN_INFO "gps-pps-io: can't get major number\n");
+		free_page((unsigned long)pps_ring);
 		return result;
 	}
 
 	if (major == 0)
 		major = result; /* dynamic */
 
-	pps_buffer = (int *)__get_free_pages(GFP_KERNEL,0);
+#if IS_ENABLED(CONFIG_PPS)
+	pps_source = pps_register_source(&pps_info, PPS_CAPTUREASSERT | PPS_OFFSETASSERT);
+	if (IS_ERR_OR_NULL(pps_source)){				/* The private protocol still works without it */
+		printk(KERN_INFO "gps-pps-io: failed to register the PPS source\n");
+		pps_source = NULL;
+	}
+	else {
+		printk(KERN_INFO "gps-pps-io: registered PPS source /dev/pps%d\n", pps_source->id);
+	}
+#endif
 
 	if (configureInterruptOn(PPS_GPIO) == -1){
 		printk(KERN_INFO "gps-pps-io: failed installation\n");
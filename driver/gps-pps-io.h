@@ -0,0 +1,207 @@
+/**
+ @file gps-pps-io.h
+ @brief This file contains the format of the PPS timestamp ring exported by the gps-pps-io driver.
+
+ The driver records the time of each PPS interrupt in a ring of
+ PPS_RING_LEN records held in one page of kernel memory that any
+ process can map read-only with mmap() on the driver file. The
+ ring head is the sequence number of the newest record, counting
+ every PPS interrupt since the driver was loaded, and record seq is
+ held in rec[seq % PPS_RING_LEN]. Readers keep their own position
+ in the ring, so the PPS-Client daemon and any number of monitoring
+ tools can read the PPS times without a system call. poll() on the
+ driver file reports each new record once to each open file.
+
+ The driver writes each record inside a sequence lock: the record's
+ seq is set to zero while the record is written and then to its
+ sequence number. A reader that sees the same sequence number before
+ and after copying a record has a consistent copy. A reader more than
+ PPS_RING_LEN records behind the head has lost the records that were
+ overwritten.
+
+ Each time is taken from a single snapshot of the timekeeping of
+ the kernel in the interrupt handler, so the time from the realtime
+ clock, which is corrected by adjtimex(), the time from the raw
+ monotonic clock, which is not, and the count of the clocksource
+ cycles all refer to the same instant. The raw time measures the
+ free-running frequency of the clock oscillator directly.
+
+ The page also holds the times of the last calibration interrupt,
+ written in the same way.
+
+ This file is included by both the driver and the daemon.
+ */
+
+ /* Copyright (C) 2016-2018  Raymond S. Connell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef GPS_PPS_IO_H_
+#define GPS_PPS_IO_H_
+
+#include <linux/types.h>
+
+/**
+ * The number of PPS timestamp records held in the ring.
+ * Must be a power of 2.
+ */
+#define PPS_RING_LEN 64
+
+/**
+ * The time of a PPS interrupt.
+ */
+struct pps_record {
+	__u32 seq;				/* Count of PPS interrupts since the driver was loaded, including this one. Zero while written. */
+	__u32 reserved;			/* Keeps time 8-byte aligned. */
+	__s64 time;				/* Time of the interrupt in nanoseconds since the epoch read from the realtime clock. */
+	__s64 raw_time;			/* Time of the interrupt in nanoseconds read from the raw monotonic clock. */
+	__u64 cycles;			/* Count of clocksource cycles at the interrupt. */
+};
+
+/**
+ * The times of a calibration interrupt.
+ */
+struct pps_calib_record {
+	__u32 seq;				/* Count of calibration interrupts since the driver was loaded. Zero while written. */
+	__u32 reserved;			/* Keeps the times 8-byte aligned. */
+	__s64 write_time;		/* Time in nanoseconds at which OUTPUT_GPIO was set. */
+	__s64 intrpt_time;		/* Time in nanoseconds at which the interrupt on INTRPT_GPIO was received. */
+	__s64 intrpt_raw_time;	/* The raw monotonic time in nanoseconds at which the interrupt was received. */
+	__u64 intrpt_cycles;	/* Count of clocksource cycles at which the interrupt was received. */
+};
+
+/**
+ * The page mapped by mmap() on the driver file.
+ */
+struct pps_ring {
+	__u32 head;				/* Sequence number of the newest record in rec[]. Zero before the first PPS interrupt. */
+	__u32 reserved;			/* Keeps calib 8-byte aligned. */
+	struct pps_calib_record calib;				/* The last calibration interrupt. */
+	struct pps_record rec[PPS_RING_LEN];		/* Record seq is in rec[seq % PPS_RING_LEN]. */
+};
+
+#ifndef __KERNEL__
+
+/**
+ * Loads a 64-bit time or count from a mapped ring as two
+ * 32-bit volatile loads. A 64-bit atomic load can need
+ * libatomic, which the static link of the daemon does
+ * not include, on 32-bit ARM. A value torn by the two
+ * loads is rejected by the sequence lock of the record.
+ *
+ * @param[in] p The 64-bit field in the mapped ring.
+ */
+static inline __u64 loadPPSRing64(const void *p){
+	const volatile __u32 *w = (const volatile __u32 *)p;
+	union {
+		__u64 v;
+		__u32 w[2];
+	} u;
+
+	u.w[0] = w[0];
+	u.w[1] = w[1];
+	return u.v;
+}
+
+/**
+ * Stores a 64-bit time or count to a ring as two 32-bit
+ * volatile stores for the same reason as loadPPSRing64().
+ * Used by a user space writer of the ring, which must
+ * invalidate the sequence number of the record first.
+ *
+ * @param[out] p The 64-bit field in the ring.
+ * @param[in] v The value.
+ */
+static inline void storePPSRing64(void *p, __u64 v){
+	volatile __u32 *w = (volatile __u32 *)p;
+	union {
+		__u64 v;
+		__u32 w[2];
+	} u;
+
+	u.v = v;
+	w[0] = u.w[0];
+	w[1] = u.w[1];
+}
+
+/**
+ * Returns the sequence number of the newest PPS
+ * record in a mapped ring.
+ */
+static inline __u32 getPPSRingHead(const struct pps_ring *ring){
+	return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Copies PPS record seq from a mapped ring.
+ *
+ * @param[in] ring The ring mapped from the driver file.
+ * @param[in] seq The sequence number of the record.
+ * @param[out] rec The copy.
+ *
+ * @returns 0 on success or -1 if the record has been
+ * overwritten or has not yet been written. Sequence
+ * number zero is never written.
+ */
+static inline int readPPSRecord(const struct pps_ring *ring, __u32 seq, struct pps_record *rec){
+	const struct pps_record *r = &ring->rec[seq % PPS_RING_LEN];
+
+	__u32 seq1 = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE);
+	rec->time = (__s64)loadPPSRing64(&r->time);
+	rec->raw_time = (__s64)loadPPSRing64(&r->raw_time);
+	rec->cycles = loadPPSRing64(&r->cycles);
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	__u32 seq2 = __atomic_load_n(&r->seq, __ATOMIC_RELAXED);
+
+	if (seq == 0 || seq1 != seq || seq2 != seq){
+		return -1;
+	}
+	rec->seq = seq;
+	rec->reserved = 0;
+	return 0;
+}
+
+/**
+ * Copies the last calibration record from a mapped ring.
+ *
+ * @param[in] ring The ring mapped from the driver file.
+ * @param[out] rec The copy.
+ *
+ * @returns 0 on success or -1 if the record is being
+ * written or no calibration interrupt has been received.
+ */
+static inline int readPPSCalibRecord(const struct pps_ring *ring, struct pps_calib_record *rec){
+	const struct pps_calib_record *r = &ring->calib;
+
+	__u32 seq1 = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE);
+	rec->write_time = (__s64)loadPPSRing64(&r->write_time);
+	rec->intrpt_time = (__s64)loadPPSRing64(&r->intrpt_time);
+	rec->intrpt_raw_time = (__s64)loadPPSRing64(&r->intrpt_raw_time);
+	rec->intrpt_cycles = loadPPSRing64(&r->intrpt_cycles);
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	__u32 seq2 = __atomic_load_n(&r->seq, __ATOMIC_RELAXED);
+
+	if (seq1 == 0 || seq1 != seq2){
+		return -1;
+	}
+	rec->seq = seq1;
+	rec->reserved = 0;
+	return 0;
+}
+
+#endif /* __KERNEL__ */
+
+#endif /* GPS_PPS_IO_H_ */
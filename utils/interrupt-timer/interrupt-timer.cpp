@@ -31,6 +31,8 @@
 #include <math.h>
 #include <sys/time.h>
 
+#include "pps-shm.h"
+
 #define INTRPT_DISTRIB_LEN 61
 #define SECS_PER_DAY 86400
 #define SECS_PER_MIN 60
@@ -44,6 +46,7 @@
 #define USECS_PER_SEC 1000000
 #define START_SAVE 20
 #define START 10
+#define SHM_STALE_SECS 3
 
 int sysCommand(const char *cmd){
 	int rv = system(cmd);
@@ -293,29 +296,57 @@ void buildInterruptDistrib(int intrptDelay){
 }
 
 /**
- * Reads the sysDelay value recorded by
- * pps-client.
+ * Reads the sysDelay value published by
+ * pps-client to its shared memory segment.
+ *
+ * The segment is mapped once and later reads make
+ * no system calls. If pps-client has restarted, the
+ * mapped segment is no longer valid or its seq no
+ * longer changes, so it is mapped again.
  */
 int getSysDelay(int *sysDelay){
+	static const struct ppsShm *shm = NULL;
+	static uint32_t lastSeq = 0;
+	static time_t lastUpdate = 0;
+	struct ppsShm snap;
+	struct timespec now;
 
-	const char* filename = "/run/shm/pps-sysDelay";
-	int delay_fd = open(filename, O_RDONLY);
-	if (delay_fd == -1){
-		printf("Error: pps-client is not running.\n");
-		return -1;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (lastUpdate == 0){
+		lastUpdate = now.tv_sec;
 	}
-	int rv = read(delay_fd, g.strbuf, 50);
-	if (rv == -1){
-		printf("getSysDelay() Unable to read %s\n", filename);
-		return -1;
+
+	if (shm != NULL){
+		if (readPPSshm(shm, &snap) == -1 || (snap.seq == lastSeq && now.tv_sec - lastUpdate > SHM_STALE_SECS)){
+			unmapPPSshm(shm);
+			shm = NULL;
+		}
 	}
 
-	g.strbuf[50] = '\0';
-	close(delay_fd);
+	if (shm == NULL){
+		shm = mapPPSshm();
+		if (shm == NULL){
+			printf("Error: pps-client is not running.\n");
+			return -1;
+		}
+		if (readPPSshm(shm, &snap) == -1){
+			printf("getSysDelay() pps-client shared memory is not valid.\n");
+			unmapPPSshm(shm);
+			shm = NULL;
+			return -1;
+		}
+	}
+
+	if (snap.seq != lastSeq){
+		lastSeq = snap.seq;
+		lastUpdate = now.tv_sec;
+	}
+	else if (now.tv_sec - lastUpdate > SHM_STALE_SECS){
+		printf("Error: pps-client is not updating its shared memory.\n");
+		return -1;
+	}
 
-	char *end = strchr(g.strbuf, '#');
-	end[0] = '\0';
-	sscanf(g.strbuf, "%d", sysDelay);
+	*sysDelay = snap.sysDelay;
 	return 0;
 }
 
@@ -0,0 +1,627 @@
+/**
+ * @file pps-sweep.cpp
+ * @brief This file contains a tool that replays recorded PPS traces through the PPS-Client controller over a grid of controller settings.
+ *
+ * Each combination of the controller settings given on the command
+ * line is run on each trace. A run replays the trace through the
+ * controller in client/pps-controller.cpp on the simulated clock of
+ * client/pps-sim.cpp, in the same way as "pps-client -r", and records the time to first lock, the
+ * count of restarts, the RMS time error (offset) of the simulated clock,
+ * the RMS time correction and the p99 of the jitter magnitude while
+ * locked. One line is written for each run.
+ *
+ * The runs are independent, so they are spread over a pool of worker
+ * threads, one for each core by default. Each worker has its own deque
+ * of runs, starting with an equal share. A worker takes runs from the
+ * back of its own deque and, when that is empty, steals a run from the
+ * front of the deque of another worker. So workers that get the short
+ * runs help out with the long ones and all cores stay busy until the
+ * last run.
+ *
+ * Usage:
+ *
+ *     pps-sweep [-j <threads>] [-o <file>] <setting>=<values> ... <trace-file> ...
+ *
+ * where <values> is a comma-separated list or a range start:stop:step,
+ * for example:
+ *
+ *     pps-sweep gain=0.4,0.63,0.8 slew=30:90:20 trace1.txt trace2.txt
+ *
+ * Settings that are not given keep their default values.
+ */
+
+/*
+ * Copyright (C) 2016-2018  Raymond S. Connell
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "../../client/pps-client.h"
+
+extern struct clockBackend simClockBackend;
+
+#define SWEEP_NUM_SETTINGS 8				//!< Number of controller settings that can be swept.
+#define SWEEP_MAX_VALUES 64				//!< Maximum number of values of one setting.
+#define SWEEP_MAX_TRACES 64				//!< Maximum number of trace files.
+#define SWEEP_MAX_THREADS 256			//!< Maximum number of worker threads.
+
+const char *version = "pps-sweep v1.0.0";
+
+/**
+ * A controller setting and the values it is swept over.
+ */
+struct sweepSetting {
+	const char *name;								//!< The command line name.
+	int count;										//!< Count of values. 0 if not swept.
+	double values[SWEEP_MAX_VALUES];				//!< The values.
+};
+
+/**
+ * A trace file read into memory.
+ */
+struct sweepTrace {
+	const char *filename;							//!< The trace file.
+	int len;											//!< Count of PPS interrupt times.
+	long *sec;										//!< Whole seconds of each interrupt time.
+	long *nsec;										//!< Nanoseconds of each interrupt time.
+};
+
+/**
+ * The result of one run.
+ */
+struct sweepResult {
+	int lockSecs;									//!< Seconds from the start of the trace to the first lock or -1.
+	unsigned int nRestarts;							//!< Count of controller restarts.
+	unsigned int nLocked;							//!< Count of PPS interrupts while locked.
+	double offsetRMS;								//!< RMS of the time error of the simulated clock while locked.
+	double correctionRMS;							//!< RMS of the time correction while locked.
+	double jitterP99;								//!< p99 of the jitter magnitude while locked.
+};
+
+/**
+ * A deque of runs owned by one worker. The owner
+ * takes runs from the back and other workers steal
+ * runs from the front.
+ */
+struct sweepDeque {
+	pthread_mutex_t lock;							//!< Protects front and back.
+	int front;										//!< Index of the first run.
+	int back;										//!< Index after the last run.
+	int *runs;										//!< The runs.
+};
+
+/**
+ * Local file-scope shared variables.
+ */
+static struct sweepLocalVars {
+	struct sweepSetting settings[SWEEP_NUM_SETTINGS];	//!< The swept settings.
+	struct sweepTrace traces[SWEEP_MAX_TRACES];		//!< The traces.
+	int nTraces;										//!< Count of traces.
+	int nCombos;										//!< Count of combinations of settings.
+	int nRuns;										//!< Count of runs: nCombos * nTraces.
+	struct sweepResult *results;					//!< The result of each run.
+	int nThreads;									//!< Count of worker threads.
+	struct sweepDeque deques[SWEEP_MAX_THREADS];		//!< The deque of each worker.
+	unsigned int nStolen;							//!< Count of stolen runs.
+} f = {{{"controller"}, {"inv-gain"}, {"gain"}, {"noise"}, {"sigmas"}, {"slew"}, {"spikes"}, {"limit"}}};	//!< Local file-scope shared variables.
+
+/**
+ * Writes log messages from the controller to stderr.
+ */
+void writeToLog(char *logbuf){
+	fputs(logbuf, stderr);
+}
+
+/**
+ * Writes the results to filename.
+ *
+ * @param[in] filename The file to write.
+ * @param[in] buf The results.
+ * @param[in] len The length of the results.
+ *
+ * @returns 0 on success, else -1 on error.
+ */
+int writeResultsFile(const char *filename, const char *buf, int len){
+	FILE *fp = fopen(filename, "w");
+	if (fp == NULL){
+		printf("Could not open %s: %s\n", filename, strerror(errno));
+		return -1;
+	}
+	int rv = (fwrite(buf, 1, len, fp) == (size_t)len) ? 0 : -1;
+	fclose(fp);
+	return rv;
+}
+
+/**
+ * Gets the controller settings of a combination. The
+ * value index of each swept setting is one digit of the
+ * combination number, with the last setting varying
+ * fastest.
+ *
+ * @param[in] combo The combination number.
+ * @param[out] p The controller settings.
+ * @param[out] values The value of each setting.
+ */
+void getComboParams(int combo, struct controllerParams *p, double values[]){
+	setControllerDefaults(p);
+	p->doLog = false;
+
+	values[0] = 0.0;
+	values[1] = p->invGain0;
+	values[2] = p->integralGain;
+	values[3] = p->noiseFactor;
+	values[4] = p->spikeSigmas;
+	values[5] = p->slewMax;
+	values[6] = p->maxSpikes;
+	values[7] = p->hardLimitShift;
+
+	for (int i = SWEEP_NUM_SETTINGS - 1; i >= 0; i--){
+		const struct sweepSetting *s = &f.settings[i];
+		if (s->count > 0){
+			values[i] = s->values[combo % s->count];
+			combo /= s->count;
+		}
+	}
+
+	p->doKalman = values[0] != 0.0;
+	p->invGain0 = (int)values[1];
+	p->integralGain = values[2];
+	p->noiseFactor = values[3];
+	p->spikeSigmas = values[4];
+	p->slewMax = values[5];
+	p->maxSpikes = (int)values[6];
+	p->hardLimitShift = (int)values[7];
+}
+
+/**
+ * Replays a trace through the controller with the
+ * settings of a combination.
+ *
+ * @param[in] run The run number. The combination
+ * is run / nTraces and the trace is run % nTraces.
+ */
+void doRun(int run){
+	struct controllerParams params;
+	struct controller ctl;
+	struct simClock sc;
+	struct hdrHist jitterHist;
+	double values[SWEEP_NUM_SETTINGS];
+	double errorSumSq = 0.0;
+	double correctionSumSq = 0.0;
+	int sysDelay = INTERRUPT_LATENCY;
+
+	const struct sweepTrace *tr = &f.traces[run % f.nTraces];
+	struct sweepResult *res = &f.results[run];
+
+	getComboParams(run / f.nTraces, &params, values);
+
+	initSimClock(&sc);
+	memset(&jitterHist, 0, sizeof(struct hdrHist));
+	memset(res, 0, sizeof(struct sweepResult));
+	res->lockSecs = -1;
+
+	initController(&ctl, &params, sysDelay);
+
+	for (int i = 0; i < tr->len; i++){
+		long nSecs = getSimEdgeSecs(&sc, tr->sec[i], tr->nsec[i]);	// PPS seconds since the last interrupt.
+		if (nSecs == 0){									// Skip out-of-order or repeated interrupts.
+			continue;
+		}
+		for (long k = 0; k < nSecs; k++){					// Missing seconds are lost interrupts.
+			advanceSimClock(&sc);
+		}
+
+		long long nsec = setSimEdge(&sc, tr->sec[i], tr->nsec[i]) % NSECS_PER_SEC;
+		if (nsec < 0){
+			nsec += NSECS_PER_SEC;
+		}
+		if (nsec > NSECS_PER_SEC / 2){						// As getFractionalSeconds().
+			nsec -= NSECS_PER_SEC;
+		}
+		double rawError = (double)nsec / NSECS_PER_USEC - sysDelay;
+
+		makeControllerCorrection(&ctl, rawError, sysDelay, &simClockBackend);
+
+		if (ctl.hardLimit == HARD_LIMIT_1 && ctl.isControlling){
+			if (res->lockSecs == -1){
+				res->lockSecs = (int)sc.monoSecs - 1;
+			}
+			res->nLocked += 1;
+			errorSumSq += rawError * rawError;
+			correctionSumSq += ctl.timeCorrection * ctl.timeCorrection;
+			histRecord(&jitterHist, rawError);
+		}
+
+		if (controllerNeedsRestart(&ctl)){
+			res->nRestarts += 1;
+			initController(&ctl, &params, sysDelay);
+			sc.freq = 0.0;									// As on a restart of the daemon.
+		}
+	}
+
+	if (res->nLocked > 0){
+		res->offsetRMS = sqrt(errorSumSq / (double)res->nLocked);
+		res->correctionRMS = sqrt(correctionSumSq / (double)res->nLocked);
+		res->jitterP99 = histPercentile(&jitterHist, 99.0);
+	}
+}
+
+/**
+ * Takes the next run from the back of a deque.
+ *
+ * @param[in,out] dq The deque.
+ *
+ * @returns The run or -1 if the deque is empty.
+ */
+int takeRun(struct sweepDeque *dq){
+	int run = -1;
+
+	pthread_mutex_lock(&dq->lock);
+	if (dq->back > dq->front){
+		dq->back -= 1;
+		run = dq->runs[dq->back];
+	}
+	pthread_mutex_unlock(&dq->lock);
+	return run;
+}
+
+/**
+ * Steals a run from the front of a deque.
+ *
+ * @param[in,out] dq The deque.
+ *
+ * @returns The run or -1 if the deque is empty.
+ */
+int stealRun(struct sweepDeque *dq){
+	int run = -1;
+
+	pthread_mutex_lock(&dq->lock);
+	if (dq->back > dq->front){
+		run = dq->runs[dq->front];
+		dq->front += 1;
+	}
+	pthread_mutex_unlock(&dq->lock);
+	return run;
+}
+
+/**
+ * A worker thread. Does the runs in its own deque,
+ * then steals runs from the other deques until all
+ * of them are empty. Since runs are never added, a
+ * worker that finds every deque empty is done.
+ *
+ * @param[in] arg The worker number.
+ */
+void *sweepWorker(void *arg){
+	int id = (int)(intptr_t)arg;
+
+	for (;;){
+		int run = takeRun(&f.deques[id]);
+
+		for (int k = 1; run == -1 && k < f.nThreads; k++){
+			run = stealRun(&f.deques[(id + k) % f.nThreads]);
+			if (run != -1){
+				__atomic_fetch_add(&f.nStolen, 1, __ATOMIC_RELAXED);
+			}
+		}
+		if (run == -1){
+			break;
+		}
+		doRun(run);
+	}
+	return NULL;
+}
+
+/**
+ * Runs every combination of settings on every trace
+ * with the worker threads.
+ *
+ * @returns 0 on success, else -1 on error.
+ */
+int runSweep(void){
+	pthread_t threads[SWEEP_MAX_THREADS];
+
+	int *runs = (int *)malloc(f.nRuns * sizeof(int));
+	f.results = (struct sweepResult *)malloc(f.nRuns * sizeof(struct sweepResult));
+	if (runs == NULL || f.results == NULL){
+		printf("Not enough memory for %d runs.\n", f.nRuns);
+		return -1;
+	}
+
+	for (int i = 0; i < f.nRuns; i++){
+		runs[i] = i;
+	}
+
+	if (f.nThreads > f.nRuns){
+		f.nThreads = f.nRuns;
+	}
+	for (int i = 0; i < f.nThreads; i++){					// An equal share of the runs for each worker.
+		struct sweepDeque *dq = &f.deques[i];
+		pthread_mutex_init(&dq->lock, NULL);
+		dq->runs = runs;
+		dq->front = (int)((long)f.nRuns * i / f.nThreads);
+		dq->back = (int)((long)f.nRuns * (i + 1) / f.nThreads);
+	}
+
+	int nStarted = 0;
+	for (int i = 0; i < f.nThreads; i++){
+		int rv = pthread_create(&threads[i], NULL, &sweepWorker, (void *)(intptr_t)i);
+		if (rv != 0){
+			printf("pthread_create() failed with msg: %s\n", strerror(rv));
+			break;
+		}
+		nStarted += 1;
+	}
+	if (nStarted == 0){
+		sweepWorker((void *)0);								// The runs of the other deques are stolen.
+	}
+	for (int i = 0; i < nStarted; i++){
+		pthread_join(threads[i], NULL);
+	}
+
+	for (int i = 0; i < f.nThreads; i++){
+		pthread_mutex_destroy(&f.deques[i].lock);
+	}
+	free(runs);
+	return 0;
+}
+
+/**
+ * Formats the result of each run with one line for
+ * each run.
+ *
+ * @param[out] len The length of the formatted results.
+ *
+ * @returns The formatted results or NULL if there
+ * is not enough memory. Must be freed.
+ */
+char *formatResults(int *len){
+	double values[SWEEP_NUM_SETTINGS];
+	struct controllerParams params;
+
+	int size = (f.nRuns + 1) * (STRBUF_SZ + MAX_LINE_LEN);
+	char *buf = (char *)malloc(size);
+	if (buf == NULL){
+		return NULL;
+	}
+
+	*len = sprintf(buf, "# trace controller inv-gain gain noise sigmas slew spikes limit lock(s) restarts rms-offset(us) rms-correction(us) p99-jitter(us)\n");
+
+	for (int run = 0; run < f.nRuns; run++){
+		const struct sweepResult *res = &f.results[run];
+
+		getComboParams(run / f.nTraces, &params, values);
+		*len += snprintf(buf + *len, size - *len, "%s %s %d %.5lf %.3lf %.2lf %.1lf %d %d %d %u %.3lf %.3lf %.3lf\n",
+				f.traces[run % f.nTraces].filename, params.doKalman ? "kalman" : "pi", params.invGain0,
+				params.integralGain, params.noiseFactor, params.spikeSigmas, params.slewMax, params.maxSpikes, params.hardLimitShift,
+				res->lockSecs, res->nRestarts, res->offsetRMS, res->correctionRMS, res->jitterP99);
+	}
+	return buf;
+}
+
+/**
+ * Parses the values of a setting from a comma-separated
+ * list or a range start:stop:step. For the controller
+ * setting the values are "pi" and "kalman".
+ *
+ * @param[in,out] s The setting.
+ * @param[in] str The values.
+ *
+ * @returns 0 on success, else -1 on error.
+ */
+int parseSettingValues(struct sweepSetting *s, char *str){
+	double start, stop, step;
+	char *savePtr;
+
+	s->count = 0;
+
+	if (strcmp(s->name, "controller") != 0 && sscanf(str, "%lf:%lf:%lf", &start, &stop, &step) == 3){
+		if (step <= 0.0 || stop < start || start < 0.0 || (strcmp(s->name, "inv-gain") == 0 && start < 1.0)){
+			return -1;
+		}
+		for (int i = 0; start + i * step <= stop + step * 1e-6; i++){
+			if (s->count == SWEEP_MAX_VALUES){
+				return -1;
+			}
+			s->values[s->count] = start + i * step;
+			s->count += 1;
+		}
+		return 0;
+	}
+
+	char *tok = strtok_r(str, ",", &savePtr);
+	while (tok != NULL){
+		if (s->count == SWEEP_MAX_VALUES){
+			return -1;
+		}
+
+		char *end;
+		double value = strtod(tok, &end);
+		if (strcmp(s->name, "controller") == 0){
+			if (strcmp(tok, "pi") != 0 && strcmp(tok, "kalman") != 0){
+				return -1;
+			}
+			value = (strcmp(tok, "kalman") == 0) ? 1.0 : 0.0;
+		}
+		else if (end == tok || *end != '\0'){
+			return -1;
+		}
+
+		if (value < 0.0 || (strcmp(s->name, "inv-gain") == 0 && value < 1.0)){
+			return -1;
+		}
+
+		s->values[s->count] = value;
+		s->count += 1;
+		tok = strtok_r(NULL, ",", &savePtr);
+	}
+	return (s->count > 0) ? 0 : -1;
+}
+
+/**
+ * Reads a trace file in the format of "pps-client -r"
+ * into memory.
+ *
+ * @param[out] tr The trace.
+ * @param[in] filename The trace file.
+ *
+ * @returns 0 on success, else -1 on error.
+ */
+int readTrace(struct sweepTrace *tr, const char *filename){
+	char line[MAX_LINE_LEN + 50];
+	int size = SECS_PER_DAY;
+
+	FILE *fp = fopen(filename, "r");
+	if (fp == NULL){
+		printf("Could not open trace file %s: %s\n", filename, strerror(errno));
+		return -1;
+	}
+
+	tr->filename = filename;
+	tr->len = 0;
+	tr->sec = (long *)malloc(size * sizeof(long));
+	tr->nsec = (long *)malloc(size * sizeof(long));
+
+	while (tr->sec != NULL && tr->nsec != NULL && fgets(line, sizeof(line), fp) != NULL){
+		long sec, nsec;
+
+		if (line[0] == '#' || sscanf(line, "%ld %ld", &sec, &nsec) < 2){
+			continue;
+		}
+
+		if (tr->len == size){
+			size *= 2;
+			tr->sec = (long *)realloc(tr->sec, size * sizeof(long));
+			tr->nsec = (long *)realloc(tr->nsec, size * sizeof(long));
+			if (tr->sec == NULL || tr->nsec == NULL){
+				break;
+			}
+		}
+		tr->sec[tr->len] = sec;
+		tr->nsec[tr->len] = nsec;
+		tr->len += 1;
+	}
+	fclose(fp);
+
+	if (tr->sec == NULL || tr->nsec == NULL){
+		printf("Not enough memory for trace file %s\n", filename);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Prints the usage.
+ */
+void printUsage(void){
+	printf("Usage: pps-sweep [-j <threads>] [-o <file>] <setting>=<values> ... <trace-file> ...\n");
+	printf("Settings: controller=pi,kalman inv-gain gain noise sigmas slew spikes limit\n");
+	printf("Values are a comma-separated list or a range start:stop:step.\n");
+}
+
+int main(int argc, char *argv[]){
+	const char *outname = NULL;
+	struct timespec t0, t1;
+
+	f.nThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+	for (int i = 1; i < argc; i++){
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc){
+			f.nThreads = atoi(argv[++i]);
+			continue;
+		}
+		if (strcmp(argv[i], "-o") == 0 && i + 1 < argc){
+			outname = argv[++i];
+			continue;
+		}
+		if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "-v") == 0){
+			printf("%s\n", version);
+			printUsage();
+			return 0;
+		}
+
+		char *value = strchr(argv[i], '=');
+		if (value != NULL){
+			*value = '\0';
+			int k;
+			for (k = 0; k < SWEEP_NUM_SETTINGS; k++){
+				if (strcmp(argv[i], f.settings[k].name) == 0){
+					break;
+				}
+			}
+			if (k == SWEEP_NUM_SETTINGS || parseSettingValues(&f.settings[k], value + 1) == -1){
+				printf("Invalid setting: %s=%s\n", argv[i], value + 1);
+				printUsage();
+				return 1;
+			}
+			continue;
+		}
+
+		if (f.nTraces == SWEEP_MAX_TRACES){
+			printf("Too many trace files. The maximum is %d.\n", SWEEP_MAX_TRACES);
+			return 1;
+		}
+		if (readTrace(&f.traces[f.nTraces], argv[i]) == -1){
+			return 1;
+		}
+		f.nTraces += 1;
+	}
+
+	if (f.nTraces == 0){
+		printUsage();
+		return 1;
+	}
+	if (f.nThreads < 1){
+		f.nThreads = 1;
+	}
+	if (f.nThreads > SWEEP_MAX_THREADS){
+		f.nThreads = SWEEP_MAX_THREADS;
+	}
+
+	f.nCombos = 1;
+	for (int i = 0; i < SWEEP_NUM_SETTINGS; i++){
+		if (f.settings[i].count > 0){
+			f.nCombos *= f.settings[i].count;
+		}
+	}
+	f.nRuns = f.nCombos * f.nTraces;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if (runSweep() == -1){
+		return 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	int len = 0;
+	char *buf = formatResults(&len);
+	if (buf == NULL){
+		printf("Not enough memory for the results.\n");
+		return 1;
+	}
+
+	int rv = 0;
+	if (outname != NULL){
+		rv = writeResultsFile(outname, buf, len);
+	}
+	else {
+		fwrite(buf, 1, len, stdout);
+	}
+	free(buf);
+
+	double secs = (double)(t1.tv_sec - t0.tv_sec) + 1e-9 * (double)(t1.tv_nsec - t0.tv_nsec);
+	fprintf(stderr, "%d runs of %d combinations on %d threads in %.2lf sec. %u runs stolen.\n",
+			f.nRuns, f.nCombos, f.nThreads, secs, f.nStolen);
+	return (rv == 0) ? 0 : 1;
+}
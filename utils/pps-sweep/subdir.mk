@@ -0,0 +1,39 @@
+
+# Add inputs and outputs from these tool invocations to the build variables 
+CPP_SRCS += \
+./pps-sweep.cpp \
+../../client/pps-controller.cpp \
+../../client/pps-kalman.cpp \
+../../client/pps-hist.cpp \
+../../client/pps-sim.cpp 
+
+OBJS += \
+./pps-sweep.o \
+./pps-controller.o \
+./pps-kalman.o \
+./pps-hist.o \
+./pps-sim.o
+
+CPP_DEPS += \
+./pps-sweep.d \
+./pps-controller.d \
+./pps-kalman.d \
+./pps-hist.d \
+./pps-sim.d
+
+# Each subdirectory must supply rules for building sources it contributes
+%.o: ./%.cpp
+	@echo 'Building file: $<'
+	@echo 'Invoking: G++ Compiler'
+	g++ -O3 -Wall -c -fmessage-length=0 -MMD -MP -MF"$(@:%.o=%.d)" -MT"$(@:%.o=%.d)" -o "$@" "$<"
+	@echo 'Finished building: $<'
+	@echo ' '
+
+# The controller is compiled from the client sources
+%.o: ../../client/%.cpp
+	@echo 'Building file: $<'
+	@echo 'Invoking: G++ Compiler'
+	g++ -O3 -Wall -c -fmessage-length=0 -MMD -MP -MF"$(@:%.o=%.d)" -MT"$(@:%.o=%.d)" -o "$@" "$<"
+	@echo 'Finished building: $<'
+	@echo ' '
+